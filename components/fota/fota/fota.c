@@ -2,6 +2,7 @@
  * Copyright (C) 2019-2020 Alibaba Group Holding Limited
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -10,6 +11,7 @@
 #include <aos/kv.h>
 #include <yoc/netio.h>
 #include <yoc/fota.h>
+#include <yoc/sysinfo.h>
 #include <ulog/ulog.h>
 
 #define TAG "fota"
@@ -34,16 +36,103 @@ int fota_register(const fota_cls_t *cls)
     return -1;
 }
 
-fota_t *fota_open(const char *fota_name, const char *dst, fota_event_cb_t event_cb)
+typedef struct {
+    aos_mutex_t lock;
+    int rate;                       /*!< bytes per second of all the sessions, 0: not limited */
+    int burst;                      /*!< depth of the shared bucket, 0: a tenth of the rate */
+    long long tokens;               /*!< bytes allowed to read now, < 0: the debt to sleep off */
+    long long last_ns;              /*!< time of the last refill, monotonic nanosecond */
+    int memory;                     /*!< bytes of download buffers of all the sessions, 0: not limited */
+    int memory_used;                /*!< bytes of download buffers allocated now */
+} fota_budget_t;
+
+/* shared by all the fota handles */
+static fota_budget_t g_fota_budget;
+
+/* created at load time, before any session can take from the budget */
+__attribute__((constructor)) static void fota_budget_init(void)
+{
+    aos_mutex_new(&g_fota_budget.lock);
+}
+
+static int fota_session_valid(const char *session)
+{
+    int len = strlen(session);
+
+    if (len == 0 || len > FOTA_SESSION_NAME_LEN) {
+        return 0;
+    }
+    for (int i = 0; i < len; i++) {
+        char c = session[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const char *fota_session_name(const char *session, const char *name, char *buf, size_t size)
+{
+    if (session == NULL || session[0] == 0) {
+        snprintf(buf, size, "%s", name);
+    } else {
+        snprintf(buf, size, "%s.%s", name, session);
+    }
+    return buf;
+}
+
+static const char *fota_kv_key(fota_t *fota, const char *key, char buf[FOTA_SESSION_KEY_LEN])
+{
+    return fota_session_name(fota->session, key, buf, FOTA_SESSION_KEY_LEN);
+}
+
+int fota_offset_get(const char *session, int64_t *offset)
+{
+    char key[FOTA_SESSION_KEY_LEN];
+    uint8_t value[sizeof(int64_t)];
+    int len = sizeof(value);
+    int32_t offset32;
+
+    if (aos_kv_get(fota_session_name(session, KV_FOTA_OFFSET, key, sizeof(key)), value, &len) < 0) {
+        return -1;
+    }
+    if (len == sizeof(int64_t)) {
+        memcpy(offset, value, sizeof(int64_t));
+    } else if (len == sizeof(int32_t)) {
+        // saved by aos_kv_setint before the offset was 64-bit
+        memcpy(&offset32, value, sizeof(int32_t));
+        *offset = offset32;
+    } else {
+        return -1;
+    }
+    return *offset >= 0 ? 0 : -1;
+}
+
+int fota_offset_set(const char *session, int64_t offset)
+{
+    char key[FOTA_SESSION_KEY_LEN];
+
+    return aos_kv_set(fota_session_name(session, KV_FOTA_OFFSET, key, sizeof(key)), &offset, sizeof(offset), 1);
+}
+
+fota_t *fota_open_session(const char *fota_name, const char *dst, const char *session, fota_event_cb_t event_cb)
 {
     fota_cls_node_t *node;
     fota_t *fota = NULL;
-    fota_config_t config = { 3000, 3000, 0, 30000, 0 };
+    fota_config_t config = {
+        .read_timeoutms = 3000,
+        .write_timeoutms = 3000,
+        .sleep_time = 30000,
+    };
 
     if (!(fota_name && dst)) {
         LOGE(TAG, "fota open e.");
         return NULL;
     }
+    if (session && !fota_session_valid(session)) {
+        LOGE(TAG, "fota session name e.");
+        return NULL;
+    }
 
     slist_for_each_entry(&fota_cls_list, node, fota_cls_node_t, next) {
         if (strcmp(node->cls->name, fota_name) == 0) {
@@ -53,13 +142,16 @@ fota_t *fota_open(const char *fota_name, const char *dst, fota_event_cb_t event_
                 return NULL;
             }
             fota->to_path = strdup(dst);
+            if (session)
+                fota->session = strdup(session);
+            fota->info.session = fota->session;
             fota->cls = node->cls;
             fota->event_cb = event_cb;
             memcpy(&fota->config, &config, sizeof(fota_config_t));
             if (fota->cls->init)
                 fota->cls->init(&fota->info);
 
-            LOGD(TAG, "fota: 0x%x path:%s", fota, fota->to_path);
+            LOGD(TAG, "fota: 0x%x path:%s session:%s", fota, fota->to_path, session ? session : "");
             break;
         }
     }
@@ -70,292 +162,1248 @@ fota_t *fota_open(const char *fota_name, const char *dst, fota_event_cb_t event_
     }
 
     aos_sem_new(&fota->sem, 0);
-    aos_sem_new(&fota->do_check_event, 0);
-    aos_sem_new(&fota->sem_download, 0);
+    aos_queue_new(&fota->cmd_queue, fota->cmd_buf, sizeof(fota->cmd_buf), sizeof(fota_cmd_t));
+    aos_sem_new(&fota->pipe.sem_free, 0);
+    aos_sem_new(&fota->pipe.sem_ready, 0);
+    aos_sem_new(&fota->pipe.sem_quit, 0);
+    aos_mutex_new(&fota->pipe.lock);
+    aos_mutex_new(&fota->progress.lock);
+    aos_mutex_new(&fota->shaper.lock);
+    aos_sem_new(&fota->progress.sem, 0);
+    aos_sem_new(&fota->progress.sem_quit, 0);
     return fota;
 }
 
+fota_t *fota_open(const char *fota_name, const char *dst, fota_event_cb_t event_cb)
+{
+    return fota_open_session(fota_name, dst, NULL, event_cb);
+}
+
 static int fota_version_check(fota_t *fota, fota_info_t *info) {
     if (fota && fota->cls && fota->cls->version_check) {
         int ret = fota->cls->version_check(info);
         if (ret != 0) {
-            return -1;
+            return ret == -ENODATA ? ret : -1;
+        }
+        if (fota->from_path == NULL) {
+            fota->from_path = strdup(info->fota_url);
+        } else {
+            aos_free(fota->from_path);
+            fota->from_path = strdup(info->fota_url);
+        }
+        LOGD(TAG, "get image url: %s", fota->from_path);
+        return ret;
+    }
+
+    return -1;
+}
+
+static void fota_finish(fota_t *fota, fota_info_t *info)
+{
+    if (fota->cls->finish)
+        fota->cls->finish(info);
+}
+
+static void fota_fail(fota_t *fota, fota_info_t *info)
+{
+    if (fota->cls->fail)
+        fota->cls->fail(info);
+}
+
+static void fota_buffer_free(fota_t *fota)
+{
+    fota_pipe_t *pipe = &fota->pipe;
+
+    if (fota->buffer) {
+        aos_free(fota->buffer);
+        fota->buffer = NULL;
+    }
+    if (pipe->chunks) {
+        for (int i = 0; i < pipe->count; i++) {
+            if (pipe->chunks[i].buffer)
+                aos_free(pipe->chunks[i].buffer);
+        }
+        aos_free(pipe->chunks);
+        pipe->chunks = NULL;
+    }
+    pipe->count = 0;
+    if (fota->buffer_budget) {
+        aos_mutex_lock(&g_fota_budget.lock, AOS_WAIT_FOREVER);
+        g_fota_budget.memory_used -= fota->buffer_budget;
+        aos_mutex_unlock(&g_fota_budget.lock);
+        fota->buffer_budget = 0;
+    }
+}
+
+#define FOTA_CHUNK_MIN_SIZE 4096     /*!< the first chunk must hold the whole pack header */
+#define FOTA_CHUNK_FAST_MS 200        /*!< grow the chunk when read and write are faster than this */
+#define FOTA_CHUNK_SLOW_MS 2000       /*!< shrink the chunk when read or write is slower than this */
+
+static void fota_chunk_bounds(fota_t *fota, int *min, int *max)
+{
+    *min = fota->config.chunk_min > 0 ? fota->config.chunk_min : CONFIG_FOTA_BUFFER_SIZE;
+    *max = fota->config.chunk_max > 0 ? fota->config.chunk_max : CONFIG_FOTA_BUFFER_SIZE;
+    if (*min < FOTA_CHUNK_MIN_SIZE)
+        *min = FOTA_CHUNK_MIN_SIZE;
+    if (*max < *min)
+        *max = *min;
+}
+
+/* the chunk size is shared by the fota and its netio pair */
+static void fota_chunk_set(fota_t *fota, int size)
+{
+    if (size != fota->chunk_size) {
+        LOGD(TAG, "fota chunk size %d -> %d", fota->chunk_size, size);
+    }
+    fota->chunk_size = size;
+    if (fota->from)
+        fota->from->block_size = size;
+    if (fota->to)
+        fota->to->block_size = size;
+}
+
+/* grow or shrink the chunk by the latency of the chunk just written */
+static void fota_chunk_tune(fota_t *fota, fota_chunk_t *chunk, int write_ms)
+{
+    int min, max, cost;
+    int size = fota->chunk_size;
+
+    fota_chunk_bounds(fota, &min, &max);
+    // the memory budget may have given smaller buffers
+    if (max > fota->buffer_size)
+        max = fota->buffer_size;
+    if (min >= max) {
+        return;
+    }
+    // the slower stage bounds the overlapped pipeline, the sum bounds the serial loop
+    if (fota->pipe.count > 1) {
+        cost = chunk->read_ms > write_ms ? chunk->read_ms : write_ms;
+    } else {
+        cost = chunk->read_ms + write_ms;
+    }
+    if ((chunk->size < chunk->length && fota->offset < fota->total_size) || cost > FOTA_CHUNK_SLOW_MS ||
+        chunk->read_ms > fota->config.read_timeoutms / 2) {
+        // short read or close to the timeout: the link is slow
+        size /= 2;
+    } else if (cost < FOTA_CHUNK_FAST_MS && chunk->size == chunk->length) {
+        size *= 2;
+    }
+    if (size < min)
+        size = min;
+    if (size > max)
+        size = max;
+    fota_chunk_set(fota, size);
+}
+
+#define FOTA_SHAPER_MIN_SCALE 10    /*!< adaptive: never yield below 10% of the rate */
+
+static int fota_shaper_burst(fota_t *fota, int rate)
+{
+    int burst = fota->config.rate_burst > 0 ? fota->config.rate_burst : rate / 10;
+
+    return burst < FOTA_CHUNK_MIN_SIZE ? FOTA_CHUNK_MIN_SIZE : burst;
+}
+
+/* the rate in use, bytes per second, 0: not limited */
+static int fota_shaper_rate(fota_t *fota)
+{
+    fota_shaper_t *shaper = &fota->shaper;
+    int rate = fota->config.rate_limit;
+
+    if (fota->config.rate_adaptive && shaper->scale < 100) {
+        // not limited: yield from the measured speed
+        if (rate <= 0)
+            rate = fota->progress.speed;
+        rate = (long long)rate * shaper->scale / 100;
+    }
+    return rate;
+}
+
+static void fota_shaper_reset(fota_t *fota)
+{
+    fota_shaper_t *shaper = &fota->shaper;
+
+    aos_mutex_lock(&shaper->lock, AOS_WAIT_FOREVER);
+    shaper->last_ns = aos_now();
+    shaper->tokens = fota_shaper_burst(fota, fota->config.rate_limit);
+    shaper->scale = 100;
+    shaper->base_lat = 0;
+    aos_mutex_unlock(&shaper->lock);
+}
+
+static int fota_budget_burst(fota_budget_t *budget)
+{
+    int burst = budget->burst > 0 ? budget->burst : budget->rate / 10;
+
+    return burst < FOTA_CHUNK_MIN_SIZE ? FOTA_CHUNK_MIN_SIZE : burst;
+}
+
+/* account size bytes to the bucket of all the sessions, return when its debt is paid off */
+static long long fota_budget_take(int size, long long now)
+{
+    fota_budget_t *budget = &g_fota_budget;
+    long long deadline = now;
+
+    aos_mutex_lock(&budget->lock, AOS_WAIT_FOREVER);
+    if (budget->rate > 0) {
+        long long elapsed = now - budget->last_ns;
+        if (elapsed > 10000000000LL)
+            elapsed = 10000000000LL;
+        budget->tokens += elapsed * budget->rate / 1000000000LL;
+        if (budget->tokens > fota_budget_burst(budget))
+            budget->tokens = fota_budget_burst(budget);
+        budget->tokens -= size;
+        if (budget->tokens < 0)
+            deadline = now + (-budget->tokens) * 1000000000LL / budget->rate;
+    }
+    budget->last_ns = now;
+    aos_mutex_unlock(&budget->lock);
+    return deadline;
+}
+
+/* a read larger than the bucket would go out as one burst */
+static int fota_shaper_length(fota_t *fota, int length)
+{
+    int rate = fota_shaper_rate(fota);
+
+    if (rate > 0) {
+        int burst = fota_shaper_burst(fota, rate);
+        if (length > burst)
+            length = burst;
+    }
+    aos_mutex_lock(&g_fota_budget.lock, AOS_WAIT_FOREVER);
+    if (g_fota_budget.rate > 0) {
+        int burst = fota_budget_burst(&g_fota_budget);
+        if (length > burst)
+            length = burst;
+    }
+    aos_mutex_unlock(&g_fota_budget.lock);
+    return length;
+}
+
+/* account size bytes read in read_ns, sleep until the bucket is out of debt */
+static void fota_shaper_wait(fota_t *fota, int size, long long read_ns)
+{
+    fota_shaper_t *shaper = &fota->shaper;
+    long long now, deadline, global;
+    int rate;
+
+    if (size <= 0) {
+        return;
+    }
+    aos_mutex_lock(&shaper->lock, AOS_WAIT_FOREVER);
+    if (fota->config.rate_adaptive) {
+        // the read latency per KB rises with the queue on the link
+        int lat = read_ns / 1000 * 1024 / size;
+        if (shaper->base_lat == 0 || lat < shaper->base_lat) {
+            shaper->base_lat = lat;
+        } else {
+            // forget a stale minimum slowly
+            shaper->base_lat += shaper->base_lat / 64 + 1;
+        }
+        if (lat > shaper->base_lat * 2) {
+            shaper->scale = shaper->scale * 3 / 4;
+            if (shaper->scale < FOTA_SHAPER_MIN_SCALE)
+                shaper->scale = FOTA_SHAPER_MIN_SCALE;
+        } else if (lat < shaper->base_lat * 5 / 4 && shaper->scale < 100) {
+            shaper->scale += 5;
+            if (shaper->scale > 100)
+                shaper->scale = 100;
+        }
+    }
+    rate = fota_shaper_rate(fota);
+    now = aos_now();
+    deadline = now;
+    if (rate > 0) {
+        long long elapsed = now - shaper->last_ns;
+        if (elapsed > 10000000000LL)
+            elapsed = 10000000000LL;
+        shaper->tokens += elapsed * rate / 1000000000LL;
+        if (shaper->tokens > fota_shaper_burst(fota, rate))
+            shaper->tokens = fota_shaper_burst(fota, rate);
+        shaper->tokens -= size;
+        if (shaper->tokens < 0)
+            deadline = now + (-shaper->tokens) * 1000000000LL / rate;
+    }
+    shaper->last_ns = now;
+    aos_mutex_unlock(&shaper->lock);
+
+    // the shared bucket paces all the sessions together
+    global = fota_budget_take(size, now);
+    if (global > deadline)
+        deadline = global;
+
+    // sleep off the debt against the monotonic clock, not a fixed tick
+    while (!fota->quit && (now = aos_now()) < deadline) {
+        int ms = (deadline - now + 999999) / 1000000;
+        aos_msleep(ms);
+    }
+}
+
+/* netio_read through the rate shaper */
+static int fota_netio_read(fota_t *fota, fota_chunk_t *chunk)
+{
+    long long start = aos_now();
+    int64_t limit;
+
+    if (fota->pipe.count > 1) {
+        // the reader task, the storage is written by the fota task
+        aos_mutex_lock(&fota->pipe.lock, AOS_WAIT_FOREVER);
+        limit = fota->pipe.limit;
+        aos_mutex_unlock(&fota->pipe.lock);
+    } else {
+        limit = fota->to ? fota->to->skip_at : 0;
+    }
+
+    chunk->length = fota_shaper_length(fota, fota->chunk_size);
+    if (fota->from->size > 0 && fota->from->offset >= fota->from->size) {
+        // the storage had the rest, no request for an empty range
+        chunk->size = 0;
+        chunk->read_ms = 0;
+        return chunk->size;
+    }
+    if (limit > 0) {
+        // stop where the storage has the data, the writer skips it and seeks
+        if (fota->from->offset >= limit) {
+            chunk->size = -1;
+            chunk->read_ms = 0;
+            return chunk->size;
+        }
+        if (limit - fota->from->offset < chunk->length)
+            chunk->length = limit - fota->from->offset;
+    }
+    // the next request of the source ends there too, the server doesn't send the data the storage has
+    fota->from->limit = limit;
+    chunk->size = netio_read(fota->from, chunk->buffer, chunk->length, fota->config.read_timeoutms);
+    chunk->read_ms = (aos_now() - start) / 1000000;
+    fota_shaper_wait(fota, chunk->size, aos_now() - start);
+    return chunk->size;
+}
+
+/* take the buffers from the memory budget of all the sessions: fewer buffers first, then smaller ones */
+static int fota_budget_reserve(fota_t *fota, int *count, int min)
+{
+    fota_budget_t *budget = &g_fota_budget;
+    int size = fota->buffer_size;
+    int n = *count > 1 ? *count : 1;
+
+    aos_mutex_lock(&budget->lock, AOS_WAIT_FOREVER);
+    if (budget->memory > 0) {
+        int avail = budget->memory - budget->memory_used;
+        while (n > 1 && size * n > avail)
+            n--;
+        while (size > min && size * n > avail) {
+            size /= 2;
+            if (size < min)
+                size = min;
+        }
+        if (size * n > avail) {
+            aos_mutex_unlock(&budget->lock);
+            LOGE(TAG, "fota memory budget used up, %d/%d", budget->memory_used, budget->memory);
+            return -ENOMEM;
+        }
+        if (size != fota->buffer_size || n != *count) {
+            LOGW(TAG, "fota memory budget: %d x %d -> %d x %d", *count, fota->buffer_size, n, size);
+        }
+    }
+    budget->memory_used += size * n;
+    aos_mutex_unlock(&budget->lock);
+
+    fota->buffer_size = size;
+    fota->buffer_budget = size * n;
+    *count = n;
+    return 0;
+}
+
+static int fota_buffer_alloc(fota_t *fota)
+{
+    fota_pipe_t *pipe = &fota->pipe;
+    int count = fota->config.buffer_count;
+    int min, max;
+
+    fota_chunk_bounds(fota, &min, &max);
+    fota->buffer_size = max;
+    if (fota_budget_reserve(fota, &count, min) < 0) {
+        return -ENOMEM;
+    }
+    fota->chunk_size = CONFIG_FOTA_BUFFER_SIZE;
+    if (fota->chunk_size < min)
+        fota->chunk_size = min;
+    if (fota->chunk_size > fota->buffer_size)
+        fota->chunk_size = fota->buffer_size;
+
+    if (count <= 1) {
+        fota->buffer = aos_malloc(fota->buffer_size);
+        if (fota->buffer == NULL) {
+            fota_buffer_free(fota);
+            return -ENOMEM;
+        }
+        return 0;
+    }
+
+    pipe->chunks = aos_zalloc(sizeof(fota_chunk_t) * count);
+    if (pipe->chunks == NULL) {
+        fota_buffer_free(fota);
+        return -ENOMEM;
+    }
+    pipe->count = count;
+    for (int i = 0; i < count; i++) {
+        pipe->chunks[i].buffer = aos_malloc(fota->buffer_size);
+        if (pipe->chunks[i].buffer == NULL) {
+            fota_buffer_free(fota);
+            return -ENOMEM;
+        }
+    }
+    LOGD(TAG, "fota pipeline buffers: %d x %d", count, fota->buffer_size);
+    return 0;
+}
+
+/* hand where the storage has the data to the reader task, before the chunks are freed for it */
+static void fota_pipe_limit(fota_t *fota)
+{
+    fota_pipe_t *pipe = &fota->pipe;
+
+    aos_mutex_lock(&pipe->lock, AOS_WAIT_FOREVER);
+    pipe->limit = fota->to ? fota->to->skip_at : 0;
+    aos_mutex_unlock(&pipe->lock);
+}
+
+static void fota_pipe_task(void *arg)
+{
+    fota_t *fota = (fota_t *)arg;
+    fota_pipe_t *pipe = &fota->pipe;
+    fota_chunk_t *chunk;
+
+    LOGD(TAG, "fota pipe reader start, offset:%lld", (long long)fota->from->offset);
+    while (1) {
+        aos_sem_wait(&pipe->sem_free, AOS_WAIT_FOREVER);
+        if (pipe->stop || fota->quit) {
+            break;
+        }
+        chunk = &pipe->chunks[pipe->head];
+        do {
+            fota_netio_read(fota, chunk);
+            if (chunk->size == -2) {
+                LOGW(TAG, "reconnect again");
+            }
+        } while (chunk->size == -2 && !(pipe->stop || fota->quit));
+        LOGD(TAG, "##pipe read: %d", chunk->size);
+        pipe->head = (pipe->head + 1) % pipe->count;
+        aos_sem_signal(&pipe->sem_ready);
+        if (chunk->size <= 0) {
+            // read finish or error, the writer will handle it
+            break;
+        }
+    }
+    LOGD(TAG, "fota pipe reader quit");
+    aos_sem_signal(&pipe->sem_quit);
+}
+
+static int fota_pipe_start(fota_t *fota)
+{
+    fota_pipe_t *pipe = &fota->pipe;
+
+    // drain the counters left by the last run
+    while (aos_sem_wait(&pipe->sem_free, AOS_NO_WAIT) == 0);
+    while (aos_sem_wait(&pipe->sem_ready, AOS_NO_WAIT) == 0);
+    while (aos_sem_wait(&pipe->sem_quit, AOS_NO_WAIT) == 0);
+
+    if (netio_seek(fota->from, fota->offset, SEEK_SET) != 0) {
+        LOGE(TAG, "pipe from seek error");
+        return -1;
+    }
+
+    pipe->head = 0;
+    pipe->tail = 0;
+    pipe->stop = 0;
+    fota_pipe_limit(fota);
+    for (int i = 0; i < pipe->count; i++) {
+        aos_sem_signal(&pipe->sem_free);
+    }
+    if (aos_task_new_ext(&pipe->task, "fota_pipe", fota_pipe_task, fota, CONFIG_FOTA_TASK_STACK_SIZE, 45) != 0) {
+        LOGE(TAG, "fota pipe task create failed.");
+        return -1;
+    }
+    pipe->running = 1;
+    return 0;
+}
+
+static void fota_pipe_stop(fota_t *fota)
+{
+    fota_pipe_t *pipe = &fota->pipe;
+
+    if (!pipe->running) {
+        return;
+    }
+    pipe->stop = 1;
+    aos_sem_signal(&pipe->sem_free);
+    aos_sem_wait(&pipe->sem_quit, AOS_WAIT_FOREVER);
+    pipe->running = 0;
+    LOGD(TAG, "fota pipe stopped, offset:%lld", (long long)fota->offset);
+}
+
+/* return the chunk size, see `netio_read`, *data points to the chunk data */
+static int fota_read_chunk(fota_t *fota, uint8_t **data)
+{
+    fota_pipe_t *pipe = &fota->pipe;
+    int size;
+
+    if (pipe->count <= 1) {
+        fota->chunk.buffer = fota->buffer;
+        *data = fota->buffer;
+        return fota_netio_read(fota, &fota->chunk);
+    }
+
+    if (!pipe->running && fota_pipe_start(fota) < 0) {
+        return -1;
+    }
+    aos_sem_wait(&pipe->sem_ready, AOS_WAIT_FOREVER);
+    if (fota->quit) {
+        return -1;
+    }
+    fota->chunk = pipe->chunks[pipe->tail];
+    *data = fota->chunk.buffer;
+    size = fota->chunk.size;
+    if (size <= 0) {
+        // the reader task has quit
+        fota_pipe_stop(fota);
+    }
+    return size;
+}
+
+static void fota_release_chunk(fota_t *fota)
+{
+    fota_pipe_t *pipe = &fota->pipe;
+
+    if (pipe->running) {
+        pipe->tail = (pipe->tail + 1) % pipe->count;
+        fota_pipe_limit(fota);
+        aos_sem_signal(&pipe->sem_free);
+    }
+}
+
+/* the storage had the data from fota->offset to to->offset, download from there */
+static int fota_skip(fota_t *fota)
+{
+    int64_t skip = fota->to->offset - fota->offset;
+
+    if (skip <= 0) {
+        return 0;
+    }
+    LOGD(TAG, "fota skip %lld -> %lld", (long long)fota->offset, (long long)fota->to->offset);
+    fota->saved_size += skip;
+    fota->offset = fota->to->offset;
+    // the speed counts the downloaded bytes only
+    fota->progress.sample_offset += skip;
+    // the chunks read ahead are stale, the pipe restarts at the new offset
+    fota_pipe_stop(fota);
+    return netio_seek(fota->from, fota->offset, SEEK_SET);
+}
+
+/*
+ * the retry after an abort: a failed write may have left the storage past fota->offset and the source has
+ * the chunk read for it, seek both back so the storage rebuilds its state from the checkpoint
+ */
+static int fota_resume(fota_t *fota)
+{
+    if (netio_seek(fota->to, fota->offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    if (fota_skip(fota) < 0) {
+        return -1;
+    }
+    return netio_seek(fota->from, fota->offset, SEEK_SET);
+}
+
+/* save the download offset once the written data is synced, force: ignore the checkpoint policy */
+static int fota_checkpoint(fota_t *fota, int force)
+{
+    long long now = aos_now_ms();
+
+    if (fota->to == NULL || fota->offset == fota->checkpoint_offset) {
+        return 0;
+    }
+    if (!force && (fota->config.checkpoint_bytes > 0 || fota->config.checkpoint_ms > 0)) {
+        int bytes_due = fota->config.checkpoint_bytes > 0 &&
+                        fota->offset - fota->checkpoint_offset >= fota->config.checkpoint_bytes;
+        int time_due = fota->config.checkpoint_ms > 0 &&
+                       now - fota->checkpoint_time >= fota->config.checkpoint_ms;
+        if (!bytes_due && !time_due) {
+            return 0;
+        }
+    }
+    // the saved offset must never run ahead of the data on the storage
+    if (netio_sync(fota->to) < 0) {
+        LOGE(TAG, "fota sync failed, offset:%lld", (long long)fota->offset);
+        return -1;
+    }
+    if (fota_offset_set(fota->session, fota->offset) < 0) {
+        return -1;
+    }
+    LOGD(TAG, "fota checkpoint %lld -> %lld", (long long)fota->checkpoint_offset, (long long)fota->offset);
+    fota->checkpoint_offset = fota->offset;
+    fota->checkpoint_time = now;
+    return 0;
+}
+
+#define FOTA_SPEED_SAMPLE_MS 500
+
+static void fota_progress_emit(fota_t *fota, fota_error_code_e error_code)
+{
+    if (fota->event_cb == NULL) {
+        return;
+    }
+    aos_mutex_lock(&fota->progress.lock, AOS_WAIT_FOREVER);
+    fota->error_code = error_code;
+    fota->event_cb(fota, FOTA_EVENT_PROGRESS);
+    aos_mutex_unlock(&fota->progress.lock);
+}
+
+static void fota_progress_task(void *arg)
+{
+    fota_t *fota = (fota_t *)arg;
+    fota_progress_t *progress = &fota->progress;
+
+    while (1) {
+        aos_sem_wait(&progress->sem, AOS_WAIT_FOREVER);
+        if (progress->stop) {
+            break;
+        }
+        progress->pending = 0;
+        fota_progress_emit(fota, FOTA_ERROR_NULL);
+    }
+    aos_sem_signal(&progress->sem_quit);
+}
+
+static void fota_progress_start(fota_t *fota)
+{
+    fota_progress_t *progress = &fota->progress;
+
+    progress->stop = 0;
+    progress->pending = 0;
+    if (aos_task_new_ext(&progress->task, "fota_progress", fota_progress_task, fota,
+                         CONFIG_FOTA_TASK_STACK_SIZE, 46) != 0) {
+        // report on the download path
+        LOGW(TAG, "fota progress task create failed.");
+        return;
+    }
+    progress->running = 1;
+}
+
+static void fota_progress_stop(fota_t *fota)
+{
+    fota_progress_t *progress = &fota->progress;
+
+    if (!progress->running) {
+        return;
+    }
+    progress->stop = 1;
+    aos_sem_signal(&progress->sem);
+    aos_sem_wait(&progress->sem_quit, AOS_WAIT_FOREVER);
+    progress->running = 0;
+}
+
+static void fota_progress_reset(fota_t *fota)
+{
+    fota_progress_t *progress = &fota->progress;
+
+    progress->sample_ms = progress->report_ms = aos_now_ms();
+    progress->sample_offset = progress->report_offset = fota->offset;
+    progress->speed = 0;
+    progress->eta = -1;
+}
+
+/* called after each chunk, update the speed and hand the event to the reporter task when it is due */
+static void fota_progress_update(fota_t *fota)
+{
+    fota_progress_t *progress = &fota->progress;
+    long long now = aos_now_ms();
+    int elapsed = now - progress->sample_ms;
+
+    if (elapsed >= FOTA_SPEED_SAMPLE_MS) {
+        int rate = (fota->offset - progress->sample_offset) * 1000 / elapsed;
+        // EWMA, alpha = 1/4
+        progress->speed = progress->speed > 0 ? progress->speed + (rate - progress->speed) / 4 : rate;
+        progress->eta = (progress->speed > 0 && fota->total_size > fota->offset) ?
+                        (fota->total_size - fota->offset) / progress->speed : -1;
+        progress->sample_ms = now;
+        progress->sample_offset = fota->offset;
+    }
+
+    if (fota->config.progress_ms > 0 || fota->config.progress_bytes > 0) {
+        int bytes_due = fota->config.progress_bytes > 0 &&
+                        fota->offset - progress->report_offset >= fota->config.progress_bytes;
+        int time_due = fota->config.progress_ms > 0 && now - progress->report_ms >= fota->config.progress_ms;
+        if (!bytes_due && !time_due) {
+            return;
+        }
+    }
+    progress->report_ms = now;
+    progress->report_offset = fota->offset;
+    if (!progress->running) {
+        fota_progress_emit(fota, FOTA_ERROR_NULL);
+    } else if (!progress->pending) {
+        // coalesce: the reporter task reads the latest offset when it runs
+        progress->pending = 1;
+        aos_sem_signal(&progress->sem);
+    }
+}
+
+static int fota_prepare(fota_t *fota)
+{
+    if (!(fota->from_path && fota->to_path)) {
+        LOGE(TAG, "fota->from_path or fota->to_path is NULL");
+        return -EINVAL;
+    }
+    LOGD(TAG, "###fota->from_path:%s, fota->to_path:%s", fota->from_path, fota->to_path);
+    int buffer_ret = fota_buffer_alloc(fota);
+    fota->from = netio_open(fota->from_path);
+    fota->to = netio_open(fota->to_path);
+
+    if (buffer_ret < 0 || fota->from == NULL || fota->to == NULL) {
+        if (buffer_ret < 0) {
+            LOGD(TAG, "fota->buffer e");
+        } else if (fota->from == NULL) {
+            LOGD(TAG, "fota->from e");
+        } else if (fota->to == NULL) {
+            LOGD(TAG, "fota->to e");
+        }
+        goto error;
+    }
+    fota->from->session = fota->session;
+    fota->to->session = fota->session;
+    fota->to->source = fota->from_path;
+
+    if (fota_offset_get(fota->session, &fota->offset) < 0) {
+        if (fota_offset_set(fota->session, 0) < 0) {
+            goto error;
+        }
+        fota->offset = 0;
+    }
+    fota->checkpoint_offset = fota->offset;
+    fota->checkpoint_time = aos_now_ms();
+    fota->saved_size = 0;
+    fota_chunk_set(fota, fota->chunk_size);
+    fota_shaper_reset(fota);
+
+    LOGI(TAG, "FOTA seek %lld", (long long)fota->offset);
+
+    // the storage may have the data at the offset, it moves the offset forward
+    if (netio_seek(fota->to, fota->offset, SEEK_SET) != 0) {
+        LOGD(TAG, "to seek error");
+        goto error;
+    }
+    if (fota_skip(fota) < 0) {
+        goto error;
+    }
+    fota_progress_reset(fota);
+
+    if (netio_seek(fota->from, fota->offset, SEEK_SET) != 0) {
+        LOGD(TAG, "from seek error");
+        goto error;
+    }
+
+    fota->status = FOTA_DOWNLOAD;
+    fota->total_size = fota->from->size;
+    LOGD(TAG, "fota prepare ok.");
+    return 0;
+
+error:
+    fota_buffer_free(fota);
+    if (fota->from) {
+        netio_close(fota->from);
+        fota->from = NULL;
+    }
+    if (fota->to) {
+        netio_close(fota->to);
+        fota->to = NULL;
+    }
+
+    return -1;
+}
+
+static void fota_release(fota_t *fota)
+{
+    LOGD(TAG, "%s,%d", __func__, __LINE__);
+    fota_pipe_stop(fota);
+    fota_buffer_free(fota);
+
+    if (fota->from) {
+        netio_close(fota->from);
+        fota->from = NULL;
+    }
+
+    if (fota->to) {
+        netio_close(fota->to);
+        fota->to = NULL;
+    }
+}
+
+static int fota_command_send(fota_t *fota, fota_cmd_e cmd, int arg)
+{
+    fota_cmd_t msg = { cmd, arg };
+
+    return aos_queue_send(&fota->cmd_queue, &msg, sizeof(fota_cmd_t));
+}
+
+/* run cmd when the timer expires, 0: no timer */
+static void fota_timer_set(fota_t *fota, fota_cmd_e cmd, int delay_ms)
+{
+    fota->timer_cmd = cmd;
+    fota->timer_ms = aos_now_ms() + delay_ms;
+}
+
+static void fota_timer_clear(fota_t *fota)
+{
+    fota->timer_cmd = 0;
+}
+
+#define FOTA_BACKOFF_MIN_MS 1000
+
+static uint32_t g_fota_rand;
+
+/* xorshift, seeded by the device id, the devices powered on together draw different delays */
+static uint32_t fota_rand(uint32_t n)
+{
+    uint32_t x = g_fota_rand;
+
+    if (x == 0) {
+        const char *id = aos_get_device_id();
+
+        x = 2166136261U;
+        for (; id && *id; id++) {
+            x = (x ^ (uint8_t)*id) * 16777619U;
+        }
+        x ^= (uint32_t)aos_now_ms() ^ (uint32_t)time(NULL);
+        if (x == 0) {
+            x = 1;
+        }
+    }
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_fota_rand = x;
+    return n ? x % n : 0;
+}
+
+/* the spread of the period, check_jitter percent of it */
+static uint32_t fota_jitter_spread(fota_t *fota, int period)
+{
+    int pct = fota->config.check_jitter;
+
+    if (pct <= 0 || period <= 0) {
+        return 0;
+    }
+    return (long long)period * (pct < 100 ? pct : 100) / 100;
+}
+
+/* capped exponential backoff with full jitter, fails: the failures in a row */
+static int fota_backoff(fota_t *fota, int fails)
+{
+    long long cap = fota->config.backoff_max;
+    long long delay = fota->config.sleep_time;
+    int min = delay < FOTA_BACKOFF_MIN_MS ? delay : FOTA_BACKOFF_MIN_MS;
+
+    if (cap <= 0) {
+        return fota->config.sleep_time;
+    }
+    if (cap > CONFIG_FOTA_NEXT_CHECK_MAX * 1000LL) {
+        cap = CONFIG_FOTA_NEXT_CHECK_MAX * 1000LL;
+    }
+    for (int i = 1; i < fails && delay < cap; i++) {
+        delay *= 2;
+    }
+    if (delay > cap) {
+        delay = cap;
+    }
+    delay = fota_rand(delay + 1);
+    return delay > min ? delay : min;
+}
+
+/* the server hint, only put off by the jitter, never earlier */
+static int fota_hint_delay(fota_t *fota, int seconds)
+{
+    long long delay;
+
+    if (seconds > CONFIG_FOTA_NEXT_CHECK_MAX) {
+        seconds = CONFIG_FOTA_NEXT_CHECK_MAX;
+    }
+    delay = seconds * 1000LL;
+    delay += fota_rand(fota_jitter_spread(fota, delay) + 1);
+    return delay < CONFIG_FOTA_NEXT_CHECK_MAX * 1000LL ? delay : CONFIG_FOTA_NEXT_CHECK_MAX * 1000LL;
+}
+
+static void fota_schedule_clear(fota_t *fota)
+{
+    char key[FOTA_SESSION_KEY_LEN];
+
+    if (fota->schedule_saved) {
+        aos_kv_del(fota_kv_key(fota, KV_FOTA_NEXT_CHECK, key));
+        aos_kv_del(fota_kv_key(fota, KV_FOTA_CHECK_FAILS, key));
+        fota->schedule_saved = 0;
+    }
+}
+
+/* arm the next auto check: after the server hint, the backoff of the failures, or the jittered period */
+static void fota_schedule_check(fota_t *fota, int failed)
+{
+    char key[FOTA_SESSION_KEY_LEN];
+    int delay;
+
+    if (!failed) {
+        fota->check_fails = 0;
+    } else if (fota->check_fails < 31) {
+        fota->check_fails++;
+    }
+    if (fota->info.next_check > 0) {
+        delay = fota_hint_delay(fota, fota->info.next_check);
+    } else if (fota->check_fails > 0) {
+        delay = fota_backoff(fota, fota->check_fails);
+    } else {
+        uint32_t spread = fota_jitter_spread(fota, fota->config.sleep_time);
+        delay = fota->config.sleep_time - spread + fota_rand(2 * spread + 1);
+    }
+    LOGI(TAG, "next check in %d ms, fails:%d", delay, fota->check_fails);
+    fota_timer_set(fota, FOTA_CMD_CHECK, delay);
+
+    // a reboot shouldn't check early, the short periods aren't worth the kv writes
+    if (delay >= CONFIG_FOTA_SCHEDULE_SAVE_MS || fota->check_fails > 0) {
+        int64_t next = (int64_t)time(NULL) + delay / 1000;
+
+        aos_kv_set(fota_kv_key(fota, KV_FOTA_NEXT_CHECK, key), &next, sizeof(next), 1);
+        aos_kv_setint(fota_kv_key(fota, KV_FOTA_CHECK_FAILS, key), fota->check_fails);
+        fota->schedule_saved = 1;
+    } else {
+        fota_schedule_clear(fota);
+    }
+}
+
+/* the delay of the first auto check after fota_start, millisecond */
+static int fota_schedule_restore(fota_t *fota)
+{
+    char key[FOTA_SESSION_KEY_LEN];
+    int64_t next;
+    int len = sizeof(next);
+    int fails;
+    // many devices boot together after a power cut, spread their first checks
+    int delay = fota_rand(fota_jitter_spread(fota, fota->config.sleep_time) + 1);
+
+    if (aos_kv_get(fota_kv_key(fota, KV_FOTA_NEXT_CHECK, key), &next, &len) < 0 || len != sizeof(next)) {
+        return delay;
+    }
+    fota->schedule_saved = 1;
+    if (aos_kv_getint(fota_kv_key(fota, KV_FOTA_CHECK_FAILS, key), &fails) == 0 && fails > 0) {
+        fota->check_fails = fails < 31 ? fails : 31;
+    }
+    next -= time(NULL);
+    if (next > CONFIG_FOTA_NEXT_CHECK_MAX) {
+        // the clock went back or isn't synced yet
+        LOGW(TAG, "the saved schedule is %lld s later, ignored", (long long)next);
+    } else if (next * 1000 > delay) {
+        delay = next * 1000;
+    }
+    return delay;
+}
+
+static void timer_thread(void *timer, void *args)
+{
+    fota_t *fota = (fota_t *)args;
+    LOGD(TAG, "timer_thread, fota:0x%x", fota);
+    if (fota) {
+        LOGD(TAG, "report restart event.");
+        if (fota->event_cb) {
+            fota->error_code = FOTA_ERROR_NULL;
+            fota->event_cb(fota, FOTA_EVENT_RESTART);
+        }
+        aos_timer_stop(&fota->restart_timer);
+        aos_timer_free(&fota->restart_timer);
+        LOGD(TAG, "stop and delete timer ok.");
+        return;
+    }
+    LOGE(TAG, "timer task params error.");
+}
+
+static int fota_do_restart(fota_t *fota, int delay_ms)
+{
+#ifdef CONFIG_DL_FINISH_FLAG_POWSAVE
+    char key[FOTA_SESSION_KEY_LEN];
+#endif
+
+    if (fota->status != FOTA_FINISH) {
+        LOGE(TAG, "fota status is not FOTA_FINISH, cant restart to upgrade.");
+        return -1;
+    }
+    if (fota->cls && fota->cls->restart) {
+        if (delay_ms > 0) {
+            int ret = aos_timer_new_ext(&fota->restart_timer, timer_thread, fota, delay_ms, 0, 1);
+            if (ret < 0) {
+                LOGE(TAG, "timer_create error [%d]!\n", errno);
+                return -1;
+            }
+            LOGD(TAG, "set timer ok.");
+            return 0;
         }
-        if (fota->from_path == NULL) {
-            fota->from_path = strdup(info->fota_url);
-        } else {
-            aos_free(fota->from_path);
-            fota->from_path = strdup(info->fota_url);
+#ifdef CONFIG_DL_FINISH_FLAG_POWSAVE
+        if (aos_kv_setint(fota_kv_key(fota, KV_FOTA_FINISH, key), 0) < 0) {
+            LOGE(TAG, "set finish 0 error.");
+            return -1;
         }
-        LOGD(TAG, "get image url: %s", fota->from_path);
-        return ret;
+#endif
+        fota->cls->restart(&fota->info);
     }
-
-    return -1;
-}
-
-static void fota_finish(fota_t *fota, fota_info_t *info)
-{
-    if (fota->cls->finish)
-        fota->cls->finish(info);
-}
-
-static void fota_fail(fota_t *fota, fota_info_t *info)
-{
-    if (fota->cls->fail)
-        fota->cls->fail(info);
+    return 0;
 }
 
-static int fota_prepare(fota_t *fota)
+static void fota_check(fota_t *fota)
 {
-    if (!(fota->from_path && fota->to_path)) {
-        LOGE(TAG, "fota->from_path or fota->to_path is NULL");
-        return -EINVAL;
+    fota->retry = fota->config.retry_count;
+    if (fota->event_cb) {
+        fota->error_code = FOTA_ERROR_NULL;
+        fota->event_cb(fota, FOTA_EVENT_START);
     }
-    LOGD(TAG, "###fota->from_path:%s, fota->to_path:%s", fota->from_path, fota->to_path);
-    fota->buffer = aos_malloc(CONFIG_FOTA_BUFFER_SIZE);
-    fota->from = netio_open(fota->from_path);
-    fota->to = netio_open(fota->to_path);
 
-    if (fota->buffer == NULL || fota->from == NULL || fota->to == NULL) {
-        if (fota->buffer == NULL) {
-            LOGD(TAG, "fota->buffer e");
-        } else if (fota->from == NULL) {
-            LOGD(TAG, "fota->from e");
-        } else if (fota->to == NULL) {
-            LOGD(TAG, "fota->to e");
+    fota->info.next_check = 0;
+    int ret = fota_version_check(fota, &fota->info);
+    // the server answered that there is no update, not a failure to back off from
+    int failed = ret != 0 && ret != -ENODATA;
+    if (ret == 0) {
+        if (fota->event_cb) {
+            fota->error_code = FOTA_ERROR_NULL;
+            fota->event_cb(fota, FOTA_EVENT_VERSION);
         }
-        goto error;
-    }
-
-    if (aos_kv_getint(KV_FOTA_OFFSET, &fota->offset) < 0) {
-        if (aos_kv_setint(KV_FOTA_OFFSET, 0) < 0) {
-            goto error;
+        if (fota->config.auto_check_en > 0) {
+            if (fota_prepare(fota) < 0) {
+                LOGE(TAG, "fota_prepare failed");
+                failed = 1;
+                if (fota->event_cb) {
+                    fota->error_code = FOTA_ERROR_PREPARE;
+                    fota->event_cb(fota, FOTA_EVENT_VERSION);
+                }
+            }
+        }
+    } else {
+        if (fota->event_cb) {
+            fota->error_code = FOTA_ERROR_VERSION_CHECK;
+            fota->event_cb(fota, FOTA_EVENT_VERSION);
         }
-        fota->offset = 0;
     }
-
-    LOGI(TAG, "FOTA seek %d", fota->offset);
-
-    if (netio_seek(fota->from, fota->offset, SEEK_SET) != 0) {
-        LOGD(TAG, "from seek error");
-        goto error;
+    if (fota->config.auto_check_en > 0 && fota->status != FOTA_DOWNLOAD) {
+        fota_schedule_check(fota, failed);
     }
+}
 
-    if (netio_seek(fota->to, fota->offset, SEEK_SET) != 0) {
-        LOGD(TAG, "to seek error");
-        goto error;
+static void fota_abort(fota_t *fota)
+{
+    LOGD(TAG, "fota abort");
+    fota->status = FOTA_ABORT;
+    if (fota->retry != 0) {
+        LOGW(TAG, "fota retry: %d!", fota->retry);
+        fota->retry--;
+        fota_timer_set(fota, FOTA_CMD_DOWNLOAD, fota_backoff(fota, fota->config.retry_count - fota->retry));
+    } else {
+        fota->retry = fota->config.retry_count;
+        fota_fail(fota, &fota->info);
+        fota_release(fota);
+        fota->status = FOTA_INIT;
+        if (fota->config.auto_check_en > 0) {
+            fota->info.next_check = 0;
+            fota_schedule_check(fota, 1);
+        }
     }
+}
 
-    fota->status = FOTA_DOWNLOAD;
-    fota->total_size = fota->from->size;
-    LOGD(TAG, "fota prepare ok.");
-    return 0;
+static void fota_download_done(fota_t *fota)
+{
+    char key[FOTA_SESSION_KEY_LEN];
 
-error:
-    if (fota->buffer) {
-        aos_free(fota->buffer);
-        fota->buffer = NULL;
+    // the last chunk may have been coalesced
+    fota_progress_emit(fota, FOTA_ERROR_NULL);
+    if (fota->event_cb) {
+        fota->error_code = FOTA_ERROR_NULL;
+        fota->event_cb(fota, FOTA_EVENT_VERIFY);
     }
-    if (fota->from) {
-        netio_close(fota->from);
-        fota->from = NULL;
+    if (fota->saved_size > 0) {
+        LOGI(TAG, "fota saved %lld of %lld bytes", (long long)fota->saved_size, (long long)fota->total_size);
     }
-    if (fota->to) {
-        netio_close(fota->to);
-        fota->to = NULL;
+    int verify = fota_data_verify(fota->session);
+    fota_finish(fota, &fota->info);
+    fota_release(fota);
+    aos_kv_del(fota_kv_key(fota, KV_FOTA_OFFSET, key));
+    if (verify != 0) {
+        LOGE(TAG, "fota data verify failed.");
+        fota_progress_emit(fota, FOTA_ERROR_VERIFY);
+        // goto init status
+        fota->status = FOTA_INIT;
+        if (fota->config.auto_check_en > 0) {
+            fota->info.next_check = 0;
+            fota_schedule_check(fota, 1);
+        }
+    } else {
+        LOGD(TAG, "fota data verify ok.");
+        fota_schedule_clear(fota);
+#ifdef CONFIG_DL_FINISH_FLAG_POWSAVE
+        aos_kv_setint(fota_kv_key(fota, KV_FOTA_FINISH, key), 1);
+#endif
+        fota->status = FOTA_FINISH;
+        fota->error_code = FOTA_ERROR_NULL;
+        if (fota->event_cb)
+            fota->event_cb(fota, FOTA_EVENT_FINISH);
+        if (fota->config.auto_check_en > 0) {
+            fota_do_restart(fota, 0);
+        }
     }
-
-    return -1;
 }
 
-static void fota_release(fota_t *fota)
+/* move one chunk from the netio to the storage */
+static void fota_download_chunk(fota_t *fota)
 {
-    LOGD(TAG, "%s,%d", __func__, __LINE__);
-    if (fota->buffer) {
-        aos_free(fota->buffer);
-        fota->buffer = NULL;
+#ifdef CONFIG_DL_FINISH_FLAG_POWSAVE
+    char key[FOTA_SESSION_KEY_LEN];
+#endif
+    uint8_t *data;
+    int size = fota_read_chunk(fota, &data);
+    if (fota->quit) {
+        return;
     }
-
-    if (fota->from) {
-        netio_close(fota->from);
-        fota->from = NULL;
+    fota->total_size = fota->from->size;
+    LOGD(TAG, "fota_task FOTA_DOWNLOAD! total:%lld offset:%lld", (long long)fota->from->size,
+         (long long)fota->to->offset);
+    LOGD(TAG, "##read: %d", size);
+    if (size < 0) {
+        LOGD(TAG, "read size < 0 %d", size);
+        if (size == -2) {
+            LOGW(TAG, "reconnect again");
+            return;
+        }
+        fota_progress_emit(fota, FOTA_ERROR_NET_READ);
+        fota_checkpoint(fota, 1);
+        fota_abort(fota);
+        return;
+    } else if (size == 0) {
+        LOGD(TAG, "read size 0.");
+        fota_download_done(fota);
+        return;
     }
-
-    if (fota->to) {
-        netio_close(fota->to);
-        fota->to = NULL;
+#ifdef CONFIG_DL_FINISH_FLAG_POWSAVE
+    if (fota->offset == 0) {
+        LOGD(TAG, "set fota_finish to 0");
+        if (aos_kv_setint(fota_kv_key(fota, KV_FOTA_FINISH, key), 0) < 0) {
+            goto write_err;
+        }
+    }
+#endif
+    long long write_start = aos_now_ms();
+    size = netio_write(fota->to, data, size, fota->config.write_timeoutms);
+    LOGI(TAG, "write size: %d", size);
+    if (size > 0) {
+        fota->offset += size;
+        fota_chunk_tune(fota, &fota->chunk, aos_now_ms() - write_start);
+        fota_release_chunk(fota);
+        if (fota_skip(fota) < 0) {
+            goto write_err;
+        }
+        if (fota_checkpoint(fota, 0) < 0) {
+            goto write_err;
+        }
+        fota_progress_update(fota);
+        return;
     }
+write_err:
+    // flash write error
+    LOGE(TAG, "flash write size error.");
+    fota_progress_emit(fota, FOTA_ERROR_WRITE);
+    // drop the chunks read ahead, the retry reads again from fota->offset
+    fota_pipe_stop(fota);
+    fota_checkpoint(fota, 1);
+    fota_abort(fota);
 }
 
-static void fota_task(void *arg)
+/* all the state changes run here, in the fota task */
+static void fota_command(fota_t *fota, fota_cmd_t *cmd)
 {
-    fota_t *fota = (fota_t *)arg;
-    int retry = fota->config.retry_count;
-
-    LOGD(TAG, "fota_task start: %s", fota->to_path);
-    while (!fota->quit) {
-        if (fota->status == FOTA_INIT) {
-            LOGD(TAG, "fota_task FOTA_INIT! wait......");
-            aos_sem_wait(&fota->do_check_event, -1);
-            if (fota->quit) {
-                break;
-            }
-            if (fota->status == FOTA_DOWNLOAD) {
-                continue;
-            }
-            retry = fota->config.retry_count;
-            if (fota->event_cb) {
-                fota->error_code = FOTA_ERROR_NULL;
-                fota->event_cb(arg, FOTA_EVENT_START);
-            }
-
-            if (fota_version_check(fota, &fota->info) == 0) {
-                if (fota->event_cb) {
-                    fota->error_code = FOTA_ERROR_NULL;
-                    fota->event_cb(arg, FOTA_EVENT_VERSION);
-                }
-                if (fota->config.auto_check_en > 0) {
-                    if (fota_prepare(fota) < 0) {
-                        LOGE(TAG, "fota_prepare failed");
-                        if (fota->event_cb) {
-                            fota->error_code = FOTA_ERROR_PREPARE;
-                            fota->event_cb(arg, FOTA_EVENT_VERSION);
-                        }
-                    }
-                }
-            } else {
-                if (fota->event_cb) {
-                    fota->error_code = FOTA_ERROR_VERSION_CHECK;
-                    fota->event_cb(arg, FOTA_EVENT_VERSION);
-                }
-            }
-            if (fota->config.auto_check_en > 0) {
-                if (fota->status == FOTA_DOWNLOAD) {
-                    aos_sem_signal(&fota->sem_download);
-                    continue;
-                }
-                aos_msleep(fota->config.sleep_time);
-                aos_sem_signal(&fota->do_check_event);
-            }
-        } else if (fota->status == FOTA_DOWNLOAD) {
-            LOGD(TAG, "fota_task download! wait......");
-            aos_sem_wait(&fota->sem_download, -1);
-            if (fota->quit) {
+    LOGD(TAG, "fota command:%d status:%d", cmd->cmd, fota->status);
+    switch (cmd->cmd) {
+        case FOTA_CMD_CHECK:
+            if (fota->status != FOTA_INIT && fota->status != FOTA_FINISH) {
+                LOGW(TAG, "check ignored, status:%d", fota->status);
                 break;
             }
-
-            int size = netio_read(fota->from, fota->buffer, CONFIG_FOTA_BUFFER_SIZE, fota->config.read_timeoutms);
-            fota->total_size = fota->from->size;
-            LOGD(TAG, "fota_task FOTA_DOWNLOAD! total:%d offset:%d", fota->from->size, fota->to->offset);
-            LOGD(TAG, "##read: %d", size);
-            if (size < 0) {
-                LOGD(TAG, "read size < 0 %d", size);
-                if (size == -2) {
-                    LOGW(TAG, "reconnect again");
-                    aos_sem_signal(&fota->sem_download);
-                    continue;
-                }
-                if (fota->event_cb) {
-                    fota->error_code = FOTA_ERROR_NET_READ;
-                    fota->event_cb(arg, FOTA_EVENT_PROGRESS);
-                }
-                fota->status = FOTA_ABORT;
-                LOGD(TAG, "fota abort");
-                continue;
-            } else if (size == 0) {
-                // download finish
-                LOGD(TAG, "read size 0.");
-                if (fota->event_cb) {
-                    fota->error_code = FOTA_ERROR_NULL;
-                    fota->event_cb(arg, FOTA_EVENT_VERIFY);
-                }
-                int verify = fota_data_verify();
-                fota_finish(fota, &fota->info);
-                fota_release(fota);
-                aos_kv_del(KV_FOTA_OFFSET);
-                if (verify != 0) {
-                    LOGE(TAG, "fota data verify failed.");
-                    fota->error_code = FOTA_ERROR_VERIFY;
-                    if (fota->event_cb)
-                        fota->event_cb(arg, FOTA_EVENT_PROGRESS);
-                    // goto init status
-                    fota->status = FOTA_INIT;
-                    if (fota->config.auto_check_en > 0) {
-                        aos_msleep(fota->config.sleep_time);
-                        aos_sem_signal(&fota->do_check_event);
-                    }
-                } else {
-                    LOGD(TAG, "fota data verify ok.");
-#ifdef CONFIG_DL_FINISH_FLAG_POWSAVE
-                    aos_kv_setint(KV_FOTA_FINISH, 1);
-#endif
-                    fota->status = FOTA_FINISH;
-                    fota->error_code = FOTA_ERROR_NULL;
-                    if (fota->event_cb)
-                        fota->event_cb(arg, FOTA_EVENT_FINISH);
-                    if (fota->config.auto_check_en > 0) {
-                        fota_restart(fota, 0);
+            fota_timer_clear(fota);
+            fota->status = FOTA_INIT;
+            fota_check(fota);
+            break;
+        case FOTA_CMD_DOWNLOAD:
+            if (fota->status == FOTA_INIT || fota->status == FOTA_FINISH) {
+                fota_timer_clear(fota);
+                if (fota_prepare(fota)) {
+                    LOGE(TAG, "fota_prepare failed");
+                    if (fota->event_cb) {
+                        fota->error_code = FOTA_ERROR_PREPARE;
+                        fota->event_cb(fota, FOTA_EVENT_VERSION);
                     }
                 }
-                continue;
-            }
-#ifdef CONFIG_DL_FINISH_FLAG_POWSAVE
-            if (fota->offset == 0) {
-                LOGD(TAG, "set fota_finish to 0");
-                if (aos_kv_setint(KV_FOTA_FINISH, 0) < 0) {
-                    goto write_err;
-                }
-            }
-#endif
-            size = netio_write(fota->to, fota->buffer, size, fota->config.write_timeoutms);
-            LOGI(TAG, "write size: %d", size);
-            if (size > 0) {
-                if (aos_kv_setint(KV_FOTA_OFFSET, fota->offset + size) < 0) {
-                    goto write_err;
-                }
-                fota->offset += size;
-                if (fota->event_cb) {
-                    fota->error_code = FOTA_ERROR_NULL;
-                    fota->event_cb(arg, FOTA_EVENT_PROGRESS);
-                }
-                aos_sem_signal(&fota->sem_download);
-            } else {
-write_err:
-                // flash write error
-                LOGE(TAG, "flash write size error.");
-                if (fota->event_cb) {
-                    fota->error_code = FOTA_ERROR_WRITE;
-                    fota->event_cb(arg, FOTA_EVENT_PROGRESS);
+            } else if (fota->status == FOTA_ABORT) {
+                fota_timer_clear(fota);
+                if (fota_resume(fota) < 0) {
+                    LOGE(TAG, "fota resume at %lld failed", (long long)fota->offset);
+                    fota_abort(fota);
+                    break;
                 }
-                fota->status = FOTA_ABORT;
-            }
-        } else if (fota->status == FOTA_ABORT) {
-            LOGD(TAG, "fota_task FOTA_ABORT!");
-            if (retry != 0) {
-                LOGW(TAG, "fota retry: %d!", retry);
-                retry--;
                 fota->status = FOTA_DOWNLOAD;
-                aos_msleep(fota->config.sleep_time);
-                aos_sem_signal(&fota->sem_download);
             } else {
-                retry = fota->config.retry_count;
-                fota_fail(fota, &fota->info);
-                fota_release(fota);
-                fota->status = FOTA_INIT;
-                if (fota->config.auto_check_en > 0) {
-                    aos_msleep(fota->config.sleep_time);
-                    aos_sem_signal(&fota->do_check_event);
-                }
+                LOGW(TAG, "download ignored, status:%d", fota->status);
             }
+            break;
+        case FOTA_CMD_RESTART:
+            fota_do_restart(fota, cmd->arg);
+            break;
+        case FOTA_CMD_STOP:
+            fota->quit = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+static void fota_task(void *arg)
+{
+    fota_t *fota = (fota_t *)arg;
+    fota_cmd_t cmd;
+    unsigned int size;
+    unsigned int timeout;
+
+    LOGD(TAG, "fota_task start: %s", fota->to_path);
+    fota->retry = fota->config.retry_count;
+    fota_progress_start(fota);
+    while (!fota->quit) {
+        if (fota->status == FOTA_DOWNLOAD) {
+            // only poll the commands between the chunks
+            timeout = AOS_NO_WAIT;
+        } else if (fota->timer_cmd) {
+            long long left = fota->timer_ms - aos_now_ms();
+            timeout = left > 0 ? left : AOS_NO_WAIT;
         } else {
-            // finish state will come here.
-            LOGD(TAG, "##fota status:%d", fota->status);
-            aos_msleep(fota->config.sleep_time);
+            timeout = AOS_WAIT_FOREVER;
+        }
+        if (aos_queue_recv(&fota->cmd_queue, timeout, &cmd, &size) == 0 && size == sizeof(fota_cmd_t)) {
+            fota_command(fota, &cmd);
+            continue;
+        }
+        if (fota->timer_cmd && aos_now_ms() >= fota->timer_ms) {
+            cmd.cmd = fota->timer_cmd;
+            cmd.arg = 0;
+            fota_timer_clear(fota);
+            fota_command(fota, &cmd);
+            continue;
+        }
+        if (fota->status == FOTA_DOWNLOAD) {
+            fota_download_chunk(fota);
         }
     }
 
     LOGD(TAG, "force quit need release source");
+    fota_checkpoint(fota, 1);
+    fota_progress_stop(fota);
     fota->status = 0; // need reset for next restart
     fota_release(fota);
 
@@ -372,8 +1420,7 @@ void fota_do_check(fota_t *fota)
 {
     LOGD(TAG, "fota do check signal........");
     if (fota && (fota->status == FOTA_INIT || fota->status == FOTA_FINISH)) {
-        fota->status = FOTA_INIT;
-        aos_sem_signal(&fota->do_check_event);
+        fota_command_send(fota, FOTA_CMD_CHECK, 0);
     }
 }
 
@@ -384,11 +1431,18 @@ int fota_start(fota_t *fota)
     }
 
     if (fota->status == 0) {
+        fota_cmd_t cmd;
+        unsigned int size;
+
+        // drop the commands left by the last run, e.g. its stop
+        while (aos_queue_recv(&fota->cmd_queue, AOS_NO_WAIT, &cmd, &size) == 0);
         fota->status = FOTA_INIT;
         fota->quit = 0;
+        fota_timer_clear(fota);
 #ifdef CONFIG_DL_FINISH_FLAG_POWSAVE
+        char key[FOTA_SESSION_KEY_LEN];
         int isfinish;
-        if (aos_kv_getint(KV_FOTA_FINISH, &isfinish) < 0) {
+        if (aos_kv_getint(fota_kv_key(fota, KV_FOTA_FINISH, key), &isfinish) < 0) {
             isfinish = 0;
         }
         if (isfinish > 0) {
@@ -396,13 +1450,21 @@ int fota_start(fota_t *fota)
             fota->status = FOTA_FINISH;
         }
 #endif
+        int delay = 0;
+        if (fota->config.auto_check_en > 0) {
+            delay = fota_schedule_restore(fota);
+            if (delay > 0) {
+                LOGI(TAG, "first check in %d ms", delay);
+                fota_timer_set(fota, FOTA_CMD_CHECK, delay);
+            }
+        }
         if (aos_task_new_ext(&fota->task, "fota", fota_task, fota, CONFIG_FOTA_TASK_STACK_SIZE, 45) != 0) {
             fota->quit = 1;
             fota->status = 0;
             LOGE(TAG, "fota task create failed.");
             return -1;
         }
-        if (fota->config.auto_check_en > 0) {
+        if (fota->config.auto_check_en > 0 && delay == 0) {
             fota_do_check(fota);
         }
     }
@@ -417,9 +1479,10 @@ int fota_stop(fota_t *fota)
     }
     LOGD(TAG, "%s,%d", __func__, __LINE__);
 
+    // interrupt the blocking read and the rate shaper, then let the task quit in order
     fota->quit = 1;
-    aos_sem_signal(&fota->do_check_event);
-    aos_sem_signal(&fota->sem_download);
+    aos_sem_signal(&fota->pipe.sem_ready);
+    fota_command_send(fota, FOTA_CMD_STOP, 0);
 
     return 0;
 }
@@ -432,16 +1495,24 @@ int fota_close(fota_t *fota)
     LOGD(TAG, "%s,%d", __func__, __LINE__);
 
     fota->quit = 1;
-    aos_sem_signal(&fota->do_check_event);
-    aos_sem_signal(&fota->sem_download);
+    aos_sem_signal(&fota->pipe.sem_ready);
+    fota_command_send(fota, FOTA_CMD_STOP, 0);
     aos_sem_wait(&fota->sem, -1);
     aos_sem_free(&fota->sem);
-    aos_sem_free(&fota->do_check_event);
-    aos_sem_free(&fota->sem_download);
+    aos_queue_free(&fota->cmd_queue);
+    aos_sem_free(&fota->pipe.sem_free);
+    aos_sem_free(&fota->pipe.sem_ready);
+    aos_sem_free(&fota->pipe.sem_quit);
+    aos_mutex_free(&fota->pipe.lock);
+    aos_mutex_free(&fota->progress.lock);
+    aos_mutex_free(&fota->shaper.lock);
+    aos_sem_free(&fota->progress.sem);
+    aos_sem_free(&fota->progress.sem_quit);
 
     if (fota->from_path) aos_free(fota->from_path);
     if (fota->to_path) aos_free(fota->to_path);
-    if (fota->buffer) aos_free(fota->buffer);
+    if (fota->session) aos_free(fota->session);
+    fota_buffer_free(fota);
     if (fota->from) netio_close(fota->from);
     if (fota->to) netio_close(fota->to);
 
@@ -458,45 +1529,13 @@ int fota_download(fota_t *fota)
     }
     LOGD(TAG, "fota download, status:%d", fota->status);
     if (fota->status == FOTA_ABORT || fota->status == FOTA_INIT || fota->status == FOTA_FINISH) {
-        if (fota->status == FOTA_INIT || fota->status == FOTA_FINISH) {
-            if (fota_prepare(fota)) {
-                LOGE(TAG, "fota_prepare failed");
-                if (fota->event_cb) {
-                    fota->error_code = FOTA_ERROR_PREPARE;
-                    fota->event_cb(fota, FOTA_EVENT_VERSION);
-                }
-                return -1;
-            }
-            aos_sem_signal(&fota->do_check_event);
-        } else {
-            fota->status = FOTA_DOWNLOAD;
-        }
         LOGD(TAG, "signal download.");
-        aos_sem_signal(&fota->sem_download);
-        return 0;
+        return fota_command_send(fota, FOTA_CMD_DOWNLOAD, 0);
     }
     LOGW(TAG, "the status is not allow to download.");
     return -1;
 }
 
-static void timer_thread(void *timer, void *args)
-{
-    fota_t *fota = (fota_t *)args;
-    LOGD(TAG, "timer_thread, fota:0x%x", fota);
-    if (fota) {
-        LOGD(TAG, "report restart event.");
-        if (fota->event_cb) {
-            fota->error_code = FOTA_ERROR_NULL;
-            fota->event_cb(fota, FOTA_EVENT_RESTART);
-        }
-        aos_timer_stop(&fota->restart_timer);
-        aos_timer_free(&fota->restart_timer);
-        LOGD(TAG, "stop and delete timer ok.");
-        return;
-    }
-    LOGE(TAG, "timer task params error.");
-}
-
 int fota_restart(fota_t *fota, int delay_ms)
 {
     if (fota == NULL) {
@@ -508,25 +1547,7 @@ int fota_restart(fota_t *fota, int delay_ms)
         LOGE(TAG, "fota status is not FOTA_FINISH, cant restart to upgrade.");
         return -1;
     }
-    if (fota->cls && fota->cls->restart) {
-        if (delay_ms > 0) {
-            int ret = aos_timer_new_ext(&fota->restart_timer, timer_thread, fota, delay_ms, 0, 1);
-            if (ret < 0) {
-                LOGE(TAG, "timer_create error [%d]!\n", errno);
-                return -1;
-            }
-            LOGD(TAG, "set timer ok.");
-            return 0;
-        }
-#ifdef CONFIG_DL_FINISH_FLAG_POWSAVE
-        if (aos_kv_setint(KV_FOTA_FINISH, 0) < 0) {
-            LOGE(TAG, "set finish 0 error.");
-            return -1;
-        }
-#endif
-        fota->cls->restart();
-    }
-    return 0;
+    return fota_command_send(fota, FOTA_CMD_RESTART, delay_ms);
 }
 
 void fota_config(fota_t *fota, fota_config_t *config)
@@ -569,6 +1590,50 @@ fota_status_e fota_get_status(fota_t *fota)
     return fota->status;
 }
 
+int fota_set_rate(fota_t *fota, int rate, int burst)
+{
+    if (fota == NULL || rate < 0 || burst < 0) {
+        LOGE(TAG, "fota set rate param e.");
+        return -EINVAL;
+    }
+    aos_mutex_lock(&fota->shaper.lock, AOS_WAIT_FOREVER);
+    fota->config.rate_limit = rate;
+    fota->config.rate_burst = burst;
+    aos_mutex_unlock(&fota->shaper.lock);
+    fota_shaper_reset(fota);
+    LOGD(TAG, "fota rate:%d burst:%d", rate, burst);
+    return 0;
+}
+
+int fota_set_global_rate(int rate, int burst)
+{
+    if (rate < 0 || burst < 0) {
+        LOGE(TAG, "fota set global rate param e.");
+        return -EINVAL;
+    }
+    aos_mutex_lock(&g_fota_budget.lock, AOS_WAIT_FOREVER);
+    g_fota_budget.rate = rate;
+    g_fota_budget.burst = burst;
+    g_fota_budget.tokens = fota_budget_burst(&g_fota_budget);
+    g_fota_budget.last_ns = aos_now();
+    aos_mutex_unlock(&g_fota_budget.lock);
+    LOGD(TAG, "fota global rate:%d burst:%d", rate, burst);
+    return 0;
+}
+
+int fota_set_memory_budget(int bytes)
+{
+    if (bytes < 0) {
+        LOGE(TAG, "fota set memory budget param e.");
+        return -EINVAL;
+    }
+    aos_mutex_lock(&g_fota_budget.lock, AOS_WAIT_FOREVER);
+    g_fota_budget.memory = bytes;
+    aos_mutex_unlock(&g_fota_budget.lock);
+    LOGD(TAG, "fota memory budget:%d", bytes);
+    return 0;
+}
+
 int64_t fota_get_size(fota_t *fota, const char *name)
 {
     if (fota == NULL) {
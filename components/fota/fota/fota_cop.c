@@ -42,6 +42,15 @@ static void cop_res_release(fota_info_t *info)
     }
 }
 
+/* the server asks to check again later: Retry-After (the HTTP-date form is ignored) or "next_check" in seconds */
+static void cop_next_check(fota_info_t *info, int seconds)
+{
+    if (seconds > 0) {
+        LOGI(TAG, "next check in %d s", seconds);
+        info->next_check = seconds;
+    }
+}
+
 #if CONFIG_FOTA_USE_HTTPC == 1
 #include <http_client.h>
 #include <cJSON.h>
@@ -71,6 +80,9 @@ static int _http_event_handler(http_client_event_t *evt)
             break;
         case HTTP_EVENT_ON_HEADER:
             // LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            if (evt->user_data && strcasecmp(evt->header_key, "Retry-After") == 0) {
+                cop_next_check(evt->user_data, atoi(evt->header_value));
+            }
             break;
         case HTTP_EVENT_ON_DATA:
             // LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
@@ -198,6 +210,8 @@ static int cop_version_check(fota_info_t *info) {
     char *buffer = NULL;
     http_errors_t err;
     http_client_config_t config = {0};
+    char url_key[FOTA_SESSION_KEY_LEN];
+    int64_t offset = 0;
     http_client_handle_t client = NULL;
 
     buffer = aos_zalloc(BUFFER_SIZE + 1);
@@ -233,6 +247,9 @@ static int cop_version_check(fota_info_t *info) {
     config.timeout_ms = 10000;
     config.buffer_size = BUFFER_SIZE;
     config.event_handler = _http_event_handler;
+    config.user_data = info;
+    // the download after the check reuses the connection
+    config.use_pool = true;
     LOGD(TAG, "http client init start.");
     client = http_client_init(&config);
     if (!client) {
@@ -265,6 +282,11 @@ static int cop_version_check(fota_info_t *info) {
         goto out;
     }
 
+    cJSON *next_check = cJSON_GetObjectItem(js, "next_check");
+    if (next_check && cJSON_IsNumber(next_check)) {
+        cop_next_check(info, next_check->valueint);
+    }
+
     cJSON *code = cJSON_GetObjectItem(js, "code");
     if (!(code && cJSON_IsNumber(code))) {
         ret = -1;
@@ -273,7 +295,8 @@ static int cop_version_check(fota_info_t *info) {
     }
     LOGD(TAG, "code: %d", code->valueint);
     if (code->valueint < 0) {
-        ret = -1;
+        // no update for the device
+        ret = -ENODATA;
         goto out;
     }
 
@@ -306,17 +329,18 @@ static int cop_version_check(fota_info_t *info) {
         ret = -1;
         goto out;
     }
-    rc = aos_kv_getstring(COP_IMG_URL, urlbuf, 156);
+    fota_session_name(info->session, COP_IMG_URL, url_key, sizeof(url_key));
+    rc = aos_kv_getstring(url_key, urlbuf, 156);
 
     if (rc <= 0) {
-        aos_kv_setstring(COP_IMG_URL, url->valuestring);
+        aos_kv_setstring(url_key, url->valuestring);
     } else {
         if (strcmp(url->valuestring, urlbuf) == 0) {
-            aos_kv_getint("fota_offset", &rc);
-            LOGI(TAG, "continue fota :%d", rc);
+            fota_offset_get(info->session, &offset);
+            LOGI(TAG, "continue fota :%lld", (long long)offset);
         } else {
-            aos_kv_setstring(COP_IMG_URL, url->valuestring);
-            aos_kv_setint("fota_offset", 0);
+            aos_kv_setstring(url_key, url->valuestring);
+            fota_offset_set(info->session, 0);
             LOGI(TAG, "restart fota");
         }
     }
@@ -399,6 +423,8 @@ static int cop_version_check(fota_info_t *info) {
     char *cptr;
     char getvalue[64];
     int rc;
+    char url_key[FOTA_SESSION_KEY_LEN];
+    int64_t offset = 0;
 
     if ((payload = aos_malloc(156)) == NULL) {
         return -1;
@@ -438,13 +464,26 @@ static int cop_version_check(fota_info_t *info) {
 
     aos_free(payload);
     LOGD(TAG, "resp body: %s", body);
+    cptr = http_head_get(http, "Retry-After", &value_len);
+    if (cptr) {
+        cop_next_check(info, atoi(cptr));
+    }
+    cptr = json_getvalue(body, "next_check", &value_len);
+    if (cptr) {
+        cop_next_check(info, atoi(cptr));
+    }
     cptr = json_getvalue(body, "code", &value_len);
 
-    if ((cptr == NULL) || (atoi(cptr) < 0)) {
+    if (cptr == NULL) {
         LOGW(TAG, "rsp format");
         http_deinit(http);
         return -1;
     }
+    if (atoi(cptr) < 0) {
+        // no update for the device
+        http_deinit(http);
+        return -ENODATA;
+    }
 
     cptr = json_getvalue(body, "version", &value_len);
     if (cptr == NULL) {
@@ -495,17 +534,18 @@ static int cop_version_check(fota_info_t *info) {
         return -1;
     }
 
-    rc = aos_kv_getstring(COP_IMG_URL, buffer, 156);
+    fota_session_name(info->session, COP_IMG_URL, url_key, sizeof(url_key));
+    rc = aos_kv_getstring(url_key, buffer, 156);
 
     if (rc <= 0) {
-        aos_kv_setstring(COP_IMG_URL, http->url);
+        aos_kv_setstring(url_key, http->url);
     } else {
         if (strcmp(http->url, buffer) == 0) {
-            aos_kv_getint("fota_offset", &rc);
-            LOGI(TAG, "continue fota :%d", rc);
+            fota_offset_get(info->session, &offset);
+            LOGI(TAG, "continue fota :%lld", (long long)offset);
         } else {
-            aos_kv_setstring(COP_IMG_URL, http->url);
-            aos_kv_setint("fota_offset", 0);
+            aos_kv_setstring(url_key, http->url);
+            fota_offset_set(info->session, 0);
             LOGI(TAG, "restart fota");
         }
     }
@@ -55,7 +55,7 @@ __attribute__((weak)) unsigned long fota_data_address_get(void)
 }
 #endif
 
-__attribute__((weak)) int fota_data_verify(void)
+__attribute__((weak)) int fota_data_verify(const char *session)
 {
 #define FOTA_DATA_MAGIC 0x45474d49
 #define BUF_SIZE 512
@@ -202,7 +202,7 @@ out:
 
 #else
 
-__attribute__((weak)) int fota_data_verify(void)
+__attribute__((weak)) int fota_data_verify(const char *session)
 {
     return 0;
 }
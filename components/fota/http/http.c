@@ -132,107 +132,123 @@ int http_head_seti(http_t *http, const char *key, int value)
     return 0;
 }
 
-int http_post(http_t *http, char *playload, int timeoutms)
+/* send the request line, the headers set in buffer and the payload, the headers are moved in place */
+static int http_send(http_t *http, const char *method, const char *payload, int timeoutms)
 {
-    char *temp_buff;
-    if ((temp_buff = strdup((char *)http->buffer)) == NULL) {
+    int line_len, len;
+    int payload_len = payload ? strlen(payload) : 0;
+    uint8_t c;
+
+    line_len = snprintf(NULL, 0, "%s %s HTTP/1.1\r\n", method, http->path);
+    len = line_len + http->buffer_offset + 2 + payload_len;
+    if (line_len <= 0 || len >= BUFFER_SIZE) {
+        LOGE(TAG, "request too long: %d", len);
         return -1;
     }
 
-    // temp_buff = strdup((char *)http->buffer);
-    memset(http->buffer, 0, BUFFER_SIZE);
-
-    snprintf((char *)http->buffer, BUFFER_SIZE, "POST %s HTTP/1.1\r\n", http->path);
-
-    strcat((char *)http->buffer, temp_buff);
-
-    strcat((char *)http->buffer, "\r\n");
-
-    strcat((char *)http->buffer, playload);
+    memmove(http->buffer + line_len, http->buffer, http->buffer_offset);
+    // snprintf terminates the line, it overwrites the first byte of the headers
+    c = http->buffer[line_len];
+    snprintf((char *)http->buffer, line_len + 1, "%s %s HTTP/1.1\r\n", method, http->path);
+    http->buffer[line_len] = c;
+    memcpy(http->buffer + line_len + http->buffer_offset, "\r\n", 2);
+    if (payload_len > 0) {
+        memcpy(http->buffer + len - payload_len, payload, payload_len);
+    }
+    http->buffer[len] = 0;
+    http->buffer_offset = 0;
 
-    // LOGD(TAG, "http post sendbuffer: %s", http->buffer);
+    // LOGD(TAG, "http %s sendbuffer: %s", method, http->buffer);
 
-    aos_free(temp_buff);
+    return http->net.net_write(&http->net, http->buffer, len, timeoutms);
+}
 
-    return http->net.net_write(&http->net, http->buffer, strlen((char*)http->buffer), timeoutms);
+int http_post(http_t *http, char *playload, int timeoutms)
+{
+    return http_send(http, "POST", playload, timeoutms);
 }
 
 int http_get(http_t *http, int timeoutms)
 {
-    char *temp_buff;
-    if ((temp_buff = strdup((char *)http->buffer)) == NULL) {
-        return -1;
-    }
-
-    // temp_buff = strdup((char *)http->buffer);
-    memset(http->buffer, 0, BUFFER_SIZE);
-
-    snprintf((char *)http->buffer, BUFFER_SIZE, "GET %s HTTP/1.1\r\n", http->path);
-
-    strcat((char *)http->buffer, temp_buff);
-
-    strcat((char *)http->buffer, "\r\n");
-
-    // LOGD(TAG, "http get sendbuffer: %s", http->buffer);
-
-    aos_free(temp_buff);
-
-    return http->net.net_write(&http->net, http->buffer, strlen((char*)http->buffer), timeoutms);
+    return http_send(http, "GET", NULL, timeoutms);
 }
 
-static int http_parse_head(http_t *http, char **head)
+static char *http_skip_space(char *value)
 {
-    char *content;
-    char *endpoint;
-    int content_len;
-    char *code_str;
-    int code;
-    char *end_point;
-
-    *head = strstr((char*)http->buffer, "\r\n\r\n");
-
-    if (*head == NULL) {
-        return 0;
+    while (*value == ' ' || *value == '\t') {
+        value++;
     }
+    return value;
+}
 
-    *head += 4;
-
-    // FIXME: server connection close, need reconnect
-    if (strstr((char*)http->buffer, "Connection: close")) {
-        return -2;
+/* parse the status line and the headers of the head in buffer, once it's received */
+static int http_parse_head(http_t *http)
+{
+    char *head = (char *)http->buffer;
+    char *line, *value, *end_point;
+    uint8_t c;
+
+    http->status = 0;
+    http->chunked = 0;
+    http->content_len = -1;
+    http->range_start = -1;
+    http->range_end = -1;
+    http->range_total = -1;
+
+    if (strncmp(head, "HTTP/1.", 7) != 0) {
+        LOGE(TAG, "bad status line");
+        return -1;
     }
-
-    if ((content = strstr((char*)http->buffer, "Content-Length: ")) == NULL) {
-        code_str = strstr((char *)http->buffer, "HTTP/1.1");
-
-        code = atoi(code_str + strlen("HTTP/1.1"));
-        if (code != 206 && code != 200) {
-            LOGD(TAG, "http code :%d", code);
-            return -1;
-        }
-
-        content_len = strtol(*head, &end_point, 16);
-
-        if (end_point == NULL) {
-            return 0;
-        }
-    } else {
-        // content_len = atoi(content + strlen("Content-Length: "));
-        content_len = strtol(content + strlen("Content-Length: "), &endpoint, 10);
-
-        if (endpoint == NULL || *endpoint != '\r') {
-            return -1;
+    // HTTP/1.0 closes the connection unless it's asked to keep it alive
+    http->keep_alive = head[7] == '1';
+    http->status = strtol(head + 8, NULL, 10);
+
+    // the body may follow the head, the headers end at the empty line
+    c = http->buffer[http->head_len - 2];
+    http->buffer[http->head_len - 2] = 0;
+    for (line = strstr(head, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            http->content_len = strtoll(http_skip_space(line + 15), NULL, 10);
+        } else if (strncasecmp(line, "Content-Range:", 14) == 0) {
+            value = http_skip_space(line + 14);
+            if (strncasecmp(value, "bytes ", 6) == 0) {
+                http->range_start = strtoll(value + 6, &end_point, 10);
+                if (*end_point == '-') {
+                    http->range_end = strtoll(end_point + 1, &end_point, 10);
+                }
+                if (*end_point == '/' && end_point[1] != '*') {
+                    http->range_total = strtoll(end_point + 1, NULL, 10);
+                }
+            }
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            value = http_skip_space(line + 11);
+            if (strncasecmp(value, "close", 5) == 0) {
+                http->keep_alive = 0;
+            } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+                http->keep_alive = 1;
+            }
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            http->chunked = strstr(line + 18, "chunked") != NULL;
         }
     }
+    http->buffer[http->head_len - 2] = c;
 
-    // LOGD(TAG, "http parse head: %s %d", http->buffer, content_len);
-    return content_len;
+    if (http->chunked) {
+        http->content_len = -1;
+    }
+    http->body_left = http->content_len;
+    return 0;
 }
 
-static int net_quick_reconnect(http_t *http)
+int http_reconnect(http_t *http)
 {
     LOGW(TAG, "i need reconnect http");
     http->net.net_disconncet(&http->net);
+    http->head_len = 0;
+    http->recv_len = 0;
+    http->body_pos = 0;
+    http->body_left = 0;
     if (http->net.net_connect(&http->net, http->host, http->port, SOCK_STREAM) != 0) {
         LOGE(TAG, "reconnect failed!");
         return -1;
@@ -240,101 +256,138 @@ static int net_quick_reconnect(http_t *http)
     return 0;
 }
 
-static int net_read(int fd, unsigned char *buffer, int len, int timeout_ms)
+int http_wait_head(http_t *http, int timeoutms)
 {
-    struct timeval interval = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    char *head_end;
+    int from, len;
+
+    http->recv_len = 0;
+    http->head_len = 0;
+    http->body_pos = 0;
+    http->body_left = 0;
 
-    if (interval.tv_sec < 0 || (interval.tv_sec == 0 && interval.tv_usec <= 100)) {
-        interval.tv_sec = 0;
-        interval.tv_usec = 10000;
+    while (http->head_len == 0) {
+        if (http->recv_len >= BUFFER_SIZE - 1) {
+            LOGE(TAG, "head too long");
+            return -1;
+        }
+
+        // peek, the body after the head stays in the socket for http_read_body
+        len = transport_sock_recv(&http->net.sock, http->buffer + http->recv_len, BUFFER_SIZE - 1 - http->recv_len, MSG_PEEK, timeoutms);
+        if (len <= 0) {
+            LOGE(TAG, "net read len=%d errno=%d", len, errno);
+            return -1;
+        }
+
+        // only the bytes just received are searched, with the 3 before them
+        from = http->recv_len > 3 ? http->recv_len - 3 : 0;
+        http->buffer[http->recv_len + len] = 0;
+        if ((head_end = strstr((char *)http->buffer + from, "\r\n\r\n")) != NULL) {
+            len = head_end + 4 - ((char *)http->buffer + http->recv_len);
+            http->head_len = http->recv_len + len;
+        }
+        if (recv(http->net.sock.fd, http->buffer + http->recv_len, len, 0) != len) {
+            LOGE(TAG, "net read errno=%d", errno);
+            return -1;
+        }
+        http->recv_len += len;
     }
+    http->buffer[http->recv_len] = 0;
 
-    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&interval,
-                   sizeof(struct timeval))) {
+    if (http_parse_head(http) < 0) {
         return -1;
     }
 
-    int rc = recv(fd, buffer, len, 0);
-
-    return rc;
+    // LOGD(TAG, "http head: %.*s", http->head_len, http->buffer);
+    return http->status;
 }
 
-int http_wait_resp(http_t *http, char **head_end, int timeoutms)
+int http_read_body(http_t *http, uint8_t *buffer, int length, int timeoutms)
 {
-    int recv_len = 0;
     int len;
-    int content_len;
-
-again:
-    recv_len = 0;
-    *head_end = NULL;
-    content_len = 0;
-    memset(http->buffer, 0, BUFFER_SIZE);
-
-    while(recv_len < BUFFER_SIZE) {
-        int pre_read = BUFFER_SIZE - recv_len;
-        if(pre_read > 512) {
-            pre_read = 512;
-        }
 
-        len = net_read(http->net.fd, http->buffer + recv_len, pre_read, timeoutms);
-        //printf("pre read %d\n", len);
+    if (http->body_left >= 0 && length > http->body_left) {
+        length = http->body_left;
+    }
+    if (length <= 0) {
+        return 0;
+    }
 
-        if (len <= 0) {
+    len = http->recv_len - http->head_len - http->body_pos;
+    if (len > 0) {
+        // received with the head by http_wait_resp
+        len = len < length ? len : length;
+        memcpy(buffer, http->buffer + http->head_len + http->body_pos, len);
+        http->body_pos += len;
+    } else {
+        len = http->net.net_read(&http->net, buffer, length, timeoutms);
+        if (len < 0) {
             LOGE(TAG, "net read len=%d errno=%d", len, errno);
             return -1;
         }
+    }
 
-        recv_len += len;
+    if (http->body_left > 0) {
+        http->body_left -= len;
+    }
+    return len;
+}
 
-        if ((content_len = http_parse_head(http, head_end)) == 0) {
-            continue;
-        }
+int http_wait_resp(http_t *http, char **head_end, int timeoutms)
+{
+    int content_len;
+    int total_len;
+    int len;
+    char *end_point;
 
-        if (content_len < 0) {
-            if (content_len == -2) {
-                if (net_quick_reconnect(http) < 0) {
-                    return 0;
-                }
-                return -2;
-            }
+    *head_end = NULL;
+    if (http_wait_head(http, timeoutms) < 0) {
+        return -1;
+    }
+    *head_end = (char *)http->buffer + http->head_len;
+
+    if (http->content_len >= 0) {
+        content_len = http->content_len;
+    } else {
+        if (http->status != 206 && http->status != 200) {
+            LOGD(TAG, "http code :%d", http->status);
             return -1;
-        } else {
-            break;
         }
-    }
 
-    if (content_len <= 0 && !(*head_end)) {
-        goto again;
+        // the size of the first chunk
+        while (strstr(*head_end, "\r\n") == NULL) {
+            if (http->recv_len >= BUFFER_SIZE - 1) {
+                return -1;
+            }
+            len = transport_sock_recv(&http->net.sock, http->buffer + http->recv_len, BUFFER_SIZE - 1 - http->recv_len, 0, timeoutms);
+            if (len <= 0) {
+                LOGE(TAG, "net read len=%d errno=%d", len, errno);
+                return -1;
+            }
+            http->recv_len += len;
+            http->buffer[http->recv_len] = 0;
+        }
+        content_len = strtol(*head_end, &end_point, 16);
     }
 
-    int head_len = (*head_end - (char *)http->buffer);
-    int total_len = content_len + head_len;
-    //int left_len = content_len + head_len - len;
-    //printf("head len %d, left_len %d, total %d, recv len %d\n", head_len, left_len, total_len, recv_len);
-
-    if ( total_len > BUFFER_SIZE ) {
+    total_len = content_len + http->head_len;
+    if (total_len > BUFFER_SIZE - 1) {
         LOGE(TAG, "total len %d", total_len);
         return -1;
     }
 
-    // LOGD(TAG, "buffer: %.*s", *head_end - (char*)http_ins->buffer, http_ins->buffer);
-
-    while(recv_len < total_len) {
-        if (content_len <= recv_len - (*head_end - (char *)http->buffer)) {
-            break;
-        }
-
-        len = http->net.net_read(&http->net, http->buffer + recv_len, total_len - recv_len, timeoutms);
+    while (http->recv_len < total_len) {
+        len = http->net.net_read(&http->net, http->buffer + http->recv_len, total_len - http->recv_len, timeoutms);
 
-        //printf("left read %d\n", len);
         if (len <= 0) {
             LOGE(TAG, "net read len=%d errno=%d", len, errno);
             return -1;
         }
 
-        recv_len += len;
+        http->recv_len += len;
     }
+    http->buffer[http->recv_len] = 0;
+    http->body_pos = http->recv_len - http->head_len;
 
     return content_len;
 }
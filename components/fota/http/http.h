@@ -5,6 +5,7 @@
 #ifndef __HTTP_H__
 #define __HTTP_H__
 
+#include <stdint.h>
 #include "util/network.h"
 
 #ifdef __cplusplus
@@ -19,6 +20,18 @@ typedef struct http {
     char *url;
     int port;
     network_t net;
+
+    int recv_len;               /*!< bytes received in buffer: the response head and the first body bytes */
+    int head_len;               /*!< the length of the response head, 0: not received */
+    int body_pos;               /*!< the body bytes in buffer already read */
+    int status;                 /*!< the status code */
+    int keep_alive;             /*!< 0: the server closes the connection after the response */
+    int chunked;                /*!< Transfer-Encoding: chunked */
+    int64_t content_len;        /*!< Content-Length, -1: none */
+    int64_t body_left;          /*!< the body bytes not read yet, -1: up to the connection closed */
+    int64_t range_start;        /*!< Content-Range: bytes range_start-range_end/range_total, -1: none */
+    int64_t range_end;
+    int64_t range_total;        /*!< -1: unknown */
 } http_t;
 
 // char *json_getvalue(char *body, char *key, int *len);
@@ -29,6 +42,11 @@ int http_head_seti(http_t *http, const char *key, int value);
 int http_post(http_t *http, char *playload, int timeoutms);
 int http_get(http_t *http, int timeoutms);
 int http_wait_resp(http_t *http, char **head_end, int timeoutms);
+/* receive the response head only, return the status code, the body is read by http_read_body */
+int http_wait_head(http_t *http, int timeoutms);
+/* read the body into buffer, up to length bytes, return 0 at the end of the body */
+int http_read_body(http_t *http, uint8_t *buffer, int length, int timeoutms);
+int http_reconnect(http_t *http);
 char *http_head_get(http_t *http, char *key, int *length);
 char *http_read_data(http_t *http);
 int http_deinit(http_t *http);
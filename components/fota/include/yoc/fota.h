@@ -25,6 +25,21 @@ extern "C" {
 #define KV_FOTA_SLEEP_TIMEMS "fota_slptm"
 #define KV_FOTA_AUTO_CHECK "fota_autock"
 #define KV_FOTA_FINISH "fota_finish"
+#define KV_FOTA_BUFFER_COUNT "fota_bufcnt"
+#define KV_FOTA_HTTPC_CONNS "fota_conns"
+#define KV_FOTA_CHECKPOINT_BYTES "fota_ckbytes"
+#define KV_FOTA_CHECKPOINT_MS "fota_ckms"
+#define KV_FOTA_PROGRESS_MS "fota_pgms"
+#define KV_FOTA_PROGRESS_BYTES "fota_pgbytes"
+#define KV_FOTA_CHUNK_MIN "fota_chkmin"
+#define KV_FOTA_CHUNK_MAX "fota_chkmax"
+#define KV_FOTA_RATE "fota_rate"
+#define KV_FOTA_RATE_BURST "fota_burst"
+#define KV_FOTA_RATE_ADAPTIVE "fota_rateadp"
+#define KV_FOTA_CHECK_JITTER "fota_ckjitter"
+#define KV_FOTA_BACKOFF_MAX "fota_bkmax"
+#define KV_FOTA_NEXT_CHECK "fota_nextck"
+#define KV_FOTA_CHECK_FAILS "fota_ckfails"
 
 #ifndef CONFIG_FOTA_TASK_STACK_SIZE
 #define CONFIG_FOTA_TASK_STACK_SIZE (4 * 1024)
@@ -35,10 +50,34 @@ extern "C" {
 #define CONFIG_FOTA_USE_HTTPC 0
 #endif
 
+// max parallel range connections of httpclient netio
+#ifndef CONFIG_FOTA_HTTPC_MAX_CONNS
+#define CONFIG_FOTA_HTTPC_MAX_CONNS 8
+#endif
+
+// range requests in flight on the connection of the http netio, when the server caps the range size
+#ifndef CONFIG_FOTA_HTTP_PIPELINE
+#define CONFIG_FOTA_HTTP_PIPELINE 4
+#endif
+
 #ifndef CONFIG_FOTA_DATA_IN_RAM
 #define CONFIG_FOTA_DATA_IN_RAM 0
 #endif
 
+// the longest wait for the next check, second, the server hint and the saved schedule are clamped to it
+#ifndef CONFIG_FOTA_NEXT_CHECK_MAX
+#define CONFIG_FOTA_NEXT_CHECK_MAX (7 * 24 * 3600)
+#endif
+
+// save the schedule of the next check when it's at least this far, millisecond
+#ifndef CONFIG_FOTA_SCHEDULE_SAVE_MS
+#define CONFIG_FOTA_SCHEDULE_SAVE_MS 60000
+#endif
+
+// the session name namespaces the kv keys and temp files, "<name>.<session>"
+#define FOTA_SESSION_NAME_LEN 16
+#define FOTA_SESSION_KEY_LEN 64
+
 typedef struct fota fota_t;
 
 typedef enum {
@@ -70,6 +109,22 @@ typedef enum fota_status {
     FOTA_FINISH = 4,        /*!< download finish */
 } fota_status_e;
 
+typedef enum {
+    FOTA_CMD_CHECK = 1,     /*!< check the version */
+    FOTA_CMD_DOWNLOAD,      /*!< start or resume the download */
+    FOTA_CMD_RESTART,       /*!< restart to upgrade, arg is the delay in milliseconds */
+    FOTA_CMD_STOP,          /*!< quit the fota task */
+} fota_cmd_e;
+
+typedef struct {
+    fota_cmd_e cmd;
+    int arg;
+} fota_cmd_t;
+
+#ifndef CONFIG_FOTA_CMD_QUEUE_SIZE
+#define CONFIG_FOTA_CMD_QUEUE_SIZE 8
+#endif
+
 typedef struct {
     char *cur_version;     /*!< the local image version, read from kv*/
     char *local_changelog; /*!< the local image changelog, read from kv*/
@@ -77,15 +132,17 @@ typedef struct {
     char *changelog;       /*!< the incoming image changelog, read from cloud server*/
     char *fota_url;        /*!< the incoming image url, read from cloud server*/
     int timestamp;         /*!< the incoming image timestamp, read from cloud server*/
+    int next_check;        /*!< seconds to wait before the next check, from Retry-After or the server, 0: not given*/
+    const char *session;   /*!< the session name, NULL: the default session*/
 } fota_info_t;
 
 typedef struct fota_cls {
     const char *name;
     int (*init)(fota_info_t *info);
-    int (*version_check)(fota_info_t *info);
+    int (*version_check)(fota_info_t *info);    /*!< 0: a new version, -ENODATA: no update for the device, others: failed */
     int (*finish)(fota_info_t *info);
     int (*fail)(fota_info_t *info);
-    int (*restart)(void);
+    int (*restart)(fota_info_t *info);
     int64_t (*get_size)(const char *name);
 } fota_cls_t;
 
@@ -95,10 +152,68 @@ typedef struct {
     int retry_count;            /*!< when download abort, it will retry to download again in retry_count times */
     int sleep_time;             /*!< the sleep time for auto-check task */
     int auto_check_en;          /*!< whether check version automatic */
+    int buffer_count;           /*!< number of download buffers, > 1 enables overlapped read and write */
+    int checkpoint_bytes;       /*!< save the download offset after this many bytes, 0: not limited by bytes */
+    int checkpoint_ms;          /*!< save the download offset after this many milliseconds, 0: not limited by time */
+    int progress_ms;            /*!< report the progress event at most every this many milliseconds, 0: not limited by time */
+    int progress_bytes;         /*!< report the progress event after this many bytes, 0: not limited by bytes */
+    int chunk_min;              /*!< min chunk size of read and write, 0: CONFIG_FOTA_BUFFER_SIZE */
+    int chunk_max;              /*!< max chunk size of read and write, 0: CONFIG_FOTA_BUFFER_SIZE */
+    int rate_limit;             /*!< download rate limit, bytes per second, 0: not limited */
+    int rate_burst;             /*!< token bucket depth, bytes, 0: a tenth of rate_limit */
+    int rate_adaptive;          /*!< 1: yield the bandwidth when the read latency inflates */
+    int check_jitter;           /*!< percent of sleep_time the auto check is randomized by, 0: fixed period */
+    int backoff_max;            /*!< max delay of the exponential backoff after failures, millisecond, 0: retry after sleep_time */
 } fota_config_t;
 
 typedef int (*fota_event_cb_t)(void *fota, fota_event_e event);   ///< fota Event call back.
 
+typedef struct {
+    uint8_t *buffer;                /*!< chunk data, fota->buffer_size bytes */
+    int size;                       /*!< > 0: data length, 0: read finish, < 0: read error */
+    int length;                     /*!< the length requested from netio_read */
+    int read_ms;                    /*!< time spent in netio_read */
+} fota_chunk_t;
+
+typedef struct {
+    fota_chunk_t *chunks;           /*!< the ring of download buffers */
+    int count;                      /*!< number of chunks in the ring */
+    int head;                       /*!< next chunk filled by the reader task */
+    int tail;                       /*!< next chunk consumed by the writer(fota task) */
+    int running;                    /*!< whether the reader task is running */
+    int stop;                       /*!< request the reader task to stop */
+    aos_task_t task;                /*!< reader task handle */
+    aos_sem_t sem_free;             /*!< counts the empty chunks */
+    aos_sem_t sem_ready;            /*!< counts the filled chunks */
+    aos_sem_t sem_quit;             /*!< signaled when the reader task quits */
+    aos_mutex_t lock;               /*!< guards limit */
+    int64_t limit;                  /*!< to->skip_at handed to the reader task with the free chunks */
+} fota_pipe_t;
+
+typedef struct {
+    long long sample_ms;            /*!< start time of the current speed sample */
+    int64_t sample_offset;          /*!< offset at the start of the current speed sample */
+    long long report_ms;            /*!< time of the last progress event */
+    int64_t report_offset;          /*!< offset of the last progress event */
+    int speed;                      /*!< EWMA download speed, bytes per second */
+    int eta;                        /*!< estimated seconds to finish, -1: unknown */
+    int pending;                    /*!< a progress event is waiting for the reporter task */
+    int running;                    /*!< whether the reporter task is running */
+    int stop;                       /*!< request the reporter task to stop */
+    aos_task_t task;                /*!< reporter task handle */
+    aos_mutex_t lock;               /*!< serialize the progress events */
+    aos_sem_t sem;                  /*!< wake up the reporter task */
+    aos_sem_t sem_quit;             /*!< signaled when the reporter task quits */
+} fota_progress_t;
+
+typedef struct {
+    long long tokens;               /*!< bytes allowed to read now, < 0: the debt to sleep off */
+    long long last_ns;              /*!< time of the last refill, monotonic nanosecond */
+    int scale;                      /*!< adaptive: percent of the rate in use */
+    int base_lat;                   /*!< adaptive: min read latency, microsecond per KB */
+    aos_mutex_t lock;               /*!< the rate may be changed while downloading */
+} fota_shaper_t;
+
 struct fota {
     const fota_cls_t *cls;          /*!< the fota server ops */
 
@@ -107,19 +222,35 @@ struct fota {
     fota_status_e status;           /*!< the fota status, see enum `fota_status_e` */
     char *from_path;                /*!< where the fota data read from, url format */
     char *to_path;                  /*!< where the fota data write to, url format*/
+    char *session;                  /*!< the session name, namespaces the persistent state, NULL: the default session */
     uint8_t *buffer;                /*!< buffer for reading data from net */
-    int offset;                     /*!< downloaded data bytes */
-    int total_size;                 /*!< total length of fota data */
+    int buffer_size;                /*!< allocated size of each download buffer, the max chunk size */
+    int buffer_budget;              /*!< bytes of buffers taken from the global memory budget */
+    int chunk_size;                 /*!< current read and write size, tuned by the read and write latency */
+    fota_chunk_t chunk;             /*!< the chunk being written */
+    int64_t offset;                 /*!< downloaded data bytes */
+    int64_t checkpoint_offset;      /*!< the offset saved in kv, the data before it is synced */
+    long long checkpoint_time;      /*!< the time of the last checkpoint, millisecond */
+    int64_t total_size;             /*!< total length of fota data */
+    int64_t saved_size;             /*!< bytes the storage had already, not downloaded in this run */
     int quit;                       /*!< fota task quit flag */
     aos_task_t task;                /*!< fota task handle */
     aos_sem_t sem;                  /*!< semaphore for waiting fota task quit */
-    aos_sem_t sem_download;         /*!< semaphore for starting download */
-    aos_sem_t do_check_event;       /*!< the semaphore for checking version loop or force */
+    aos_queue_t cmd_queue;          /*!< the control commands, serialized by the fota task */
+    fota_cmd_t cmd_buf[CONFIG_FOTA_CMD_QUEUE_SIZE];
+    fota_cmd_e timer_cmd;           /*!< the command to run when timer_ms expires, 0: none */
+    long long timer_ms;             /*!< deadline of timer_cmd, for auto check and retry */
+    int retry;                      /*!< retries left of the current download */
+    int check_fails;                /*!< failed checks and downloads in a row, for the backoff of the auto check */
+    int schedule_saved;             /*!< the schedule of the next check is saved in kv */
     fota_event_cb_t event_cb;       /*!< the event callback */
     fota_error_code_e error_code;   /*!< fota error code, get it when event occurs */
     fota_config_t config;           /*!< fota config */
     fota_info_t info;               /*!< fota information */
     aos_timer_t restart_timer;      /*!< the timer to norify to restart */
+    fota_pipe_t pipe;               /*!< overlapped read/write pipeline, used when config.buffer_count > 1 */
+    fota_progress_t progress;       /*!< progress reporter, events are sent out of the download path */
+    fota_shaper_t shaper;           /*!< token bucket of the download rate */
     void *private;                  /*!< user data context */
 };
 
@@ -187,6 +318,56 @@ int fota_get_auto_check(fota_t *fota);
  */
 fota_status_e fota_get_status(fota_t *fota);
 
+/**
+ * @brief  设置下载限速，下载过程中可以调用
+ * @param  [in] fota: fota 句柄
+ * @param  [in] rate: 每秒下载字节数，0表示不限速
+ * @param  [in] burst: 令牌桶深度(字节)，0表示rate的十分之一
+ * @return 0 on success, -1 on failed
+ */
+int fota_set_rate(fota_t *fota, int rate, int burst);
+
+/**
+ * @brief  设置所有FOTA会话共享的总下载限速，下载过程中可以调用
+ * @param  [in] rate: 所有会话每秒下载字节数之和，0表示不限速
+ * @param  [in] burst: 令牌桶深度(字节)，0表示rate的十分之一
+ * @return 0 on success, -1 on failed
+ */
+int fota_set_global_rate(int rate, int burst);
+
+/**
+ * @brief  设置所有FOTA会话下载缓存的总内存预算，超出时减少缓存个数和大小
+ * @param  [in] bytes: 下载缓存总字节数，0表示不限制
+ * @return 0 on success, -1 on failed
+ */
+int fota_set_memory_budget(int bytes);
+
+/**
+ * @brief  获取会话对应的kv键名或者临时文件名
+ * @param  [in] session: 会话名，NULL或者""表示默认会话
+ * @param  [in] name: kv键名或者文件路径
+ * @param  [out] buf: 存放会话名字的buffer
+ * @param  [in] size: buffer大小
+ * @return buf，默认会话为name本身，否则为"name.session"
+ */
+const char *fota_session_name(const char *session, const char *name, char *buf, size_t size);
+
+/**
+ * @brief  读取会话保存在kv中的下载偏移(KV_FOTA_OFFSET)
+ * @param  [in] session: 会话名，NULL或者""表示默认会话
+ * @param  [out] offset: 下载偏移，兼容aos_kv_setint保存的4字节偏移
+ * @return 0 on success, -1 on failed
+ */
+int fota_offset_get(const char *session, int64_t *offset);
+
+/**
+ * @brief  保存会话的下载偏移(KV_FOTA_OFFSET)，按8字节保存
+ * @param  [in] session: 会话名，NULL或者""表示默认会话
+ * @param  [in] offset: 下载偏移
+ * @return 0 on success, -1 on failed
+ */
+int fota_offset_set(const char *session, int64_t offset);
+
 /**
  * @brief  获取剩余可用空间
  * @param  [in] fota: fota 句柄
@@ -204,6 +385,16 @@ int64_t fota_get_size(fota_t *fota, const char *name);
  */
 fota_t *fota_open(const char *fota_name, const char *dst, fota_event_cb_t event_cb);
 
+/**
+ * @brief  fota会话初始化，不同会话的下载偏移、临时文件等相互独立，可以同时下载
+ * @param  [in] fota_name: FOTA平台名字，比如"cop",
+ * @param  [in] dst: 差分包存储url
+ * @param  [in] session: 会话名，只能包含字母、数字、'_'和'-'，NULL表示默认会话
+ * @param  [in] event_cb: 用户事件回调
+ * @return fota句柄或者NULL
+ */
+fota_t *fota_open_session(const char *fota_name, const char *dst, const char *session, fota_event_cb_t event_cb);
+
 /**
  * @brief  关闭FOTA功能，释放所有资源
  * @param  [in] fota: fota 句柄
@@ -232,9 +423,10 @@ int fota_register(const fota_cls_t *cls);
 
 /**
  * @brief  对已经下载好的FOTA数据进行校验,(用户可自定义)
+ * @param  [in] session: 会话名，NULL表示默认会话
  * @return 0 on success, -1 on failed
  */
-int fota_data_verify(void);
+int fota_data_verify(const char *session);
 
 #if CONFIG_FOTA_DATA_IN_RAM > 0
 /**
@@ -24,9 +24,15 @@ typedef struct netio_cls netio_cls_t;
 
 typedef struct {
     const netio_cls_t *cls;     /*!< netio ops */
-    size_t offset;              /*!< offset for seek */
-    size_t size;                /*!< file size or partition size */
+    int64_t offset;             /*!< offset for seek */
+    int64_t size;               /*!< file size or partition size */
     size_t block_size;          /*!< the size for transmission(sector size) */
+    const char *session;        /*!< the fota session name, namespaces the persistent state, NULL: the default */
+    const char *source;         /*!< the storage: the url the data is downloaded from, NULL: unknown */
+    int64_t limit;              /*!< the source: the data is read up to here, 0: to the end */
+    int64_t skip_at;            /*!< the storage: it has the data from here on and skips it by the offset, 0: none */
+    int64_t unpacked;           /*!< the storage: bytes written after decompressing the data */
+    int64_t unpacked_size;      /*!< the storage: the size of the data decompressed, 0: not compressed */
 
     void *private;              /*!< user data */
 } netio_t;
@@ -39,7 +45,8 @@ struct netio_cls {
     int (*read)(netio_t *io, uint8_t *buffer, int length, int timeoutms);
     int (*write)(netio_t *io, uint8_t *buffer, int length, int timeoutms);
     int (*remove)(netio_t *io);
-    int (*seek)(netio_t *io, size_t offset, int whence);
+    int (*seek)(netio_t *io, int64_t offset, int whence);
+    int (*sync)(netio_t *io);
 
     void *private;
 };
@@ -83,6 +90,14 @@ int netio_register_coap(void);
  */
 netio_t *netio_open(const char *path);
 
+/**
+ * @brief  netio 打开，只读取到 limit 为止，http 在打开时发出的请求也只请求这一段
+ * @param  [in] path: 下载 url
+ * @param  [in] limit: 读取的结束位置，0表示读到文件结尾
+ * @return netio_t句柄或者NULL
+ */
+netio_t *netio_open_limit(const char *path, int64_t limit);
+
 /**
  * @brief  netio 关闭
  * @param  [in] io: netio句柄
@@ -117,7 +132,14 @@ int netio_write(netio_t *io, uint8_t *buffer, size_t lenght, int timeoutms);
  * @param  [in] whence：偏移方向
  * @return 0 on success, -1 on failed
  */
-int netio_seek(netio_t *io, size_t offset, int whence);
+int netio_seek(netio_t *io, int64_t offset, int whence);
+
+/**
+ * @brief  netio 同步，将已写入的数据持久化到存储介质
+ * @param  [in] io: netio句柄
+ * @return 0 on success, -1 on failed
+ */
+int netio_sync(netio_t *io);
 
 #ifdef __cplusplus
 }
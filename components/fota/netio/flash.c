@@ -73,7 +73,7 @@ static int flash_write(netio_t *io, uint8_t *buffer, int length, int timeoutms)
         length = io->size - io->offset;
     // LOGD(TAG, "length %d\n", length);
     if (fota_flash_erase(handle, io->offset + (io->block_size << 1), io->block_size, (length + io->block_size - 1) / io->block_size) < 0) {
-        LOGE(TAG, "erase addr:%x length:%x\n", io->offset + (io->block_size << 1), (length + io->block_size - 1) / io->block_size);
+        LOGE(TAG, "erase addr:%x length:%x\n", (uint32_t)(io->offset + (io->block_size << 1)), (length + io->block_size - 1) / io->block_size);
 
         return -1;
     }
@@ -84,11 +84,11 @@ static int flash_write(netio_t *io, uint8_t *buffer, int length, int timeoutms)
         return length;
     }
 
-    LOGD(TAG, "write fail addr:0x%x length:0x%x\n", io->offset + (io->block_size << 1), length);
+    LOGD(TAG, "write fail addr:0x%x length:0x%x\n", (uint32_t)(io->offset + (io->block_size << 1)), length);
     return -1;
 }
 
-static int flash_seek(netio_t *io, size_t offset, int whence)
+static int flash_seek(netio_t *io, int64_t offset, int whence)
 {
     // partition_t handle = (partition_t)io->private;
 
@@ -129,7 +129,7 @@ static int flash_write(netio_t *io, uint8_t *buffer, int length, int timeoutms)
     return 0;
 }
 
-static int flash_seek(netio_t *io, size_t offset, int whence)
+static int flash_seek(netio_t *io, int64_t offset, int whence)
 {
     // partition_t handle = (partition_t)io->private;
 
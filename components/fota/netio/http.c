@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "../http/http.h"
 #include <yoc/fota.h>
 #include <yoc/netio.h>
@@ -14,107 +15,261 @@
 
 #define TAG "fota"
 
-static int http_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+#define HTTP_REQ_TIMEOUT 10000
+
+typedef struct {
+    http_t *http;
+    int64_t pos;                /*!< the offset of the next body byte on the connection */
+    int64_t end;                /*!< the last byte of the response being read, -1: no response */
+    int64_t cap;                /*!< the size the server caps the ranges to, 0: the rest is sent in one response */
+    int64_t requested;          /*!< the first byte not asked for on the connection */
+    int64_t asked[CONFIG_FOTA_HTTP_PIPELINE]; /*!< the last byte asked by each request not answered yet, -1: to the end */
+    int asked_head;
+    int asked_count;
+} http_io_t;
+
+/* GET bytes=start-end, end < 0: to the end of the file, the response is queued behind the ones asked */
+static int http_request(http_io_t *hio, int64_t start, int64_t end)
 {
-    int content_len;
-    char *head_end;
-    http_t *http = (http_t*)io->private;
+    http_t *http = hio->http;
+    char range[56];
 
-    if (io->offset >= io->size) {
-        LOGD(TAG, "http_read done: %d %d", io->size, io->offset);
-        return 0;
+    if (hio->asked_count >= CONFIG_FOTA_HTTP_PIPELINE) {
+        return -1;
     }
 
-    memset(http->buffer, 0, BUFFER_SIZE);
     http->buffer_offset = 0;
     http_head_sets(http, "Host", http->host);
-
-    int range_end = io->offset + io->block_size - 1;
-    char *range;
-    range = aos_zalloc(56);
-    if (io->size > 0) {
-        range_end = range_end < (io->size - 1)? range_end : (io->size - 1);
+    if (end >= 0) {
+        snprintf(range, sizeof(range), "bytes=%lld-%lld", (long long)start, (long long)end);
+    } else {
+        snprintf(range, sizeof(range), "bytes=%lld-", (long long)start);
     }
-    snprintf(range, 56, "bytes=%d-%d", io->offset, range_end);
     http_head_sets(http, "Range", range);
-    aos_free(range);
     http_head_sets(http, "Connection", "keep-alive");
     http_head_sets(http, "Cache-Control", "no-cache");
 
-    http_get(http, 10000);
+    LOGD(TAG, "http get range: %s", range);
+    if (http_get(http, HTTP_REQ_TIMEOUT) <= 0) {
+        return -1;
+    }
+    hio->asked[(hio->asked_head + hio->asked_count) % CONFIG_FOTA_HTTP_PIPELINE] = end;
+    hio->asked_count++;
+    hio->requested = end >= 0 ? end + 1 : INT64_MAX;
+    return 0;
+}
 
-    if ((content_len = http_wait_resp(http, &head_end, 10000)) < 0) {
-        LOGE(TAG, "recv failed: %d", content_len);
-        return content_len;
+/* the last byte the session reads: up to the limit, or to the end of the file */
+static int64_t http_want_end(netio_t *io)
+{
+    if (io->limit > io->offset) {
+        return io->limit - 1;
     }
+    return io->size > 0 ? io->size - 1 : -1;
+}
 
-    if (content_len != (range_end - io->offset + 1)) {
-        LOGE(TAG, "content_len overflow :%d", content_len);
-        return -1;
+/* the range of a request from offset, the rest unless the server caps it */
+static int64_t http_range_end(netio_t *io, http_io_t *hio, int64_t offset)
+{
+    int64_t end = http_want_end(io);
+
+    if (hio->cap > 0 && (end < 0 || offset + hio->cap - 1 < end)) {
+        end = offset + hio->cap - 1;
     }
-    // LOGD(TAG, "recv sucess: %d", content_len);
-    io->offset += content_len;
+    return end;
+}
 
-    memcpy(buffer, head_end, content_len);
+/* keep the next ranges asked while this one is read, the server sends them back to back */
+static void http_pipeline(netio_t *io, http_io_t *hio)
+{
+    int64_t want = http_want_end(io);
 
-    return content_len;
+    if (hio->cap == 0 || !hio->http->keep_alive) {
+        return;
+    }
+    while (hio->asked_count < CONFIG_FOTA_HTTP_PIPELINE && want >= 0 && hio->requested <= want) {
+        if (http_request(hio, hio->requested, http_range_end(io, hio, hio->requested)) < 0) {
+            break;
+        }
+    }
 }
 
-static int http_open(netio_t *io, const char *path)
+/* receive the head of the next response, to the range from start */
+static int http_response(netio_t *io, http_io_t *hio, int64_t start, int timeoutms)
 {
-    http_t *http;
-    if ((http = http_init(path)) == NULL) {
-        LOGD(TAG, "e http init");
+    http_t *http = hio->http;
+    int64_t asked;
+    int status;
+
+    if (hio->asked_count == 0) {
         return -1;
     }
+    asked = hio->asked[hio->asked_head];
+    hio->asked_head = (hio->asked_head + 1) % CONFIG_FOTA_HTTP_PIPELINE;
+    hio->asked_count--;
 
-    io->offset = 0;
-    io->block_size = CONFIG_FOTA_BUFFER_SIZE;// 1024
-    // io->private = http;
+    if ((status = http_wait_head(http, timeoutms)) < 0) {
+        return -1;
+    }
 
-    int content_len;
-    char *range;
-    char *head_end;
-    memset(http->buffer, 0, BUFFER_SIZE);
-    http->buffer_offset = 0;
-    http_head_sets(http, "Host", http->host);
+    if (status == 206 && http->range_start == start && http->range_end >= start) {
+        if (http->range_total > 0) {
+            io->size = http->range_total;
+        }
+        hio->end = http->range_end;
+    } else if (status == 200 && start == 0 && http->content_len > 0) {
+        // Range is ignored, the whole file follows
+        io->size = http->content_len;
+        hio->end = http->content_len - 1;
+    } else {
+        LOGE(TAG, "http code:%d, range:%lld-%lld", status, (long long)http->range_start, (long long)http->range_end);
+        return -1;
+    }
+    hio->pos = start;
+
+    // less than asked for: the server caps the ranges, the rest is asked in ranges of that size
+    if (asked < 0) {
+        asked = io->size - 1;
+    }
+    if (hio->end < asked) {
+        if (hio->cap != hio->end - start + 1) {
+            LOGD(TAG, "http range capped to %lld", (long long)(hio->end - start + 1));
+        }
+        hio->cap = hio->end - start + 1;
+        if (hio->asked_count == 0) {
+            hio->requested = hio->end + 1;
+        }
+    }
+    if (hio->end >= 0 && !http->keep_alive) {
+        // nothing else is answered on the connection
+        hio->asked_count = 0;
+    }
+    http_pipeline(io, hio);
+    return 0;
+}
 
-    int range_end = io->offset + io->block_size - 1;
+/* drop the response and the requests on the connection */
+static int http_reset(http_io_t *hio)
+{
+    hio->end = -1;
+    hio->asked_count = 0;
+    return http_reconnect(hio->http);
+}
+
+static int http_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+{
+    http_io_t *hio = (http_io_t *)io->private;
+    http_t *http = hio->http;
+    long long time1ms;
+    int64_t want;
+    int read_len = 0;
+    int ret = 0;
+    int len;
 
-    range = (void *)aos_zalloc(56);
-    if (io->size > 0) {
-        range_end = range_end < (io->size - 1)? range_end : (io->size - 1);
+    if ((io->size > 0 && io->offset >= io->size) || (io->limit > 0 && io->offset >= io->limit)) {
+        LOGD(TAG, "http_read done: %lld %lld", (long long)io->size, (long long)io->offset);
+        return 0;
     }
-    snprintf(range, 56, "bytes=%d-%d", io->offset, range_end);
-    http_head_sets(http, "Range", range);
-    aos_free(range);
-    http_head_sets(http, "Connection", "keep-alive");
-    http_head_sets(http, "Cache-Control", "no-cache");
 
-    http_get(http, 10000);
+    if (hio->end >= 0 && hio->pos != io->offset) {
+        // seeked, the connection is positioned at hio->pos
+        LOGD(TAG, "http seek %lld -> %lld, reconnect", (long long)hio->pos, (long long)io->offset);
+        if (http_reset(hio) < 0) {
+            return -1;
+        }
+    }
 
-    if ((content_len = http_wait_resp(http, &head_end, 10000)) < 0) {
-        LOGD(TAG, "recv failed: %d", content_len);
-        return -1;
+    if (hio->end >= 0 && io->limit > io->offset && hio->requested > io->limit) {
+        // asked past the limit, the storage has the data from there on: ask again up to it
+        LOGD(TAG, "http limit %lld, reconnect", (long long)io->limit);
+        if (http_reset(hio) < 0) {
+            return -1;
+        }
+    }
+
+    want = http_want_end(io);
+    if (want >= 0 && length > want - io->offset + 1) {
+        length = want - io->offset + 1;
     }
 
-    if ((range = strstr((char *)http->buffer, "Content-Range: bytes ")) == NULL) {
-        LOGD(TAG, "no Content-Range");
+    time1ms = aos_now_ms();
+    while (read_len < length) {
+        if (hio->end < 0 || hio->pos > hio->end) {
+            // the response is read to the end, the next one is asked already or now
+            if (hio->end >= 0 && !http->keep_alive && http_reset(hio) < 0) {
+                ret = -1;
+                break;
+            }
+            if (hio->asked_count == 0 &&
+                http_request(hio, io->offset, http_range_end(io, hio, io->offset)) < 0) {
+                LOGE(TAG, "http request failed");
+                http_reset(hio);
+                ret = -1;
+                break;
+            }
+            if (http_response(io, hio, io->offset, timeoutms) < 0) {
+                // the server may have closed the kept-alive connection, ask again
+                ret = http_reset(hio) == 0 ? -2 : -1;
+                break;
+            }
+        }
+
+        len = length - read_len;
+        if (len > hio->end - hio->pos + 1) {
+            len = hio->end - hio->pos + 1;
+        }
+        len = http_read_body(http, buffer + read_len, len, timeoutms);
+        if (len <= 0) {
+            LOGE(TAG, "http read body failed: %d", len);
+            http_reset(hio);
+            ret = -1;
+            break;
+        }
+        hio->pos += len;
+        io->offset += len;
+        read_len += len;
+        if (aos_now_ms() - time1ms > timeoutms) {
+            break;
+        }
+    }
+
+    return read_len > 0 ? read_len : ret;
+}
+
+static int http_open(netio_t *io, const char *path)
+{
+    http_io_t *hio;
+
+    hio = aos_zalloc_check(sizeof(http_io_t));
+    if ((hio->http = http_init(path)) == NULL) {
+        LOGD(TAG, "e http init");
+        aos_free(hio);
         return -1;
     }
 
-    io->size = atoi(strchr(range, '/') + 1);
+    io->offset = 0;
+    io->size = 0;
+    io->block_size = CONFIG_FOTA_BUFFER_SIZE;// 1024
+    hio->end = -1;
+
+    // one request for the whole file or up to the limit, the first read takes its body
+    if (http_request(hio, 0, http_want_end(io)) < 0 || http_response(io, hio, 0, HTTP_REQ_TIMEOUT) < 0) {
+        LOGD(TAG, "recv failed");
+        http_deinit(hio->http);
+        aos_free(hio);
+        return -1;
+    }
 
-    LOGD(TAG, "range_len: %d", io->size);
+    LOGD(TAG, "range_len: %lld", (long long)io->size);
 
-    io->private = http;
+    io->private = hio;
 
     return 0;
 }
 
-static int http_seek(netio_t *io, size_t offset, int whence)
+static int http_seek(netio_t *io, int64_t offset, int whence)
 {
-    // http_t *http = (http_t*)io->private;
+    // the read reconnects if the connection isn't positioned at the offset
 
     io->offset = offset;
 
@@ -123,9 +278,14 @@ static int http_seek(netio_t *io, size_t offset, int whence)
 
 static int http_close(netio_t *io)
 {
-    http_t *http = (http_t*)io->private;
+    http_io_t *hio = (http_io_t *)io->private;
 
-    return http_deinit(http);
+    if (hio == NULL) {
+        return 0;
+    }
+    http_deinit(hio->http);
+    aos_free(hio);
+    return 0;
 }
 
 const netio_cls_t http_cls = {
@@ -7,16 +7,74 @@
 #include <yoc/netio.h>
 #include <ulog/ulog.h>
 #include <aos/kernel.h>
+#include <aos/kv.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <http_client.h>
 #include "util/network.h"
 
 #define TAG "fota-httpc"
 
+#define RANGE_BUF_SIZE 56
+#define HTTPC_SEG_BUFFER_SIZE (16 * 1024)
+#define HTTPC_SEG_RETRY 2           /* requests in a row a segment may fail without progress */
+
+#define HTTPC_SEG_FREE  0
+#define HTTPC_SEG_BUSY  1
+#define HTTPC_SEG_DONE  2
+#define HTTPC_SEG_ERROR 3
+
+typedef struct httpc_multi httpc_multi_t;
+
+typedef struct {
+    int64_t offset;                 /*!< object offset of the segment */
+    int length;                     /*!< segment length */
+    int state;                      /*!< HTTPC_SEG_XXX */
+    uint8_t *buffer;                /*!< segment data */
+} httpc_seg_t;
+
+typedef struct {
+    int idx;                        /*!< connection index, only idx < active fetch segments */
+    httpc_multi_t *multi;
+    http_client_handle_t client;    /*!< keep-alive connection */
+    int64_t total;                  /*!< object size from the last Content-Range */
+    aos_task_t task;
+    aos_sem_t sem_work;             /*!< wake up the connection task */
+} httpc_conn_t;
+
+struct httpc_multi {
+    netio_t *io;
+    httpc_seg_t segs[CONFIG_FOTA_HTTPC_MAX_CONNS + 1];
+    httpc_conn_t conns[CONFIG_FOTA_HTTPC_MAX_CONNS];
+    int seg_count;                  /*!< segments in the ring, max_conns + 1 */
+    int seg_size;
+    int max_conns;
+    int active;                     /*!< connections in use, auto-tuned */
+    int started;                    /*!< connection tasks started */
+    int stop;
+    int timeoutms;
+    int64_t next_offset;            /*!< first byte not assigned to a segment */
+    int64_t limit;                  /*!< first byte not to assign, the io limit, 0: to the object size */
+    unsigned int next_seg;          /*!< next segment to assign */
+    unsigned int cur_seg;           /*!< segment delivered to netio_read */
+    int read_pos;                   /*!< bytes of cur_seg already delivered */
+    long long round_start;          /*!< auto-tune: start time of the round */
+    int round_segs;                 /*!< auto-tune: segments delivered in the round */
+    size_t round_bytes;             /*!< auto-tune: bytes delivered in the round */
+    int last_rate;                  /*!< auto-tune: bytes/ms of the last round */
+    aos_mutex_t lock;
+    aos_sem_t sem_done;             /*!< a segment is done or failed */
+    aos_sem_t sem_quit;             /*!< a connection task quits */
+};
+
 typedef struct {
     http_client_handle_t http_client;
     const char *cert;
     const char *path;
+    int max_conns;                  /*!< > 1: fetch ranges over parallel connections */
+    int64_t range_end;              /*!< the end of the Range the stream asked for, 0: to the end of the object */
+    int64_t total;                  /*!< object size from the Content-Range of the stream */
+    httpc_multi_t *multi;
 } httpc_priv_t;
 
 static int _http_event_handler(http_client_event_t *evt)
@@ -33,6 +91,13 @@ static int _http_event_handler(http_client_event_t *evt)
             break;
         case HTTP_EVENT_ON_HEADER:
             // LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            if (evt->user_data && strcasecmp(evt->header_key, "Content-Range") == 0) {
+                // bytes <first>-<last>/<total>
+                const char *total = strchr(evt->header_value, '/');
+                if (total && total[1] != '*') {
+                    *(int64_t *)evt->user_data = strtoll(total + 1, NULL, 10);
+                }
+            }
             break;
         case HTTP_EVENT_ON_DATA:
             // LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
@@ -147,14 +212,33 @@ static void _http_cleanup(http_client_handle_t client)
     }
 }
 
-static int http_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+/* the Range of the stream does not fit the limit: it asks past it, or it ended and more is wanted */
+static int http_stream_stale(netio_t *io, httpc_priv_t *priv)
+{
+    int64_t want = io->limit > io->offset ? io->limit : 0;
+
+    if (io->size > 0 && io->offset >= io->size) {
+        return 0;
+    }
+    if (want > 0 && (priv->range_end == 0 || priv->range_end > want)) {
+        return 1;
+    }
+    return priv->range_end > 0 && io->offset >= priv->range_end && want != priv->range_end;
+}
+
+static int http_stream_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
 {
-#define RANGE_BUF_SIZE 56
     int read_len;
     long long time1ms;
     httpc_priv_t *priv = (httpc_priv_t *)io->private;
     http_client_handle_t client = priv->http_client;
 
+    if (client && http_stream_stale(io, priv)) {
+        // the storage has the data from the limit on, the server must not send it
+        LOGD(TAG, "http limit %lld, range end %lld, reconnect", (long long)io->limit, (long long)priv->range_end);
+        _http_cleanup(client);
+        client = priv->http_client = NULL;
+    }
     if (client == NULL) {
         int ret = 0;
         int statuscode;
@@ -162,13 +246,17 @@ static int http_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
         char *buffer = NULL;
         http_errors_t err;
         http_client_config_t config = {0};
+        // follows the chunk size the fota tuned for this link
+        int buf_size = io->block_size * 2;
 
         config.method = HTTP_METHOD_GET;
         config.url = priv->path;
         config.timeout_ms = timeoutms;
-        config.buffer_size = BUFFER_SIZE;
+        config.buffer_size = buf_size;
         config.cert_pem = priv->cert;
         config.event_handler = _http_event_handler;
+        config.user_data = &priv->total;
+        config.use_pool = true;
         client = http_client_init(&config);
         if (!client) {
             LOGE(TAG, "Client init e");
@@ -177,7 +265,7 @@ static int http_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
         }
         LOGD(TAG, "http client init ok.[%s]", config.url);
         LOGD(TAG, "http read connecting........");
-        buffer = aos_zalloc(BUFFER_SIZE + 1);
+        buffer = aos_zalloc(buf_size + 1);
         if (!buffer) {
             LOGE(TAG, "http open nomem.");
             ret = -ENOMEM;
@@ -189,7 +277,12 @@ static int http_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
             ret = -ENOMEM;
             goto exit;
         }
-        snprintf(range, RANGE_BUF_SIZE, "bytes=%d-", io->offset);
+        priv->range_end = io->limit > io->offset ? io->limit : 0;
+        if (priv->range_end > 0) {
+            snprintf(range, RANGE_BUF_SIZE, "bytes=%lld-%lld", (long long)io->offset, (long long)priv->range_end - 1);
+        } else {
+            snprintf(range, RANGE_BUF_SIZE, "bytes=%lld-", (long long)io->offset);
+        }
         LOGD(TAG, "range:%s", range);
         err = http_client_set_header(client, "Range", range);
         if (err != HTTP_CLI_OK) {
@@ -210,7 +303,8 @@ static int http_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
             goto exit;
         }
 
-        err = _http_connect(client, buffer, BUFFER_SIZE);
+        priv->total = 0;
+        err = _http_connect(client, buffer, buf_size);
         if (err != HTTP_CLI_OK) {
             LOGE(TAG, "Client connect e");
             ret = -1;
@@ -222,9 +316,12 @@ static int http_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
             ret = -1;
             goto exit;
         }
-        io->size = http_client_get_content_length(client);
-        io->size += io->offset;
-        LOGD(TAG, "range_len: %d", io->size);
+        if (priv->total > 0) {
+            io->size = priv->total;
+        } else if (priv->range_end == 0) {
+            io->size = io->offset + http_client_get_content_length(client);
+        }
+        LOGD(TAG, "range_len: %lld", (long long)io->size);
         priv->http_client = client;
 exit:
         if (buffer) aos_free(buffer);
@@ -234,8 +331,8 @@ exit:
             return ret;
         }
     }
-    if (io->offset >= io->size) {
-        LOGW(TAG, "http_read done: offset:%d tsize:%d", io->offset, io->size);
+    if ((io->size > 0 && io->offset >= io->size) || (priv->range_end > 0 && io->offset >= priv->range_end)) {
+        LOGW(TAG, "http_read done: offset:%lld tsize:%lld", (long long)io->offset, (long long)io->size);
         return 0;
     }
 
@@ -259,6 +356,374 @@ exit:
     return read_len;
 }
 
+static http_client_handle_t httpc_conn_init(httpc_priv_t *priv, httpc_conn_t *conn, int timeoutms)
+{
+    http_client_config_t config = {0};
+    http_client_handle_t client;
+
+    config.method = HTTP_METHOD_GET;
+    config.url = priv->path;
+    config.timeout_ms = timeoutms;
+    config.buffer_size = HTTPC_SEG_BUFFER_SIZE;
+    config.cert_pem = priv->cert;
+    config.event_handler = _http_event_handler;
+    config.user_data = &conn->total;
+    config.use_pool = true;
+    client = http_client_init(&config);
+    if (!client) {
+        LOGE(TAG, "conn[%d] client init e", conn->idx);
+        return NULL;
+    }
+    http_client_set_header(client, "Connection", "keep-alive");
+    http_client_set_header(client, "Cache-Control", "no-cache");
+    return client;
+}
+
+/*
+ * fetch [offset, offset + length) on the keep-alive connection, return the body length or -1.
+ * Each read waits up to the timeout of the client, a response cut short or stalled is closed and the rest of
+ * the segment is asked for on a fresh connection.
+ */
+static int httpc_conn_fetch(httpc_conn_t *conn, int64_t offset, uint8_t *buffer, int length)
+{
+    char range[RANGE_BUF_SIZE];
+    http_client_handle_t client = conn->client;
+    int retry = HTTPC_SEG_RETRY;
+    int read_len = 0;
+
+    while (read_len < length) {
+        snprintf(range, sizeof(range), "bytes=%lld-%lld", (long long)offset + read_len, (long long)offset + length - 1);
+        if (http_client_set_header(client, "Range", range) != HTTP_CLI_OK) {
+            return -1;
+        }
+        conn->total = 0;
+        if (_http_connect(client, (char *)buffer + read_len, length - read_len) != HTTP_CLI_OK) {
+            // the server may have closed the idle keep-alive connection
+            http_client_close(client);
+            if (retry-- > 0) {
+                LOGD(TAG, "conn[%d] reconnect", conn->idx);
+                continue;
+            }
+            return -1;
+        }
+        if (http_client_get_status_code(client) != 206) {
+            LOGE(TAG, "conn[%d] not 206 Partial Content", conn->idx);
+            http_client_close(client);
+            return -1;
+        }
+        int64_t content_len = http_client_get_content_length(client);
+        if (content_len <= 0 || content_len > length - read_len) {
+            LOGE(TAG, "conn[%d] range length e: %lld", conn->idx, (long long)content_len);
+            http_client_close(client);
+            return -1;
+        }
+
+        int got = 0;
+        while (got < content_len) {
+            int data_read = http_client_read(client, (char *)buffer + read_len + got, content_len - got);
+            if (data_read <= 0) {
+                LOGW(TAG, "conn[%d] read error:%d, errno:%d", conn->idx, data_read, errno);
+                break;
+            }
+            got += data_read;
+        }
+        read_len += got;
+        if (got < content_len) {
+            http_client_close(client);
+            // only the requests in a row that bring nothing count
+            retry = got > 0 ? HTTPC_SEG_RETRY : retry - 1;
+            if (retry < 0) {
+                return -1;
+            }
+            LOGD(TAG, "conn[%d] resume at %lld", conn->idx, (long long)offset + read_len);
+        }
+    }
+    return read_len;
+}
+
+static void httpc_multi_wakeup(httpc_multi_t *multi)
+{
+    for (int i = 0; i < multi->started; i++) {
+        aos_sem_signal(&multi->conns[i].sem_work);
+    }
+}
+
+/* the segments are assigned up to the limit or the object size, call with the lock */
+static int64_t httpc_multi_end(httpc_multi_t *multi)
+{
+    if (multi->limit > 0 && multi->limit < multi->io->size) {
+        return multi->limit;
+    }
+    return multi->io->size;
+}
+
+static void httpc_multi_task(void *arg)
+{
+    httpc_conn_t *conn = (httpc_conn_t *)arg;
+    httpc_multi_t *multi = conn->multi;
+    httpc_seg_t *seg;
+
+    LOGD(TAG, "conn[%d] task start", conn->idx);
+    while (1) {
+        seg = NULL;
+        aos_mutex_lock(&multi->lock, AOS_WAIT_FOREVER);
+        if (multi->stop) {
+            aos_mutex_unlock(&multi->lock);
+            break;
+        }
+        int64_t end = httpc_multi_end(multi);
+        if (conn->idx < multi->active && multi->next_offset < end) {
+            httpc_seg_t *s = &multi->segs[multi->next_seg % multi->seg_count];
+            // in order ring: the slot is free once the reader consumed next_seg - seg_count
+            if (s->state == HTTPC_SEG_FREE) {
+                s->offset = multi->next_offset;
+                s->length = multi->seg_size;
+                if (s->length > end - multi->next_offset)
+                    s->length = end - multi->next_offset;
+                s->state = HTTPC_SEG_BUSY;
+                multi->next_offset += s->length;
+                multi->next_seg++;
+                seg = s;
+            }
+        }
+        aos_mutex_unlock(&multi->lock);
+
+        if (seg == NULL) {
+            aos_sem_wait(&conn->sem_work, AOS_WAIT_FOREVER);
+            continue;
+        }
+        if (conn->client == NULL) {
+            conn->client = httpc_conn_init((httpc_priv_t *)multi->io->private, conn, multi->timeoutms);
+        }
+        int ret = -1;
+        if (conn->client) {
+            ret = httpc_conn_fetch(conn, seg->offset, seg->buffer, seg->length);
+        }
+        aos_mutex_lock(&multi->lock, AOS_WAIT_FOREVER);
+        seg->state = (ret == seg->length) ? HTTPC_SEG_DONE : HTTPC_SEG_ERROR;
+        aos_mutex_unlock(&multi->lock);
+        aos_sem_signal(&multi->sem_done);
+    }
+    LOGD(TAG, "conn[%d] task quit", conn->idx);
+    aos_sem_signal(&multi->sem_quit);
+}
+
+static void httpc_multi_stop(netio_t *io)
+{
+    httpc_priv_t *priv = (httpc_priv_t *)io->private;
+    httpc_multi_t *multi = priv->multi;
+
+    if (multi == NULL) {
+        return;
+    }
+    aos_mutex_lock(&multi->lock, AOS_WAIT_FOREVER);
+    multi->stop = 1;
+    aos_mutex_unlock(&multi->lock);
+    httpc_multi_wakeup(multi);
+    for (int i = 0; i < multi->started; i++) {
+        aos_sem_wait(&multi->sem_quit, AOS_WAIT_FOREVER);
+    }
+    for (int i = 0; i < multi->max_conns; i++) {
+        _http_cleanup(multi->conns[i].client);
+        aos_sem_free(&multi->conns[i].sem_work);
+    }
+    for (int i = 0; i < multi->seg_count; i++) {
+        if (multi->segs[i].buffer)
+            aos_free(multi->segs[i].buffer);
+    }
+    aos_mutex_free(&multi->lock);
+    aos_sem_free(&multi->sem_done);
+    aos_sem_free(&multi->sem_quit);
+    aos_free(multi);
+    priv->multi = NULL;
+    LOGD(TAG, "multi stopped, offset:%lld", (long long)io->offset);
+}
+
+/* probe the object size with the first segment, then start the connection tasks */
+static int httpc_multi_start(netio_t *io, int timeoutms)
+{
+    httpc_priv_t *priv = (httpc_priv_t *)io->private;
+    httpc_multi_t *multi;
+    httpc_seg_t *seg;
+    int length;
+    int ret;
+
+    multi = aos_zalloc(sizeof(httpc_multi_t));
+    if (multi == NULL) {
+        return -ENOMEM;
+    }
+    multi->io = io;
+    multi->max_conns = priv->max_conns;
+    multi->seg_count = priv->max_conns + 1;
+    multi->seg_size = io->block_size;
+    multi->timeoutms = timeoutms;
+    multi->limit = io->limit;
+    aos_mutex_new(&multi->lock);
+    aos_sem_new(&multi->sem_done, 0);
+    aos_sem_new(&multi->sem_quit, 0);
+    for (int i = 0; i < multi->max_conns; i++) {
+        multi->conns[i].idx = i;
+        multi->conns[i].multi = multi;
+        aos_sem_new(&multi->conns[i].sem_work, 0);
+    }
+    priv->multi = multi;
+    for (int i = 0; i < multi->seg_count; i++) {
+        multi->segs[i].buffer = aos_malloc(multi->seg_size);
+        if (multi->segs[i].buffer == NULL) {
+            LOGE(TAG, "multi seg nomem");
+            ret = -ENOMEM;
+            goto error;
+        }
+    }
+
+    seg = &multi->segs[0];
+    multi->conns[0].client = httpc_conn_init(priv, &multi->conns[0], timeoutms);
+    if (multi->conns[0].client == NULL) {
+        ret = -1;
+        goto error;
+    }
+    length = multi->seg_size;
+    if (io->limit > io->offset && io->limit - io->offset < length) {
+        length = io->limit - io->offset;
+    }
+    ret = httpc_conn_fetch(&multi->conns[0], io->offset, seg->buffer, length);
+    if (ret <= 0 || multi->conns[0].total == 0) {
+        LOGW(TAG, "range probe failed, fall back to single stream");
+        ret = 1;
+        goto error;
+    }
+    io->size = multi->conns[0].total;
+    seg->offset = io->offset;
+    seg->length = ret;
+    seg->state = HTTPC_SEG_DONE;
+    multi->next_offset = io->offset + ret;
+    multi->next_seg = 1;
+    multi->cur_seg = 0;
+    multi->active = multi->max_conns > 1 ? 2 : 1;
+    multi->round_start = aos_now_ms();
+    LOGD(TAG, "multi start, offset:%lld size:%lld conns:%d/%d", (long long)io->offset, (long long)io->size,
+         multi->active, multi->max_conns);
+
+    for (int i = 0; i < multi->max_conns; i++) {
+        if (aos_task_new_ext(&multi->conns[i].task, "fota_httpc", httpc_multi_task, &multi->conns[i],
+                             CONFIG_FOTA_TASK_STACK_SIZE, 45) != 0) {
+            LOGE(TAG, "conn[%d] task create failed", i);
+            ret = -1;
+            goto error;
+        }
+        multi->started++;
+    }
+    return 0;
+
+error:
+    httpc_multi_stop(io);
+    return ret;
+}
+
+/* adjust the connection count by the delivered rate of each round */
+static void httpc_multi_tune(httpc_multi_t *multi, int length)
+{
+    multi->round_bytes += length;
+    if (++multi->round_segs < multi->active * 2) {
+        return;
+    }
+
+    int ms = aos_now_ms() - multi->round_start;
+    int rate = multi->round_bytes / (ms > 0 ? ms : 1);
+    LOGD(TAG, "multi round: conns:%d rate:%dKB/s per conn:%dKB/s", multi->active,
+         rate * 1000 / 1024, rate * 1000 / 1024 / multi->active);
+    if (rate > multi->last_rate + multi->last_rate / 10) {
+        // the link is not saturated, one more connection
+        if (multi->active < multi->max_conns)
+            multi->active++;
+    } else if (rate < multi->last_rate - multi->last_rate / 10) {
+        // the connections only share the bandwidth
+        if (multi->active > 1)
+            multi->active--;
+    }
+    multi->last_rate = rate;
+    multi->round_start = aos_now_ms();
+    multi->round_segs = 0;
+    multi->round_bytes = 0;
+}
+
+static int http_multi_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+{
+    httpc_priv_t *priv = (httpc_priv_t *)io->private;
+    httpc_multi_t *multi = priv->multi;
+    httpc_seg_t *seg;
+    int state;
+
+    if (multi == NULL) {
+        int ret = httpc_multi_start(io, timeoutms);
+        if (ret == 1) {
+            priv->max_conns = 1;
+            return http_stream_read(io, buffer, length, timeoutms);
+        } else if (ret < 0) {
+            return ret;
+        }
+        multi = priv->multi;
+    }
+    if (multi->limit != io->limit) {
+        // the storage skips from the new limit on, the segments are assigned up to it
+        aos_mutex_lock(&multi->lock, AOS_WAIT_FOREVER);
+        multi->limit = io->limit;
+        aos_mutex_unlock(&multi->lock);
+        httpc_multi_wakeup(multi);
+    }
+    if (io->offset >= io->size || (io->limit > 0 && io->offset >= io->limit)) {
+        LOGW(TAG, "http_read done: offset:%lld tsize:%lld", (long long)io->offset, (long long)io->size);
+        return 0;
+    }
+
+    seg = &multi->segs[multi->cur_seg % multi->seg_count];
+    while (1) {
+        aos_mutex_lock(&multi->lock, AOS_WAIT_FOREVER);
+        state = seg->state;
+        aos_mutex_unlock(&multi->lock);
+        if (state == HTTPC_SEG_DONE || state == HTTPC_SEG_ERROR) {
+            break;
+        }
+        aos_sem_wait(&multi->sem_done, AOS_WAIT_FOREVER);
+    }
+    if (state == HTTPC_SEG_ERROR) {
+        // the server does not serve the parallel ranges, go on with one connection from the segment
+        LOGW(TAG, "segment 0x%llx failed, fall back to single stream", (long long)seg->offset);
+        httpc_multi_stop(io);
+        priv->max_conns = 1;
+        return http_stream_read(io, buffer, length, timeoutms);
+    }
+
+    int len = seg->length - multi->read_pos;
+    if (len > length)
+        len = length;
+    memcpy(buffer, seg->buffer + multi->read_pos, len);
+    multi->read_pos += len;
+    io->offset += len;
+    if (multi->read_pos == seg->length) {
+        aos_mutex_lock(&multi->lock, AOS_WAIT_FOREVER);
+        seg->state = HTTPC_SEG_FREE;
+        multi->cur_seg++;
+        multi->read_pos = 0;
+        httpc_multi_tune(multi, seg->length);
+        aos_mutex_unlock(&multi->lock);
+        httpc_multi_wakeup(multi);
+    }
+    return len;
+}
+
+static int http_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+{
+    httpc_priv_t *priv = (httpc_priv_t *)io->private;
+
+    // a bounded read shorter than a segment takes one connection, the stream goes on with it
+    if (priv->max_conns > 1 && priv->http_client == NULL &&
+        (priv->multi || io->limit <= io->offset || io->limit - io->offset > io->block_size)) {
+        return http_multi_read(io, buffer, length, timeoutms);
+    }
+    return http_stream_read(io, buffer, length, timeoutms);
+}
+
 static int http_open(netio_t *io, const char *path)
 {
     const char *cert;
@@ -278,6 +743,12 @@ static int http_open(netio_t *io, const char *path)
     priv->http_client = NULL;
     priv->path = path;
     priv->cert = cert;
+    if (aos_kv_getint(KV_FOTA_HTTPC_CONNS, &priv->max_conns) < 0) {
+        priv->max_conns = 1;
+    }
+    if (priv->max_conns > CONFIG_FOTA_HTTPC_MAX_CONNS) {
+        priv->max_conns = CONFIG_FOTA_HTTPC_MAX_CONNS;
+    }
     io->private = priv;
 #if 0 // just for test, mem leak...
     char *tempbuffer = (char *)aos_malloc(400);
@@ -297,8 +768,19 @@ static int http_open(netio_t *io, const char *path)
     return 0;
 }
 
-static int http_seek(netio_t *io, size_t offset, int whence)
+static int http_seek(netio_t *io, int64_t offset, int whence)
 {
+    httpc_priv_t *priv = (httpc_priv_t *)io->private;
+
+    if (priv->multi && offset != io->offset) {
+        httpc_multi_stop(io);
+    }
+    if (priv->http_client && offset != io->offset) {
+        // the stream is positioned at io->offset, reconnect with a new Range
+        LOGD(TAG, "http seek %lld -> %lld, reconnect", (long long)io->offset, (long long)offset);
+        _http_cleanup(priv->http_client);
+        priv->http_client = NULL;
+    }
     io->offset = offset;
     return 0;
 }
@@ -307,6 +789,7 @@ static int http_close(netio_t *io)
 {
     httpc_priv_t *priv = (httpc_priv_t *)io->private;
     http_client_handle_t client = priv->http_client;
+    httpc_multi_stop(io);
     _http_cleanup(client);
     aos_free(priv);
     return 0;
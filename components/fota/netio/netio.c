@@ -30,6 +30,11 @@ int netio_register(const netio_cls_t *cls)
 }
 
 netio_t *netio_open(const char *path)
+{
+    return netio_open_limit(path, 0);
+}
+
+netio_t *netio_open_limit(const char *path, int64_t limit)
 {
     netio_t *io = NULL;
     char *delim = strstr(path, "://");
@@ -47,6 +52,8 @@ netio_t *netio_open(const char *path)
                 if (node->cls->open) {
                     io = aos_zalloc(sizeof(netio_t));
                     io->cls = node->cls;
+                    // set before open, a netio may send its request there
+                    io->limit = limit;
                     if (io->cls->open(io, path) < 0) {
                         aos_free(io);
                         LOGD(TAG, "open fail\n");
@@ -89,10 +96,19 @@ int netio_write(netio_t *io, uint8_t *buffer, size_t lenght, int timeoutms)
     return -1;
 }
 
-int netio_seek(netio_t *io, size_t offset, int whence)
+int netio_seek(netio_t *io, int64_t offset, int whence)
 {
     if (io->cls->seek)
         return io->cls->seek(io, offset, whence);
 
     return -1;
 }
+
+int netio_sync(netio_t *io)
+{
+    // no sync op: the write is durable when it returns
+    if (io->cls->sync)
+        return io->cls->sync(io);
+
+    return 0;
+}
@@ -12,13 +12,14 @@
 #else
 #include <netdb.h>
 #endif
+#include "transport/transport_sock.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct network {
-    int fd;
+    transport_sock_t sock;
     struct sockaddr_in address;
     int (*net_connect)(struct network *n, char *addr, int port, int net_type);
     int (*net_read)(struct network *, unsigned char *, int, int);
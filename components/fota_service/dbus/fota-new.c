@@ -60,6 +60,15 @@ const struct fota_dbus_method_desc fota_dbus_global_methods[] = {
             END_ARGS
         }
     },
+    {
+        FOTA_DBUS_METHOD_CALL_SET_RATE, FOTA_DBUS_INTERFACE,
+        (method_function) fota_dbus_method_set_rate,
+        {
+            { "rate", "i", ARG_IN },
+            { "burst", "i", ARG_IN },
+            END_ARGS
+        }
+    },
     { NULL, NULL, NULL, { END_ARGS } }
 };
 
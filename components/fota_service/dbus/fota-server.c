@@ -457,6 +457,53 @@ int fota_dbus_method_size(DBusMessage *msg, fota_server_t *fota)
     return 0;
 }
 
+int fota_dbus_method_set_rate(DBusMessage *msg, fota_server_t *fota)
+{
+    int ret_val;
+    DBusMessage *reply;
+    DBusMessageIter iter;
+    dbus_uint32_t serial = 0;
+    DBusConnection *conn = fota->conn;
+    dbus_int32_t rate = 0;
+    dbus_int32_t burst = 0;
+
+    fota_log(LOG_DEBUG, "Enter %s\n", __func__);
+
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_INT32, &rate, DBUS_TYPE_INT32, &burst, DBUS_TYPE_INVALID)) {
+        fota_log(LOG_ERR, "setRate args error\n");
+        ret_val = -1;
+    } else {
+        fota_log(LOG_DEBUG, "rate = %d, burst = %d\n", rate, burst);
+        ret_val = fotax_set_rate(&fota->fotax, rate, burst);
+    }
+
+    reply = dbus_message_new_method_return(msg);
+    if (reply == NULL) {
+        fota_log(LOG_ERR, "Out Of Memory!\n");
+        return -1;
+    }
+
+    dbus_message_iter_init_append(reply, &iter);
+
+    if (!dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &ret_val)) {
+        fota_log(LOG_ERR, "Out Of Memory!\n");
+        dbus_message_unref(reply);
+        return -1;
+    }
+
+    if (!dbus_connection_send(conn, reply, &serial)) {
+        fota_log(LOG_ERR, "Out Of Memory!\n");
+        dbus_message_unref(reply);
+        return -1;
+    }
+
+    dbus_connection_flush(conn);
+
+    dbus_message_unref(reply);
+
+    return 0;
+}
+
 static void msg_method_handler(DBusMessage *msg, fota_server_t *fota)
 {
     const char *member;
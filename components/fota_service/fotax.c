@@ -4,7 +4,6 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
-#include <time.h>
 #include <cJSON.h>
 #include <yoc/fota.h>
 #include <ulog/ulog.h>
@@ -15,28 +14,8 @@
 
 #define TAG "fotax"
 
-struct timespec diff_timespec(struct timespec start, struct timespec end)
-{
-     struct timespec result;
- 
-     if (end.tv_nsec < start.tv_nsec)
-     { 
-        result.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;        
-        result.tv_sec = end.tv_sec - 1 - start.tv_sec;
-     }
-     else
-     {
-        result.tv_nsec = end.tv_nsec - start.tv_nsec;        
-        result.tv_sec = end.tv_sec - start.tv_sec;
-     }
- 
-    return result;
-}
-
 static int fota_event_cb(void *arg, fota_event_e event)
 {
-    static int data_offset;
-    static struct timespec tv;
     fota_t *fota = (fota_t *)arg;
     fotax_t *fotax = (fotax_t *)fota->private;
     if (!fotax->fotax_event_cb) {
@@ -51,8 +30,6 @@ static int fota_event_cb(void *arg, fota_event_e event)
         case FOTA_EVENT_VERSION:
         {
             LOGD(TAG, "FOTA VERSION CHECK :%x", fota->status);
-            data_offset = 0;
-            memset(&tv, 0, sizeof(struct timespec));
             cJSON *root = cJSON_CreateObject();
             if (fota->error_code != FOTA_ERROR_NULL) {
                 cJSON_AddNumberToObject(root, "code", 1);
@@ -77,10 +54,10 @@ static int fota_event_cb(void *arg, fota_event_e event)
         }
         case FOTA_EVENT_PROGRESS:
         {
-            LOGD(TAG, "FOTA PROGRESS :%x, %d, %d", fota->status, fota->offset, fota->total_size);
+            LOGD(TAG, "FOTA PROGRESS :%x, %lld, %lld", fota->status, (long long)fota->offset, (long long)fota->total_size);
             int64_t cur_size = fota->offset;
             int64_t total_size = fota->total_size;
-            int speed = 0; //kbps
+            int speed = 0; //KB/s
             int percent = 0;
             if (total_size > 0) {
                 percent = (int)(cur_size * 100 / total_size);
@@ -97,23 +74,20 @@ static int fota_event_cb(void *arg, fota_event_e event)
                 cJSON_AddNumberToObject(root, "cur_size", cur_size);
                 cJSON_AddNumberToObject(root, "percent", percent);
             } else {
-                // current_size, total_size, percent, speed
-                struct timespec now;
-                clock_gettime(CLOCK_MONOTONIC, &now);
-                if (tv.tv_sec > 0 && tv.tv_nsec > 0 && data_offset > 0) {
-                    struct timespec diff = diff_timespec(tv, now);
-                    int millisecond = diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
-                    LOGD(TAG, "interval time: %d ms", millisecond);
-                    speed = ((fota->offset - data_offset) / 1024) * 1000 / millisecond;
-                }
+                // current_size, total_size, percent, speed, eta
+                speed = fota->progress.speed / 1024;
                 cJSON_AddNumberToObject(root, "code", 0);
                 cJSON_AddNumberToObject(root, "total_size", total_size);
                 cJSON_AddNumberToObject(root, "cur_size", cur_size);
                 cJSON_AddNumberToObject(root, "percent", percent);
                 cJSON_AddNumberToObject(root, "speed", speed);
-                tv.tv_sec = now.tv_sec;
-                tv.tv_nsec = now.tv_nsec;
-                data_offset = fota->offset;
+                cJSON_AddNumberToObject(root, "eta", fota->progress.eta);
+                cJSON_AddNumberToObject(root, "saved_size", fota->saved_size);
+                if (fota->to && fota->to->unpacked_size > 0) {
+                    // the sizes above are of the compressed data downloaded
+                    cJSON_AddNumberToObject(root, "unpacked_total_size", fota->to->unpacked_size);
+                    cJSON_AddNumberToObject(root, "unpacked_cur_size", fota->to->unpacked);
+                }
             }
             char *out = cJSON_PrintUnformatted(root);
             cJSON_Delete(root);
@@ -161,6 +135,18 @@ int fotax_start(fotax_t *fotax)
     int retry_count;            /*!< when download abort, it will retry to download again in retry_count times */
     int sleep_time;             /*!< the sleep time for auto-check task */
     int auto_check_en;          /*!< whether check version automatic */
+    int buffer_count;           /*!< number of download buffers, > 1 enables overlapped read and write */
+    int checkpoint_bytes;       /*!< save the download offset after this many bytes */
+    int checkpoint_ms;          /*!< save the download offset after this many milliseconds */
+    int progress_ms;            /*!< report the progress at most every this many milliseconds */
+    int progress_bytes;         /*!< report the progress after this many bytes */
+    int chunk_min;              /*!< min chunk size of read and write */
+    int chunk_max;              /*!< max chunk size of read and write */
+    int rate_limit;             /*!< download rate limit, bytes per second */
+    int rate_burst;             /*!< token bucket depth, bytes */
+    int rate_adaptive;          /*!< yield the bandwidth when the read latency inflates */
+    int check_jitter;           /*!< percent of sleep_time the auto check is randomized by */
+    int backoff_max;            /*!< max delay of the backoff after failures, millisecond */
     fota_config_t config;
 
     if (fotax == NULL) {
@@ -233,16 +219,76 @@ int fotax_start(fotax_t *fotax)
     if (aos_kv_getint(KV_FOTA_SLEEP_TIMEMS, &sleep_time) < 0) {
         sleep_time = 30000;
     }
+    if (aos_kv_getint(KV_FOTA_BUFFER_COUNT, &buffer_count) < 0) {
+        buffer_count = 0;
+    }
+    if (aos_kv_getint(KV_FOTA_CHECKPOINT_BYTES, &checkpoint_bytes) < 0) {
+        checkpoint_bytes = 4 * CONFIG_FOTA_BUFFER_SIZE;
+    }
+    if (aos_kv_getint(KV_FOTA_CHECKPOINT_MS, &checkpoint_ms) < 0) {
+        checkpoint_ms = 5000;
+    }
+    if (aos_kv_getint(KV_FOTA_PROGRESS_MS, &progress_ms) < 0) {
+        progress_ms = 1000;
+    }
+    if (aos_kv_getint(KV_FOTA_PROGRESS_BYTES, &progress_bytes) < 0) {
+        progress_bytes = 0;
+    }
+    if (aos_kv_getint(KV_FOTA_CHUNK_MIN, &chunk_min) < 0) {
+        chunk_min = 0;
+    }
+    if (aos_kv_getint(KV_FOTA_CHUNK_MAX, &chunk_max) < 0) {
+        chunk_max = 0;
+    }
+    if (aos_kv_getint(KV_FOTA_RATE, &rate_limit) < 0) {
+        rate_limit = 0;
+    }
+    if (aos_kv_getint(KV_FOTA_RATE_BURST, &rate_burst) < 0) {
+        rate_burst = 0;
+    }
+    if (aos_kv_getint(KV_FOTA_RATE_ADAPTIVE, &rate_adaptive) < 0) {
+        rate_adaptive = 0;
+    }
+    if (aos_kv_getint(KV_FOTA_CHECK_JITTER, &check_jitter) < 0) {
+        check_jitter = 10;
+    }
+    if (aos_kv_getint(KV_FOTA_BACKOFF_MAX, &backoff_max) < 0) {
+        backoff_max = 600000;
+    }
     config.read_timeoutms = read_timeoutms;
     config.write_timeoutms = write_timeoutms;
     config.retry_count = retry_count;
     config.auto_check_en = auto_check_en;
     config.sleep_time = sleep_time;
+    config.buffer_count = buffer_count;
+    config.checkpoint_bytes = checkpoint_bytes;
+    config.checkpoint_ms = checkpoint_ms;
+    config.progress_ms = progress_ms;
+    config.progress_bytes = progress_bytes;
+    config.chunk_min = chunk_min;
+    config.chunk_max = chunk_max;
+    config.rate_limit = rate_limit;
+    config.rate_burst = rate_burst;
+    config.rate_adaptive = rate_adaptive;
+    config.check_jitter = check_jitter;
+    config.backoff_max = backoff_max;
     LOGD(TAG, "read_timeoutms: %d", read_timeoutms);
     LOGD(TAG, "write_timeoutms: %d", write_timeoutms);
     LOGD(TAG, "retry_count: %d", retry_count);
     LOGD(TAG, "auto_check_en: %d", auto_check_en);
     LOGD(TAG, "sleep_time: %d", sleep_time);
+    LOGD(TAG, "buffer_count: %d", buffer_count);
+    LOGD(TAG, "checkpoint_bytes: %d", checkpoint_bytes);
+    LOGD(TAG, "checkpoint_ms: %d", checkpoint_ms);
+    LOGD(TAG, "progress_ms: %d", progress_ms);
+    LOGD(TAG, "progress_bytes: %d", progress_bytes);
+    LOGD(TAG, "chunk_min: %d", chunk_min);
+    LOGD(TAG, "chunk_max: %d", chunk_max);
+    LOGD(TAG, "rate_limit: %d", rate_limit);
+    LOGD(TAG, "rate_burst: %d", rate_burst);
+    LOGD(TAG, "rate_adaptive: %d", rate_adaptive);
+    LOGD(TAG, "check_jitter: %d", check_jitter);
+    LOGD(TAG, "backoff_max: %d", backoff_max);
     fota_config(fotax->fota_handle, &config);
     ret = fota_start(fotax->fota_handle);
     fotax->state = FOTAX_INIT;
@@ -330,6 +376,24 @@ int fotax_restart(fotax_t *fotax, int delay_ms)
     return fota_restart(fotax->fota_handle, delay_ms);
 }
 
+int fotax_set_rate(fotax_t *fotax, int rate, int burst)
+{
+    int ret;
+
+    if (fotax == NULL || fotax->fota_handle == NULL) {
+        LOGE(TAG, "fotax set rate e");
+        return -EINVAL;
+    }
+    LOGD(TAG, "%s, %d", __func__, __LINE__);
+    ret = fota_set_rate(fotax->fota_handle, rate, burst);
+    if (ret == 0) {
+        // keep it for the next start
+        aos_kv_setint(KV_FOTA_RATE, rate);
+        aos_kv_setint(KV_FOTA_RATE_BURST, burst);
+    }
+    return ret;
+}
+
 int64_t fotax_get_size(fotax_t *fotax, const char *name)
 {
     if (fotax == NULL || fotax->fota_handle == NULL) {
@@ -24,6 +24,7 @@
 #define FOTA_DBUS_METHOD_CALL_DOWNLOAD        "download"
 #define FOTA_DBUS_METHOD_CALL_RESTART         "restart"
 #define FOTA_DBUS_METHOD_CALL_SIZE            "availableSize"
+#define FOTA_DBUS_METHOD_CALL_SET_RATE        "setRate"
 
 typedef struct fota {
     DBusConnection *conn;      /* DBus connection handle */
@@ -26,6 +26,7 @@ int fota_dbus_method_version_check(DBusMessage *msg, fota_server_t *fota);
 int fota_dbus_method_download(DBusMessage *msg, fota_server_t *fota);
 int fota_dbus_method_restart(DBusMessage *msg, fota_server_t *fota);
 int fota_dbus_method_size(DBusMessage *msg, fota_server_t *fota);
+int fota_dbus_method_set_rate(DBusMessage *msg, fota_server_t *fota);
 
 #ifdef __cplusplus
 }
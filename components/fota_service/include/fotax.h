@@ -55,6 +55,8 @@ int fotax_restart(fotax_t *fotax, int delay_ms);
 
 int64_t fotax_get_size(fotax_t *fotax, const char *name);
 
+int fotax_set_rate(fotax_t *fotax, int rate, int burst);
+
 #ifdef __cplusplus
 }
 #endif
@@ -35,6 +35,7 @@ L_SRCS += \
     $(L_SRCS_PATH)http_parser.c        	\
     $(L_SRCS_PATH)http_header.c     	\
 	$(L_SRCS_PATH)http_auth.c     		\
+    $(L_SRCS_PATH)http_pool.c     		\
     $(L_SRCS_PATH)http_client.c
 
 
@@ -84,9 +84,9 @@ static void http_rest_with_url()
     // GET
     http_errors_t err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP GET Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP GET Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP GET request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -99,9 +99,9 @@ static void http_rest_with_url()
     http_client_set_post_field(client, post_data, strlen(post_data));
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP POST Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP POST Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP POST request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -112,9 +112,9 @@ static void http_rest_with_url()
     http_client_set_method(client, HTTP_METHOD_PUT);
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP PUT Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP PUT Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP PUT request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -126,9 +126,9 @@ static void http_rest_with_url()
     http_client_set_post_field(client, NULL, 0);
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP PATCH Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP PATCH Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP PATCH request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -139,9 +139,9 @@ static void http_rest_with_url()
     http_client_set_method(client, HTTP_METHOD_DELETE);
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP DELETE Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP DELETE Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP DELETE request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -152,9 +152,9 @@ static void http_rest_with_url()
     http_client_set_method(client, HTTP_METHOD_HEAD);
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP HEAD Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP HEAD Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP HEAD request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -176,9 +176,9 @@ static void http_rest_with_hostname_path()
     // GET
     http_errors_t err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP GET Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP GET Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP GET request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -191,9 +191,9 @@ static void http_rest_with_hostname_path()
     http_client_set_post_field(client, post_data, strlen(post_data));
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP POST Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP POST Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP POST request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -204,9 +204,9 @@ static void http_rest_with_hostname_path()
     http_client_set_method(client, HTTP_METHOD_PUT);
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP PUT Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP PUT Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP PUT request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -218,9 +218,9 @@ static void http_rest_with_hostname_path()
     http_client_set_post_field(client, NULL, 0);
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP PATCH Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP PATCH Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP PATCH request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -231,9 +231,9 @@ static void http_rest_with_hostname_path()
     http_client_set_method(client, HTTP_METHOD_DELETE);
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP DELETE Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP DELETE Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP DELETE request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -244,9 +244,9 @@ static void http_rest_with_hostname_path()
     http_client_set_method(client, HTTP_METHOD_HEAD);
     err = http_client_perform(client);
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP HEAD Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP HEAD Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "HTTP HEAD request failed: 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -267,9 +267,9 @@ static void http_auth_basic()
     http_errors_t err = http_client_perform(client);
 
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP Basic Auth Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP Basic Auth Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -287,9 +287,9 @@ static void http_auth_basic_redirect()
     http_errors_t err = http_client_perform(client);
 
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP Basic Auth redirect Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP Basic Auth redirect Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -307,9 +307,9 @@ static void http_auth_digest()
     http_errors_t err = http_client_perform(client);
 
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP Digest Auth Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP Digest Auth Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -328,9 +328,9 @@ static void https_with_url()
     http_errors_t err = http_client_perform(client);
 
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTPS Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTPS Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -351,9 +351,9 @@ static void https_with_hostname_path()
     http_errors_t err = http_client_perform(client);
 
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTPS Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTPS Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -371,9 +371,9 @@ static void http_relative_redirect()
     http_errors_t err = http_client_perform(client);
 
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP Relative path redirect Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP Relative path redirect Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -391,9 +391,9 @@ static void http_absolute_redirect()
     http_errors_t err = http_client_perform(client);
 
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP Absolute path redirect Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP Absolute path redirect Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -411,9 +411,9 @@ static void http_redirect_to_https()
     http_errors_t err = http_client_perform(client);
 
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP redirect to HTTPS Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP redirect to HTTPS Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -432,9 +432,9 @@ static void http_download_chunk()
     http_errors_t err = http_client_perform(client);
 
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTP chunk encoding Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTP chunk encoding Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -460,7 +460,7 @@ static void http_perform_as_stream_reader()
         aos_free(buffer);
         return;
     }
-    int content_length =  http_client_fetch_headers(client);
+    int64_t content_length =  http_client_fetch_headers(client);
     int total_read_len = 0, read_len;
     if (total_read_len < content_length && content_length <= MAX_HTTP_RECV_BUFFER) {
         read_len = http_client_read(client, buffer, content_length);
@@ -470,9 +470,9 @@ static void http_perform_as_stream_reader()
         buffer[read_len] = 0;
         LOGD(TAG, "read_len = %d", read_len);
     }
-    LOGI(TAG, "HTTP Stream reader Status = %d, content_length = %d \r\n",
+    LOGI(TAG, "HTTP Stream reader Status = %d, content_length = %lld \r\n",
                     http_client_get_status_code(client),
-                    http_client_get_content_length(client));
+                    (long long)http_client_get_content_length(client));
     http_client_close(client);
     http_client_cleanup(client);
     aos_free(buffer);
@@ -501,9 +501,9 @@ static void https_async()
         }
     }
     if (err == HTTP_CLI_OK) {
-        LOGI(TAG, "HTTPS Status = %d, content_length = %d \r\n",
+        LOGI(TAG, "HTTPS Status = %d, content_length = %lld \r\n",
                 http_client_get_status_code(client),
-                http_client_get_content_length(client));
+                (long long)http_client_get_content_length(client));
     } else {
         LOGE(TAG, "Error perform http request 0x%x @#@@@@@@", (err));
         e_count ++;
@@ -133,6 +133,7 @@ typedef struct {
     void                        *user_data;               /*!< HTTP user_data context */
     bool                        is_async;                 /*!< Set asynchronous mode, only supported with HTTPS for now */
     bool                        use_global_ca_store;      /*!< Use a global ca_store for all the connections in which this bool is set. */
+    bool                        use_pool;                 /*!< Borrow the connection from the pool of the process (http_pool.h), give it back when closed, not with is_async */
 } http_client_config_t;
 
 /**
@@ -142,12 +143,14 @@ typedef enum {
     /* 3xx - Redirection */
     HttpStatus_MovedPermanently  = 301,
     HttpStatus_Found             = 302,
+    HttpStatus_NotModified       = 304,
     HttpStatus_TemporaryRedirect = 307,
 
     /* 4xx - Client Error */
     HttpStatus_Unauthorized      = 401,
     HttpStatus_Forbidden         = 403,
     HttpStatus_NotFound          = 404,
+    HttpStatus_PreconditionFailed = 412,
 
     /* 5xx - Server Error */
     HttpStatus_InternalError     = 500
@@ -345,7 +348,7 @@ int http_client_write(http_client_handle_t client, const char *buffer, int len);
  *     - (-1: HTTP_CLI_FAIL) if any errors
  *     - Download data length defined by content-length header
  */
-int http_client_fetch_headers(http_client_handle_t client);
+int64_t http_client_fetch_headers(http_client_handle_t client);
 
 
 /**
@@ -390,7 +393,7 @@ int http_client_get_status_code(http_client_handle_t client);
  *     - (-1) Chunked transfer
  *     - Content-Length value as bytes
  */
-int http_client_get_content_length(http_client_handle_t client);
+int64_t http_client_get_content_length(http_client_handle_t client);
 
 /**
  * @brief      Close http connection, still kept all http request resources
@@ -0,0 +1,60 @@
+#ifndef _HTTP_POOL_H_
+#define _HTTP_POOL_H_
+
+#include <stdint.h>
+#include "transport/transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The idle keep-alive connections of the process, keyed by (scheme, host, port) and the TLS
+ * configuration. A client with `use_pool` set borrows its connection here when it connects and
+ * gives it back when it's closed after a complete keep-alive response.
+ */
+#ifndef CONFIG_HTTP_POOL_SIZE
+#define CONFIG_HTTP_POOL_SIZE 4             /*!< idle connections kept, the oldest is closed when it's full */
+#endif
+
+#ifndef CONFIG_HTTP_POOL_IDLE_MS
+#define CONFIG_HTTP_POOL_IDLE_MS 30000      /*!< an idle connection older than this is closed */
+#endif
+
+/**
+ * @brief      Take an idle connection to the origin out of the pool
+ *
+ *             The connections which are idle for too long, or readable (closed by the server), are closed.
+ *
+ * @param[in]  scheme  The scheme, "http" or "https"
+ * @param[in]  host    The host
+ * @param[in]  port    The port
+ * @param[in]  tag     The hash of the TLS configuration, 0 for "http"
+ *
+ * @return
+ *     - The connected transport, the caller owns it
+ *     - NULL if there isn't any
+ */
+transport_handle_t http_pool_take(const char *scheme, const char *host, int port, uint32_t tag);
+
+/**
+ * @brief      Give a connected transport back to the pool, the pool owns it from now on
+ *
+ * @param[in]  scheme  The scheme, "http" or "https"
+ * @param[in]  host    The host
+ * @param[in]  port    The port
+ * @param[in]  tag     The hash of the TLS configuration, 0 for "http"
+ * @param[in]  t       The transport, not in any transport list
+ */
+void http_pool_give(const char *scheme, const char *host, int port, uint32_t tag, transport_handle_t t);
+
+/**
+ * @brief      Close all of the idle connections, e.g. when the network is changed
+ */
+void http_pool_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HTTP_POOL_H_ */
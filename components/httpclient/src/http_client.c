@@ -12,11 +12,13 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <stdlib.h>
+#include <limits.h>
 #include "http_client.h"
 #include "http_header.h"
 #include "http_utils.h"
 #include "http_parser.h"
 #include "http_auth.h"
+#include "http_pool.h"
 #include "transport/transport_tcp.h"
 #include "transport/tperrors.h"
 #include "ulog/ulog.h"
@@ -59,11 +61,12 @@ typedef struct {
     http_header_handle_t headers;       /*!< http header */
     http_buffer_t       *buffer;        /*!< data buffer as linked list */
     int                 status_code;    /*!< status code (integer) */
-    int                 content_length; /*!< data length */
+    int64_t             content_length; /*!< data length */
     int                 data_offset;    /*!< offset to http data (Skip header) */
-    int                 data_process;   /*!< data processed */
+    int64_t             data_process;   /*!< data processed */
     int                 method;         /*!< http method */
     bool                is_chunked;
+    bool                is_direct;      /*!< The Content-Length body is read into the caller's buffer, not parsed */
 } http_data_t;
 
 typedef struct {
@@ -126,6 +129,17 @@ struct http_client {
     bool                        first_line_prepared;
     int                         header_index;
     bool                        is_async;
+    bool                        use_pool;
+    bool                        keep_alive;     /*!< No request in flight on the connection, or the response is read to the end and keep-alive */
+    bool                        pool_borrowed;  /*!< The connection was taken from the pool, the server may have closed it */
+    uint32_t                    pool_tag;       /*!< The hash of the TLS configuration, a connection is only shared by the clients with the same */
+    char                        *conn_scheme;   /*!< The origin the pooled transport is connected to */
+    char                        *conn_host;
+    int                         conn_port;
+    const char                  *cert_pem;
+    const char                  *client_cert_pem;
+    const char                  *client_key_pem;
+    bool                        use_global_ca_store;
 };
 
 typedef struct http_client http_client_t;
@@ -163,6 +177,7 @@ static const char *HTTP_METHOD_MAPPING[] = {
 static web_err_t http_client_request_send(http_client_handle_t client, int write_len);
 static web_err_t http_client_connect(http_client_handle_t client);
 static web_err_t http_client_send_post_data(http_client_handle_t client);
+static web_err_t http_client_pool_retry(http_client_handle_t client);
 
 static web_err_t http_dispatch_event(http_client_t *client, http_client_event_id_t event_id, void *data, int len)
 {
@@ -184,6 +199,7 @@ static int http_on_message_begin(http_parser *parser)
     LOGD(TAG, "on_message_begin");
 
     client->response->is_chunked = false;
+    client->response->is_direct = false;
     client->is_chunk_complete = false;
     return 0;
 }
@@ -241,6 +257,9 @@ static int http_on_headers_complete(http_parser *parser)
     client->response->data_offset = parser->nread;
     client->response->content_length = parser->content_length;
     client->response->data_process = 0;
+    client->response->is_direct = !client->response->is_chunked && parser->content_length != ULLONG_MAX &&
+                                  client->connection_info.method != HTTP_METHOD_HEAD &&
+                                  parser->status_code / 100 != 1 && parser->status_code != 204 && parser->status_code != 304;
     LOGD(TAG, "http_on_headers_complete, status=%d, offset=%d, nread=%d", parser->status_code, client->response->data_offset, parser->nread);
     client->state = HTTP_STATE_RES_COMPLETE_HEADER;
     return 0;
@@ -262,11 +281,23 @@ static int http_on_body(http_parser *parser, const char *at, size_t length)
     return 0;
 }
 
+/* the body read by http_client_read bypassing the parser, complete the message when it's all read */
+static void http_on_direct_body(http_client_handle_t client, char *data, int length)
+{
+    client->response->data_process += length;
+    http_dispatch_event(client, HTTP_EVENT_ON_DATA, data, length);
+    if (client->response->data_process >= client->response->content_length) {
+        client->is_chunk_complete = true;
+        client->keep_alive = http_should_keep_alive(client->parser);
+    }
+}
+
 static int http_on_message_complete(http_parser *parser)
 {
     LOGD(TAG, "http_on_message_complete, parser=0x%lx", (unsigned long)parser);
     http_client_handle_t client = parser->data;
     client->is_chunk_complete = true;
+    client->keep_alive = http_should_keep_alive(parser);
     return 0;
 }
 
@@ -311,6 +342,21 @@ web_err_t http_client_get_password(http_client_handle_t client, char **value)
     return WEB_OK;
 }
 
+/* FNV-1a of the TLS settings */
+static uint32_t http_client_pool_tag(const http_client_config_t *config)
+{
+    const char *pem[] = {config->cert_pem, config->client_cert_pem, config->client_key_pem};
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < sizeof(pem) / sizeof(pem[0]); i++) {
+        for (const char *c = pem[i]; c && *c; c++) {
+            hash = (hash ^ (uint8_t)*c) * 16777619u;
+        }
+        hash = (hash ^ 0xff) * 16777619u;
+    }
+    return (hash ^ config->use_global_ca_store) * 16777619u;
+}
+
 static web_err_t _set_config(http_client_handle_t client, const http_client_config_t *config)
 {
     client->connection_info.method = config->method;
@@ -391,6 +437,12 @@ static web_err_t _set_config(http_client_handle_t client, const http_client_conf
     if (config->is_async) {
         client->is_async = true;
     }
+    client->use_pool = config->use_pool && !config->is_async;
+    client->cert_pem = config->cert_pem;
+    client->client_cert_pem = config->client_cert_pem;
+    client->client_key_pem = config->client_key_pem;
+    client->use_global_ca_store = config->use_global_ca_store;
+    client->pool_tag = http_client_pool_tag(config);
 
     return WEB_OK;
 }
@@ -601,6 +653,8 @@ web_err_t http_client_cleanup(http_client_handle_t client)
     free(client->current_header_key);
     free(client->location);
     free(client->auth_header);
+    free(client->conn_scheme);
+    free(client->conn_host);
     free(client);
     return WEB_OK;
 }
@@ -822,7 +876,8 @@ static int http_client_get_data(http_client_handle_t client)
 
     http_buffer_t *res_buffer = client->response->buffer;
 
-    LOGD(TAG, "data_process=%d, content_length=%d", client->response->data_process, client->response->content_length);
+    LOGD(TAG, "data_process=%lld, content_length=%lld", (long long)client->response->data_process,
+         (long long)client->response->content_length);
 
     int rlen = transport_read(client->transport, res_buffer->data, client->buffer_size, client->timeout_ms);
     if (rlen >= 0) {
@@ -840,7 +895,8 @@ bool http_client_is_complete_data_received(http_client_handle_t client)
         }
     } else {
         if (client->response->data_process != client->response->content_length) {
-            LOGD(TAG, "Data processed %d != Data specified in content length %d", client->response->data_process, client->response->content_length);
+            LOGD(TAG, "Data processed %lld != Data specified in content length %lld", (long long)client->response->data_process,
+                 (long long)client->response->content_length);
             return false;
         }
     }
@@ -875,11 +931,18 @@ int http_client_read(http_client_handle_t client, char *buffer, int len)
             break;
         }
         int byte_to_read = need_read;
-        if (byte_to_read > client->buffer_size) {
+        char *dest = res_buffer->data;
+        if (client->response->is_direct) {
+            // nothing but the body is left on the connection, read it straight into the caller's buffer
+            if (byte_to_read > client->response->content_length - client->response->data_process) {
+                byte_to_read = (int)(client->response->content_length - client->response->data_process);
+            }
+            dest = buffer + ridx;
+        } else if (byte_to_read > client->buffer_size) {
             byte_to_read = client->buffer_size;
         }
         errno = 0;
-        rlen = transport_read(client->transport, res_buffer->data, byte_to_read, client->timeout_ms);
+        rlen = transport_read(client->transport, dest, byte_to_read, client->timeout_ms);
         // LOGD(TAG, "need_read=%d, byte_to_read=%d, rlen=%d, ridx=%d", need_read, byte_to_read, rlen, ridx);
 
         if (rlen <= 0) {
@@ -899,6 +962,12 @@ int http_client_read(http_client_handle_t client, char *buffer, int len)
                 return ridx;
             }
         }
+        if (client->response->is_direct) {
+            http_on_direct_body(client, dest, rlen);
+            ridx += rlen;
+            need_read -= rlen;
+            continue;
+        }
         res_buffer->output_ptr = buffer + ridx;
         http_parser_execute(client->parser, client->parser_settings, res_buffer->data, rlen);
         ridx += res_buffer->raw_len;
@@ -1003,7 +1072,7 @@ web_err_t http_client_perform(http_client_handle_t client)
     return WEB_OK;
 }
 
-int http_client_fetch_headers(http_client_handle_t client)
+int64_t http_client_fetch_headers(http_client_handle_t client)
 {
     if (client->state < HTTP_STATE_REQ_COMPLETE_HEADER) {
         return WEB_FAIL;
@@ -1016,11 +1085,15 @@ int http_client_fetch_headers(http_client_handle_t client)
     while (client->state < HTTP_STATE_RES_COMPLETE_HEADER) {
         buffer->len = transport_read(client->transport, buffer->data, client->buffer_size, client->timeout_ms);
         if (buffer->len <= 0) {
+            if (client->pool_borrowed && http_client_pool_retry(client) == WEB_OK) {
+                continue;
+            }
             return WEB_FAIL;
         }
+        client->pool_borrowed = false;
         http_parser_execute(client->parser, client->parser_settings, buffer->data, buffer->len);
     }
-    LOGD(TAG, "content_length = %d", client->response->content_length);
+    LOGD(TAG, "content_length = %lld", (long long)client->response->content_length);
     if (client->response->content_length <= 0) {
         client->response->is_chunked = true;
         return 0;
@@ -1028,6 +1101,98 @@ int http_client_fetch_headers(http_client_handle_t client)
     return client->response->content_length;
 }
 
+/* a transport which isn't in the list, the client owns it until it's given to the pool */
+static transport_handle_t http_client_new_transport(http_client_handle_t client)
+{
+    transport_handle_t t = NULL;
+
+    if (strcasecmp(client->connection_info.scheme, "http") == 0) {
+        t = transport_tcp_init();
+    }
+#ifdef CONFIG_USING_TLS
+    else if (strcasecmp(client->connection_info.scheme, "https") == 0 && (t = transport_ssl_init()) != NULL) {
+        if (client->use_global_ca_store == true) {
+            transport_ssl_enable_global_ca_store(t);
+        } else if (client->cert_pem) {
+            transport_ssl_set_cert_data(t, client->cert_pem, strlen(client->cert_pem));
+        }
+        if (client->client_cert_pem) {
+            transport_ssl_set_client_cert_data(t, client->client_cert_pem, strlen(client->client_cert_pem));
+        }
+        if (client->client_key_pem) {
+            transport_ssl_set_client_key_data(t, client->client_key_pem, strlen(client->client_key_pem));
+        }
+    }
+#endif
+    return t;
+}
+
+static web_err_t http_client_pool_connect(http_client_handle_t client)
+{
+    connection_info_t *info = &client->connection_info;
+
+    http_utils_assign_string(&client->conn_scheme, info->scheme, 0);
+    http_utils_assign_string(&client->conn_host, info->host, 0);
+    HTTP_MEM_CHECK(TAG, client->conn_scheme && client->conn_host, return WEB_ERR_NO_MEM);
+    client->conn_port = info->port;
+
+    client->transport = http_pool_take(info->scheme, info->host, info->port, client->pool_tag);
+    client->pool_borrowed = client->transport != NULL;
+    if (client->transport == NULL) {
+        client->transport = http_client_new_transport(client);
+        if (client->transport == NULL) {
+            LOGE(TAG, "No transport found");
+            return ERR_HTTP_INVALID_TRANSPORT;
+        }
+        if (transport_connect(client->transport, info->host, info->port, client->timeout_ms) < 0) {
+            LOGE(TAG, "Connection failed, sock < 0");
+            transport_free(client->transport);
+            client->transport = NULL;
+            return ERR_HTTP_CONNECT;
+        }
+    }
+    client->keep_alive = true;
+    client->state = HTTP_STATE_CONNECTED;
+    http_dispatch_event(client, HTTP_EVENT_ON_CONNECTED, NULL, 0);
+    return WEB_OK;
+}
+
+/* give the connection back to the pool if nothing is left on it, otherwise close it */
+static web_err_t http_client_pool_release(http_client_handle_t client, bool connected)
+{
+    transport_handle_t t = client->transport;
+
+    client->transport = NULL;
+    client->pool_borrowed = false;
+    if (t == NULL) {
+        return WEB_OK;
+    }
+    if (connected && client->keep_alive) {
+        http_pool_give(client->conn_scheme, client->conn_host, client->conn_port, client->pool_tag, t);
+        return WEB_OK;
+    }
+    return transport_free(t);
+}
+
+/* the server closed the borrowed connection before answering, send the request again on another one */
+static web_err_t http_client_pool_retry(http_client_handle_t client)
+{
+    web_err_t err;
+
+    if (client->post_len > 0 && client->post_data == NULL) {
+        // the body was written by the caller
+        return WEB_FAIL;
+    }
+    LOGD(TAG, "Borrowed connection is closed, send the request again");
+    http_client_close(client);
+    if ((err = http_client_connect(client)) != WEB_OK ||
+        (err = http_client_request_send(client, client->post_len)) != WEB_OK ||
+        (err = http_client_send_post_data(client)) != WEB_OK) {
+        return err;
+    }
+    return WEB_OK;
+}
+
 static web_err_t http_client_connect(http_client_handle_t client)
 {
     web_err_t err;
@@ -1045,6 +1210,9 @@ static web_err_t http_client_connect(http_client_handle_t client)
 
     if (client->state < HTTP_STATE_CONNECTED) {
         LOGD(TAG, "Begin connect to: %s://%s:%d", client->connection_info.scheme, client->connection_info.host, client->connection_info.port);
+        if (client->use_pool) {
+            return http_client_pool_connect(client);
+        }
         client->transport = transport_list_get_transport(client->transport_list, client->connection_info.scheme);
         if (client->transport == NULL) {
             LOGE(TAG, "No transport found");
@@ -1121,6 +1289,7 @@ static int http_client_prepare_first_line(http_client_handle_t client, int write
 static web_err_t http_client_request_send(http_client_handle_t client, int write_len)
 {
     int first_line_len = 0;
+    client->keep_alive = false;
     if (!client->first_line_prepared) {
         if ((first_line_len = http_client_prepare_first_line(client, write_len)) < 0) {
             return first_line_len;
@@ -1244,8 +1413,13 @@ int http_client_write(http_client_handle_t client, const char *buffer, int len)
 web_err_t http_client_close(http_client_handle_t client)
 {
     if (client->state >= HTTP_STATE_INIT) {
+        bool connected = client->state >= HTTP_STATE_CONNECTED;
+
         http_dispatch_event(client, HTTP_EVENT_DISCONNECTED, NULL, 0);
         client->state = HTTP_STATE_INIT;
+        if (client->use_pool) {
+            return http_client_pool_release(client, connected);
+        }
         return transport_close(client->transport);
     }
     return WEB_OK;
@@ -1286,7 +1460,7 @@ int http_client_get_status_code(http_client_handle_t client)
     return client->response->status_code;
 }
 
-int http_client_get_content_length(http_client_handle_t client)
+int64_t http_client_get_content_length(http_client_handle_t client)
 {
     return client->response->content_length;
 }
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <aos/kernel.h>
+#include "http_pool.h"
+#include "ulog/ulog.h"
+
+static const char *TAG = "HTTP_POOL";
+
+typedef struct {
+    transport_handle_t  transport;      /*!< The idle connection, NULL if the slot is free */
+    char                *scheme;
+    char                *host;
+    int                 port;
+    uint32_t            tag;            /*!< The hash of the TLS configuration */
+    long long           idle_ms;        /*!< When it was given back */
+} http_pool_conn_t;
+
+static http_pool_conn_t g_pool_conns[CONFIG_HTTP_POOL_SIZE];
+static aos_mutex_t g_pool_lock;
+
+/* created at load time, before any thread can take or give back a connection */
+__attribute__((constructor)) static void http_pool_init(void)
+{
+    aos_mutex_new(&g_pool_lock);
+}
+
+static void http_pool_lock(void)
+{
+    aos_mutex_lock(&g_pool_lock, AOS_WAIT_FOREVER);
+}
+
+static void http_pool_unlock(void)
+{
+    aos_mutex_unlock(&g_pool_lock);
+}
+
+/* detach the connection of the slot, return it to be freed outside of the lock */
+static transport_handle_t http_pool_detach(http_pool_conn_t *conn)
+{
+    transport_handle_t t = conn->transport;
+
+    free(conn->scheme);
+    free(conn->host);
+    memset(conn, 0, sizeof(http_pool_conn_t));
+    return t;
+}
+
+static bool http_pool_match(const http_pool_conn_t *conn, const char *scheme, const char *host, int port, uint32_t tag)
+{
+    return conn->transport && conn->port == port && conn->tag == tag &&
+           strcasecmp(conn->scheme, scheme) == 0 && strcasecmp(conn->host, host) == 0;
+}
+
+transport_handle_t http_pool_take(const char *scheme, const char *host, int port, uint32_t tag)
+{
+    transport_handle_t stale[CONFIG_HTTP_POOL_SIZE];
+    transport_handle_t t = NULL;
+    long long now = aos_now_ms();
+    int count = 0;
+
+    if (scheme == NULL || host == NULL) {
+        return NULL;
+    }
+    http_pool_lock();
+    for (int i = 0; i < CONFIG_HTTP_POOL_SIZE; i++) {
+        http_pool_conn_t *conn = &g_pool_conns[i];
+
+        if (conn->transport == NULL) {
+            continue;
+        }
+        if (now - conn->idle_ms > CONFIG_HTTP_POOL_IDLE_MS) {
+            stale[count++] = http_pool_detach(conn);
+        } else if (t == NULL && http_pool_match(conn, scheme, host, port, tag)) {
+            // an idle connection has nothing to read, unless the server closed it
+            if (transport_poll_read(conn->transport, 0) != 0) {
+                LOGD(TAG, "Drop the connection closed by %s:%d", host, port);
+                stale[count++] = http_pool_detach(conn);
+            } else {
+                t = http_pool_detach(conn);
+            }
+        }
+    }
+    http_pool_unlock();
+
+    for (int i = 0; i < count; i++) {
+        transport_free(stale[i]);
+    }
+    if (t) {
+        LOGD(TAG, "Reuse the connection to %s://%s:%d", scheme, host, port);
+    }
+    return t;
+}
+
+void http_pool_give(const char *scheme, const char *host, int port, uint32_t tag, transport_handle_t t)
+{
+    transport_handle_t stale[CONFIG_HTTP_POOL_SIZE];
+    http_pool_conn_t *slot = NULL;
+    long long now = aos_now_ms();
+    int count = 0;
+
+    if (t == NULL) {
+        return;
+    }
+    if (scheme == NULL || host == NULL) {
+        transport_free(t);
+        return;
+    }
+    http_pool_lock();
+    for (int i = 0; i < CONFIG_HTTP_POOL_SIZE; i++) {
+        http_pool_conn_t *conn = &g_pool_conns[i];
+
+        if (conn->transport && now - conn->idle_ms > CONFIG_HTTP_POOL_IDLE_MS) {
+            stale[count++] = http_pool_detach(conn);
+        }
+        if (conn->transport == NULL) {
+            if (slot == NULL || slot->transport) {
+                slot = conn;
+            }
+        } else if (slot == NULL || (slot->transport && conn->idle_ms < slot->idle_ms)) {
+            // full so far, the oldest one makes room
+            slot = conn;
+        }
+    }
+    if (slot->transport) {
+        LOGD(TAG, "Pool is full, close the connection to %s:%d", slot->host, slot->port);
+        stale[count++] = http_pool_detach(slot);
+    }
+    slot->scheme = strdup(scheme);
+    slot->host = strdup(host);
+    if (slot->scheme && slot->host) {
+        slot->transport = t;
+        slot->port = port;
+        slot->tag = tag;
+        slot->idle_ms = now;
+        t = NULL;
+    } else {
+        http_pool_detach(slot);
+    }
+    http_pool_unlock();
+
+    if (t) {
+        transport_free(t);
+    }
+    for (int i = 0; i < count; i++) {
+        transport_free(stale[i]);
+    }
+}
+
+void http_pool_flush(void)
+{
+    transport_handle_t stale[CONFIG_HTTP_POOL_SIZE];
+    int count = 0;
+
+    http_pool_lock();
+    for (int i = 0; i < CONFIG_HTTP_POOL_SIZE; i++) {
+        if (g_pool_conns[i].transport) {
+            stale[count++] = http_pool_detach(&g_pool_conns[i]);
+        }
+    }
+    http_pool_unlock();
+
+    for (int i = 0; i < count; i++) {
+        transport_free(stale[i]);
+    }
+}
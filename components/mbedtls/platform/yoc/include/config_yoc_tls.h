@@ -106,6 +106,9 @@
 
 #define MBEDTLS_SSL_SERVER_NAME_INDICATION
 
+/* the client resumes the sessions with the tickets from the servers */
+#define MBEDTLS_SSL_SESSION_TICKETS
+
 /* Save RAM at the expense of ROM */
 // #define MBEDTLS_AES_ROM_TABLES
 
@@ -9,6 +9,8 @@
     #include "config_yoc_alimqtt.h"
 #elif defined(CONFIG_USING_HTTP2)
     #include "config_yoc_http2.h"
+#elif defined(CONFIG_USING_TLS) && defined(CONFIG_TLS_BULK_PROFILE)
+    #include "config_yoc_tls_bulk.h"
 #elif defined(CONFIG_USING_TLS)
     #include "config_yoc_tls.h"
 #else
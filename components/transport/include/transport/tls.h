@@ -93,22 +93,20 @@ typedef struct tls_cfg {
 typedef struct tls {
     mbedtls_ssl_context ssl;                                                    /*!< TLS/SSL context */
 
-    mbedtls_entropy_context entropy;                                            /*!< mbedTLS entropy context structure */
-
-    mbedtls_ctr_drbg_context ctr_drbg;                                          /*!< mbedTLS ctr drbg context structure.
-                                                                                     CTR_DRBG is deterministic random
-                                                                                     bit generation based on AES-256 */
-
     mbedtls_ssl_config conf;                                                    /*!< TLS/SSL configuration to be shared
                                                                                      between mbedtls_ssl_context
                                                                                      structures */
 
     mbedtls_net_context server_fd;                                              /*!< mbedTLS wrapper type for sockets */
 
-    mbedtls_x509_crt cacert;                                                    /*!< Container for the X.509 CA certificate */
-
     mbedtls_x509_crt *cacert_ptr;                                               /*!< Pointer to the cacert being used. */
 
+    struct tls_ca *ca;                                                          /*!< The shared CA chain cacert_ptr points to,
+                                                                                     NULL for the global CA store */
+
+    unsigned char trust[32];                                                    /*!< Digest of the CA and the client certificate,
+                                                                                     a cached session is only resumed with the same */
+
     mbedtls_x509_crt clientcert;                                                /*!< Container for the X.509 client certificate */
 
     mbedtls_pk_context clientkey;                                               /*!< Container for the private key of the client
@@ -131,6 +129,20 @@ typedef struct tls {
     bool is_tls;                                                                /*!< indicates connection type (TLS or NON-TLS) */
 } tls_t;
 
+/**
+ * @brief      TLS statistics of the process
+ *
+ * The connections share one seeded DRBG and the parsed CA chains, and the session of the last
+ * handshake with each host:port is offered again, so a reconnect may skip the full handshake.
+ */
+typedef struct tls_stats {
+    uint32_t handshakes;                    /*!< Handshakes done */
+    uint32_t resumed;                       /*!< Handshakes which resumed a cached session,
+                                                 resumed / handshakes is the hit rate */
+    uint32_t failed;                        /*!< Handshakes failed */
+    uint32_t ca_parsed;                     /*!< CA chains parsed, the other connections shared them */
+} tls_stats_t;
+
 /**
  * @brief      Create a new blocking TLS/SSL connection
  *
@@ -289,6 +301,18 @@ mbedtls_x509_crt *tls_get_global_ca_store();
  */
 void tls_free_global_ca_store();
 
+/**
+ * @brief      Get the TLS statistics of the process
+ * @param[out] stats  The statistics, see tls_stats_t
+ */
+void tls_get_stats(tls_stats_t *stats);
+
+/**
+ * @brief      Forget the cached sessions and the CA chains which no connection uses,
+ *             e.g. when the server certificates are changed.
+ */
+void tls_flush_cache(void);
+
 
 #ifdef __cplusplus
 }
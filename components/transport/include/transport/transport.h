@@ -104,6 +104,18 @@ transport_handle_t transport_init();
  */
 web_err_t transport_destroy(transport_handle_t t);
 
+/**
+ * @brief      Close the transport, destroy its context and free it,
+ *             for a transport which hasn't been added to a list
+ *
+ * @param[in]  t     The transport handle
+ *
+ * @return
+ *     - WEB_OK
+ *     - WEB_ERR_INVALID_ARG
+ */
+web_err_t transport_free(transport_handle_t t);
+
 /**
  * @brief      Get default port number used by this transport
  *
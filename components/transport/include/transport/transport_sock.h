@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+#ifndef _TRANSPORT_SOCK_H_
+#define _TRANSPORT_SOCK_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A connected non-blocking TCP socket. The I/O is tried first and the socket is waited only when
+ * it would block, by epoll on Linux and by select elsewhere. The timeouts are deadlines on the
+ * monotonic clock, EINTR restarts the wait with the time left.
+ */
+typedef struct {
+    int         fd;             /*!< The non-blocking socket, -1 if it's closed */
+    int         efd;            /*!< The epoll instance waiting for fd, -1 if select is used */
+    uint32_t    events;         /*!< The events efd is armed with */
+} transport_sock_t;
+
+#define TRANSPORT_SOCK_READ     0x1     /*!< wait until the socket is readable */
+#define TRANSPORT_SOCK_WRITE    0x2     /*!< wait until the socket is writable */
+
+/**
+ * @brief      Initialize the socket as closed
+ *
+ * @param[in]  sock  The socket
+ */
+void transport_sock_init(transport_sock_t *sock);
+
+/**
+ * @brief      Create a non-blocking socket and connect it within the timeout
+ *
+ * @param[in]  sock        The socket, closed
+ * @param[in]  addr        The address of the server
+ * @param[in]  addrlen     The length of addr
+ * @param[in]  timeout_ms  The timeout milliseconds, < 0: forever
+ *
+ * @return
+ *     - 0 connected
+ *     - -1 if it fails or times out, the socket is closed
+ */
+int transport_sock_connect(transport_sock_t *sock, const struct sockaddr *addr, socklen_t addrlen, int timeout_ms);
+
+/**
+ * @brief      Wait until the socket is readable or writable
+ *
+ * @param[in]  sock        The socket
+ * @param[in]  events      TRANSPORT_SOCK_READ and/or TRANSPORT_SOCK_WRITE
+ * @param[in]  timeout_ms  The timeout milliseconds, 0: only check, < 0: forever
+ *
+ * @return
+ *     - 1 ready, or closed by the peer
+ *     - 0 timeout
+ *     - -1 if the socket has an error, errno is set to it
+ */
+int transport_sock_wait(transport_sock_t *sock, int events, int timeout_ms);
+
+/**
+ * @brief      Receive from the socket
+ *
+ * @param[in]  sock        The socket
+ * @param[out] buf         The buffer
+ * @param[in]  len         The length of buf
+ * @param[in]  flags       MSG_PEEK: keep the data in the socket,
+ *                         MSG_WAITALL: fill buf until the peer closes or it times out
+ * @param[in]  timeout_ms  The timeout milliseconds, < 0: forever
+ *
+ * @return
+ *     - without MSG_WAITALL: the length received, 0 if the peer closed, -1 on error or timeout (errno ETIMEDOUT)
+ *     - with MSG_WAITALL: the length received, -1 on error
+ */
+int transport_sock_recv(transport_sock_t *sock, void *buf, int len, int flags, int timeout_ms);
+
+/**
+ * @brief      Send all of the data within the timeout
+ *
+ * @param[in]  sock        The socket
+ * @param[in]  buf         The data
+ * @param[in]  len         The length of data
+ * @param[in]  timeout_ms  The timeout milliseconds, < 0: forever
+ *
+ * @return
+ *     - the length sent, less than len if it times out
+ *     - -1 on error, or if nothing is sent before the timeout
+ */
+int transport_sock_send(transport_sock_t *sock, const void *buf, int len, int timeout_ms);
+
+/**
+ * @brief      Close the socket
+ *
+ * @param[in]  sock  The socket
+ *
+ * @return     The result of close, -1 if it's closed already
+ */
+int transport_sock_close(transport_sock_t *sock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRANSPORT_SOCK_H_ */
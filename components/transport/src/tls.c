@@ -21,6 +21,7 @@
 #include <arpa/inet.h>
 #include <aos/errno.h>
 #include "mbedtls/error.h"
+#include "mbedtls/sha256.h"
 
 #if defined(MBEDTLS_DEBUG_C)
 #include "mbedtls/debug.h"
@@ -29,6 +30,43 @@
 static const char *TAG = "tls";
 static mbedtls_x509_crt *global_cacert = NULL;
 
+#ifndef CONFIG_TLS_SESSION_CACHE_SIZE
+#define CONFIG_TLS_SESSION_CACHE_SIZE 4     /* the origins whose sessions are kept for resumption */
+#endif
+
+#ifndef CONFIG_TLS_CA_CACHE_SIZE
+#define CONFIG_TLS_CA_CACHE_SIZE 2          /* the CA chains kept parsed while no connection uses them */
+#endif
+
+/* a CA chain parsed once, shared by the connections with the same PEM */
+struct tls_ca {
+    unsigned char digest[32];       /* sha256 of the PEM */
+    int refs;
+    mbedtls_x509_crt crt;
+    struct tls_ca *next;
+};
+
+typedef struct {
+    char *host;                     /* NULL: free */
+    int port;
+    unsigned char trust[32];        /* the CA and the client cert the session was established with */
+    unsigned int used;
+    mbedtls_ssl_session session;
+} tls_session_t;
+
+/* shared by all of the connections of the process */
+static struct {
+    aos_mutex_t lock;               /* the caches and the statistics */
+    aos_mutex_t rng_lock;
+    bool rng_ready;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    struct tls_ca *cas;
+    tls_session_t sessions[CONFIG_TLS_SESSION_CACHE_SIZE];
+    unsigned int clock;
+    tls_stats_t stats;
+} g_tls;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 static void _ssl_debug(void *ctx, int level, const char *file, int line, const char *str)
 {
@@ -97,6 +135,256 @@ static void ms_to_timeval(int timeout_ms, struct timeval *tv)
     tv->tv_usec = (timeout_ms % 1000) * 1000;
 }
 
+/* created at load time, before any thread can open a connection */
+__attribute__((constructor)) static void tls_shared_init(void)
+{
+    aos_mutex_new(&g_tls.lock);
+    aos_mutex_new(&g_tls.rng_lock);
+}
+
+static void tls_shared_lock(void)
+{
+    aos_mutex_lock(&g_tls.lock, AOS_WAIT_FOREVER);
+}
+
+static void tls_shared_unlock(void)
+{
+    aos_mutex_unlock(&g_tls.lock);
+}
+
+/* the DRBG is seeded once, every connection draws from it */
+static int tls_shared_random(void *p_rng, unsigned char *output, size_t output_len)
+{
+    int ret;
+
+    aos_mutex_lock(&g_tls.rng_lock, AOS_WAIT_FOREVER);
+    ret = mbedtls_ctr_drbg_random(&g_tls.ctr_drbg, output, output_len);
+    aos_mutex_unlock(&g_tls.rng_lock);
+    return ret;
+}
+
+static int tls_shared_rng_init(void)
+{
+    const char *pers = "https";
+    int ret = 0;
+
+    tls_shared_lock();
+    if (!g_tls.rng_ready) {
+        mbedtls_entropy_init(&g_tls.entropy);
+        mbedtls_ctr_drbg_init(&g_tls.ctr_drbg);
+        ret = mbedtls_ctr_drbg_seed(&g_tls.ctr_drbg, mbedtls_entropy_func, &g_tls.entropy,
+                                    (const unsigned char *)pers, strlen(pers));
+        if (ret != 0) {
+            LOGE(TAG, "mbedtls_ctr_drbg_seed() failed, value:-0x%x.", -ret);
+            mbedtls_ctr_drbg_free(&g_tls.ctr_drbg);
+            mbedtls_entropy_free(&g_tls.entropy);
+        } else {
+            g_tls.rng_ready = true;
+        }
+    }
+    tls_shared_unlock();
+    return ret;
+}
+
+static mbedtls_x509_crt *tls_ca_get(const unsigned char *pem, size_t bytes, struct tls_ca **out)
+{
+    unsigned char digest[32];
+    struct tls_ca *ca, **pp;
+    int count = 0, ret;
+
+    mbedtls_sha256_ret(pem, bytes, digest, 0);
+    tls_shared_lock();
+    for (ca = g_tls.cas; ca; ca = ca->next) {
+        if (memcmp(ca->digest, digest, sizeof(digest)) == 0) {
+            ca->refs++;
+            goto out;
+        }
+        count++;
+    }
+    // make room by dropping the chains no connection uses
+    for (pp = &g_tls.cas; count >= CONFIG_TLS_CA_CACHE_SIZE && *pp;) {
+        ca = *pp;
+        if (ca->refs == 0) {
+            *pp = ca->next;
+            mbedtls_x509_crt_free(&ca->crt);
+            free(ca);
+            count--;
+        } else {
+            pp = &ca->next;
+        }
+    }
+    ca = calloc(1, sizeof(struct tls_ca));
+    if (ca == NULL) {
+        goto out;
+    }
+    mbedtls_x509_crt_init(&ca->crt);
+    ret = mbedtls_x509_crt_parse(&ca->crt, pem, bytes);
+    if (ret < 0) {
+        LOGE(TAG, "mbedtls_x509_crt_ parse returned -0x%x\n\n", -ret);
+        mbedtls_x509_crt_free(&ca->crt);
+        free(ca);
+        ca = NULL;
+        goto out;
+    }
+    memcpy(ca->digest, digest, sizeof(digest));
+    ca->refs = 1;
+    ca->next = g_tls.cas;
+    g_tls.cas = ca;
+    g_tls.stats.ca_parsed++;
+out:
+    tls_shared_unlock();
+    *out = ca;
+    return ca ? &ca->crt : NULL;
+}
+
+static void tls_ca_put(struct tls_ca *ca)
+{
+    tls_shared_lock();
+    ca->refs--;
+    tls_shared_unlock();
+}
+
+/* a session is only resumed with the trust settings it was verified with */
+static void tls_trust_digest(const tls_cfg_t *cfg, unsigned char digest[32])
+{
+    mbedtls_sha256_context ctx;
+    unsigned char mode = cfg->use_global_ca_store ? 2 : (cfg->cacert_pem_buf ? 1 : 0);
+
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    mbedtls_sha256_update_ret(&ctx, &mode, 1);
+    if (mode == 1) {
+        mbedtls_sha256_update_ret(&ctx, cfg->cacert_pem_buf, cfg->cacert_pem_bytes);
+    }
+    if (cfg->clientcert_pem_buf) {
+        mbedtls_sha256_update_ret(&ctx, cfg->clientcert_pem_buf, cfg->clientcert_pem_bytes);
+    }
+    mbedtls_sha256_finish_ret(&ctx, digest);
+    mbedtls_sha256_free(&ctx);
+}
+
+static tls_session_t *tls_session_find(const char *host, int port, const unsigned char trust[32])
+{
+    for (int i = 0; i < CONFIG_TLS_SESSION_CACHE_SIZE; i++) {
+        tls_session_t *entry = &g_tls.sessions[i];
+
+        if (entry->host && entry->port == port && strcasecmp(entry->host, host) == 0 &&
+            memcmp(entry->trust, trust, sizeof(entry->trust)) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void tls_session_free(tls_session_t *entry)
+{
+    free(entry->host);
+    mbedtls_ssl_session_free(&entry->session);
+    memset(entry, 0, sizeof(tls_session_t));
+}
+
+/* offer the session of the last handshake with the host, the server may resume it */
+static void tls_session_load(tls_t *tls, const char *host, int port, const unsigned char trust[32])
+{
+    tls_session_t *entry;
+
+    tls_shared_lock();
+    entry = tls_session_find(host, port, trust);
+    if (entry) {
+        entry->used = ++g_tls.clock;
+        if (mbedtls_ssl_set_session(&tls->ssl, &entry->session) != 0) {
+            tls_session_free(entry);
+        }
+    }
+    tls_shared_unlock();
+}
+
+/* keep the session of the handshake, return true if it resumed the cached one */
+static bool tls_session_save(tls_t *tls, const char *host, int port, const unsigned char trust[32])
+{
+    mbedtls_ssl_session session;
+    tls_session_t *entry;
+    bool resumed = false;
+
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_get_session(&tls->ssl, &session) != 0) {
+        mbedtls_ssl_session_free(&session);
+        return false;
+    }
+    tls_shared_lock();
+    entry = tls_session_find(host, port, trust);
+    if (entry) {
+        // a new handshake makes a new master secret
+        resumed = memcmp(entry->session.master, session.master, sizeof(session.master)) == 0;
+    } else {
+        entry = &g_tls.sessions[0];
+        for (int i = 1; i < CONFIG_TLS_SESSION_CACHE_SIZE && entry->host; i++) {
+            if (g_tls.sessions[i].host == NULL || g_tls.sessions[i].used < entry->used) {
+                entry = &g_tls.sessions[i];
+            }
+        }
+        tls_session_free(entry);
+        entry->host = strdup(host);
+        entry->port = port;
+        memcpy(entry->trust, trust, sizeof(entry->trust));
+    }
+    if (entry->host) {
+        mbedtls_ssl_session_free(&entry->session);
+        entry->session = session;
+        entry->used = ++g_tls.clock;
+    } else {
+        mbedtls_ssl_session_free(&session);
+    }
+    g_tls.stats.handshakes++;
+    if (resumed) {
+        g_tls.stats.resumed++;
+    }
+    tls_shared_unlock();
+    return resumed;
+}
+
+/* the server refused the handshake, don't offer the session again */
+static void tls_session_drop(const char *host, int port, const unsigned char trust[32])
+{
+    tls_session_t *entry;
+
+    tls_shared_lock();
+    entry = tls_session_find(host, port, trust);
+    if (entry) {
+        tls_session_free(entry);
+    }
+    g_tls.stats.failed++;
+    tls_shared_unlock();
+}
+
+void tls_get_stats(tls_stats_t *stats)
+{
+    tls_shared_lock();
+    *stats = g_tls.stats;
+    tls_shared_unlock();
+}
+
+void tls_flush_cache(void)
+{
+    struct tls_ca *ca, **pp;
+
+    tls_shared_lock();
+    for (int i = 0; i < CONFIG_TLS_SESSION_CACHE_SIZE; i++) {
+        tls_session_free(&g_tls.sessions[i]);
+    }
+    for (pp = &g_tls.cas; *pp;) {
+        ca = *pp;
+        if (ca->refs == 0) {
+            *pp = ca->next;
+            mbedtls_x509_crt_free(&ca->crt);
+            free(ca);
+        } else {
+            pp = &ca->next;
+        }
+    }
+    tls_shared_unlock();
+}
+
 web_err_t tls_init_global_ca_store()
 {
     if (global_cacert == NULL) {
@@ -123,6 +411,8 @@ web_err_t tls_set_global_ca_store(const unsigned char *cacert_pem_buf, const uns
             return ret;
         }
     }
+    // the sessions verified with the old store
+    tls_flush_cache();
     ret = mbedtls_x509_crt_parse(global_cacert, cacert_pem_buf, cacert_pem_bytes);
     if (ret < 0) {
         LOGE(TAG, "mbedtls_x509_crt_ parse returned -0x%x\n\n", -ret);
@@ -143,6 +433,7 @@ mbedtls_x509_crt *tls_get_global_ca_store()
 void tls_free_global_ca_store()
 {
     if (global_cacert) {
+        tls_flush_cache();
         mbedtls_x509_crt_free(global_cacert);
         global_cacert = NULL;
     }
@@ -171,23 +462,20 @@ static void mbedtls_cleanup(tls_t *tls)
         return;
     }
     mbedtls_ssl_close_notify(&tls->ssl);
-    if (tls->cacert_ptr != global_cacert) {
-        mbedtls_x509_crt_free(tls->cacert_ptr);
+    if (tls->ca) {
+        tls_ca_put(tls->ca);
+        tls->ca = NULL;
     }
     tls->cacert_ptr = NULL;
-    mbedtls_x509_crt_free(&tls->cacert);
     mbedtls_x509_crt_free(&tls->clientcert);
     mbedtls_pk_free(&tls->clientkey);
-    mbedtls_entropy_free(&tls->entropy);
     mbedtls_ssl_config_free(&tls->conf);
-    mbedtls_ctr_drbg_free(&tls->ctr_drbg);
     mbedtls_ssl_free(&tls->ssl);
 }
 
-static int create_ssl_handle(tls_t *tls, const char *hostname, size_t hostlen, const tls_cfg_t *cfg)
+static int create_ssl_handle(tls_t *tls, const char *hostname, size_t hostlen, int port, const tls_cfg_t *cfg)
 {
-    int ret, value;
-    const char *pers = "https";
+    int ret;
 
 #if defined(MBEDTLS_DEBUG_C)
     mbedtls_debug_set_threshold(5);
@@ -195,16 +483,8 @@ static int create_ssl_handle(tls_t *tls, const char *hostname, size_t hostlen, c
 
     tls->server_fd.fd = tls->sockfd;
     mbedtls_ssl_init(&tls->ssl);
-    mbedtls_ctr_drbg_init(&tls->ctr_drbg);
     mbedtls_ssl_config_init(&tls->conf);
-    mbedtls_entropy_init(&tls->entropy);
-    if ((value = mbedtls_ctr_drbg_seed(&tls->ctr_drbg,
-                               mbedtls_entropy_func,
-                               &tls->entropy,
-                               (const unsigned char*)pers,
-                               strlen(pers))) != 0) {
-        LOGE(TAG, "mbedtls_ctr_drbg_seed() failed, value:-0x%x.", -value);
-        ret = -1;
+    if (tls_shared_rng_init() != 0) {
         goto exit;
     }
 
@@ -248,11 +528,8 @@ static int create_ssl_handle(tls_t *tls, const char *hostname, size_t hostlen, c
         mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
         mbedtls_ssl_conf_ca_chain(&tls->conf, tls->cacert_ptr, NULL);
     } else if (cfg->cacert_pem_buf != NULL) {
-        tls->cacert_ptr = &tls->cacert;
-        mbedtls_x509_crt_init(tls->cacert_ptr);
-        ret = mbedtls_x509_crt_parse(tls->cacert_ptr, cfg->cacert_pem_buf, cfg->cacert_pem_bytes);
-        if (ret < 0) {
-            LOGE(TAG, "mbedtls_x509_crt_ parse returned -0x%x\n\n", -ret);
+        tls->cacert_ptr = tls_ca_get(cfg->cacert_pem_buf, cfg->cacert_pem_bytes, &tls->ca);
+        if (tls->cacert_ptr == NULL) {
             goto exit;
         }
         mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
@@ -288,7 +565,7 @@ static int create_ssl_handle(tls_t *tls, const char *hostname, size_t hostlen, c
         goto exit;
     }
 
-    mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+    mbedtls_ssl_conf_rng(&tls->conf, tls_shared_random, NULL);
     mbedtls_ssl_conf_dbg(&tls->conf, _ssl_debug, NULL);
 #ifdef CONFIG_MBEDTLS_DEBUG
     mbedtls_enable_debug_log(&tls->conf, 4);
@@ -299,6 +576,8 @@ static int create_ssl_handle(tls_t *tls, const char *hostname, size_t hostlen, c
         goto exit;
     }
     mbedtls_ssl_set_bio(&tls->ssl, &tls->server_fd, mbedtls_net_send, mbedtls_net_recv, mbedtls_net_recv_timeout);
+    tls_trust_digest(cfg, tls->trust);
+    tls_session_load(tls, tls->ssl.hostname, port, tls->trust);
 
     return 0;
 exit:
@@ -419,7 +698,7 @@ static int tls_low_level_conn(const char *hostname, int hostlen, int port, const
                 }
             }
             /* By now, the connection has been established */
-            ret = create_ssl_handle(tls, hostname, hostlen, cfg);
+            ret = create_ssl_handle(tls, hostname, hostlen, port, cfg);
             if (ret != 0) {
                 LOGD(TAG, "create_ssl_handshake failed");
                 tls->conn_state = TLS_FAIL;
@@ -433,11 +712,15 @@ static int tls_low_level_conn(const char *hostname, int hostlen, int port, const
             LOGD(TAG, "handshake in progress...");
             ret = mbedtls_ssl_handshake(&tls->ssl);
             if (ret == 0) {
+                bool resumed = tls_session_save(tls, tls->ssl.hostname, port, tls->trust);
+
+                LOGD(TAG, "handshake done, %s, resumed:%d", mbedtls_ssl_get_ciphersuite(&tls->ssl), resumed);
                 tls->conn_state = TLS_DONE;
                 return 1;
             } else {
                 if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
                     LOGE(TAG, "mbedtls_ssl_handshake returned -0x%x", -ret);
+                    tls_session_drop(tls->ssl.hostname, port, tls->trust);
                     if (cfg->cacert_pem_buf != NULL || cfg->use_global_ca_store == true) {
                         /* This is to check whether handshake failed due to invalid certificate*/
                         verify_certificate(tls);
@@ -143,6 +143,17 @@ web_err_t transport_destroy(transport_handle_t t)
     return WEB_OK;
 }
 
+web_err_t transport_free(transport_handle_t t)
+{
+    if (t == NULL) {
+        return WEB_ERR_INVALID_ARG;
+    }
+    if (t->_destroy) {
+        t->_destroy(t);
+    }
+    return transport_destroy(t);
+}
+
 int transport_connect(transport_handle_t t, const char *host, int port, int timeout_ms)
 {
     int ret = -1;
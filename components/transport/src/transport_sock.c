@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/select.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <aos/kernel.h>
+#endif
+#include "ulog/ulog.h"
+#include "transport/transport_sock.h"
+
+static const char *TAG = "TRANS_SOCK";
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static long long sock_now_ms(void)
+{
+#ifdef __linux__
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+#else
+    return aos_now_ms();
+#endif
+}
+
+static long long sock_deadline(int timeout_ms)
+{
+    return timeout_ms < 0 ? -1 : sock_now_ms() + timeout_ms;
+}
+
+static int sock_time_left(long long deadline)
+{
+    long long left;
+
+    if (deadline < 0) {
+        return -1;
+    }
+    left = deadline - sock_now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+/* the pending error of the socket, to errno */
+static int sock_error(transport_sock_t *sock)
+{
+    int sock_errno = 0;
+    socklen_t optlen = sizeof(sock_errno);
+
+    if (getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &sock_errno, &optlen) == 0 && sock_errno) {
+        errno = sock_errno;
+    }
+    return -1;
+}
+
+static int sock_wait_until(transport_sock_t *sock, int events, long long deadline)
+{
+    int ret;
+
+    do {
+#ifdef __linux__
+        struct epoll_event ev;
+
+        if (sock->events != (uint32_t)events) {
+            // level triggered, only rearmed when the direction changes
+            ev.events = ((events & TRANSPORT_SOCK_READ) ? EPOLLIN : 0) | ((events & TRANSPORT_SOCK_WRITE) ? EPOLLOUT : 0);
+            ev.data.fd = sock->fd;
+            if (epoll_ctl(sock->efd, EPOLL_CTL_MOD, sock->fd, &ev) < 0) {
+                return -1;
+            }
+            sock->events = events;
+        }
+        ret = epoll_wait(sock->efd, &ev, 1, sock_time_left(deadline));
+        if (ret > 0 && (ev.events & EPOLLERR)) {
+            return sock_error(sock);
+        }
+#else
+        fd_set readset, writeset, errset;
+        struct timeval tv, *ptv = NULL;
+        int left = sock_time_left(deadline);
+
+        FD_ZERO(&readset);
+        FD_ZERO(&writeset);
+        FD_ZERO(&errset);
+        if (events & TRANSPORT_SOCK_READ) {
+            FD_SET(sock->fd, &readset);
+        }
+        if (events & TRANSPORT_SOCK_WRITE) {
+            FD_SET(sock->fd, &writeset);
+        }
+        FD_SET(sock->fd, &errset);
+        if (left >= 0) {
+            tv.tv_sec = left / 1000;
+            tv.tv_usec = (left % 1000) * 1000;
+            ptv = &tv;
+        }
+        ret = select(sock->fd + 1, &readset, &writeset, &errset, ptv);
+        if (ret > 0 && FD_ISSET(sock->fd, &errset)) {
+            return sock_error(sock);
+        }
+#endif
+    } while (ret < 0 && errno == EINTR);
+
+    return ret > 0 ? 1 : ret;
+}
+
+void transport_sock_init(transport_sock_t *sock)
+{
+    sock->fd = -1;
+    sock->efd = -1;
+    sock->events = 0;
+}
+
+int transport_sock_connect(transport_sock_t *sock, const struct sockaddr *addr, socklen_t addrlen, int timeout_ms)
+{
+    long long deadline = sock_deadline(timeout_ms);
+    socklen_t optlen = sizeof(int);
+    int sock_errno = 0;
+    int ret;
+
+    sock->fd = socket(addr->sa_family, SOCK_STREAM, 0);
+    if (sock->fd < 0) {
+        LOGE(TAG, "Error create socket");
+        return -1;
+    }
+    if (fcntl(sock->fd, F_SETFL, fcntl(sock->fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        goto error;
+    }
+
+#ifdef __linux__
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = sock->fd};
+
+    sock->efd = epoll_create1(EPOLL_CLOEXEC);
+    if (sock->efd < 0 || epoll_ctl(sock->efd, EPOLL_CTL_ADD, sock->fd, &ev) < 0) {
+        LOGE(TAG, "Error create epoll, errno=%d", errno);
+        goto error;
+    }
+    sock->events = TRANSPORT_SOCK_READ;
+#endif
+
+    if (connect(sock->fd, addr, addrlen) == 0) {
+        return 0;
+    }
+    if (errno != EINPROGRESS) {
+        goto error;
+    }
+    ret = sock_wait_until(sock, TRANSPORT_SOCK_WRITE, deadline);
+    if (ret == 0) {
+        errno = ETIMEDOUT;
+        goto error;
+    }
+    if (ret < 0) {
+        goto error;
+    }
+
+    // writable, the result of connect is in SO_ERROR
+    if (getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &sock_errno, &optlen) != 0) {
+        goto error;
+    }
+    if (sock_errno) {
+        errno = sock_errno;
+        goto error;
+    }
+    return 0;
+
+error:
+    LOGE(TAG, "[sock=%d] connect failed, errno=%d", sock->fd, errno);
+    transport_sock_close(sock);
+    return -1;
+}
+
+int transport_sock_wait(transport_sock_t *sock, int events, int timeout_ms)
+{
+    if (sock->fd < 0) {
+        return -1;
+    }
+    return sock_wait_until(sock, events, sock_deadline(timeout_ms));
+}
+
+int transport_sock_recv(transport_sock_t *sock, void *buf, int len, int flags, int timeout_ms)
+{
+    long long deadline = sock_deadline(timeout_ms);
+    int waitall = flags & MSG_WAITALL;
+    int total = 0;
+    int ret;
+
+    flags &= ~MSG_WAITALL;
+    while (total < len) {
+        ret = recv(sock->fd, (char *)buf + total, len - total, flags);
+        if (ret > 0) {
+            total += ret;
+            if (!waitall) {
+                break;
+            }
+            continue;
+        }
+        if (ret == 0) {
+            // closed by the peer
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        ret = sock_wait_until(sock, TRANSPORT_SOCK_READ, deadline);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            if (waitall) {
+                break;
+            }
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    return total;
+}
+
+int transport_sock_send(transport_sock_t *sock, const void *buf, int len, int timeout_ms)
+{
+    long long deadline = sock_deadline(timeout_ms);
+    int total = 0;
+    int ret;
+
+    while (total < len) {
+        ret = send(sock->fd, (const char *)buf + total, len - total, MSG_NOSIGNAL);
+        if (ret > 0) {
+            total += ret;
+            continue;
+        }
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        ret = sock_wait_until(sock, TRANSPORT_SOCK_WRITE, deadline);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            errno = ETIMEDOUT;
+            break;
+        }
+    }
+
+    return total > 0 || len == 0 ? total : -1;
+}
+
+int transport_sock_close(transport_sock_t *sock)
+{
+    int ret = -1;
+
+    if (sock->efd >= 0) {
+        close(sock->efd);
+    }
+    if (sock->fd >= 0) {
+        ret = close(sock->fd);
+    }
+    transport_sock_init(sock);
+    return ret;
+}
@@ -93,6 +93,10 @@ static int ssl_poll_read(transport_handle_t t, int timeout_ms)
     }
     transport_utils_ms_to_timeval(timeout_ms, &timeout);
     ret = select(ssl->tls->sockfd + 1, &readset, NULL, &errset, &timeout);
+    if (ret == 0 && timeout_ms == 0) {
+        // only checking, e.g. whether an idle connection is closed
+        return 0;
+    }
     if (ret == 0) {
         LOGE(TAG, "ssl_poll_read, select ret:%d, timeout", ret);
         return -1;
@@ -15,13 +15,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include "ulog/ulog.h"
-// #include <network.h>
+#include "transport/transport_sock.h"
 #include "transport/transport_utils.h"
 #include "transport/transport.h"
 #include "transport/tperrors.h"
@@ -29,7 +29,7 @@
 static const char *TAG = "TRANS_TCP";
 
 typedef struct {
-    int sock;
+    transport_sock_t sock;
 } transport_tcp_t;
 
 typedef uint32_t ip_addr_t;
@@ -54,7 +54,6 @@ static int resolve_dns(const char *host, struct sockaddr_in *ip) {
 static int tcp_connect(transport_handle_t t, const char *host, int port, int timeout_ms)
 {
     struct sockaddr_in remote_ip;
-    struct timeval tv;
     transport_tcp_t *tcp = transport_get_context_data(t);
 
     bzero(&remote_ip, sizeof(struct sockaddr_in));
@@ -66,136 +65,76 @@ static int tcp_connect(transport_handle_t t, const char *host, int port, int tim
         }
     }
 
-    tcp->sock = socket(PF_INET, SOCK_STREAM, 0);
-
-    if (tcp->sock < 0) {
-        LOGE(TAG, "Error create socket");
-        return -1;
-    }
-
     remote_ip.sin_family = AF_INET;
     remote_ip.sin_port = htons(port);
 
-    transport_utils_ms_to_timeval(timeout_ms, &tv);
-
-    if (setsockopt(tcp->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-        return -1;
-    }
-    if (setsockopt(tcp->sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) <0 ) {
-        return -1;
-    }
-
-    LOGD(TAG, "[sock=%d],connecting to server IP:%s,Port:%d...",
-             tcp->sock, inet_ntoa(remote_ip.sin_addr), port);
-    if (connect(tcp->sock, (struct sockaddr *)(&remote_ip), sizeof(struct sockaddr)) != 0) {
-        close(tcp->sock);
-        tcp->sock = -1;
+    LOGD(TAG, "connecting to server IP:%s,Port:%d...", inet_ntoa(remote_ip.sin_addr), port);
+    if (transport_sock_connect(&tcp->sock, (struct sockaddr *)(&remote_ip), sizeof(struct sockaddr), timeout_ms) != 0) {
         return -1;
     }
-    return tcp->sock;
+    return tcp->sock.fd;
 }
 
 static int tcp_write(transport_handle_t t, const char *buffer, int len, int timeout_ms)
 {
-    int poll;
     transport_tcp_t *tcp = (transport_tcp_t *)transport_get_context_data(t);
-    if ((poll = transport_poll_write(t, timeout_ms)) <= 0) {
-        return poll;
+    int ret = transport_sock_send(&tcp->sock, buffer, len, timeout_ms);
+
+    if (ret < 0 && errno == ETIMEDOUT) {
+        LOGE(TAG, "tcp_write timeout");
     }
-    // network_t *n = transport_get_n(t);
-    // return n->net_write(n, (unsigned char *)buffer, len, timeout_ms);
-    return write(tcp->sock, buffer, len);
+    return ret;
 }
 
 static int tcp_read(transport_handle_t t, char *buffer, int len, int timeout_ms)
 {
     transport_tcp_t *tcp = (transport_tcp_t *)transport_get_context_data(t);
-    int poll = -1;
-    if ((poll = transport_poll_read(t, timeout_ms)) <= 0) {
-        return poll;
+    // read first, the socket is waited only when it's empty
+    int read_len = transport_sock_recv(&tcp->sock, buffer, len, 0, timeout_ms);
+
+    if (read_len < 0 && errno == ETIMEDOUT) {
+        LOGE(TAG, "tcp_read timeout_ms:%d", timeout_ms);
     }
-    // network_t *n = transport_get_n(t);
-    // int read_len = n->net_read(n, (unsigned char *)buffer, len, timeout_ms);
-    int read_len = read(tcp->sock, buffer, len);
     if (read_len == 0) {
         return -1;
     }
     return read_len;
 }
 
-static int tcp_poll_read(transport_handle_t t, int timeout_ms)
+static int tcp_poll(transport_handle_t t, int events, int timeout_ms)
 {
     transport_tcp_t *tcp = transport_get_context_data(t);
-    int ret = -1;
-    fd_set readset;
-    fd_set errset;
-    FD_ZERO(&readset);
-    FD_ZERO(&errset);
-    FD_SET(tcp->sock, &readset);
-    FD_SET(tcp->sock, &errset);
-    struct timeval timeout;
-    transport_utils_ms_to_timeval(timeout_ms, &timeout);
-    ret = select(tcp->sock + 1, &readset, NULL, &errset, &timeout);
+    int ret = transport_sock_wait(&tcp->sock, events, timeout_ms);
+
+    if (ret == 0 && timeout_ms == 0) {
+        // only checking, e.g. whether an idle connection is closed
+        return 0;
+    }
     if (ret == 0) {
-        LOGE(TAG, "tcp_poll_read, select ret:%d, timeout_ms:%d", ret, timeout_ms);
+        LOGE(TAG, "tcp_poll %s timeout_ms:%d", events == TRANSPORT_SOCK_READ ? "read" : "write", timeout_ms);
         return -1;
     }
-    if (ret > 0 && FD_ISSET(tcp->sock, &errset)) {
-        int sock_errno = 0;
-        uint32_t optlen = sizeof(sock_errno);
-        ret = getsockopt(tcp->sock, SOL_SOCKET, SO_ERROR, &sock_errno, &optlen);
-        if (ret == 0) {
-            LOGE(TAG, "tcp_poll_read select error %d, errno = %d, fd = %d", sock_errno, (sock_errno), tcp->sock);
-        } else {
-            LOGE(TAG, "tcp_poll_read getsockopt error.");
-        }
-        ret = -1;
+    if (ret < 0) {
+        LOGE(TAG, "tcp_poll error, errno = %d, fd = %d", errno, tcp->sock.fd);
     }
     return ret;
 }
 
+static int tcp_poll_read(transport_handle_t t, int timeout_ms)
+{
+    return tcp_poll(t, TRANSPORT_SOCK_READ, timeout_ms);
+}
+
 static int tcp_poll_write(transport_handle_t t, int timeout_ms)
 {
-    transport_tcp_t *tcp = transport_get_context_data(t);
-    int ret = -1;
-    fd_set writeset;
-    fd_set errset;
-    FD_ZERO(&writeset);
-    FD_ZERO(&errset);
-    FD_SET(tcp->sock, &writeset);
-    FD_SET(tcp->sock, &errset);
-    struct timeval timeout;
-    transport_utils_ms_to_timeval(timeout_ms, &timeout);
-    ret = select(tcp->sock + 1, NULL, &writeset, &errset, &timeout);
-    if (ret == 0) {
-        LOGE(TAG, "tcp_poll_write, select ret:%d, timeout", ret);
-        return -1;
-    }
-    if (ret > 0 && FD_ISSET(tcp->sock, &errset)) {
-        int sock_errno = 0;
-        uint32_t optlen = sizeof(sock_errno);
-        ret = getsockopt(tcp->sock, SOL_SOCKET, SO_ERROR, &sock_errno, &optlen);
-        if (ret == 0) {
-            LOGE(TAG, "tcp_poll_read select error %d, errno = %d, fd = %d", sock_errno, (sock_errno), tcp->sock);
-        } else {
-            LOGE(TAG, "tcp_poll_read getsockopt error.");
-        }
-        ret = -1;
-    }
-    return ret;
+    return tcp_poll(t, TRANSPORT_SOCK_WRITE, timeout_ms);
 }
 
 static int tcp_close(transport_handle_t t)
 {
     transport_tcp_t *tcp = transport_get_context_data(t);
-    int ret = -1;
-    if (tcp->sock >= 0) {
-        ret = close(tcp->sock);
-        tcp->sock = -1;
-    }
-    // network_t *n = transport_get_n(t);
-    // n->net_disconncet(n);
-    return ret;
+
+    return transport_sock_close(&tcp->sock);
 }
 
 static web_err_t tcp_destroy(transport_handle_t t)
@@ -218,7 +157,7 @@ transport_handle_t transport_tcp_init()
         transport_destroy(t);
         return NULL;
     });
-    tcp->sock = -1;
+    transport_sock_init(&tcp->sock);
     transport_set_func(t, tcp_connect, tcp_read, tcp_write, tcp_close, tcp_poll_read, tcp_poll_write, tcp_destroy);
     transport_set_context_data(t, tcp);
 
@@ -142,13 +142,6 @@ int main(int argc, char *argv[])
     }
     LOGD(TAG, "############current_version: %s", aos_get_app_version());
     LOGD(TAG, "############current_changelog: %s", aos_get_changelog());
-#ifdef UBI_NOT_SUPPORT_INTERRUPTED_UPDATE
-    if (FILE_SYSTEM_IS_UBI()) {
-        // because of UBI volume features, see ubi-user.h in linux kernel
-        aos_kv_setint("fota_offset", 0);
-    }
-#endif
-
     fota_server_t *fota = fota_init();
     if (fota)
         fota->fotax.register_ops = (fota_register_ops_t *)&register_ops;
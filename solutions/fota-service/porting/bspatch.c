@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+#include <string.h>
+#include <errno.h>
+#include <aos/kernel.h>
+#include <ulog/ulog.h>
+#include "bspatch.h"
+
+#define TAG "bspatch"
+
+static int64_t offtin(const uint8_t *buf)
+{
+    int64_t y;
+
+    y = buf[7] & 0x7F;
+    for (int i = 6; i >= 0; i--) {
+        y = y * 256 + buf[i];
+    }
+    if (buf[7] & 0x80) {
+        y = -y;
+    }
+    return y;
+}
+
+int bspatch_init(bspatch_t *patch, int block_size, void *arg,
+                 int (*read_old)(void *arg, int64_t pos, uint8_t *buffer, int length),
+                 int (*write_new)(void *arg, int64_t pos, const uint8_t *buffer, int length))
+{
+    memset(patch, 0, sizeof(bspatch_t));
+    patch->block = aos_malloc(block_size);
+    if (patch->block == NULL) {
+        return -ENOMEM;
+    }
+    patch->block_size = block_size;
+    patch->arg = arg;
+    patch->read_old = read_old;
+    patch->write_new = write_new;
+    patch->state.magic = BSPATCH_STATE_MAGIC;
+    patch->state.stage = BSPATCH_STAGE_HEADER;
+    return 0;
+}
+
+void bspatch_free(bspatch_t *patch)
+{
+    if (patch->block) {
+        aos_free(patch->block);
+        patch->block = NULL;
+    }
+}
+
+/* the old data out of [0, oldsize) reads as 0, as bspatch does */
+static int bspatch_diff(bspatch_t *patch, const uint8_t *buffer, int length)
+{
+    bspatch_state_t *st = &patch->state;
+    int64_t lo = st->oldpos > 0 ? st->oldpos : 0;
+    int64_t hi = st->oldpos + length < patch->oldsize ? st->oldpos + length : patch->oldsize;
+
+    memset(patch->block, 0, length);
+    if (lo < hi && patch->read_old(patch->arg, lo, patch->block + (lo - st->oldpos), hi - lo) < 0) {
+        LOGE(TAG, "read old %d bytes at %lld failed", (int)(hi - lo), lo);
+        return -1;
+    }
+    for (int i = 0; i < length; i++) {
+        patch->block[i] += buffer[i];
+    }
+    return patch->write_new(patch->arg, st->newpos, patch->block, length);
+}
+
+int bspatch_write(bspatch_t *patch, const uint8_t *buffer, int length)
+{
+    bspatch_state_t *st = &patch->state;
+    int done = 0;
+    int n;
+
+    for (;;) {
+        if (st->stage == BSPATCH_STAGE_DIFF && st->diff_left == 0) {
+            st->stage = BSPATCH_STAGE_EXTRA;
+        }
+        if (st->stage == BSPATCH_STAGE_EXTRA && st->extra_left == 0) {
+            st->oldpos += st->seek;
+            st->stage = st->newpos == st->newsize ? BSPATCH_STAGE_DONE : BSPATCH_STAGE_CTRL;
+        }
+        if (done == length || st->stage == BSPATCH_STAGE_DONE) {
+            break;
+        }
+        n = length - done;
+        switch (st->stage) {
+            case BSPATCH_STAGE_HEADER:
+            case BSPATCH_STAGE_CTRL:
+                if (n > BSPATCH_CTRL_SIZE - st->fill) {
+                    n = BSPATCH_CTRL_SIZE - st->fill;
+                }
+                memcpy(st->buf + st->fill, buffer + done, n);
+                st->fill += n;
+                if (st->fill < BSPATCH_CTRL_SIZE) {
+                    break;
+                }
+                if (st->stage == BSPATCH_STAGE_HEADER) {
+                    // not a patch, the header is left in buf
+                    if (memcmp(st->buf, BSPATCH_MAGIC, strlen(BSPATCH_MAGIC)) != 0) {
+                        return -1;
+                    }
+                    st->fill = 0;
+                    st->newsize = offtin(st->buf + 16);
+                    if (st->newsize < 0) {
+                        LOGE(TAG, "the new size is error.");
+                        return -1;
+                    }
+                    st->stage = st->newsize > 0 ? BSPATCH_STAGE_CTRL : BSPATCH_STAGE_DONE;
+                    break;
+                }
+                st->fill = 0;
+                st->diff_left = offtin(st->buf);
+                st->extra_left = offtin(st->buf + 8);
+                st->seek = offtin(st->buf + 16);
+                if (st->diff_left < 0 || st->extra_left < 0 ||
+                    st->newpos + st->diff_left + st->extra_left > st->newsize) {
+                    LOGE(TAG, "the ctrl is error.[%lld, %lld] at %lld", st->diff_left, st->extra_left, st->newpos);
+                    return -1;
+                }
+                st->stage = BSPATCH_STAGE_DIFF;
+                break;
+            case BSPATCH_STAGE_DIFF:
+                if (n > st->diff_left) {
+                    n = st->diff_left;
+                }
+                if (n > patch->block_size) {
+                    n = patch->block_size;
+                }
+                if (bspatch_diff(patch, buffer + done, n) < 0) {
+                    return -1;
+                }
+                st->oldpos += n;
+                st->newpos += n;
+                st->diff_left -= n;
+                break;
+            case BSPATCH_STAGE_EXTRA:
+                if (n > st->extra_left) {
+                    n = st->extra_left;
+                }
+                if (patch->write_new(patch->arg, st->newpos, buffer + done, n) < 0) {
+                    return -1;
+                }
+                st->newpos += n;
+                st->extra_left -= n;
+                break;
+        }
+        done += n;
+        st->consumed += n;
+    }
+    if (done < length) {
+        LOGE(TAG, "%d bytes after the end of the patch.", length - done);
+        return -1;
+    }
+    return length;
+}
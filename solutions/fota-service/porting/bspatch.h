@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef __BSPATCH_H__
+#define __BSPATCH_H__
+
+/*
+ * The uncompressed bsdiff stream:
+ * "ENDSLEY/BSDIFF43" + newsize, then records of
+ * ctrl(x, y, z) + x bytes added to the old data + y bytes copied, the old position moves z after each record.
+ * The numbers are 8 bytes, little endian with the sign in the top bit.
+ */
+#define BSPATCH_MAGIC "ENDSLEY/BSDIFF43"
+#define BSPATCH_HEADER_SIZE 24
+#define BSPATCH_CTRL_SIZE 24
+
+typedef enum {
+    BSPATCH_STAGE_HEADER = 0,
+    BSPATCH_STAGE_CTRL,
+    BSPATCH_STAGE_DIFF,
+    BSPATCH_STAGE_EXTRA,
+    BSPATCH_STAGE_DONE,
+} bspatch_stage_e;
+
+typedef struct {
+#define BSPATCH_STATE_MAGIC 0x48435450 // "PTCH"
+    uint32_t magic;
+    uint32_t stage;                     // bspatch_stage_e
+    uint64_t consumed;                  // bytes of the patch stream applied
+    int64_t newsize;
+    int64_t newpos;
+    int64_t oldpos;
+    int64_t diff_left;                  // bytes left of the current record
+    int64_t extra_left;
+    int64_t seek;
+    uint32_t fill;                      // bytes in buf
+    uint8_t buf[BSPATCH_HEADER_SIZE];   // the header or the ctrl being received
+} bspatch_state_t;
+
+typedef struct {
+    bspatch_state_t state;              // all of the progress, save it to resume
+    int64_t oldsize;
+    uint8_t *block;
+    int block_size;
+    void *arg;
+    int (*read_old)(void *arg, int64_t pos, uint8_t *buffer, int length);
+    int (*write_new)(void *arg, int64_t pos, const uint8_t *buffer, int length);
+} bspatch_t;
+
+int bspatch_init(bspatch_t *patch, int block_size, void *arg,
+                 int (*read_old)(void *arg, int64_t pos, uint8_t *buffer, int length),
+                 int (*write_new)(void *arg, int64_t pos, const uint8_t *buffer, int length));
+void bspatch_free(bspatch_t *patch);
+/* return length, or -1 if the stream is broken or the callbacks fail */
+int bspatch_write(bspatch_t *patch, const uint8_t *buffer, int length);
+
+#endif
@@ -20,6 +20,9 @@
 #include <mtd/ubi-user.h>
 #include <mtd/mtd-user.h>
 #include "imagef.h"
+#include "libubi.h"
+#include "bspatch.h"
+#include "unpack.h"
 
 #define TAG "fota"
 
@@ -27,7 +30,7 @@ struct partition_info_t {
     char img_name[IMG_NAME_MAX_LEN];
     char char_name[DEV_NAME_MAX_LEN + 4]; // for uboot name(/dev/mmcblk0boot0) length + 4
     char dev_name[DEV_NAME_MAX_LEN + 4];
-    size_t size;
+    uint64_t size;
     int ab;
 };
 
@@ -44,7 +47,207 @@ static struct partition_info_t g_partition_info_ext4_uboot[] = {
     {IMG_NAME_UBOOT,  "/dev/mmcblk0boot0", "/dev/mmcblk0boot0", ( 4 * 1024 * 1024), 1},
 };
 
-static struct partition_info_t *g_partition_info;
+typedef struct {
+    int size;                                   /*!< LEB size of the volume, 0: not written LEB by LEB */
+    int count;                                  /*!< reserved LEBs of the volume */
+    int lnum;                                   /*!< the LEB in buffer */
+    int fill;                                   /*!< bytes of the LEB in buffer */
+    int dirty;                                  /*!< the buffer is newer than the LEB on flash */
+    uint8_t *buffer;                            /*!< the LEB being written */
+} flash_leb_t;
+
+typedef struct {
+    uint64_t offset;                              /*!< in the pack */
+    uint64_t old_offset;                          /*!< in the active partition */
+    uint64_t length;
+} flash_span_t;
+
+typedef struct {
+    int idx;                                    /*!< the image the spans are in */
+    int count;
+    flash_span_t *spans;                        /*!< sorted by offset */
+    int old_fd;                                 /*!< the active partition of the image */
+} flash_zsync_t;
+
+typedef struct {
+    download_img_info_t info;                   /*!< the images of the pack, saved to IMGINFOFILE */
+    struct partition_info_t *partition_info;    /*!< the partition table of this io */
+    img_digest_t digest;                        /*!< the digest of the data written */
+    int digest_valid;                           /*!< whether digest covers all the data before io->offset */
+    flash_leb_t leb[IMG_MAX_COUNT];             /*!< the UBI volumes written LEB by LEB */
+    struct flash_patch *patch;                  /*!< the diff image applied while downloading */
+    struct flash_unpack *unpack;                /*!< the compressed image being written */
+    flash_zsync_t zsync;                        /*!< the spans copied from the active partition, not downloaded */
+    uint32_t skip_plan;                         /*!< the unchanged images not skipped yet, see flash_image_plan */
+} flash_priv_t;
+
+#define FLASH_PATCH_BLOCK_SIZE  4096            /* the old data read at a time */
+#define FLASH_PATCH_BUFFER_SIZE (64 * 1024)     /* the new data written at a time, when not LEB by LEB */
+
+typedef struct flash_patch {
+    netio_t *io;
+    int idx;                                    /*!< the diff image */
+    int broken;                                 /*!< a write failed, the patch can't resume */
+    bspatch_t patch;
+    int fd;                                     /*!< the inactive rootfs patched, -1: the header is not received */
+    int old_fd;                                 /*!< the active rootfs */
+    flash_leb_t leb;
+    uint8_t *buffer;                            /*!< the new data not written */
+    int fill;
+    int64_t pos;                                /*!< where the buffer is written */
+} flash_patch_t;
+
+typedef struct flash_unpack {
+    netio_t *io;
+    int idx;                                    /*!< the compressed image */
+    int broken;                                 /*!< a write failed, the image can't resume */
+    unpack_t unpack;
+} flash_unpack_t;
+
+/* the temp files of a session, see fota_session_name */
+static const char *flash_file(netio_t *io, const char *path, char buf[FOTA_SESSION_KEY_LEN])
+{
+    return fota_session_name(io->session, path, buf, FOTA_SESSION_KEY_LEN);
+}
+
+/*
+ * A dynamic UBI volume is written LEB by LEB with atomic LEB changes instead of UBI_IOCVOLUP,
+ * so an interrupted update leaves every LEB either old or new and can resume from the checkpoint.
+ */
+static int flash_leb_init(flash_leb_t *leb, const char *dev_name)
+{
+    libubi_t libubi;
+    struct ubi_vol_info info;
+    int ret;
+
+    memset(leb, 0, sizeof(flash_leb_t));
+    libubi = libubi_open();
+    if (!libubi) {
+        return -1;
+    }
+    ret = ubi_get_vol_info(libubi, dev_name, &info);
+    libubi_close(libubi);
+    if (ret < 0 || info.type != UBI_DYNAMIC_VOLUME) {
+        return -1;
+    }
+    leb->size = info.leb_size;
+    leb->count = info.rsvd_lebs;
+    leb->lnum = -1;
+    LOGD(TAG, "%s LEB size:%d count:%d", dev_name, leb->size, leb->count);
+    return 0;
+}
+
+static void flash_leb_free(flash_leb_t *leb)
+{
+    if (leb->buffer) {
+        aos_free(leb->buffer);
+        leb->buffer = NULL;
+    }
+}
+
+/* change the LEB in buffer atomically, a partial LEB is changed again when it fills up */
+static int flash_leb_commit(flash_leb_t *leb, int fd)
+{
+    if (!leb->dirty) {
+        return 0;
+    }
+    if (ubi_leb_change_start(NULL, fd, leb->lnum, leb->fill) < 0) {
+        LOGE(TAG, "LEB %d change start failed, errno:%d", leb->lnum, errno);
+        return -1;
+    }
+    if (write(fd, leb->buffer, leb->fill) != leb->fill) {
+        LOGE(TAG, "LEB %d write %d bytes failed, errno:%d", leb->lnum, leb->fill, errno);
+        return -1;
+    }
+    leb->dirty = 0;
+    return 0;
+}
+
+/* the data of size is complete: unmap the LEBs after it, as UBI_IOCVOLUP does */
+static int flash_leb_finish(flash_leb_t *leb, int fd, uint64_t size)
+{
+    int lnum = (size + leb->size - 1) / leb->size;
+
+    for (; lnum < leb->count; lnum++) {
+        if (ubi_leb_unmap(fd, lnum) < 0) {
+            LOGE(TAG, "LEB %d unmap failed, errno:%d", lnum, errno);
+            return -1;
+        }
+    }
+    flash_leb_free(leb);
+    LOGD(TAG, "%lld bytes written LEB by LEB.", (long long)size);
+    return 0;
+}
+
+// pos: where the buffer is written, size: the whole data to write
+static int flash_leb_write(flash_leb_t *leb, int fd, uint64_t pos, uint64_t size, const uint8_t *buffer, int length)
+{
+    int done = 0;
+
+    if (leb->buffer == NULL) {
+        if (pos % leb->size) {
+            LOGE(TAG, "LEB %d is not restored.", (int)(pos / leb->size));
+            return -1;
+        }
+        leb->buffer = aos_malloc(leb->size);
+        if (leb->buffer == NULL) {
+            return -ENOMEM;
+        }
+        leb->lnum = pos / leb->size;
+        leb->fill = 0;
+    }
+    while (done < length) {
+        int lnum = pos / leb->size;
+        int off = pos % leb->size;
+        int n = leb->size - off;
+
+        if (n > length - done)
+            n = length - done;
+        if (lnum != leb->lnum) {
+            leb->lnum = lnum;
+            leb->fill = 0;
+        }
+        memcpy(leb->buffer + off, buffer + done, n);
+        leb->fill = off + n;
+        leb->dirty = 1;
+        pos += n;
+        done += n;
+        if (leb->fill == leb->size || pos == size) {
+            if (flash_leb_commit(leb, fd) < 0) {
+                return -1;
+            }
+        }
+    }
+    if (pos == size) {
+        if (flash_leb_finish(leb, fd, size) < 0) {
+            return -1;
+        }
+    }
+    return length;
+}
+
+/* resume at pos: read back the part of the current LEB that was synced */
+static int flash_leb_restore(flash_leb_t *leb, int fd, uint64_t pos, uint64_t size)
+{
+    if (leb->size == 0 || pos >= size) {
+        return 0;
+    }
+    if (leb->buffer == NULL) {
+        leb->buffer = aos_malloc(leb->size);
+        if (leb->buffer == NULL) {
+            return -ENOMEM;
+        }
+    }
+    leb->lnum = pos / leb->size;
+    leb->fill = pos % leb->size;
+    leb->dirty = 0;
+    if (leb->fill && pread(fd, leb->buffer, leb->fill, (off_t)leb->lnum * leb->size) != leb->fill) {
+        LOGE(TAG, "LEB %d read back failed, errno:%d", leb->lnum, errno);
+        return -1;
+    }
+    LOGD(TAG, "resume at LEB %d + %d", leb->lnum, leb->fill);
+    return 0;
+}
 
 // data: if return 0, need free *data
 static int get_emmc_valid_partition_info(struct partition_info_t **data)
@@ -160,9 +363,12 @@ err:
     return -1;
 }
 
-static int get_partition_info(const char *img_name, size_t img_size, size_t *out_size,
-                            unsigned long *fp, int *fd, char *out_dev_name, char *out_img_path)
+// done: bytes of the image written before, flash_leb_t: set if written LEB by LEB
+static int get_partition_info(netio_t *io, const char *img_name, uint64_t img_size, uint64_t done, flash_leb_t *leb,
+                            uint64_t *out_size, unsigned long *fp, int *fd, char *out_dev_name, char *out_img_path)
 {
+    struct partition_info_t *table = ((flash_priv_t *)io->private)->partition_info;
+    char path[FOTA_SESSION_KEY_LEN];
     int i;
     int rootfsab, kernelab;
     int is_uboot;
@@ -196,12 +402,12 @@ static int get_partition_info(const char *img_name, size_t img_size, size_t *out
             if (statvfs("/", &vfs) < 0) {
                 return -1;
             }
-            *out_size = vfs.f_bavail * vfs.f_bsize;
+            *out_size = (uint64_t)vfs.f_bavail * vfs.f_bsize;
             if (img_size >= *out_size) {
-                LOGE(TAG, "the package[%d] is larger than disk space[%d].", img_size, *out_size);
+                LOGE(TAG, "the package[%lld] is larger than disk space[%lld].", (long long)img_size, (long long)*out_size);
                 return -1;
             }
-            ffd = open("/"IMG_NAME_DIFF, O_CREAT | O_RDWR | O_SYNC, 0666);
+            ffd = open(flash_file(io, "/"IMG_NAME_DIFF, path), O_CREAT | O_RDWR | O_SYNC, 0666);
             if (ffd < 0) {
                 LOGE(TAG, "open diff temp file failed.");
                 return -1;
@@ -209,12 +415,12 @@ static int get_partition_info(const char *img_name, size_t img_size, size_t *out
             *fd = ffd;
             return 0;
         }
-        if (g_partition_info[i].size == 0) {
+        if (table[i].size == 0) {
             break;
         }
-        if (strcmp(img_name, g_partition_info[i].img_name) == 0) {
+        if (strcmp(img_name, table[i].img_name) == 0) {
             if (is_uboot == 1) {
-                LOGD(TAG, "got uboot devname: %s", g_partition_info[i].dev_name);
+                LOGD(TAG, "got uboot devname: %s", table[i].dev_name);
                 char *namepath = strdup_img_path(img_name);
                 if (namepath == NULL) {
                     return -ENOMEM;
@@ -230,13 +436,13 @@ static int get_partition_info(const char *img_name, size_t img_size, size_t *out
                 }
                 *fd = ffd;
                 LOGD(TAG, "@@@[%d].*fp:0x%08x", i, *fp);
-                memcpy(out_dev_name, g_partition_info[i].dev_name, sizeof(g_partition_info[i].dev_name));
+                memcpy(out_dev_name, table[i].dev_name, sizeof(table[i].dev_name));
                 // Open and size the device
-                size_t memsize;
+                uint64_t memsize;
                 if (FILE_SYSTEM_IS_UBI()) {
                     mtd_info_t meminfo;
-                    if ((ffd = open(g_partition_info[i].char_name, O_RDONLY)) < 0) {
-                        LOGE(TAG, "Open device %s failed.", g_partition_info[i].char_name);
+                    if ((ffd = open(table[i].char_name, O_RDONLY)) < 0) {
+                        LOGE(TAG, "Open device %s failed.", table[i].char_name);
                         return -1;
                     }
                     if (ioctl(ffd, MEMGETINFO, &meminfo) != 0) {
@@ -248,8 +454,8 @@ static int get_partition_info(const char *img_name, size_t img_size, size_t *out
                     memsize = meminfo.size;
                 }
                 if (FILE_SYSTEM_IS_EXT4()) {
-                    if ((ffd = open(g_partition_info[i].char_name, O_RDONLY)) < 0) {
-                        LOGE(TAG, "Open device %s failed.", g_partition_info[i].char_name);
+                    if ((ffd = open(table[i].char_name, O_RDONLY)) < 0) {
+                        LOGE(TAG, "Open device %s failed.", table[i].char_name);
                         return -1;
                     }
                     if (ioctl(ffd, BLKGETSIZE64, &memsize) != 0) {
@@ -259,29 +465,29 @@ static int get_partition_info(const char *img_name, size_t img_size, size_t *out
                     }
                     close(ffd);
                 }
-                g_partition_info[i].size = memsize;
-                *out_size = g_partition_info[i].size;
-                LOGD(TAG, "partition size:%d", *out_size);
+                table[i].size = memsize;
+                *out_size = table[i].size;
+                LOGD(TAG, "partition size:%lld", (long long)*out_size);
                 return 0;
             } else {
                 int ret;
                 long long image_size = img_size;
-                if ((strcmp(img_name, IMG_NAME_KERNEL) == 0 && g_partition_info[i].ab == kernelab)
-                    || (strcmp(img_name, IMG_NAME_ROOTFS) == 0 && g_partition_info[i].ab == rootfsab)
-                    || (strcmp(img_name, g_partition_info[i].img_name) == 0 && g_partition_info[i].ab == check_partition_ab(img_name))) {
-                    LOGD(TAG, "got devname: %s", g_partition_info[i].dev_name);
-                    LOGD(TAG, "img_size: %d", img_size);
-                    int ffd = open(g_partition_info[i].dev_name, O_RDWR | O_SYNC);
+                if ((strcmp(img_name, IMG_NAME_KERNEL) == 0 && table[i].ab == kernelab)
+                    || (strcmp(img_name, IMG_NAME_ROOTFS) == 0 && table[i].ab == rootfsab)
+                    || (strcmp(img_name, table[i].img_name) == 0 && table[i].ab == check_partition_ab(img_name))) {
+                    LOGD(TAG, "got devname: %s", table[i].dev_name);
+                    LOGD(TAG, "img_size: %lld", (long long)img_size);
+                    int ffd = open(table[i].dev_name, O_RDWR | O_SYNC);
                     if (ffd < 0) {
-                        LOGE(TAG, "open image: %s, [%s]file failed.[errno:%d]", img_name, g_partition_info[i].dev_name, errno);
+                        LOGE(TAG, "open image: %s, [%s]file failed.[errno:%d]", img_name, table[i].dev_name, errno);
                         return -1;
                     }
-                    size_t bytes;
+                    uint64_t bytes = 0;
                     if (FILE_SYSTEM_IS_UBI()) {
                         long long bytes2;
                         extern int get_ubi_info(const char *ubi_name, long long *bytes2);
-                        if (get_ubi_info(g_partition_info[i].dev_name, &bytes2)) {
-                            LOGE(TAG, "get %s length error.", g_partition_info[i].dev_name);
+                        if (get_ubi_info(table[i].dev_name, &bytes2)) {
+                            LOGE(TAG, "get %s length error.", table[i].dev_name);
                             close(ffd);
                             return -1;
                         }
@@ -294,26 +500,34 @@ static int get_partition_info(const char *img_name, size_t img_size, size_t *out
                             return -1;
                         }
                     }
-                    g_partition_info[i].size = (int)bytes;
-                    LOGD(TAG, "the %s bytes:%d", g_partition_info[i].dev_name, bytes);
+                    table[i].size = bytes;
+                    LOGD(TAG, "the %s bytes:%lld", table[i].dev_name, (long long)bytes);
                     if (image_size > bytes) {
-                        LOGE(TAG, "the image_size[%d] is larger than partition_size[%d].", image_size, bytes);
+                        LOGE(TAG, "the image_size[%lld] is larger than partition_size[%lld].", image_size, (long long)bytes);
                         close(ffd);
                         return -1;
                     }
-                    if (FILE_SYSTEM_IS_UBI()) {
-                        ret = ioctl(ffd, UBI_IOCVOLUP, &image_size);
-                        if (ret < 0) {
-                            LOGE(TAG, "UBI_IOCVOLUP failed, ffd:%d,[%s][ret:%d][errno:%d].", ffd, g_partition_info[i].dev_name, ret, errno);
+                    if (FILE_SYSTEM_IS_UBI() && flash_leb_init(leb, table[i].dev_name) < 0) {
+                        // the static volume is marked corrupted until the update completes, it can't resume
+                        if (done > 0 && done < img_size) {
+                            LOGE(TAG, "the update of %s can't resume.", table[i].dev_name);
                             close(ffd);
                             return -1;
                         }
+                        if (done == 0) {
+                            ret = ioctl(ffd, UBI_IOCVOLUP, &image_size);
+                            if (ret < 0) {
+                                LOGE(TAG, "UBI_IOCVOLUP failed, ffd:%d,[%s][ret:%d][errno:%d].", ffd, table[i].dev_name, ret, errno);
+                                close(ffd);
+                                return -1;
+                            }
+                        }
                     }
                     *fd = ffd;
-                    LOGD(TAG, "###[%d].*fd:%d, img_size:%d, image_size:%d", i, *fd, img_size, image_size);
-                    *out_size = g_partition_info[i].size;
-                    memcpy(out_dev_name, g_partition_info[i].dev_name, sizeof(g_partition_info[i].dev_name));
-                    LOGD(TAG, "partition size:%d", *out_size);
+                    LOGD(TAG, "###[%d].*fd:%d, img_size:%lld, image_size:%lld", i, *fd, (long long)img_size, image_size);
+                    *out_size = table[i].size;
+                    memcpy(out_dev_name, table[i].dev_name, sizeof(table[i].dev_name));
+                    LOGD(TAG, "partition size:%lld", (long long)*out_size);
                     return 0;
                 }
             }
@@ -323,317 +537,1930 @@ static int get_partition_info(const char *img_name, size_t img_size, size_t *out
     return -1;
 }
 
-static int set_img_info(netio_t *io, uint8_t *buffer)
+/*
+ * the partition that has the image the last update installed, 1: A, 2: B, -1: unknown.
+ * uboot has a single partition. The others of check_partition_exists are written to <name>_partition, and the
+ * switch points it to the other one, so the installed image is in the other one.
+ */
+static int flash_image_slot(const char *img_name)
 {
-    download_img_info_t *priv = (download_img_info_t *)io->private;
-    pack_header_v2_t *header = (pack_header_v2_t *)buffer;
-    pack_header_imginfo_v2_t *imginfo = header->image_info;
+    int ab;
 
-    LOGD(TAG, "come to set image info.");
-    if (header->magic != PACK_HEAD_MAGIC) {
-        LOGE(TAG, "the image header is wrong.");
-        return -1;
+    if (strcmp(img_name, IMG_NAME_KERNEL) == 0) {
+        return check_kernel_partition();
     }
-    if (header->image_count > IMG_MAX_COUNT) {
-        LOGE(TAG, "the image count is overflow.");
-        return -1;
+    if (strcmp(img_name, IMG_NAME_ROOTFS) == 0) {
+        return check_rootfs_partition();
     }
-    priv->image_count = header->image_count;
-    priv->head_size = header->head_size;
-    priv->digest_type = header->digest_type;
-    priv->signature_type = header->signature_type;
-    memcpy(priv->md5sum, header->md5sum, sizeof(priv->md5sum));
-    memcpy(priv->signature, header->signature, sizeof(priv->signature));
-    LOGD(TAG, "image count is :%d", header->image_count);
-    for (int i = 0; i < header->image_count; i++) {
-        LOGD(TAG, "-------> %s", imginfo->img_name);
-        LOGD(TAG, "offset:%d", imginfo->offset);
-        LOGD(TAG, "size:%d", imginfo->size);
-        memcpy(priv->img_info[i].img_name, imginfo->img_name, IMG_NAME_MAX_LEN);
-        priv->img_info[i].img_offset = imginfo->offset;
-        priv->img_info[i].img_size = imginfo->size;
-        priv->img_info[i].fp = NULL;
-        priv->img_info[i].fd = -1;
-        unsigned long ffp;
-        int ret = get_partition_info(priv->img_info[i].img_name, priv->img_info[i].img_size,
-                                     &priv->img_info[i].partition_size, &ffp, &priv->img_info[i].fd,
-                                     priv->img_info[i].dev_name, priv->img_info[i].img_path);
-        if (ret < 0) {
-            LOGE(TAG, "get partition info error.");
-            return -1;
-        }
-        priv->img_info[i].fp = (FILE *)ffp;
-        LOGD(TAG, "@@@priv->img_info[%d].fp:0x%08x, fd:%d", i, priv->img_info[i].fp, priv->img_info[i].fd);
-        imginfo++;
+    if (strcmp(img_name, IMG_NAME_UBOOT) == 0) {
+        return 1;
     }
-    return 0;
+    if (!check_partition_exists(img_name)) {
+        return -1;
+    }
+    ab = check_partition_ab(img_name);
+    return ab == 1 ? 2 : (ab == 2 ? 1 : -1);
 }
 
-static int get_img_index(netio_t *io, size_t cur_offset)
+/* open the partition that has the installed image, see flash_image_slot */
+static int flash_active_open(netio_t *io, const char *img_name)
 {
-    int i;
-    size_t offsets[IMG_MAX_COUNT + 1];
+    struct partition_info_t *table = ((flash_priv_t *)io->private)->partition_info;
+    int ab;
+    int fd;
 
-    download_img_info_t *priv = (download_img_info_t *)io->private;
-    LOGD(TAG, "%s, cur_offset: %d", __func__, cur_offset);
-    if (cur_offset == 0) {
-        return 0;
-    }
-    for (i = 0; i < IMG_MAX_COUNT + 1; i++) {
-        offsets[i] = ~0;
-    }
-    for (i = 0; i < priv->image_count; i++) {
-        offsets[i] = priv->img_info[i].img_offset;
-        LOGD(TAG, "offsets[%d]: %d", i, offsets[i]);
+    ab = flash_image_slot(img_name);
+    if (ab != 1 && ab != 2) {
+        LOGE(TAG, "Check %s partition failed", img_name);
+        return -1;
     }
-    for (i = 0; i < priv->image_count; i++) {
-        LOGD(TAG, "offsets[%d]: %d, offsets[%d]: %d", i, offsets[i], i+1, offsets[i+1]);
-        if(cur_offset >= offsets[i] && cur_offset < offsets[i+1]) {
-            LOGD(TAG, "Range Num: %d", i);
-            return i;
+    for (int i = 0; table[i].size != 0; i++) {
+        if (strcmp(table[i].img_name, img_name) == 0 && table[i].ab == ab) {
+            fd = open(table[i].dev_name, O_RDONLY);
+            if (fd < 0) {
+                LOGE(TAG, "open %s failed.[errno:%d]", table[i].dev_name, errno);
+            }
+            return fd;
         }
     }
-    LOGE(TAG, "get img index error.");
+    LOGE(TAG, "can't find the active %s.", img_name);
     return -1;
 }
 
-static int flash_open(netio_t *io, const char *path)
+static void flash_zsync_free(netio_t *io)
 {
-    io->block_size = CONFIG_FOTA_BUFFER_SIZE;
+    flash_zsync_t *z = &((flash_priv_t *)io->private)->zsync;
 
-    io->private = aos_zalloc(sizeof(download_img_info_t));
-    if (io->private == NULL) {
-        return -ENOMEM;
+    if (z->spans) {
+        aos_free(z->spans);
+        z->spans = NULL;
     }
-    if (FILE_SYSTEM_IS_EXT4()) {
-        if (get_emmc_valid_partition_info(&g_partition_info) < 0) {
-            aos_free(io->private);
-            return -1;
-        }
-    } else if (FILE_SYSTEM_IS_UBI()) {
-        g_partition_info = g_partition_info_ubi;
-    } else {
-        aos_free(io->private);
-        return -1;
+    if (z->old_fd >= 0) {
+        close(z->old_fd);
+        z->old_fd = -1;
     }
-
-    return 0;
+    z->count = 0;
 }
 
-static int flash_close(netio_t *io)
+/*
+ * A "diff" image in bsdiff format is applied while downloading:
+ * the old data is read from the active rootfs and the new one is written to the inactive rootfs,
+ * so the patch is never stored. The state is saved to IMGPATCHFILE at every sync to resume.
+ * Any other "diff" image is stored to a file for ota-burndiff as before.
+ */
+static int flash_patch_read_old(void *arg, int64_t pos, uint8_t *buffer, int length)
 {
-    int i;
-    int ret = 0;
-    size_t total_size;
-    download_img_info_t *priv = (download_img_info_t *)io->private;
+    flash_patch_t *p = (flash_patch_t *)arg;
 
-    if (FILE_SYSTEM_IS_EXT4()) {
-        aos_free(g_partition_info);
+    if (pread(p->old_fd, buffer, length, (off_t)pos) != length) {
+        LOGE(TAG, "read the active rootfs failed, errno:%d", errno);
+        return -1;
     }
-    // save to file first
-    FILE *fp = fopen(IMGINFOFILE, "wb+");
-    if (!fp) {
-        LOGE(TAG, "open %s file failed.", IMGINFOFILE);
-        ret = -1;
-        goto out;
+    return length;
+}
+
+static int flash_patch_flush(flash_patch_t *p)
+{
+    if (p->fill == 0) {
+        return 0;
     }
-    if (fwrite(priv, 1, sizeof(download_img_info_t), fp) < 0) {
-        ret = -1;
-        goto out;
+    if (pwrite(p->fd, p->buffer, p->fill, (off_t)p->pos) != p->fill) {
+        LOGE(TAG, "write %d bytes at %lld failed, errno:%d", p->fill, p->pos, errno);
+        return -1;
     }
-    fsync(fileno(fp));
+    p->pos += p->fill;
+    p->fill = 0;
+    return 0;
+}
 
-    total_size = priv->head_size;
-    for (i = 0; i < priv->image_count; i++) {
-        total_size += priv->img_info[i].img_size;
+static int flash_patch_write_new(void *arg, int64_t pos, const uint8_t *buffer, int length)
+{
+    flash_patch_t *p = (flash_patch_t *)arg;
+    int64_t newsize = p->patch.state.newsize;
+    int done = 0;
+
+    if (p->leb.size > 0) {
+        return flash_leb_write(&p->leb, p->fd, pos, newsize, buffer, length);
+    }
+    if (pos != p->pos + p->fill) {
+        if (flash_patch_flush(p) < 0) {
+            return -1;
+        }
+        p->pos = pos;
     }
-    LOGD(TAG, "flash close, total_size:%d, io->offset:%d", total_size, io->offset);
+    while (done < length) {
+        int n = FLASH_PATCH_BUFFER_SIZE - p->fill;
 
-    if (io->offset == total_size && io->offset != 0) {
-        LOGD(TAG, "come to close file");
-        for (i = 0; i < priv->image_count; i++) {
-            if (priv->img_info[i].fp) {
-                fclose(priv->img_info[i].fp);
-                LOGD(TAG, "close 0x%08x", priv->img_info[i].fp);
-            }
-            if (priv->img_info[i].fd > 0) {
-                close(priv->img_info[i].fd);
-                LOGD(TAG, "close %d", priv->img_info[i].fd);
-            }
+        if (n > length - done) {
+            n = length - done;
         }
-    } else {
-        for (i = 0; i < priv->image_count; i++) {
-            if (priv->img_info[i].fp) {
-                LOGD(TAG, "no need to close 0x%08x", priv->img_info[i].fp);
-            }
-            if (priv->img_info[i].fd > 0) {
-                LOGD(TAG, "no need to close %d", priv->img_info[i].fd);
+        memcpy(p->buffer + p->fill, buffer + done, n);
+        p->fill += n;
+        done += n;
+        if (p->fill == FLASH_PATCH_BUFFER_SIZE || p->pos + p->fill == newsize) {
+            if (flash_patch_flush(p) < 0) {
+                return -1;
             }
-        }        
-    }
-out:
-    if (fp) fclose(fp);
-    if (io->private) {
-        aos_free(io->private);
-        io->private = NULL;
+        }
     }
-    return ret;
+    return length;
 }
 
-static int flash_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+/* the header is received: open the active rootfs to read and the inactive one to write */
+static int flash_patch_output(flash_patch_t *p)
 {
+    flash_priv_t *ctx = (flash_priv_t *)p->io->private;
+    bspatch_state_t *st = &p->patch.state;
+    char img_path[IMG_PATH_MAX_LEN];
+    unsigned long ffp;
+    uint64_t size;
+
+    p->old_fd = flash_active_open(p->io, IMG_NAME_ROOTFS);
+    if (p->old_fd < 0) {
+        return -1;
+    }
+    p->patch.oldsize = lseek(p->old_fd, 0, SEEK_END);
+    if (get_partition_info(p->io, IMG_NAME_ROOTFS, st->newsize, st->newpos, &p->leb, &size, &ffp, &p->fd,
+                           ctx->info.img_info[p->idx].dev_name, img_path) < 0) {
+        return -1;
+    }
+    LOGD(TAG, "patch %lld bytes to %s at %lld, old size:%lld",
+         st->newsize, ctx->info.img_info[p->idx].dev_name, st->newpos, p->patch.oldsize);
+    if (p->leb.size > 0) {
+        return flash_leb_restore(&p->leb, p->fd, st->newpos, st->newsize);
+    }
+    p->buffer = aos_malloc(FLASH_PATCH_BUFFER_SIZE);
+    if (p->buffer == NULL) {
+        return -ENOMEM;
+    }
+    p->pos = st->newpos;
     return 0;
 }
 
-static int _file_write(netio_t *io, int idx, uint8_t *buffer, int length)
+static void flash_patch_close(netio_t *io)
 {
-    int ret = -1;
-    FILE *fp;
-    int fd;
-    download_img_info_t *priv = (download_img_info_t *)io->private;
-
-    fp = priv->img_info[idx].fp;
-    fd = priv->img_info[idx].fd;
-    LOGD(TAG, "_file write fp: 0x%08x, fd: %d", fp, fd);
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    flash_patch_t *p = ctx->patch;
 
-    if (fp) {
-        ret = fwrite(buffer, sizeof(uint8_t), length, fp);
+    if (p == NULL) {
+        return;
     }
-    if (fd >= 0) {
-        ret = write(fd, buffer, length);
+    if (p->fd >= 0) {
+        close(p->fd);
     }
-
-    if (ret < 0) {
-        LOGE(TAG, "[%s, %d]write %d bytes failed, [fp:0x%08x, fd:%d], ret:%d, errno:%d",
-             __func__, __LINE__, length, fp, fd, ret, errno);
-        return -1;
+    if (p->old_fd >= 0) {
+        close(p->old_fd);
     }
-    if (fp) fflush(fp);
-    return ret;
+    flash_leb_free(&p->leb);
+    if (p->buffer) {
+        aos_free(p->buffer);
+    }
+    bspatch_free(&p->patch);
+    aos_free(p);
+    ctx->patch = NULL;
 }
 
-static int download_img_info_init(netio_t *io, uint8_t *buffer, int length, int buffer_save)
+/* done: bytes of the diff image written before, return 1 if it is stored for ota-burndiff */
+static int flash_patch_open(netio_t *io, int idx, uint64_t done)
 {
-    int headsize = 0;
-    pack_header_v2_t *header;
-
-    header = (pack_header_v2_t *)buffer;
-    download_img_info_t *priv = (download_img_info_t *)io->private;
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    char path[FOTA_SESSION_KEY_LEN];
+    bspatch_state_t state;
+    flash_patch_t *p;
+    FILE *fp;
 
-    if (length < sizeof(pack_header_v2_t)) {
-        LOGE(TAG, "the first size %d is less than %d", length, sizeof(pack_header_v2_t));
-        return -1;
-    }
-    if (buffer_save) {
-        FILE *headerfp = fopen(IMGHEADERPATH, "wb+");
-        if (!headerfp) {
-            LOGE(TAG, "create %s file failed.", IMGHEADERPATH);
-            return -1;
+    flash_file(io, IMGPATCHFILE, path);
+    if (done > 0) {
+        fp = fopen(path, "rb");
+        if (!fp) {
+            return 1;
         }
-        if (fwrite(buffer, 1, sizeof(pack_header_v2_t), headerfp) < 0) {
-            LOGE(TAG, "write %s failed.", IMGHEADERPATH);
-            fclose(headerfp);
+        int ok = fread(&state, 1, sizeof(bspatch_state_t), fp) == sizeof(bspatch_state_t) &&
+                 state.magic == BSPATCH_STATE_MAGIC && state.consumed == done;
+        fclose(fp);
+        if (!ok) {
+            LOGE(TAG, "the patch state does not match offset %lld.", (long long)done);
             return -1;
         }
-        fsync(fileno(headerfp));
-        fclose(headerfp);
+    } else {
+        unlink(path);
     }
-    LOGD(TAG, "head_version:%d, head_size:%d, checksum:0x%08x, count:%d, digest:%d, signature:%d",
-                header->head_version, header->head_size, header->head_checksum, header->image_count,
-                header->digest_type, header->signature_type);
-    headsize = header->head_size;
-    uint8_t *tempbuf = aos_zalloc(headsize);
-    if (!tempbuf) {
+    p = aos_zalloc(sizeof(flash_patch_t));
+    if (p == NULL) {
         return -ENOMEM;
     }
-    memcpy(tempbuf, buffer, headsize);
-    ((pack_header_v2_t *)tempbuf)->head_checksum = 0;
-    memset(((pack_header_v2_t *)tempbuf)->signature, 0, sizeof(((pack_header_v2_t *)tempbuf)->signature));
-    uint32_t cksum = get_checksum((uint8_t *)tempbuf, headsize);
-    aos_free(tempbuf);
-    if (cksum != header->head_checksum) {
-        LOGE(TAG, "the header checksum error.[0x%08x, 0x%08x]", header->head_checksum, cksum);
-        return -1;
-    }
-    FILE *imginfofp = fopen(IMGINFOFILE, "wb+");
-    if (!imginfofp) {
-        LOGE(TAG, "create %s file failed.", IMGINFOFILE);
-        return -1;
-    }
-    if (set_img_info(io, buffer) < 0) {
-        LOGE(TAG, "set imageinfo failed.");
-        return -1;
+    if (bspatch_init(&p->patch, FLASH_PATCH_BLOCK_SIZE, p, flash_patch_read_old, flash_patch_write_new) < 0) {
+        aos_free(p);
+        return -ENOMEM;
     }
-    if (fwrite(priv, 1, sizeof(download_img_info_t), imginfofp) < 0) {
-        LOGE(TAG, "write %s file failed.", IMGINFOFILE);
-        fclose(imginfofp);
-        return -1;
+    p->io = io;
+    p->idx = idx;
+    p->fd = -1;
+    p->old_fd = -1;
+    ctx->patch = p;
+    // the patch is not stored, no partition limits the writes
+    ctx->info.img_info[idx].partition_size = UINT64_MAX / 2;
+    if (done > 0) {
+        p->patch.state = state;
+        if (state.stage != BSPATCH_STAGE_HEADER) {
+            return flash_patch_output(p);
+        }
     }
-    fsync(fileno(imginfofp));
-    fclose(imginfofp);
-
     return 0;
 }
 
-static int download_img_info_init_from_file(netio_t *io)
+/* not a bsdiff patch: store it for ota-burndiff, with the header received */
+static int flash_patch_fallback(netio_t *io, const uint8_t *buffer, int length)
 {
-    int ret;
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    flash_patch_t *p = ctx->patch;
+    char path[FOTA_SESSION_KEY_LEN];
+    unsigned long ffp;
+    int idx = p->idx;
+    int fd;
+
+    LOGD(TAG, "the diff image is stored for ota-burndiff.");
+    if (get_partition_info(io, IMG_NAME_DIFF, ctx->info.img_info[idx].img_size, 0, &ctx->leb[idx],
+                           &ctx->info.img_info[idx].partition_size, &ffp, &fd,
+                           ctx->info.img_info[idx].dev_name, ctx->info.img_info[idx].img_path) < 0) {
+        return -1;
+    }
+    ctx->info.img_info[idx].fd = fd;
+    if (write(fd, p->patch.state.buf, p->patch.state.fill) != p->patch.state.fill ||
+        write(fd, buffer, length) != length) {
+        LOGE(TAG, "write diff temp file failed, errno:%d", errno);
+        return -1;
+    }
+    flash_patch_close(io);
+    unlink(flash_file(io, IMGPATCHFILE, path));
+    return 0;
+}
+
+static int flash_patch_write(netio_t *io, int idx, const uint8_t *buffer, int length)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    flash_patch_t *p = ctx->patch;
+    bspatch_state_t *st = &p->patch.state;
+    uint64_t end = ctx->info.img_info[idx].write_size + length;
+    int n = 0;
+
+    if (p->broken) {
+        return -1;
+    }
+    if (st->stage == BSPATCH_STAGE_HEADER) {
+        n = BSPATCH_HEADER_SIZE - st->fill;
+        if (n > length) {
+            n = length;
+        }
+        if (bspatch_write(&p->patch, buffer, n) < 0) {
+            return flash_patch_fallback(io, buffer + n, length - n) < 0 ? -1 : length;
+        }
+        if (st->stage == BSPATCH_STAGE_HEADER) {
+            if (end < ctx->info.img_info[idx].img_size) {
+                return length;
+            }
+            return flash_patch_fallback(io, buffer + n, length - n) < 0 ? -1 : length;
+        }
+        if (flash_patch_output(p) < 0) {
+            p->broken = 1;
+            return -1;
+        }
+    }
+    if (bspatch_write(&p->patch, buffer + n, length - n) < 0) {
+        p->broken = 1;
+        return -1;
+    }
+    if (end == ctx->info.img_info[idx].img_size && st->stage != BSPATCH_STAGE_DONE) {
+        LOGE(TAG, "the patch ends at %lld of %lld bytes.", st->newpos, st->newsize);
+        p->broken = 1;
+        return -1;
+    }
+    return length;
+}
+
+/* the new data is on flash before the state, a broken patch starts over */
+static int flash_patch_sync(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    flash_patch_t *p = ctx->patch;
+    char path[FOTA_SESSION_KEY_LEN];
+    FILE *fp;
+
+    if (p == NULL) {
+        return 0;
+    }
+    flash_file(io, IMGPATCHFILE, path);
+    if (p->broken) {
+        // without the state flash_patch_open takes the diff as stored for ota-burndiff, so restart the update
+        LOGE(TAG, "the patch is broken, restart the update.");
+        unlink(path);
+        fota_offset_set(io->session, 0);
+        return -1;
+    }
+    if (p->fd >= 0) {
+        if (p->leb.size > 0) {
+            if (flash_leb_commit(&p->leb, p->fd) < 0) {
+                return -1;
+            }
+        } else if (flash_patch_flush(p) < 0 || fsync(p->fd) < 0) {
+            LOGE(TAG, "sync the patched rootfs failed, errno:%d", errno);
+            return -1;
+        }
+    }
+    fp = fopen(path, "wb+");
+    if (!fp) {
+        LOGE(TAG, "create %s file failed.", path);
+        return -1;
+    }
+    if (fwrite(&p->patch.state, 1, sizeof(bspatch_state_t), fp) != sizeof(bspatch_state_t)) {
+        LOGE(TAG, "write %s file failed.", path);
+        fclose(fp);
+        return -1;
+    }
+    fsync(fileno(fp));
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * A compressed or sparse image is decompressed while downloading, the pack header has the compression of each image.
+ * img_info.write_size counts the compressed bytes as for the other images,
+ * the state and the frame in memory are saved to IMGUNPACKFILE at every sync to resume.
+ */
+#define FLASH_FILL_SIZE (64 * 1024)             /* the pattern written at a time */
+
+static int flash_unpack_put(flash_unpack_t *p, uint64_t pos, const uint8_t *buffer, int length)
+{
+    flash_priv_t *ctx = (flash_priv_t *)p->io->private;
+    download_img_info_t *priv = &ctx->info;
+    int idx = p->idx;
+
+    if (pos + length > priv->img_info[idx].unpack_size) {
+        LOGE(TAG, "%s is larger than %lld bytes decompressed.", priv->img_info[idx].img_name,
+             (long long)priv->img_info[idx].unpack_size);
+        return -1;
+    }
+    if (ctx->leb[idx].size > 0) {
+        return flash_leb_write(&ctx->leb[idx], priv->img_info[idx].fd, pos, priv->img_info[idx].unpack_size,
+                               buffer, length);
+    }
+    if (write(priv->img_info[idx].fd, buffer, length) != length) {
+        LOGE(TAG, "write %d bytes at %lld failed, errno:%d", length, pos, errno);
+        return -1;
+    }
+    return length;
+}
+
+static int flash_unpack_out(void *arg, const uint8_t *buffer, int length)
+{
+    flash_unpack_t *p = (flash_unpack_t *)arg;
+
+    return flash_unpack_put(p, p->unpack.state.out_pos, buffer, length);
+}
+
+/* a sparse FILL or DONT_CARE chunk, a block device zeroes or discards it without the data */
+static int flash_unpack_fill(void *arg, uint32_t pattern, uint64_t length, int care)
+{
+    flash_unpack_t *p = (flash_unpack_t *)arg;
+    flash_priv_t *ctx = (flash_priv_t *)p->io->private;
+    download_img_info_t *priv = &ctx->info;
+    uint64_t pos = p->unpack.state.out_pos;
+    int fd = priv->img_info[p->idx].fd;
+    uint32_t *buffer;
+    struct stat st;
+
+    if (pos + length > priv->img_info[p->idx].unpack_size) {
+        LOGE(TAG, "%s is larger than %lld bytes unpacked.", priv->img_info[p->idx].img_name,
+             (long long)priv->img_info[p->idx].unpack_size);
+        return -1;
+    }
+    // a UBI volume is written in order, the rest can be seeked
+    if (ctx->leb[p->idx].size == 0 && fstat(fd, &st) == 0 && (S_ISBLK(st.st_mode) || S_ISREG(st.st_mode))) {
+        uint64_t range[2] = {pos, length};
+
+        if (!care) {
+            // the data doesn't matter, the device may drop it
+            if (S_ISBLK(st.st_mode) && ioctl(fd, BLKDISCARD, &range) != 0) {
+                LOGD(TAG, "discard %lld bytes at %lld failed, errno:%d", length, pos, errno);
+            }
+            return lseek(fd, (off_t)(pos + length), SEEK_SET) < 0 ? -1 : 0;
+        }
+        if (pattern == 0 && S_ISBLK(st.st_mode)) {
+            if (ioctl(fd, BLKZEROOUT, &range) == 0) {
+                return lseek(fd, (off_t)(pos + length), SEEK_SET) < 0 ? -1 : 0;
+            }
+            LOGD(TAG, "zero out %lld bytes at %lld failed, errno:%d", length, pos, errno);
+        }
+    }
+    buffer = aos_malloc(FLASH_FILL_SIZE);
+    if (buffer == NULL) {
+        return -ENOMEM;
+    }
+    for (int i = 0; i < FLASH_FILL_SIZE / 4; i++) {
+        buffer[i] = pattern;
+    }
+    while (length > 0) {
+        int n = length < FLASH_FILL_SIZE ? length : FLASH_FILL_SIZE;
+
+        if (flash_unpack_put(p, pos, (uint8_t *)buffer, n) < 0) {
+            aos_free(buffer);
+            return -1;
+        }
+        pos += n;
+        length -= n;
+    }
+    aos_free(buffer);
+    return 0;
+}
+
+static void flash_unpack_close(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+
+    if (ctx->unpack == NULL) {
+        return;
+    }
+    unpack_free(&ctx->unpack->unpack);
+    aos_free(ctx->unpack);
+    ctx->unpack = NULL;
+}
+
+/* done: the compressed bytes of the image written before */
+static int flash_unpack_open(netio_t *io, int idx, uint64_t done)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    char path[FOTA_SESSION_KEY_LEN];
+    unpack_state_t state;
+    uint8_t *frame = NULL;
+    flash_unpack_t *p;
+    FILE *fp;
+    int ok;
+
+    flash_unpack_close(io);
+    p = aos_zalloc(sizeof(flash_unpack_t));
+    if (p == NULL) {
+        return -ENOMEM;
+    }
+    if (unpack_init(&p->unpack, ctx->info.img_info[idx].compress, p, flash_unpack_out, flash_unpack_fill) < 0) {
+        unpack_free(&p->unpack);
+        aos_free(p);
+        return -1;
+    }
+    p->io = io;
+    p->idx = idx;
+    ctx->unpack = p;
+    if (done == 0) {
+        return 0;
+    }
+    fp = fopen(flash_file(io, IMGUNPACKFILE, path), "rb");
+    if (!fp) {
+        LOGE(TAG, "the unpack state of %s is lost.", ctx->info.img_info[idx].img_name);
+        return -1;
+    }
+    ok = fread(&state, 1, sizeof(unpack_state_t), fp) == sizeof(unpack_state_t) &&
+         state.magic == UNPACK_STATE_MAGIC && state.consumed == done && state.fill <= CONFIG_FOTA_UNPACK_FRAME_SIZE + 8;
+    if (ok) {
+        frame = aos_malloc(state.fill + 1);
+        ok = frame && fread(frame, 1, state.fill, fp) == state.fill;
+    }
+    fclose(fp);
+    if (!ok || unpack_resume(&p->unpack, &state, frame) < 0) {
+        LOGE(TAG, "the unpack state does not match offset %lld.", (long long)done);
+        if (frame) aos_free(frame);
+        return -1;
+    }
+    aos_free(frame);
+    LOGD(TAG, "resume %s at %lld, %lld bytes decompressed", ctx->info.img_info[idx].img_name, (long long)done,
+         (long long)state.out_pos);
+    return 0;
+}
+
+/* the image is resumed at write_size */
+static int flash_unpack_seek(netio_t *io, int idx)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    uint64_t pos = 0;
+
+    flash_unpack_close(io);
+    if (priv->img_info[idx].write_size > 0) {
+        if (flash_unpack_open(io, idx, priv->img_info[idx].write_size) < 0) {
+            return -1;
+        }
+        pos = ctx->unpack->unpack.state.out_pos;
+    }
+    if (priv->img_info[idx].fd >= 0)
+        lseek(priv->img_info[idx].fd, (off_t)pos, 0);
+    return flash_leb_restore(&ctx->leb[idx], priv->img_info[idx].fd, pos, priv->img_info[idx].unpack_size);
+}
+
+static int flash_unpack_write(netio_t *io, int idx, const uint8_t *buffer, int length)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    flash_unpack_t *p = ctx->unpack;
+    unpack_state_t *st;
+
+    if (p == NULL || p->idx != idx) {
+        if (flash_unpack_open(io, idx, 0) < 0) {
+            return -1;
+        }
+        p = ctx->unpack;
+    }
+    st = &p->unpack.state;
+    if (p->broken) {
+        return -1;
+    }
+    if (unpack_write(&p->unpack, buffer, length) < 0) {
+        p->broken = 1;
+        return -1;
+    }
+    if (priv->img_info[idx].write_size + length == priv->img_info[idx].img_size) {
+        if (!st->done || st->out_pos != priv->img_info[idx].unpack_size) {
+            LOGE(TAG, "%s ends at %lld of %lld bytes decompressed.", priv->img_info[idx].img_name,
+                 (long long)st->out_pos, (long long)priv->img_info[idx].unpack_size);
+            p->broken = 1;
+            return -1;
+        }
+        LOGD(TAG, "%s decompressed, %lld -> %lld bytes", priv->img_info[idx].img_name,
+             (long long)priv->img_info[idx].img_size, (long long)priv->img_info[idx].unpack_size);
+    }
+    return length;
+}
+
+/* the image is on flash before the state, a broken image starts over */
+static int flash_unpack_sync(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    flash_unpack_t *p = ctx->unpack;
+    char path[FOTA_SESSION_KEY_LEN];
+    FILE *fp;
+
+    if (p == NULL) {
+        return 0;
+    }
+    flash_file(io, IMGUNPACKFILE, path);
+    if (p->broken) {
+        unlink(path);
+        return -1;
+    }
+    fp = fopen(path, "wb+");
+    if (!fp) {
+        LOGE(TAG, "create %s file failed.", path);
+        return -1;
+    }
+    if (fwrite(&p->unpack.state, 1, sizeof(unpack_state_t), fp) != sizeof(unpack_state_t) ||
+        fwrite(p->unpack.in, 1, p->unpack.state.fill, fp) != p->unpack.state.fill) {
+        LOGE(TAG, "write %s file failed.", path);
+        fclose(fp);
+        return -1;
+    }
+    fsync(fileno(fp));
+    fclose(fp);
+    return 0;
+}
+
+/* the progress of the data decompressed, none if no image is compressed */
+static void flash_unpack_progress(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    uint64_t unpacked = io->offset > 0 ? priv->head_size : 0;
+    uint64_t unpacked_size = priv->head_size;
+    int compressed = 0;
+
+    for (int i = 0; i < priv->image_count; i++) {
+        uint64_t start = priv->img_info[i].img_offset;
+        uint64_t done = io->offset > start ? io->offset - start : 0;
+
+        // write_size is of the images from the last seek on
+        if (done > priv->img_info[i].img_size)
+            done = priv->img_info[i].img_size;
+        unpacked_size += priv->img_info[i].unpack_size;
+        if (!priv->img_info[i].compress) {
+            unpacked += done;
+            continue;
+        }
+        compressed = 1;
+        if (ctx->unpack && ctx->unpack->idx == i) {
+            unpacked += ctx->unpack->unpack.state.out_pos;
+        } else if (done == priv->img_info[i].img_size) {
+            unpacked += priv->img_info[i].unpack_size;
+        }
+    }
+    io->unpacked = compressed ? unpacked : 0;
+    io->unpacked_size = compressed ? unpacked_size : 0;
+}
+
+/* head_version 4: the image table with 64-bit sizes, NULL: the one in pack_header_v2_t */
+static const pack_header_size64_t *pack_header_size64(const uint8_t *buffer)
+{
+    const pack_header_v2_t *header = (const pack_header_v2_t *)buffer;
+    const pack_header_size64_t *size64;
+
+    if (header->head_version < 4 ||
+        header->head_size < sizeof(pack_header_v2_t) + sizeof(pack_header_digest_t) + sizeof(pack_header_size64_t)) {
+        return NULL;
+    }
+    size64 = (const pack_header_size64_t *)(buffer + sizeof(pack_header_v2_t) + sizeof(pack_header_digest_t));
+    return size64->magic == PACK_SIZE64_MAGIC ? size64 : NULL;
+}
+
+/* the offset and size of image i in the pack, unpack_size: the size written to the partition */
+static void pack_image_size(const uint8_t *buffer, int i, uint64_t *offset, uint64_t *size, uint64_t *unpack_size)
+{
+    const pack_header_v2_t *header = (const pack_header_v2_t *)buffer;
+    const pack_header_size64_t *size64 = pack_header_size64(buffer);
+
+    if (size64) {
+        *offset = size64->image[i].offset;
+        *size = size64->image[i].size;
+        *unpack_size = header->compress[i] ? size64->image[i].unpack_size : *size;
+    } else {
+        *offset = header->image_info[i].offset;
+        *size = header->image_info[i].size;
+        *unpack_size = header->compress[i] ? header->unpack_size[i] : *size;
+    }
+}
+
+// offset: where the download resumes, 0: start a new update
+static int set_img_info(netio_t *io, uint8_t *buffer, uint64_t offset)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    pack_header_v2_t *header = (pack_header_v2_t *)buffer;
+    pack_header_imginfo_v2_t *imginfo = header->image_info;
+    pack_header_digest_t *digest = NULL;
+
+    LOGD(TAG, "come to set image info.");
+    if (header->magic != PACK_HEAD_MAGIC) {
+        LOGE(TAG, "the image header is wrong.");
+        return -1;
+    }
+    if (header->image_count > IMG_MAX_COUNT) {
+        LOGE(TAG, "the image count is overflow.");
+        return -1;
+    }
+    if (header->head_version >= 3 && header->head_size >= sizeof(pack_header_v2_t) + sizeof(pack_header_digest_t)) {
+        digest = (pack_header_digest_t *)(buffer + sizeof(pack_header_v2_t));
+        if (digest->magic != PACK_DIGEST_MAGIC) {
+            LOGW(TAG, "unknown header extension 0x%08x", digest->magic);
+            digest = NULL;
+        }
+    }
+    priv->image_count = header->image_count;
+    priv->head_size = header->head_size;
+    priv->digest_type = header->digest_type;
+    priv->signature_type = header->signature_type;
+    memcpy(priv->md5sum, header->md5sum, sizeof(priv->md5sum));
+    memcpy(priv->signature, header->signature, sizeof(priv->signature));
+    LOGD(TAG, "image count is :%d", header->image_count);
+    if (header->head_version >= 4 && pack_header_size64(buffer) == NULL) {
+        LOGE(TAG, "the 64-bit image table is missing.");
+        return -1;
+    }
+    for (int i = 0; i < header->image_count; i++) {
+        memcpy(priv->img_info[i].img_name, imginfo->img_name, IMG_NAME_MAX_LEN);
+        pack_image_size(buffer, i, &priv->img_info[i].img_offset, &priv->img_info[i].img_size,
+                        &priv->img_info[i].unpack_size);
+        priv->img_info[i].compress = header->compress[i];
+        LOGD(TAG, "-------> %s", imginfo->img_name);
+        LOGD(TAG, "offset:%lld", (long long)priv->img_info[i].img_offset);
+        LOGD(TAG, "size:%lld", (long long)priv->img_info[i].img_size);
+        if (header->compress[i] >= UNPACK_TYPE_END ||
+            (header->compress[i] && strcmp(imginfo->img_name, IMG_NAME_DIFF) == 0)) {
+            LOGE(TAG, "the compression %d of %s is not supported.", header->compress[i], imginfo->img_name);
+            return -1;
+        }
+        // the digest of what the partition has, so only a raw image
+        memset(priv->img_info[i].sha256, 0, sizeof(priv->img_info[i].sha256));
+        if (digest && !header->compress[i]) {
+            memcpy(priv->img_info[i].sha256, digest->sha256[i], sizeof(priv->img_info[i].sha256));
+        }
+        priv->img_info[i].skipped = 0;
+        priv->img_info[i].fp = NULL;
+        priv->img_info[i].fd = -1;
+        unsigned long ffp;
+        uint64_t done = offset > priv->img_info[i].img_offset ? offset - priv->img_info[i].img_offset : 0;
+        if (done > priv->img_info[i].img_size)
+            done = priv->img_info[i].img_size;
+        int ret = 1;
+        ffp = 0;
+        if (strcmp(priv->img_info[i].img_name, IMG_NAME_DIFF) == 0) {
+            ret = flash_patch_open(io, i, done);
+        }
+        if (ret > 0) {
+            // only whether the image is started or finished matters, the compressed sizes are not comparable
+            if (priv->img_info[i].compress && done > 0)
+                done = done == priv->img_info[i].img_size ? priv->img_info[i].unpack_size : 1;
+            ret = get_partition_info(io, priv->img_info[i].img_name, priv->img_info[i].unpack_size, done, &ctx->leb[i],
+                                     &priv->img_info[i].partition_size, &ffp, &priv->img_info[i].fd,
+                                     priv->img_info[i].dev_name, priv->img_info[i].img_path);
+        }
+        if (ret < 0) {
+            LOGE(TAG, "get partition info error.");
+            return -1;
+        }
+        priv->img_info[i].fp = (FILE *)ffp;
+        LOGD(TAG, "@@@priv->img_info[%d].fp:0x%08x, fd:%d", i, priv->img_info[i].fp, priv->img_info[i].fd);
+        imginfo++;
+    }
+    return 0;
+}
+
+static int get_img_index(netio_t *io, uint64_t cur_offset)
+{
+    int i;
+    uint64_t offsets[IMG_MAX_COUNT + 1];
+
+    download_img_info_t *priv = &((flash_priv_t *)io->private)->info;
+    LOGD(TAG, "%s, cur_offset: %lld", __func__, (long long)cur_offset);
+    if (cur_offset == 0) {
+        return 0;
+    }
+    for (i = 0; i < IMG_MAX_COUNT + 1; i++) {
+        offsets[i] = ~0;
+    }
+    for (i = 0; i < priv->image_count; i++) {
+        offsets[i] = priv->img_info[i].img_offset;
+        LOGD(TAG, "offsets[%d]: %lld", i, (long long)offsets[i]);
+    }
+    for (i = 0; i < priv->image_count; i++) {
+        LOGD(TAG, "offsets[%d]: %lld, offsets[%d]: %lld", i, (long long)offsets[i], i+1, (long long)offsets[i+1]);
+        if(cur_offset >= offsets[i] && cur_offset < offsets[i+1]) {
+            LOGD(TAG, "Range Num: %d", i);
+            return i;
+        }
+    }
+    LOGE(TAG, "get img index error.");
+    return -1;
+}
+
+static int flash_open(netio_t *io, const char *path)
+{
+    io->block_size = CONFIG_FOTA_BUFFER_SIZE;
+
+    flash_priv_t *ctx = aos_zalloc(sizeof(flash_priv_t));
+    if (ctx == NULL) {
+        return -ENOMEM;
+    }
+    io->private = ctx;
+    ctx->zsync.old_fd = -1;
+    if (FILE_SYSTEM_IS_EXT4()) {
+        if (get_emmc_valid_partition_info(&ctx->partition_info) < 0) {
+            aos_free(io->private);
+            return -1;
+        }
+    } else if (FILE_SYSTEM_IS_UBI()) {
+        // a copy, the sizes are filled per io
+        ctx->partition_info = aos_malloc(sizeof(g_partition_info_ubi));
+        if (ctx->partition_info == NULL) {
+            aos_free(io->private);
+            return -ENOMEM;
+        }
+        memcpy(ctx->partition_info, g_partition_info_ubi, sizeof(g_partition_info_ubi));
+    } else {
+        aos_free(io->private);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int flash_close(netio_t *io)
+{
+    int i;
+    int ret = 0;
+    uint64_t total_size;
+    char path[FOTA_SESSION_KEY_LEN];
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+
+    aos_free(ctx->partition_info);
+    // save to file first
+    FILE *fp = fopen(flash_file(io, IMGINFOFILE, path), "wb+");
+    if (!fp) {
+        LOGE(TAG, "open %s file failed.", path);
+        ret = -1;
+        goto out;
+    }
+    if (fwrite(priv, 1, sizeof(download_img_info_t), fp) < 0) {
+        ret = -1;
+        goto out;
+    }
+    fsync(fileno(fp));
+
+    total_size = priv->head_size;
+    for (i = 0; i < priv->image_count; i++) {
+        total_size += priv->img_info[i].img_size;
+    }
+    LOGD(TAG, "flash close, total_size:%lld, io->offset:%lld", (long long)total_size, (long long)io->offset);
+
+out:
+    // a resumed download opens them again, a UBI volume has only one writer
+    for (i = 0; i < priv->image_count; i++) {
+        if (priv->img_info[i].fp) {
+            fclose(priv->img_info[i].fp);
+            LOGD(TAG, "close 0x%08x", priv->img_info[i].fp);
+        }
+        if (priv->img_info[i].fd > 0) {
+            close(priv->img_info[i].fd);
+            LOGD(TAG, "close %d", priv->img_info[i].fd);
+        }
+        flash_leb_free(&ctx->leb[i]);
+    }
+    flash_patch_close(io);
+    flash_unpack_close(io);
+    flash_zsync_free(io);
+    if (fp) fclose(fp);
+    if (io->private) {
+        aos_free(io->private);
+        io->private = NULL;
+    }
+    return ret;
+}
+
+static int flash_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+{
+    return 0;
+}
+
+static int _file_write(netio_t *io, int idx, uint8_t *buffer, int length)
+{
+    int ret = -1;
+    FILE *fp;
+    int fd;
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+
+    fp = priv->img_info[idx].fp;
+    fd = priv->img_info[idx].fd;
+    LOGD(TAG, "_file write fp: 0x%08x, fd: %d", fp, fd);
+    if (ctx->patch && ctx->patch->idx == idx) {
+        return flash_patch_write(io, idx, buffer, length);
+    }
+    if (priv->img_info[idx].compress) {
+        return flash_unpack_write(io, idx, buffer, length);
+    }
+    if (ctx->leb[idx].size > 0) {
+        return flash_leb_write(&ctx->leb[idx], fd,
+                               priv->img_info[idx].write_size, priv->img_info[idx].img_size, buffer, length);
+    }
+
+    if (fp) {
+        ret = fwrite(buffer, sizeof(uint8_t), length, fp);
+    }
+    if (fd >= 0) {
+        ret = write(fd, buffer, length);
+    }
+
+    if (ret < 0) {
+        LOGE(TAG, "[%s, %d]write %d bytes failed, [fp:0x%08x, fd:%d], ret:%d, errno:%d",
+             __func__, __LINE__, length, fp, fd, ret, errno);
+        return -1;
+    }
+    if (fp) fflush(fp);
+    return ret;
+}
+
+/* the checks of the header alone: the checksum and the image table, length: the bytes of buffer */
+static int pack_header_check(const uint8_t *buffer, int length)
+{
+    const pack_header_v2_t *header = (const pack_header_v2_t *)buffer;
+    uint64_t end;
+
+    if (length < sizeof(pack_header_v2_t) || header->magic != PACK_HEAD_MAGIC) {
+        LOGE(TAG, "the image header is wrong.");
+        return -1;
+    }
+    LOGD(TAG, "head_version:%d, head_size:%d, checksum:0x%08x, count:%d, digest:%d, signature:%d",
+                header->head_version, header->head_size, header->head_checksum, header->image_count,
+                header->digest_type, header->signature_type);
+    if (header->head_size < sizeof(pack_header_v2_t) || header->head_size > length) {
+        LOGE(TAG, "the header size %d is wrong.", header->head_size);
+        return -1;
+    }
+    uint8_t *tempbuf = aos_malloc(header->head_size);
+    if (!tempbuf) {
+        return -ENOMEM;
+    }
+    memcpy(tempbuf, buffer, header->head_size);
+    ((pack_header_v2_t *)tempbuf)->head_checksum = 0;
+    memset(((pack_header_v2_t *)tempbuf)->signature, 0, sizeof(((pack_header_v2_t *)tempbuf)->signature));
+    uint32_t cksum = get_checksum(tempbuf, header->head_size);
+    aos_free(tempbuf);
+    if (cksum != header->head_checksum) {
+        LOGE(TAG, "the header checksum error.[0x%08x, 0x%08x]", header->head_checksum, cksum);
+        return -1;
+    }
+    if (header->image_count == 0 || header->image_count > IMG_MAX_COUNT) {
+        LOGE(TAG, "the image count %d is wrong.", header->image_count);
+        return -1;
+    }
+    if (header->head_version >= 4 && pack_header_size64(buffer) == NULL) {
+        LOGE(TAG, "the 64-bit image table is missing.");
+        return -1;
+    }
+    // the images follow the header one after another, the download goes by the offsets
+    end = header->head_size;
+    for (int i = 0; i < header->image_count; i++) {
+        const pack_header_imginfo_v2_t *imginfo = &header->image_info[i];
+        uint64_t offset, size, unpack_size;
+
+        pack_image_size(buffer, i, &offset, &size, &unpack_size);
+        if (memchr(imginfo->img_name, 0, IMG_NAME_MAX_LEN) == NULL || offset != end) {
+            LOGE(TAG, "the image %d in the header is wrong.", i);
+            return -1;
+        }
+        if (header->compress[i] >= UNPACK_TYPE_END ||
+            (header->compress[i] && strcmp(imginfo->img_name, IMG_NAME_DIFF) == 0)) {
+            LOGE(TAG, "the compression %d of %s is not supported.", header->compress[i], imginfo->img_name);
+            return -1;
+        }
+        end += size;
+    }
+    return 0;
+}
+
+/* the size of the partition, the inactive one of an A/B image, without opening it for writing */
+static int pack_partition_size(struct partition_info_t *table, const char *img_name, uint64_t *bytes)
+{
+    int ab = 0;
+    int fd;
+
+    if (strcmp(img_name, IMG_NAME_KERNEL) == 0) {
+        ab = check_kernel_partition() == 1 ? 2 : 1;
+    } else if (strcmp(img_name, IMG_NAME_ROOTFS) == 0) {
+        ab = check_rootfs_partition() == 1 ? 2 : 1;
+    } else if (strcmp(img_name, IMG_NAME_UBOOT) != 0) {
+        ab = check_partition_ab(img_name);
+    }
+    for (int i = 0; table[i].size != 0; i++) {
+        if (strcmp(table[i].img_name, img_name) != 0 || (ab && table[i].ab != ab)) {
+            continue;
+        }
+        if (FILE_SYSTEM_IS_UBI() && strcmp(img_name, IMG_NAME_UBOOT) != 0) {
+            long long bytes2;
+            extern int get_ubi_info(const char *ubi_name, long long *bytes2);
+            if (get_ubi_info(table[i].dev_name, &bytes2)) {
+                LOGE(TAG, "get %s length error.", table[i].dev_name);
+                return -1;
+            }
+            *bytes = bytes2;
+            return 0;
+        }
+        // uboot is written by ota-burnuboot, the size of the device
+        fd = open(table[i].char_name[0] ? table[i].char_name : table[i].dev_name, O_RDONLY);
+        if (fd < 0) {
+            LOGE(TAG, "open %s failed.[errno:%d]", table[i].dev_name, errno);
+            return -1;
+        }
+        if (FILE_SYSTEM_IS_UBI()) {
+            mtd_info_t meminfo;
+            if (ioctl(fd, MEMGETINFO, &meminfo) != 0) {
+                LOGE(TAG, "ioctl(MEMGETINFO) error,[fd:%d][errno:%d]", fd, errno);
+                close(fd);
+                return -1;
+            }
+            *bytes = meminfo.size;
+        } else if (ioctl(fd, BLKGETSIZE64, bytes) != 0) {
+            LOGE(TAG, "ioctl(BLKGETSIZE64) error,[fd:%d][errno:%d]", fd, errno);
+            close(fd);
+            return -1;
+        }
+        close(fd);
+        return 0;
+    }
+    LOGE(TAG, "no partition for %s.", img_name);
+    return -1;
+}
+
+/* the size of a temp file, 0 if it doesn't exist */
+static uint64_t pack_file_size(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+int flash_pack_preflight(const char *session, const uint8_t *buffer, int length)
+{
+    const pack_header_v2_t *header = (const pack_header_v2_t *)buffer;
+    struct partition_info_t *table = NULL;
+    char path[FOTA_SESSION_KEY_LEN];
+    struct statvfs vfs;
+    uint64_t need = 0;
+    uint64_t avail;
+    uint64_t bytes;
+    int ret = -1;
+
+    if (pack_header_check(buffer, length) < 0) {
+        return -1;
+    }
+    if (FILE_SYSTEM_IS_EXT4()) {
+        if (get_emmc_valid_partition_info(&table) < 0) {
+            return -1;
+        }
+    } else if (FILE_SYSTEM_IS_UBI()) {
+        table = g_partition_info_ubi;
+    } else {
+        return -1;
+    }
+    if (statvfs("/", &vfs) < 0) {
+        goto out;
+    }
+    avail = (uint64_t)vfs.f_bavail * vfs.f_bsize;
+    for (int i = 0; i < header->image_count; i++) {
+        const char *name = header->image_info[i].img_name;
+        uint64_t offset, packed_size, size;
+
+        pack_image_size(buffer, i, &offset, &packed_size, &size);
+
+        // written to a temp file first, a resumed download has part of it
+        if (strcmp(name, IMG_NAME_DIFF) == 0 || strcmp(name, IMG_NAME_UBOOT) == 0) {
+            char *namepath = NULL;
+            const char *file = strcmp(name, IMG_NAME_DIFF) == 0 ?
+                               fota_session_name(session, "/"IMG_NAME_DIFF, path, sizeof(path)) :
+                               (namepath = strdup_img_path(name));
+            if (file == NULL) {
+                goto out;
+            }
+            avail += pack_file_size(file);
+            need += size;
+            if (namepath) aos_free(namepath);
+            if (strcmp(name, IMG_NAME_DIFF) == 0) {
+                continue;
+            }
+        }
+        if (pack_partition_size(table, name, &bytes) < 0) {
+            goto out;
+        }
+        if (size > bytes) {
+            LOGE(TAG, "the %s[%lld] is larger than the partition[%lld].", name, size, bytes);
+            goto out;
+        }
+    }
+    if (need >= avail) {
+        LOGE(TAG, "the temp files[%lld] are larger than disk space[%lld].", need, avail);
+        goto out;
+    }
+    LOGI(TAG, "the pack header is checked, %d images.", header->image_count);
+    ret = 0;
+out:
+    if (table && table != g_partition_info_ubi) {
+        aos_free(table);
+    }
+    return ret;
+}
+
+static int download_img_info_init(netio_t *io, uint8_t *buffer, int length, int buffer_save, uint64_t offset)
+{
+    pack_header_v2_t *header;
+    char path[FOTA_SESSION_KEY_LEN];
+
+    header = (pack_header_v2_t *)buffer;
+    download_img_info_t *priv = &((flash_priv_t *)io->private)->info;
+
+    if (length < sizeof(pack_header_v2_t) || length < header->head_size) {
+        LOGE(TAG, "the first size %d is less than %d", length,
+             header->head_size > sizeof(pack_header_v2_t) ? header->head_size : sizeof(pack_header_v2_t));
+        return -1;
+    }
+    if (buffer_save) {
+        FILE *headerfp = fopen(flash_file(io, IMGHEADERPATH, path), "wb+");
+        if (!headerfp) {
+            LOGE(TAG, "create %s file failed.", path);
+            return -1;
+        }
+        // with the extension, the header checksum covers it
+        if (fwrite(buffer, 1, header->head_size > sizeof(pack_header_v2_t) ? header->head_size : sizeof(pack_header_v2_t),
+                   headerfp) < 0) {
+            LOGE(TAG, "write %s failed.", path);
+            fclose(headerfp);
+            return -1;
+        }
+        fsync(fileno(headerfp));
+        fclose(headerfp);
+    }
+    if (pack_header_check(buffer, length) < 0) {
+        return -1;
+    }
+    FILE *imginfofp = fopen(flash_file(io, IMGINFOFILE, path), "wb+");
+    if (!imginfofp) {
+        LOGE(TAG, "create %s file failed.", path);
+        return -1;
+    }
+    if (set_img_info(io, buffer, offset) < 0) {
+        LOGE(TAG, "set imageinfo failed.");
+        return -1;
+    }
+    if (fwrite(priv, 1, sizeof(download_img_info_t), imginfofp) < 0) {
+        LOGE(TAG, "write %s file failed.", path);
+        fclose(imginfofp);
+        return -1;
+    }
+    fsync(fileno(imginfofp));
+    fclose(imginfofp);
+
+    return 0;
+}
+
+static int download_img_info_init_from_file(netio_t *io, uint64_t offset)
+{
+    int ret;
     int fd;
     uint8_t *buffer;
     uint64_t length;
+    char path[FOTA_SESSION_KEY_LEN];
+
+    fd = open(flash_file(io, IMGHEADERPATH, path), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    buffer = NULL;
+    length = lseek(fd, 0, SEEK_END);
+    if (length <= 0) {
+        ret = -1;
+        goto out;
+    }
+    buffer = aos_zalloc(length);
+    if (buffer == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    lseek(fd, 0, SEEK_SET);
+    if (read(fd, buffer, length) != length) {
+        ret = -1;
+        goto out;
+    }
+    ret = download_img_info_init(io, buffer, length, 0, offset);
+    if (ret < 0) {
+        ret = -1;
+        goto out;
+    }
+    ret = 0;
+out:
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (buffer) {
+        aos_free(buffer);
+    }
+    return ret;
+}
+
+static void img_digest_reset(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    char path[FOTA_SESSION_KEY_LEN];
+
+    ctx->digest_valid = 0;
+    unlink(flash_file(io, IMGDIGESTFILE, path));
+}
+
+/* the same data as fota_data_verify: MD5 of the images, or SHA of the signed header(signature zeroed) and the images */
+static int img_digest_start(netio_t *io, uint8_t *buffer)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    pack_header_v2_t *header;
+    uint32_t head_len;
+
+    img_digest_reset(io);
+    memset(&ctx->digest, 0, sizeof(img_digest_t));
+    ctx->digest.magic = IMG_DIGEST_MAGIC;
+    ctx->digest.digest_type = ((pack_header_v2_t *)buffer)->digest_type;
+    if (ctx->digest.digest_type == DIGEST_HASH_NONE) {
+        mbedtls_md5_init(&ctx->digest.ctx.md5);
+        mbedtls_md5_starts(&ctx->digest.ctx.md5);
+    } else if (ctx->digest.digest_type == DIGEST_HASH_SHA1 || ctx->digest.digest_type == DIGEST_HASH_SHA256) {
+        // download_img_info_init checked that the first chunk holds head_size bytes
+        head_len = pack_header_signed_size((pack_header_v2_t *)buffer);
+        header = aos_malloc(head_len);
+        if (!header) {
+            return -ENOMEM;
+        }
+        memcpy(header, buffer, head_len);
+        memset(header->signature, 0, sizeof(header->signature));
+        if (ctx->digest.digest_type == DIGEST_HASH_SHA1) {
+            mbedtls_sha1_init(&ctx->digest.ctx.sha1);
+            mbedtls_sha1_starts(&ctx->digest.ctx.sha1);
+            mbedtls_sha1_update(&ctx->digest.ctx.sha1, (uint8_t *)header, head_len);
+        } else {
+            mbedtls_sha256_init(&ctx->digest.ctx.sha256);
+            mbedtls_sha256_starts(&ctx->digest.ctx.sha256, 0);
+            mbedtls_sha256_update(&ctx->digest.ctx.sha256, (uint8_t *)header, head_len);
+        }
+        aos_free(header);
+    } else {
+        // verify it after downloading
+        LOGW(TAG, "no streaming digest for type %d", ctx->digest.digest_type);
+        return 0;
+    }
+    ctx->digest_valid = 1;
+    return 0;
+}
+
+static void img_digest_update(netio_t *io, uint8_t *buffer, int length)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+
+    if (!ctx->digest_valid) {
+        return;
+    }
+    if (ctx->digest.digest_type == DIGEST_HASH_NONE) {
+        mbedtls_md5_update(&ctx->digest.ctx.md5, buffer, length);
+    } else if (ctx->digest.digest_type == DIGEST_HASH_SHA1) {
+        mbedtls_sha1_update(&ctx->digest.ctx.sha1, buffer, length);
+    } else {
+        mbedtls_sha256_update(&ctx->digest.ctx.sha256, buffer, length);
+    }
+}
+
+static int img_digest_save(netio_t *io, uint64_t offset)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    char path[FOTA_SESSION_KEY_LEN];
+    FILE *fp;
+
+    if (!ctx->digest_valid) {
+        return 0;
+    }
+    ctx->digest.offset = offset;
+    fp = fopen(flash_file(io, IMGDIGESTFILE, path), "wb+");
+    if (!fp) {
+        LOGE(TAG, "create %s file failed.", path);
+        return -1;
+    }
+    if (fwrite(&ctx->digest, 1, sizeof(img_digest_t), fp) != sizeof(img_digest_t)) {
+        LOGE(TAG, "write %s file failed.", path);
+        fclose(fp);
+        return -1;
+    }
+    fsync(fileno(fp));
+    fclose(fp);
+    return 0;
+}
+
+static void img_digest_finish(netio_t *io, uint64_t offset)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+
+    if (!ctx->digest_valid) {
+        return;
+    }
+    if (ctx->digest.digest_type == DIGEST_HASH_NONE) {
+        mbedtls_md5_finish(&ctx->digest.ctx.md5, ctx->digest.hash);
+    } else if (ctx->digest.digest_type == DIGEST_HASH_SHA1) {
+        mbedtls_sha1_finish(&ctx->digest.ctx.sha1, ctx->digest.hash);
+    } else {
+        mbedtls_sha256_finish(&ctx->digest.ctx.sha256, ctx->digest.hash);
+    }
+    ctx->digest.finished = 1;
+    img_digest_save(io, offset);
+    ctx->digest_valid = 0;
+    LOGD(TAG, "streaming digest finished.");
+}
+
+/* resume the digest context saved with the checkpoint at offset */
+static void img_digest_load(netio_t *io, uint64_t offset)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    char path[FOTA_SESSION_KEY_LEN];
+    FILE *fp;
+
+    ctx->digest_valid = 0;
+    fp = fopen(flash_file(io, IMGDIGESTFILE, path), "rb");
+    if (!fp) {
+        return;
+    }
+    if (fread(&ctx->digest, 1, sizeof(img_digest_t), fp) == sizeof(img_digest_t) &&
+        ctx->digest.magic == IMG_DIGEST_MAGIC && !ctx->digest.finished && ctx->digest.offset == offset) {
+        ctx->digest_valid = 1;
+    } else {
+        LOGW(TAG, "the digest context does not match offset %lld, verify it after downloading", (long long)offset);
+    }
+    fclose(fp);
+}
+
+/*
+ * zsync: the server publishes the block hashes of an image next to the pack, see blkhash_t.
+ * The blocks found in the active partition make the spans copied from it while the image is written,
+ * the download skips them. The spans are saved to IMGZSYNCFILE for a resumed download.
+ */
+#define FLASH_ZSYNC_MIN_SPAN    (64 * 1024)     /* a shorter span is downloaded with the data around it */
+#define FLASH_ZSYNC_READ_SIZE   (64 * 1024)
+#define FLASH_ZSYNC_TIMEOUT_MS  10000
+
+typedef struct {
+#define FLASH_ZSYNC_MAGIC 0x434E595A // "ZYNC"
+    uint32_t magic;
+    int idx;
+    int count;                                  /* flash_span_t follow */
+} flash_zsync_file_t;
+
+static int flash_zsync_fetch(netio_t *mio, void *buffer, int length)
+{
+    int done = 0;
+
+    while (done < length) {
+        int n = netio_read(mio, (uint8_t *)buffer + done, length - done, FLASH_ZSYNC_TIMEOUT_MS);
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static void flash_zsync_md5(const uint8_t *data, int length, uint8_t md5[16])
+{
+    mbedtls_md5_context ctx;
+
+    mbedtls_md5_init(&ctx);
+    mbedtls_md5_starts(&ctx);
+    mbedtls_md5_update(&ctx, data, length);
+    mbedtls_md5_finish(&ctx, md5);
+    mbedtls_md5_free(&ctx);
+}
+
+/* roll the weak checksum over the active partition, found[k]: where block k is, -1: not found */
+static int flash_zsync_scan(int fd, uint64_t scan_size, blkhash_header_t *hdr, blkhash_t *blocks, int64_t *found)
+{
+    int bs = hdr->block_size;
+    int count = hdr->block_count;
+    int bits = 1;
+    int *head = NULL;
+    int *next = NULL;
+    uint8_t *buf = NULL;
+    uint64_t base = 0, pos = 0;
+    int len = 0;
+    int left = count;
+    int fresh = 1;
+    uint32_t a = 0, b = 0;
+    int ret = -1;
 
-    fd = open(IMGHEADERPATH, O_RDONLY);
-    if (fd < 0) {
+    while ((1 << bits) < count)
+        bits++;
+    head = aos_malloc(sizeof(int) << bits);
+    next = aos_malloc(sizeof(int) * count);
+    buf = aos_malloc(bs + FLASH_ZSYNC_READ_SIZE);
+    if (!head || !next || !buf) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    memset(head, 0xff, sizeof(int) << bits);
+    for (int k = 0; k < count; k++) {
+        uint32_t h = (blocks[k].weak * 2654435761U) >> (32 - bits);
+        found[k] = -1;
+        next[k] = head[h];
+        head[h] = k;
+    }
+    while (left > 0 && pos + bs <= scan_size) {
+        // keep the window and the byte after it in buf
+        if (pos + bs + 1 > base + len && base + len < scan_size) {
+            int keep = base + len - pos;
+            int want = bs + FLASH_ZSYNC_READ_SIZE - keep;
+
+            memmove(buf, buf + (pos - base), keep);
+            base = pos;
+            len = keep;
+            if (want > scan_size - (base + len))
+                want = scan_size - (base + len);
+            if (pread(fd, buf + len, want, (off_t)(base + len)) != want) {
+                LOGE(TAG, "read the active partition at %lld failed, errno:%d", (long long)(base + len), errno);
+                goto out;
+            }
+            len += want;
+        }
+        uint8_t *w = buf + (pos - base);
+        if (fresh) {
+            a = b = 0;
+            for (int i = 0; i < bs; i++) {
+                a += w[i];
+                b += (bs - i) * w[i];
+            }
+            fresh = 0;
+        }
+        uint32_t weak = (a & 0xffff) | (b << 16);
+        uint8_t md5[16];
+        int hashed = 0, matched = 0;
+        for (int k = head[(weak * 2654435761U) >> (32 - bits)]; k >= 0; k = next[k]) {
+            if (found[k] >= 0 || blocks[k].weak != weak) {
+                continue;
+            }
+            if (!hashed) {
+                flash_zsync_md5(w, bs, md5);
+                hashed = 1;
+            }
+            if (memcmp(md5, blocks[k].strong, 16) == 0) {
+                found[k] = pos;
+                left--;
+                matched = 1;
+            }
+        }
+        if (matched) {
+            pos += bs;
+            fresh = 1;
+            continue;
+        }
+        if (pos + bs >= scan_size) {
+            break;
+        }
+        a += w[bs] - w[0];
+        b += a - bs * w[0];
+        pos++;
+    }
+    ret = count - left;
+out:
+    if (head) aos_free(head);
+    if (next) aos_free(next);
+    if (buf) aos_free(buf);
+    return ret;
+}
+
+/* the runs of blocks found in order, spans: NULL to count them */
+static int flash_zsync_spans(int64_t *found, int count, int bs, uint64_t img_offset, flash_span_t *spans)
+{
+    int n = 0;
+
+    for (int k = 0, start = 0; k <= count; k++) {
+        if (k < count && k > start && found[k] >= 0 && found[k] == found[k - 1] + bs) {
+            continue;
+        }
+        if (k > start && found[start] >= 0 && (uint64_t)(k - start) * bs >= FLASH_ZSYNC_MIN_SPAN) {
+            if (spans) {
+                spans[n].offset = img_offset + (uint64_t)start * bs;
+                spans[n].old_offset = found[start];
+                spans[n].length = (uint64_t)(k - start) * bs;
+            }
+            n++;
+        }
+        start = k;
+    }
+    return n;
+}
+
+static int flash_zsync_save(netio_t *io)
+{
+    flash_zsync_t *z = &((flash_priv_t *)io->private)->zsync;
+    flash_zsync_file_t head = {FLASH_ZSYNC_MAGIC, z->idx, z->count};
+    char path[FOTA_SESSION_KEY_LEN];
+    FILE *fp;
+
+    fp = fopen(flash_file(io, IMGZSYNCFILE, path), "wb+");
+    if (!fp) {
+        LOGE(TAG, "create %s file failed.", path);
         return -1;
     }
-    buffer = NULL;
-    length = lseek(fd, 0, SEEK_END);
-    if (length <= 0) {
-        ret = -1;
+    if (fwrite(&head, 1, sizeof(head), fp) != sizeof(head) ||
+        fwrite(z->spans, sizeof(flash_span_t), z->count, fp) != z->count) {
+        LOGE(TAG, "write %s file failed.", path);
+        fclose(fp);
+        unlink(path);
+        return -1;
+    }
+    fsync(fileno(fp));
+    fclose(fp);
+    return 0;
+}
+
+/* a new download: find the blocks of the image the manifest describes, none if there is no manifest */
+static void flash_zsync_plan(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    flash_zsync_t *z = &ctx->zsync;
+    char path[FOTA_SESSION_KEY_LEN];
+    blkhash_header_t hdr;
+    blkhash_t *blocks = NULL;
+    int64_t *found = NULL;
+    netio_t *mio = NULL;
+    char *url = NULL;
+    uint64_t scan_size;
+    uint64_t saved = 0;
+    int idx;
+    int ret;
+
+    flash_zsync_free(io);
+    unlink(flash_file(io, IMGZSYNCFILE, path));
+    if (io->source == NULL) {
+        return;
+    }
+    url = aos_malloc(strlen(io->source) + sizeof(BLKHASH_SUFFIX));
+    if (url == NULL) {
+        return;
+    }
+    sprintf(url, "%s%s", io->source, BLKHASH_SUFFIX);
+    mio = netio_open(url);
+    if (mio == NULL || flash_zsync_fetch(mio, &hdr, sizeof(hdr)) < 0) {
+        LOGI(TAG, "no block hash manifest, download all.");
         goto out;
     }
-    buffer = aos_zalloc(sizeof(download_img_info_t));
-    if (buffer == NULL) {
-        ret = -ENOMEM;
+    hdr.img_name[IMG_NAME_MAX_LEN - 1] = 0;
+    for (idx = 0; idx < priv->image_count; idx++) {
+        if (strcmp(priv->img_info[idx].img_name, hdr.img_name) == 0) {
+            break;
+        }
+    }
+    if (hdr.magic != BLKHASH_MAGIC || hdr.block_size < 512 || hdr.block_size > FLASH_ZSYNC_MIN_SPAN ||
+        (hdr.block_size & (hdr.block_size - 1)) || hdr.block_count != hdr.image_size / hdr.block_size ||
+        hdr.block_count == 0 || idx == priv->image_count || priv->img_info[idx].img_size != hdr.image_size ||
+        priv->img_info[idx].compress || (ctx->skip_plan & (1U << idx)) ||
+        (strcmp(hdr.img_name, IMG_NAME_KERNEL) && strcmp(hdr.img_name, IMG_NAME_ROOTFS))) {
+        LOGW(TAG, "the block hash manifest doesn't match the pack, download all.");
         goto out;
     }
-    lseek(fd, 0, SEEK_SET);
-    if (read(fd, buffer, length) != length) {
-        ret = -1;
+    blocks = aos_malloc(sizeof(blkhash_t) * hdr.block_count);
+    found = aos_malloc(sizeof(int64_t) * hdr.block_count);
+    if (!blocks || !found || flash_zsync_fetch(mio, blocks, sizeof(blkhash_t) * hdr.block_count) < 0) {
+        LOGW(TAG, "read the block hash manifest failed, download all.");
         goto out;
     }
-    ret = download_img_info_init(io, buffer, length, 0);
+    netio_close(mio);
+    mio = NULL;
+
+    z->old_fd = flash_active_open(io, hdr.img_name);
+    if (z->old_fd < 0) {
+        goto out;
+    }
+    // the active image is about the size of the new one, not the whole partition
+    scan_size = lseek(z->old_fd, 0, SEEK_END);
+    if (scan_size > (uint64_t)hdr.image_size * 2)
+        scan_size = (uint64_t)hdr.image_size * 2;
+    long long start = aos_now_ms();
+    ret = flash_zsync_scan(z->old_fd, scan_size, &hdr, blocks, found);
     if (ret < 0) {
-        ret = -1;
         goto out;
     }
-    ret = 0;
+    z->count = flash_zsync_spans(found, hdr.block_count, hdr.block_size, priv->img_info[idx].img_offset, NULL);
+    if (z->count > 0) {
+        z->spans = aos_malloc(sizeof(flash_span_t) * z->count);
+        if (z->spans == NULL) {
+            goto out;
+        }
+        flash_zsync_spans(found, hdr.block_count, hdr.block_size, priv->img_info[idx].img_offset, z->spans);
+        z->idx = idx;
+        if (flash_zsync_save(io) < 0) {
+            goto out;
+        }
+    }
+    for (int i = 0; i < z->count; i++) {
+        saved += z->spans[i].length;
+    }
+    LOGI(TAG, "%s: %d of %d blocks found in %lld ms, %lld bytes in %d spans not downloaded",
+         hdr.img_name, ret, hdr.block_count, aos_now_ms() - start, (long long)saved, z->count);
 out:
-    if (fd >= 0) {
+    if (saved == 0) {
+        flash_zsync_free(io);
+    }
+    if (mio) netio_close(mio);
+    if (url) aos_free(url);
+    if (blocks) aos_free(blocks);
+    if (found) aos_free(found);
+}
+
+/* a resumed download: the spans of the plan, none if they are lost */
+static void flash_zsync_load(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    flash_zsync_t *z = &ctx->zsync;
+    char path[FOTA_SESSION_KEY_LEN];
+    flash_zsync_file_t head;
+    FILE *fp;
+
+    flash_zsync_free(io);
+    fp = fopen(flash_file(io, IMGZSYNCFILE, path), "rb");
+    if (!fp) {
+        return;
+    }
+    if (fread(&head, 1, sizeof(head), fp) != sizeof(head) || head.magic != FLASH_ZSYNC_MAGIC ||
+        head.idx < 0 || head.idx >= ctx->info.image_count || head.count <= 0) {
+        goto err;
+    }
+    z->spans = aos_malloc(sizeof(flash_span_t) * head.count);
+    if (z->spans == NULL || fread(z->spans, sizeof(flash_span_t), head.count, fp) != head.count) {
+        goto err;
+    }
+    z->old_fd = flash_active_open(io, ctx->info.img_info[head.idx].img_name);
+    if (z->old_fd < 0) {
+        goto err;
+    }
+    z->idx = head.idx;
+    z->count = head.count;
+    fclose(fp);
+    return;
+err:
+    LOGW(TAG, "the zsync spans are lost, download all the rest.");
+    fclose(fp);
+    flash_zsync_free(io);
+}
+
+/* copy the span the offset is in from the active partition, and set io->skip_at to the next span */
+static int flash_zsync_skip(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    flash_zsync_t *z = &ctx->zsync;
+    uint8_t *buffer = NULL;
+
+    io->skip_at = 0;
+    for (int i = 0; i < z->count; i++) {
+        flash_span_t *span = &z->spans[i];
+
+        if (io->offset >= span->offset + span->length) {
+            continue;
+        }
+        if (io->offset < span->offset) {
+            io->skip_at = span->offset;
+            break;
+        }
+        if (buffer == NULL) {
+            buffer = aos_malloc(FLASH_ZSYNC_READ_SIZE);
+            if (buffer == NULL) {
+                return -ENOMEM;
+            }
+        }
+        LOGD(TAG, "copy %lld bytes at %lld from the active partition", (long long)(span->offset + span->length - io->offset),
+             (long long)io->offset);
+        while (io->offset < span->offset + span->length) {
+            int n = span->offset + span->length - io->offset;
+
+            if (n > FLASH_ZSYNC_READ_SIZE)
+                n = FLASH_ZSYNC_READ_SIZE;
+            if (pread(z->old_fd, buffer, n, (off_t)(span->old_offset + io->offset - span->offset)) != n) {
+                LOGE(TAG, "read the active partition failed, errno:%d", errno);
+                goto err;
+            }
+            if (_file_write(io, z->idx, buffer, n) < 0) {
+                ctx->digest_valid = 0;
+                goto err;
+            }
+            img_digest_update(io, buffer, n);
+            priv->img_info[z->idx].write_size += n;
+            io->offset += n;
+        }
+    }
+    if (buffer) aos_free(buffer);
+    return 0;
+err:
+    aos_free(buffer);
+    return -1;
+}
+
+/*
+ * An image of a version 3 pack has its SHA256 in the header. Each raw image the last update installed is recorded
+ * with its digest and partition, see img_installed_set. If that partition has the image already, it is not
+ * downloaded, the partition is hashed into the pack digest instead, and it is neither switched nor burned again.
+ * This covers the single partition of uboot too, the record is only a hint and the partition is always hashed.
+ */
+
+/* the SHA256 of the first size bytes of the active partition, update: hash them into the pack digest too */
+static int flash_image_hash(netio_t *io, const char *img_name, uint64_t size, int update, uint8_t sha256[32])
+{
+    mbedtls_sha256_context sha;
+    uint8_t *buffer;
+    int fd;
+    int ret = -1;
+
+    fd = flash_active_open(io, img_name);
+    if (fd < 0) {
+        return -1;
+    }
+    buffer = aos_malloc(FLASH_ZSYNC_READ_SIZE);
+    if (buffer == NULL) {
         close(fd);
+        return -ENOMEM;
     }
-    if (buffer) {
-        aos_free(buffer);
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint64_t pos = 0; pos < size;) {
+        int n = size - pos > FLASH_ZSYNC_READ_SIZE ? FLASH_ZSYNC_READ_SIZE : size - pos;
+
+        if (pread(fd, buffer, n, (off_t)pos) != n) {
+            LOGE(TAG, "read the active %s failed, errno:%d", img_name, errno);
+            goto out;
+        }
+        mbedtls_sha256_update(&sha, buffer, n);
+        if (update) {
+            img_digest_update(io, buffer, n);
+        }
+        pos += n;
     }
+    mbedtls_sha256_finish(&sha, sha256);
+    ret = 0;
+out:
+    mbedtls_sha256_free(&sha);
+    aos_free(buffer);
+    close(fd);
     return ret;
 }
 
+static int flash_image_save(netio_t *io)
+{
+    download_img_info_t *priv = &((flash_priv_t *)io->private)->info;
+    char path[FOTA_SESSION_KEY_LEN];
+    uint32_t mask = 0;
+    FILE *fp;
+
+    for (int i = 0; i < priv->image_count; i++) {
+        if (priv->img_info[i].skipped)
+            mask |= 1U << i;
+    }
+    fp = fopen(flash_file(io, IMGSKIPFILE, path), "wb+");
+    if (!fp) {
+        LOGE(TAG, "create %s file failed.", path);
+        return -1;
+    }
+    if (fwrite(&mask, 1, sizeof(mask), fp) != sizeof(mask)) {
+        LOGE(TAG, "write %s file failed.", path);
+        fclose(fp);
+        return -1;
+    }
+    fsync(fileno(fp));
+    fclose(fp);
+    return 0;
+}
+
+/* a resumed download: mark the images skipped before offset, return how many */
+static int flash_image_load(netio_t *io, uint64_t offset)
+{
+    download_img_info_t *priv = &((flash_priv_t *)io->private)->info;
+    char path[FOTA_SESSION_KEY_LEN];
+    uint32_t mask = 0;
+    int count = 0;
+    FILE *fp;
+
+    fp = fopen(flash_file(io, IMGSKIPFILE, path), "rb");
+    if (fp) {
+        if (fread(&mask, 1, sizeof(mask), fp) != sizeof(mask)) {
+            mask = 0;
+        }
+        fclose(fp);
+    }
+    for (int i = 0; i < priv->image_count; i++) {
+        // the mark is saved before the checkpoint passes the image
+        priv->img_info[i].skipped = (mask & (1U << i)) &&
+                                    priv->img_info[i].img_offset + priv->img_info[i].img_size <= offset;
+        count += priv->img_info[i].skipped;
+    }
+    return count;
+}
+
+/* find the images from offset on the active partition has, none if the pack digest is not streamed */
+static void flash_image_plan(netio_t *io, uint64_t offset)
+{
+    static const uint8_t zero[32];
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    char path[FOTA_SESSION_KEY_LEN];
+    img_installed_t inst;
+    uint8_t sha256[32];
+    int has_diff = 0;
+    int ab;
+
+    ctx->skip_plan = 0;
+    if (offset == 0) {
+        unlink(flash_file(io, IMGSKIPFILE, path));
+    }
+    // the skipped data is verified with the pack digest only
+    if (!ctx->digest_valid) {
+        return;
+    }
+    for (int i = 0; i < priv->image_count; i++) {
+        if (strcmp(priv->img_info[i].img_name, IMG_NAME_DIFF) == 0)
+            has_diff = 1;
+    }
+    for (int i = 0; i < priv->image_count; i++) {
+        const char *name = priv->img_info[i].img_name;
+
+        if (priv->img_info[i].img_offset < offset || memcmp(priv->img_info[i].sha256, zero, sizeof(zero)) == 0) {
+            continue;
+        }
+        // the diff patches the rootfs
+        if (strcmp(name, IMG_NAME_DIFF) == 0 || (strcmp(name, IMG_NAME_ROOTFS) == 0 && has_diff)) {
+            continue;
+        }
+        ab = flash_image_slot(name);
+        if (img_installed_get(name, &inst) < 0 || inst.ab != ab ||
+            memcmp(inst.sha256, priv->img_info[i].sha256, sizeof(inst.sha256)) != 0) {
+            continue;
+        }
+        // the record may be stale, e.g. the partition was written by others
+        long long start = aos_now_ms();
+        if (flash_image_hash(io, name, priv->img_info[i].img_size, 0, sha256) < 0 ||
+            memcmp(sha256, priv->img_info[i].sha256, sizeof(sha256)) != 0) {
+            LOGW(TAG, "the active %s is not the one installed, download it.", name);
+            img_installed_set(name, 0, NULL);
+            continue;
+        }
+        ctx->skip_plan |= 1U << i;
+        LOGI(TAG, "%s is not changed, checked in %lld ms, %lld bytes not downloaded",
+             name, aos_now_ms() - start, (long long)priv->img_info[i].img_size);
+    }
+}
+
+/*
+ * whether the pack can be verified with the streamed digest only: the partitions don't have the bytes of the pack,
+ * an image is skipped, decompressed or a diff patched in place, so fota_data_verify can't hash them again after
+ * downloading
+ */
+static int flash_digest_required(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+
+    if (priv->digest_type != DIGEST_HASH_NONE && priv->digest_type != DIGEST_HASH_SHA1 &&
+        priv->digest_type != DIGEST_HASH_SHA256) {
+        // not streamed at all
+        return 0;
+    }
+    if (ctx->patch) {
+        return 1;
+    }
+    for (int i = 0; i < priv->image_count; i++) {
+        if (priv->img_info[i].skipped || priv->img_info[i].compress) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* skip the images in the plan the offset is at, and set io->skip_at to the next one */
+static int flash_image_skip(netio_t *io)
+{
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    uint8_t sha256[32];
+
+    for (int i = 0; i < priv->image_count; i++) {
+        if (!(ctx->skip_plan & (1U << i)) || priv->img_info[i].img_offset < io->offset) {
+            continue;
+        }
+        if (priv->img_info[i].img_offset > io->offset) {
+            if (io->skip_at == 0 || priv->img_info[i].img_offset < io->skip_at)
+                io->skip_at = priv->img_info[i].img_offset;
+            break;
+        }
+        LOGD(TAG, "%s is not downloaded, hash the active one", priv->img_info[i].img_name);
+        if (flash_image_hash(io, priv->img_info[i].img_name, priv->img_info[i].img_size, 1, sha256) < 0 ||
+            memcmp(sha256, priv->img_info[i].sha256, sizeof(sha256)) != 0) {
+            LOGE(TAG, "the active %s is changed.", priv->img_info[i].img_name);
+            ctx->digest_valid = 0;
+            return -1;
+        }
+        ctx->skip_plan &= ~(1U << i);
+        priv->img_info[i].skipped = 1;
+        priv->img_info[i].write_size = priv->img_info[i].img_size;
+        if (flash_image_save(io) < 0) {
+            ctx->digest_valid = 0;
+            return -1;
+        }
+        io->offset += priv->img_info[i].img_size;
+    }
+    return 0;
+}
+
+/* the data the storage has: the zsync spans and the unchanged images, io->skip_at is where the download stops */
+static int flash_skip(netio_t *io)
+{
+    uint64_t offset;
+
+    do {
+        offset = io->offset;
+        if (flash_zsync_skip(io) < 0 || flash_image_skip(io) < 0) {
+            return -1;
+        }
+    } while (io->offset != offset);
+    return 0;
+}
+
 static int flash_write(netio_t *io, uint8_t *buffer, int length, int timeoutms)
 {
     int headsize = 0;
     pack_header_v2_t *header;
-    download_img_info_t *priv = (download_img_info_t *)io->private;
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    img_digest_t digest;
 
     header = (pack_header_v2_t *)buffer;
-    LOGD(TAG, "flash write, total: %d offset: %d len: %d", io->size, io->offset, length);
+    LOGD(TAG, "flash write, total: %lld offset: %lld len: %d", (long long)io->size, (long long)io->offset, length);
 
     if (io->offset == 0) {
         if (header->magic == PACK_HEAD_MAGIC) {
             LOGD(TAG, "i am the pack image.");
-            int ret = download_img_info_init(io, buffer, length, 1);
+            int ret = download_img_info_init(io, buffer, length, 1, 0);
+            if (ret < 0) {
+                return ret;
+            }
+            ret = img_digest_start(io, buffer);
             if (ret < 0) {
                 return ret;
             }
+            flash_image_plan(io, 0);
+            flash_zsync_plan(io);
+            if (flash_skip(io) < 0) {
+                return -1;
+            }
             headsize = header->head_size;
             LOGD(TAG, "parse packed image ok.");
         } else {
@@ -646,10 +2473,14 @@ static int flash_write(netio_t *io, uint8_t *buffer, int length, int timeoutms)
         LOGE(TAG, "flash write error.");
         return -1;
     }
-    LOGD(TAG, "idx:%d, priv->img_info[%d].img_offset:%d", idx, idx, priv->img_info[idx].img_offset);
+    LOGD(TAG, "idx:%d, priv->img_info[%d].img_offset:%lld", idx, idx, (long long)priv->img_info[idx].img_offset);
     if (priv->img_info[idx].partition_size - (io->offset - priv->img_info[idx].img_offset) < length) {
         length = priv->img_info[idx].partition_size - (io->offset - priv->img_info[idx].img_offset);
     }
+    // the chunks read before io->skip_at was set
+    if (io->skip_at > io->offset && io->offset + length > io->skip_at) {
+        length = io->skip_at - io->offset;
+    }
     int real_to_write_len = length - headsize;
     if (priv->img_info[idx].write_size + real_to_write_len > priv->img_info[idx].img_size) {
         int leftsize = priv->img_info[idx].img_size - priv->img_info[idx].write_size;
@@ -657,14 +2488,19 @@ static int flash_write(netio_t *io, uint8_t *buffer, int length, int timeoutms)
             LOGE(TAG, "write leftsize %d bytes failed", leftsize);
             return -1;
         }
+        // the context before the chunk, the retry hashes the whole chunk again
+        memcpy(&digest, &ctx->digest, sizeof(img_digest_t));
+        img_digest_update(io, &buffer[headsize], leftsize);
         LOGD(TAG, "write leftsize %d bytes ok", leftsize);
         priv->img_info[idx].write_size += leftsize;
         int remainsize = real_to_write_len - leftsize;
-        if (priv->img_info[idx + 1].fp || priv->img_info[idx + 1].fd >= 0) {
+        if (idx + 1 < priv->image_count) {
             if (_file_write(io, idx + 1, &buffer[headsize + leftsize], remainsize) < 0) {
                 LOGE(TAG, "write remainsize %d bytes failed", remainsize);
+                memcpy(&ctx->digest, &digest, sizeof(img_digest_t));
                 return -1;
             }
+            img_digest_update(io, &buffer[headsize + leftsize], remainsize);
             LOGD(TAG, "write remainsize %d bytes ok", remainsize);
             priv->img_info[idx + 1].write_size += remainsize;
         }
@@ -673,68 +2509,55 @@ static int flash_write(netio_t *io, uint8_t *buffer, int length, int timeoutms)
             LOGE(TAG, "write real_to_write_len %d bytes failed", real_to_write_len);
             return -1;
         }
+        img_digest_update(io, &buffer[headsize], real_to_write_len);
         LOGD(TAG, "write real_to_write_len %d bytes ok", real_to_write_len);
         priv->img_info[idx].write_size += real_to_write_len;
     }
 
     io->offset += length;
+    if (flash_skip(io) < 0) {
+        return -1;
+    }
+    uint64_t total_size = priv->head_size;
+    for (int i = 0; i < priv->image_count; i++) {
+        total_size += priv->img_info[i].img_size;
+    }
+    if (io->offset == total_size) {
+        img_digest_finish(io, io->offset);
+    }
+    flash_unpack_progress(io);
     return length;
 }
 
-static int flash_seek(netio_t *io, size_t offset, int whence)
+static int flash_seek(netio_t *io, int64_t offset, int whence)
 {
     int idx;
-    download_img_info_t *priv = (download_img_info_t *)io->private; 
-    LOGD(TAG, "flash seek %d", offset);
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+    LOGD(TAG, "flash seek %lld", (long long)offset);
 
-    if (FILE_SYSTEM_IS_EXT4()) {
-        if (offset && priv->image_count <= 0) {
-            if (download_img_info_init_from_file(io) < 0) {
-                return -1;
-            }
-        }
-        idx = get_img_index(io, offset);
-        if (idx < 0) {
-            LOGE(TAG, "flash seek error.");
+    if (offset == 0) {
+        img_digest_reset(io);
+    } else {
+        img_digest_load(io, offset);
+    }
+
+    if (offset && priv->image_count <= 0) {
+        if (download_img_info_init_from_file(io, offset) < 0) {
+            // the next download starts over
+            LOGE(TAG, "can't resume at %lld, restart the update.", (long long)offset);
+            fota_offset_set(io->session, 0);
             return -1;
         }
-        switch (whence) {
-            case SEEK_SET:
-                io->offset = offset;
-                if (priv->img_info[idx].fp)
-                    fseek(priv->img_info[idx].fp, (long)offset - priv->img_info[idx].img_offset, 0);
-                if (priv->img_info[idx].fd >= 0)
-                    lseek(priv->img_info[idx].fd, (long)offset - priv->img_info[idx].img_offset, 0);
-                priv->img_info[idx].write_size = offset - priv->img_info[idx].img_offset;
-                return 0;
-        }
-        return -1;
+        flash_zsync_load(io);
+        flash_image_load(io, offset);
+        flash_image_plan(io, offset);
     }
-#ifdef UBI_NOT_SUPPORT_INTERRUPTED_UPDATE
-    int ret = 0;
-    FILE *fp = NULL;
-    // because of UBI not support seek.
-    io->offset = offset;
-    if (offset != 0) {
-        fp = fopen(IMGINFOFILE, "rb+");
-        if (fp) {
-            if (fread(priv, 1, sizeof(download_img_info_t), fp) < sizeof(download_img_info_t)) {
-                LOGE(TAG, "read %s failed.", IMGINFOFILE);
-                ret = -1;
-                goto out;
-            }
-        } else {
-            LOGE(TAG, "download some data, but there is no %s file found.", IMGINFOFILE);
-            if (aos_kv_setint(KV_FOTA_OFFSET, 0) < 0) {
-                ret = -1;
-                goto out;
-            }
-        }
+    if (offset && !ctx->digest_valid && flash_digest_required(io)) {
+        LOGE(TAG, "the digest at %lld is lost, restart the update.", (long long)offset);
+        fota_offset_set(io->session, 0);
+        return -1;
     }
-out:
-    if (fp) fclose(fp);
-    return ret;
-#else
     idx = get_img_index(io, offset);
     if (idx < 0) {
         LOGE(TAG, "flash seek error.");
@@ -743,17 +2566,70 @@ out:
     switch (whence) {
         case SEEK_SET:
             io->offset = offset;
-            if (priv->img_info[idx].fp)
-                fseek(priv->img_info[idx].fp, (long)offset - priv->img_info[idx].img_offset, 0);
-            if (priv->img_info[idx].fd >= 0)
-                lseek(priv->img_info[idx].fd, (long)offset - priv->img_info[idx].img_offset, 0);
             priv->img_info[idx].write_size = offset - priv->img_info[idx].img_offset;
+            if (priv->img_info[idx].compress) {
+                if (flash_unpack_seek(io, idx) < 0) {
+                    return -1;
+                }
+            } else {
+                if (priv->img_info[idx].fp)
+                    fseeko(priv->img_info[idx].fp, (off_t)(offset - priv->img_info[idx].img_offset), 0);
+                if (priv->img_info[idx].fd >= 0)
+                    lseek(priv->img_info[idx].fd, (off_t)(offset - priv->img_info[idx].img_offset), 0);
+                if (flash_leb_restore(&ctx->leb[idx], priv->img_info[idx].fd,
+                                      priv->img_info[idx].write_size, priv->img_info[idx].img_size) < 0) {
+                    return -1;
+                }
+            }
+            // the offset moves forward if it is in a span or at an unchanged image
+            if (flash_skip(io) < 0) {
+                return -1;
+            }
+            uint64_t total_size = priv->head_size;
+            for (int i = 0; i < priv->image_count; i++) {
+                total_size += priv->img_info[i].img_size;
+            }
+            if (io->offset > offset && io->offset == total_size) {
+                img_digest_finish(io, io->offset);
+            }
+            flash_unpack_progress(io);
             return 0;
     }
-#endif
     return -1;
 }
 
+static int flash_sync(netio_t *io)
+{
+    int i;
+    flash_priv_t *ctx = (flash_priv_t *)io->private;
+    download_img_info_t *priv = &ctx->info;
+
+    for (i = 0; i < priv->image_count; i++) {
+        // the LEB in buffer is changed now, and again when it fills up
+        if (flash_leb_commit(&ctx->leb[i], priv->img_info[i].fd) < 0) {
+            return -1;
+        }
+        if (priv->img_info[i].fp) {
+            if (fflush(priv->img_info[i].fp) != 0 || fsync(fileno(priv->img_info[i].fp)) < 0) {
+                LOGE(TAG, "sync image %d failed, errno:%d", i, errno);
+                return -1;
+            }
+        }
+        if (priv->img_info[i].fd >= 0) {
+            if (fsync(priv->img_info[i].fd) < 0) {
+                LOGE(TAG, "sync image %d failed, errno:%d", i, errno);
+                return -1;
+            }
+        }
+    }
+    if (flash_patch_sync(io) < 0 || flash_unpack_sync(io) < 0) {
+        return -1;
+    }
+    LOGD(TAG, "flash sync, offset:%lld", (long long)io->offset);
+    // saved with the checkpoint, so a resumed download continues the digest
+    return img_digest_save(io, io->offset);
+}
+
 const netio_cls_t flash2 = {
     .name = "flash2",
     .open = flash_open,
@@ -761,6 +2637,7 @@ const netio_cls_t flash2 = {
     .write = flash_write,
     .read = flash_read,
     .seek = flash_seek,
+    .sync = flash_sync,
 };
 
 int netio_register_flash2(void)
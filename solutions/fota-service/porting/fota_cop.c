@@ -19,6 +19,10 @@
 
 #define COP_IMG_URL "cop_img_url"
 #define COP_VERSION "cop_version"
+#define COP_ETAG    "cop_etag"      // the ETag of the last "no update" response
+#define COP_ETAG_LEN 72
+#define COP_HTTP_BUFFER_SIZE 2048   // the buffers of the http client, the body is read in pieces
+#define COP_RESP_MAX (64 * 1024)    // the largest version check response
 
 #define TAG "fotacop"
 
@@ -36,6 +40,35 @@ static int cop_get_ota_url(char *ota_url, int len)
     return ret;
 }
 
+/* the server asks to check again later: Retry-After (the HTTP-date form is ignored) or "next_check" in seconds */
+static void cop_next_check(fota_info_t *info, int seconds)
+{
+    if (seconds > 0) {
+        LOGI(TAG, "next check in %d s", seconds);
+        info->next_check = seconds;
+    }
+}
+
+/* the state of a version check, the user_data of the http events */
+typedef struct {
+    fota_info_t *info;
+    char etag[COP_ETAG_LEN];        // the ETag of the response, "": none
+} cop_check_t;
+
+static void cop_on_header(cop_check_t *check, const char *key, const char *value)
+{
+    if (strcasecmp(key, "Retry-After") == 0) {
+        cop_next_check(check->info, atoi(value));
+    } else if (strcasecmp(key, "ETag") == 0) {
+        // a redirect may have one, the last response wins
+        if (strlen(value) < sizeof(check->etag)) {
+            strcpy(check->etag, value);
+        } else {
+            check->etag[0] = 0;
+        }
+    }
+}
+
 static int _http_event_handler(http_client_event_t *evt)
 {
     switch(evt->event_id) {
@@ -50,6 +83,9 @@ static int _http_event_handler(http_client_event_t *evt)
             break;
         case HTTP_EVENT_ON_HEADER:
             // LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            if (evt->user_data) {
+                cop_on_header(evt->user_data, evt->header_key, evt->header_value);
+            }
             break;
         case HTTP_EVENT_ON_DATA:
             // LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
@@ -169,34 +205,78 @@ static void _http_cleanup(http_client_handle_t client)
     }
 }
 
-static int sw_partition(download_img_info_t *dl_img_info)
+/* the response body, sized by Content-Length, or grown up to COP_RESP_MAX when it's chunked */
+static char *cop_read_body(http_client_handle_t client, int *length)
+{
+    int64_t content_length = http_client_get_content_length(client);
+    int size = content_length > 0 ? content_length : COP_HTTP_BUFFER_SIZE;
+    int len = 0;
+    char *body = NULL, *p;
+
+    if (content_length > COP_RESP_MAX) {
+        LOGE(TAG, "the response is too large, %lld bytes", (long long)content_length);
+        return NULL;
+    }
+    for (;;) {
+        p = aos_realloc(body, size + 1);
+        if (p == NULL) {
+            aos_free(body);
+            return NULL;
+        }
+        body = p;
+        len += http_client_read_response(client, body + len, size - len);
+        if (len < size || len == content_length || size == COP_RESP_MAX) {
+            break;
+        }
+        size = size * 2 < COP_RESP_MAX ? size * 2 : COP_RESP_MAX;
+    }
+    body[len] = 0;
+    *length = len;
+    return body;
+}
+
+static int sw_partition(const char *session, download_img_info_t *dl_img_info)
 {
     int ret;
     char cmd[128];
+    char path[FOTA_SESSION_KEY_LEN];
 
     for (int i = 0; i < dl_img_info->image_count; i++) {
-        if (strcmp(dl_img_info->img_info[i].img_name, IMG_NAME_DIFF) == 0) {
+        // a bsdiff patch is applied to dev_name already, the rootfs switches below
+        if (strcmp(dl_img_info->img_info[i].img_name, IMG_NAME_DIFF) == 0 && dl_img_info->img_info[i].dev_name[0] == 0) {
+            fota_session_name(session, "/"IMG_NAME_DIFF, path, sizeof(path));
             ret = check_rootfs_partition();
             if (ret != 1 && ret != 2) {
                 LOGE(TAG, "Check rootfs partition failed");
-                remove("/"IMG_NAME_DIFF);
+                remove(path);
                 return -1;
             }
-            if (system("ota-burndiff /"IMG_NAME_DIFF) != 0)
+            snprintf(cmd, sizeof(cmd), "ota-burndiff %s", path);
+            if (system(cmd) != 0)
             {
                 LOGE(TAG, "Exec ota-diff failed");
-                remove("/"IMG_NAME_DIFF);
+                remove(path);
                 return -1;
             }
+            img_installed_set(IMG_NAME_ROOTFS, 0, NULL);
         }
     }
     for (int i = 0; i < dl_img_info->image_count; i++) {
+        int ab = 0;
+
+        if (dl_img_info->img_info[i].skipped) {
+            // the active partition has it, keep running from there
+            LOGI(TAG, "%s is not changed, not switched", dl_img_info->img_info[i].img_name);
+            continue;
+        }
         if (strcmp(dl_img_info->img_info[i].img_name, IMG_NAME_UBOOT) == 0) {
             LOGD(TAG, "got uboot the dev name: %s, img_path: %s", dl_img_info->img_info[i].dev_name, dl_img_info->img_info[i].img_path);
             // snprintf(cmd, sizeof(cmd), "dd if=%s of=%s >/dev/null", dl_img_info->img_info[i].img_path, dl_img_info->img_info[i].dev_name);
             snprintf(cmd, sizeof(cmd), "ota-burnuboot %s > /dev/null", dl_img_info->img_info[i].img_path);
             LOGD(TAG, "cmd: %s", cmd);
             ret = system(cmd);
+            // the single partition of uboot
+            img_installed_set(IMG_NAME_UBOOT, ret == 0 ? 1 : 0, dl_img_info->img_info[i].sha256);
         } else if (strcmp(dl_img_info->img_info[i].img_name, IMG_NAME_KERNEL) == 0) {
             ret = check_kernel_partition();
             if (ret == 1)
@@ -205,6 +285,7 @@ static int sw_partition(download_img_info_t *dl_img_info)
                 LOGD(TAG, "kernel Switch A -> B");
                 ret = system("fw_setenv boot_partition bootB");
                 ret |= system("fw_setenv boot_partition_alt bootA");
+                ab = 2;
             }
             else if (ret == 2)
             {
@@ -212,12 +293,15 @@ static int sw_partition(download_img_info_t *dl_img_info)
                 LOGD(TAG, "kernel Switch B -> A");
                 ret = system("fw_setenv boot_partition bootA");
                 ret |= system("fw_setenv boot_partition_alt bootB");
+                ab = 1;
             }
             else
             {
                 LOGE(TAG, "Check kernel partition failed");
             }
-        } else if (strcmp(dl_img_info->img_info[i].img_name, IMG_NAME_ROOTFS) == 0) {
+            img_installed_set(IMG_NAME_KERNEL, ret == 0 ? ab : 0, dl_img_info->img_info[i].sha256);
+        } else if (strcmp(dl_img_info->img_info[i].img_name, IMG_NAME_ROOTFS) == 0
+                   || (strcmp(dl_img_info->img_info[i].img_name, IMG_NAME_DIFF) == 0 && dl_img_info->img_info[i].dev_name[0])) {
             ret = check_rootfs_partition();
             if (ret == 1)
             {
@@ -230,6 +314,7 @@ static int sw_partition(download_img_info_t *dl_img_info)
                 } else {
                     ret = -1;
                 }
+                ab = 2;
             }
             else if (ret == 2)
             {
@@ -242,11 +327,16 @@ static int sw_partition(download_img_info_t *dl_img_info)
                 } else {
                     ret = -1;
                 }
+                ab = 1;
             }
             else
             {
                 LOGE(TAG, "Check rootfs partition failed");
             }
+            // the digest of a diff image is not the one of the patched rootfs
+            img_installed_set(IMG_NAME_ROOTFS, ret == 0 ? ab : 0,
+                              strcmp(dl_img_info->img_info[i].img_name, IMG_NAME_ROOTFS) == 0 ?
+                              dl_img_info->img_info[i].sha256 : NULL);
         } else if (check_partition_exists(dl_img_info->img_info[i].img_name)) {
             ret = check_partition_ab(dl_img_info->img_info[i].img_name);
             if (ret == 1)
@@ -257,6 +347,7 @@ static int sw_partition(download_img_info_t *dl_img_info)
                 ret = system(cmd);
                 snprintf(cmd, sizeof(cmd) - 1, "fw_setenv %s_partition_alt A", dl_img_info->img_info[i].img_name);
                 ret |= system(cmd);
+                ab = 1;
             }
             else if (ret == 2)
             {
@@ -266,11 +357,14 @@ static int sw_partition(download_img_info_t *dl_img_info)
                 ret = system(cmd);
                 snprintf(cmd, sizeof(cmd) - 1, "fw_setenv %s_partition_alt B", dl_img_info->img_info[i].img_name);
                 ret |= system(cmd);
+                ab = 2;
             }
             else
             {
                 LOGE(TAG, "Check %s partition failed", dl_img_info->img_info[i].img_name);
             }
+            // the partition written is the one <name>_partition named before the switch
+            img_installed_set(dl_img_info->img_info[i].img_name, ret == 0 ? ab : 0, dl_img_info->img_info[i].sha256);
         } else {
             LOGE(TAG, "the image name is error.[%s]", dl_img_info->img_info[i].img_name);
         }
@@ -307,6 +401,64 @@ static void cop_res_release(fota_info_t *info)
     }
 }
 
+/* the first size bytes of the pack, a Range request for them only */
+static int cop_fetch_head(const char *url, uint8_t *buffer, int size, int timeout_ms)
+{
+    netio_t *io;
+    int got = 0;
+
+    io = netio_open_limit(url, size);
+    if (io == NULL) {
+        LOGE(TAG, "open %s failed.", url);
+        return -1;
+    }
+    while (got < size) {
+        int n = netio_read(io, buffer + got, size - got, timeout_ms);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    netio_close(io);
+    return got == size ? 0 : -1;
+}
+
+/* reject a pack the download would reject, before downloading any image */
+static int cop_pack_preflight(fota_info_t *info, const char *url, int timeout_ms)
+{
+    pack_header_v2_t *header;
+    uint8_t *buffer;
+    int size = sizeof(pack_header_v2_t);
+    int ret = -1;
+
+    buffer = aos_malloc(size);
+    if (buffer == NULL) {
+        return -ENOMEM;
+    }
+    if (cop_fetch_head(url, buffer, size, timeout_ms) < 0) {
+        LOGE(TAG, "fetch the pack header failed.");
+        goto out;
+    }
+    header = (pack_header_v2_t *)buffer;
+    if (header->magic == PACK_HEAD_MAGIC && header->head_size > size) {
+        // a version 3 header has an extension
+        size = header->head_size;
+        aos_free(buffer);
+        buffer = aos_malloc(size);
+        if (buffer == NULL) {
+            return -ENOMEM;
+        }
+        if (cop_fetch_head(url, buffer, size, timeout_ms) < 0) {
+            LOGE(TAG, "fetch the pack header failed.");
+            goto out;
+        }
+    }
+    ret = flash_pack_preflight(info->session, buffer, size);
+out:
+    aos_free(buffer);
+    return ret;
+}
+
 static int cop_version_check(fota_info_t *info) {
 #define BUF_SIZE 156
 #define URL_SIZE 256
@@ -316,7 +468,12 @@ static int cop_version_check(fota_info_t *info) {
     char *device_id, *model, *app_version;
     cJSON *js = NULL;
     char *buffer = NULL;
+    char *body = NULL;
     char *urlbuf = NULL;
+    char url_key[FOTA_SESSION_KEY_LEN];
+    char etag_key[FOTA_SESSION_KEY_LEN];
+    cop_check_t check;
+    int64_t offset;
     http_errors_t err;
     http_client_config_t config = {0};
     http_client_handle_t client = NULL;
@@ -325,7 +482,10 @@ static int cop_version_check(fota_info_t *info) {
         return -EINVAL;
     }
 
-    buffer = aos_zalloc(BUFFER_SIZE + 1);
+    memset(&check, 0, sizeof(check));
+    check.info = info;
+    // only drains the body of a redirect
+    buffer = aos_malloc(COP_HTTP_BUFFER_SIZE);
     if (buffer == NULL) {
         ret = -ENOMEM;
         goto out;
@@ -355,8 +515,11 @@ static int cop_version_check(fota_info_t *info) {
     config.method = HTTP_METHOD_POST;
     config.url = getvalue;
     config.timeout_ms = timeout_ms;
-    config.buffer_size = BUFFER_SIZE;
+    config.buffer_size = COP_HTTP_BUFFER_SIZE;
     config.event_handler = _http_event_handler;
+    config.user_data = &check;
+    // the download after the check reuses the connection
+    config.use_pool = true;
     LOGD(TAG, "http client init start.");
     client = http_client_init(&config);
     if (!client) {
@@ -368,27 +531,44 @@ static int cop_version_check(fota_info_t *info) {
     http_client_set_header(client, "Content-Type", "application/json");
     http_client_set_header(client, "Connection", "keep-alive");
     http_client_set_header(client, "Cache-Control", "no-cache");
-    err = _http_connect(client, payload, buffer, BUFFER_SIZE);
+    // the last response said no update, the server answers 304 (or 412 for the POST) if it's still so
+    fota_session_name(info->session, COP_ETAG, etag_key, sizeof(etag_key));
+    if (aos_kv_getstring(etag_key, check.etag, sizeof(check.etag)) > 0) {
+        http_client_set_header(client, "If-None-Match", check.etag);
+        check.etag[0] = 0;
+    }
+    err = _http_connect(client, payload, buffer, COP_HTTP_BUFFER_SIZE);
     if (err != HTTP_CLI_OK) {
         LOGE(TAG, "Client connect e");
         ret = -1;
         goto out;
     }
-    int read_len = http_client_read(client, buffer, BUFFER_SIZE);
-    if (read_len <= 0) {
+    int status_code = http_client_get_status_code(client);
+    if (status_code == HttpStatus_NotModified || status_code == HttpStatus_PreconditionFailed) {
+        LOGD(TAG, "not modified, no update");
+        ret = -ENODATA;
+        goto out;
+    }
+    int read_len;
+    body = cop_read_body(client, &read_len);
+    if (body == NULL || read_len <= 0) {
         ret = -1;
         goto out;
     }
-    buffer[read_len] = 0;
-    LOGD(TAG, "resp: %s", buffer);
+    LOGD(TAG, "resp: %s", body);
 
-    js = cJSON_Parse(buffer);
+    js = cJSON_Parse(body);
     if (js == NULL) {
         ret = -1;
         LOGW(TAG, "cJSON_Parse failed");
         goto out;
     }
 
+    cJSON *next_check = cJSON_GetObjectItem(js, "next_check");
+    if (next_check && cJSON_IsNumber(next_check)) {
+        cop_next_check(info, next_check->valueint);
+    }
+
     cJSON *code = cJSON_GetObjectItem(js, "code");
     if (!(code && cJSON_IsNumber(code))) {
         ret = -1;
@@ -397,9 +577,16 @@ static int cop_version_check(fota_info_t *info) {
     }
     LOGD(TAG, "code: %d", code->valueint);
     if (code->valueint < 0) {
-        ret = -1;
+        // no update for the device, ask whether it's changed next time
+        if (check.etag[0]) {
+            aos_kv_setstring(etag_key, check.etag);
+        } else {
+            aos_kv_del(etag_key);
+        }
+        ret = -ENODATA;
         goto out;
     }
+    aos_kv_del(etag_key);
 
     cJSON *result = cJSON_GetObjectItem(js, "result");
     if (!(result && cJSON_IsObject(result))) {
@@ -424,24 +611,30 @@ static int cop_version_check(fota_info_t *info) {
         goto out;
     }
     LOGD(TAG, "url: %s", url->valuestring);
+    if (cop_pack_preflight(info, url->valuestring, timeout_ms) < 0) {
+        LOGE(TAG, "the pack is rejected, not downloaded.");
+        ret = -1;
+        goto out;
+    }
 
     urlbuf = aos_malloc(URL_SIZE);
     if (urlbuf == NULL) {
         ret = -1;
         goto out;
     }
-    rc = aos_kv_getstring(COP_IMG_URL, urlbuf, URL_SIZE);
+    fota_session_name(info->session, COP_IMG_URL, url_key, sizeof(url_key));
+    rc = aos_kv_getstring(url_key, urlbuf, URL_SIZE);
     if (rc <= 0) {
-        aos_kv_setstring(COP_IMG_URL, url->valuestring);
+        aos_kv_setstring(url_key, url->valuestring);
     } else {
         if (strcmp(url->valuestring, urlbuf) == 0) {
-            if (aos_kv_getint(KV_FOTA_OFFSET, &rc) < 0) {
-                rc = 0;
+            if (fota_offset_get(info->session, &offset) < 0) {
+                offset = 0;
             }
-            LOGI(TAG, "-------->>>continue fota, offset: %d", rc);
+            LOGI(TAG, "-------->>>continue fota, offset: %lld", (long long)offset);
         } else {
-            aos_kv_setstring(COP_IMG_URL, url->valuestring);
-            if (aos_kv_setint(KV_FOTA_OFFSET, 0) < 0) {
+            aos_kv_setstring(url_key, url->valuestring);
+            if (fota_offset_set(info->session, 0) < 0) {
                 ret = -1;
                 goto out;
             }
@@ -490,10 +683,13 @@ static int cop_version_check(fota_info_t *info) {
     LOGD(TAG, "get changelog: %s", info->changelog);
     goto success;
 out:
-    LOGE(TAG, "fota cop version check failed.");
+    if (ret != -ENODATA) {
+        LOGE(TAG, "fota cop version check failed.");
+    }
 success:
     if (urlbuf) aos_free(urlbuf);
     if (buffer) aos_free(buffer);
+    if (body) aos_free(body);
     if (payload) aos_free(payload);
     if (js) cJSON_Delete(js);
     _http_cleanup(client);
@@ -503,11 +699,13 @@ success:
 static int cop_init(fota_info_t *info)
 {
     char *version, *changelog;
+    char path[FOTA_SESSION_KEY_LEN];
+    const char *session = info ? info->session : NULL;
     LOGD(TAG, "%s, %d", __func__, __LINE__);
 
-    if (access(IMGINFOFILE, F_OK) != 0) {
-        LOGD(TAG, "there is no %s file.", IMGINFOFILE);
-        if (aos_kv_setint(KV_FOTA_OFFSET, 0) < 0) {
+    if (access(fota_session_name(session, IMGINFOFILE, path, sizeof(path)), F_OK) != 0) {
+        LOGD(TAG, "there is no %s file.", path);
+        if (fota_offset_set(session, 0) < 0) {
             LOGE(TAG, "cop init set fota offset 0 failed.");
             return -1;
         }
@@ -533,36 +731,37 @@ static int fail(fota_info_t *info)
     return 0;
 }
 
-static int restart(void)
+static int restart(fota_info_t *info)
 {
     FILE *fp;
     int ret;
     download_img_info_t dl_img_info;
+    char path[FOTA_SESSION_KEY_LEN];
 
     LOGD(TAG, "real to do restart opration......");
-    fp = fopen(IMGINFOFILE, "rb+");
+    fp = fopen(fota_session_name(info->session, IMGINFOFILE, path, sizeof(path)), "rb+");
     if (fp != NULL) {
         int len = get_file_size(fp, -1);
         if (len < sizeof(download_img_info_t)) {
-            LOGE(TAG, "The %s file length is wrong.", IMGINFOFILE);
+            LOGE(TAG, "The %s file length is wrong.", path);
             ret = -1;
             goto out;
         }
         if (fread(&dl_img_info, 1, sizeof(download_img_info_t), fp) < sizeof(download_img_info_t)) {
-            LOGE(TAG, "Read %s file error.", IMGINFOFILE);
+            LOGE(TAG, "Read %s file error.", path);
             ret = -1;
             goto out;
         }
         fclose(fp);
         fp = NULL;
-        if (sw_partition(&dl_img_info) < 0) {
+        if (sw_partition(info->session, &dl_img_info) < 0) {
             return -1;
         }
         set_rollback_env_param(5);          // set rollback bootlimit=5
         ret = system("reboot -n");
     } else {
         ret = -1;
-        LOGE(TAG, "Cant find %s file.", IMGINFOFILE);
+        LOGE(TAG, "Cant find %s file.", path);
     }
 out:
     if (fp) fclose(fp);
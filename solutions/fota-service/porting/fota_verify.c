@@ -66,20 +66,68 @@ static int _file_read(int idx, download_img_info_t *dl_img_info, void *buffer, i
     return ret;
 }
 
-int fota_data_verify(void)
+/* check the digest computed while downloading, return 1 if there is none */
+static int _streamed_verify(const char *session, download_img_info_t *dl_img_info)
+{
+    FILE *fp;
+    img_digest_t digest;
+    char path[FOTA_SESSION_KEY_LEN];
+
+    fp = fopen(fota_session_name(session, IMGDIGESTFILE, path, sizeof(path)), "rb");
+    if (!fp) {
+        return 1;
+    }
+    if (fread(&digest, 1, sizeof(img_digest_t), fp) != sizeof(img_digest_t)) {
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+    if (digest.magic != IMG_DIGEST_MAGIC || !digest.finished || digest.digest_type != dl_img_info->digest_type) {
+        return 1;
+    }
+    for (int i = 0; i < dl_img_info->image_count; i++) {
+        if (dl_img_info->img_info[i].fp) {
+            int64_t fpsize = get_file_size(dl_img_info->img_info[i].fp, dl_img_info->img_info[i].fd);
+            if (fpsize != dl_img_info->img_info[i].img_size) {
+                LOGE(TAG, "the imagesize is not matched.[fpsize:%lld, image_size:%lld]", (long long)fpsize,
+                     (long long)dl_img_info->img_info[i].img_size);
+                return -1;
+            }
+        }
+    }
+    LOGD(TAG, "come to verify streaming digest.");
+    if (digest.digest_type == DIGEST_HASH_SHA1) {
+        if (mbed_sha1_rsa_verify(g_pubkey_rsa, sizeof(g_pubkey_rsa), digest.hash, dl_img_info->signature) != 0) {
+            LOGE(TAG, "sha1 rsa verify failed.");
+            return -1;
+        }
+    } else if (digest.digest_type == DIGEST_HASH_SHA256) {
+        if (mbed_sha256_rsa_verify(g_pubkey_rsa, sizeof(g_pubkey_rsa), digest.hash, dl_img_info->signature) != 0) {
+            LOGE(TAG, "sha256 rsa verify failed.");
+            return -1;
+        }
+    } else if (memcmp(dl_img_info->md5sum, digest.hash, 16) != 0) {
+        LOGE(TAG, "image md5sum verify failed.");
+        return -1;
+    }
+    return 0;
+}
+
+int fota_data_verify(const char *session)
 {
     int len;
     FILE *fp = NULL;
+    char path[FOTA_SESSION_KEY_LEN];
     download_img_info_t dl_img_info;
     uint8_t temp_buffer[4096] __attribute__((aligned(4)));
 
     LOGD(TAG, "come to image verify.");
 
-    fp = fopen(IMGINFOFILE, "rb+");
+    fp = fopen(fota_session_name(session, IMGINFOFILE, path, sizeof(path)), "rb+");
     if (fp != NULL) {
         len = get_file_size(fp, -1);
         if (len < sizeof(download_img_info_t)) {
-            LOGE(TAG, "The %s file length is wrong.", IMGINFOFILE);
+            LOGE(TAG, "The %s file length is wrong.", path);
             goto errout;
         }
         if (fread(&dl_img_info, 1, sizeof(download_img_info_t), fp) < sizeof(download_img_info_t)) {
@@ -87,9 +135,17 @@ int fota_data_verify(void)
         }
         LOGD(TAG, "dl_img_info.image_count:%d", dl_img_info.image_count);
         for (int i = 0; i < dl_img_info.image_count; i++) {
-            LOGD(TAG, "%s, size: %d", dl_img_info.img_info[i].img_name, dl_img_info.img_info[i].img_size);
+            LOGD(TAG, "%s, size: %lld", dl_img_info.img_info[i].img_name, (long long)dl_img_info.img_info[i].img_size);
         }
         LOGD(TAG, "dl_img_info.digest_type:%d", dl_img_info.digest_type);
+        int ret = _streamed_verify(session, &dl_img_info);
+        if (ret < 0) {
+            goto errout;
+        } else if (ret == 0) {
+            LOGD(TAG, "image verify ok.");
+            fclose(fp);
+            return 0;
+        }
         if (dl_img_info.digest_type > 0) {
             uint8_t hash_out[128];
 
@@ -98,13 +154,22 @@ int fota_data_verify(void)
                 LOGE(TAG, "the digest type %d is error", dl_img_info.digest_type);
                 goto errout;
             }
-            FILE *headerfp = fopen(IMGHEADERPATH, "rb+");
+            FILE *headerfp = fopen(fota_session_name(session, IMGHEADERPATH, path, sizeof(path)), "rb+");
             if (!headerfp) {
-                LOGE(TAG, "can't find %s.", IMGHEADERPATH);
+                LOGE(TAG, "can't find %s.", path);
                 goto errout;
             }
             if (fread(temp_buffer, 1, sizeof(pack_header_v2_t), headerfp) < sizeof(pack_header_v2_t)) {
-                LOGE(TAG, "read %s error.", IMGHEADERPATH);
+                LOGE(TAG, "read %s error.", path);
+                fclose(headerfp);
+                goto errout;
+            }
+            // head_version 4 signs the whole header, the 64-bit image table with it
+            uint32_t head_len = pack_header_signed_size((pack_header_v2_t *)temp_buffer);
+            if (head_len < sizeof(pack_header_v2_t) || head_len > sizeof(temp_buffer) ||
+                fread(temp_buffer + sizeof(pack_header_v2_t), 1, head_len - sizeof(pack_header_v2_t), headerfp) <
+                    head_len - sizeof(pack_header_v2_t)) {
+                LOGE(TAG, "read %s error, head size %d.", path, head_len);
                 fclose(headerfp);
                 goto errout;
             }
@@ -115,15 +180,15 @@ int fota_data_verify(void)
                 mbedtls_sha1_starts(&ctx);
                 // SHA header first
                 memset(((pack_header_v2_t *)temp_buffer)->signature, 0, sizeof(((pack_header_v2_t *)temp_buffer)->signature));
-                mbedtls_sha1_update(&ctx, temp_buffer, sizeof(pack_header_v2_t));
+                mbedtls_sha1_update(&ctx, temp_buffer, head_len);
 
                 for (int i = 0; i < dl_img_info.image_count; i++) {
-                    int image_size = dl_img_info.img_info[i].img_size;
-                    int fpsize = get_file_size(dl_img_info.img_info[i].fp, dl_img_info.img_info[i].fd);
-                    LOGD(TAG, "### [fpsize:%d, image_size:%d]", fpsize, image_size);
+                    int64_t image_size = dl_img_info.img_info[i].img_size;
+                    int64_t fpsize = get_file_size(dl_img_info.img_info[i].fp, dl_img_info.img_info[i].fd);
+                    LOGD(TAG, "### [fpsize:%lld, image_size:%lld]", (long long)fpsize, (long long)image_size);
                     if (dl_img_info.img_info[i].fp) {
                         if (fpsize != image_size) {
-                            LOGE(TAG, "the imagesize is not matched.[fpsize:%d, image_size:%d]", fpsize, image_size);
+                            LOGE(TAG, "the imagesize is not matched.[fpsize:%lld, image_size:%lld]", (long long)fpsize, (long long)image_size);
                             goto errout;
                         }
                     } else if (dl_img_info.img_info[i].fd > 0) {
@@ -166,15 +231,15 @@ int fota_data_verify(void)
                 mbedtls_sha256_starts(&ctx, 0);
                 // SHA header first
                 memset(((pack_header_v2_t *)temp_buffer)->signature, 0, sizeof(((pack_header_v2_t *)temp_buffer)->signature));
-                mbedtls_sha256_update(&ctx, temp_buffer, sizeof(pack_header_v2_t));
+                mbedtls_sha256_update(&ctx, temp_buffer, head_len);
 
                 for (int i = 0; i < dl_img_info.image_count; i++) {
-                    int image_size = dl_img_info.img_info[i].img_size;
-                    int fpsize = get_file_size(dl_img_info.img_info[i].fp, dl_img_info.img_info[i].fd);
-                    LOGD(TAG, "### [fpsize:%d, image_size:%d]", fpsize, image_size);
+                    int64_t image_size = dl_img_info.img_info[i].img_size;
+                    int64_t fpsize = get_file_size(dl_img_info.img_info[i].fp, dl_img_info.img_info[i].fd);
+                    LOGD(TAG, "### [fpsize:%lld, image_size:%lld]", (long long)fpsize, (long long)image_size);
                     if (dl_img_info.img_info[i].fp) {
                         if (fpsize != image_size) {
-                            LOGE(TAG, "the imagesize is not matched.[fpsize:%d, image_size:%d]", fpsize, image_size);
+                            LOGE(TAG, "the imagesize is not matched.[fpsize:%lld, image_size:%lld]", (long long)fpsize, (long long)image_size);
                             goto errout;
                         }
                     } else if (dl_img_info.img_info[i].fd > 0) {
@@ -222,12 +287,12 @@ int fota_data_verify(void)
             mbedtls_md5_init(&md5);
             mbedtls_md5_starts(&md5);
             for (int i = 0; i < dl_img_info.image_count; i++) {
-                int image_size = dl_img_info.img_info[i].img_size;
-                int fpsize = get_file_size(dl_img_info.img_info[i].fp, dl_img_info.img_info[i].fd);
-                LOGD(TAG, "### [fpsize:%d, image_size:%d]", fpsize, image_size);
+                int64_t image_size = dl_img_info.img_info[i].img_size;
+                int64_t fpsize = get_file_size(dl_img_info.img_info[i].fp, dl_img_info.img_info[i].fd);
+                LOGD(TAG, "### [fpsize:%lld, image_size:%lld]", (long long)fpsize, (long long)image_size);
                 if (dl_img_info.img_info[i].fp) {
                     if (fpsize != image_size) {
-                        LOGE(TAG, "the imagesize is not matched.[fpsize:%d, image_size:%d]", fpsize, image_size);
+                        LOGE(TAG, "the imagesize is not matched.[fpsize:%lld, image_size:%lld]", (long long)fpsize, (long long)image_size);
                         goto errout;
                     }
                 } else if (dl_img_info.img_info[i].fd > 0) {
@@ -7,17 +7,18 @@
 #include <unistd.h>
 #include <mbedtls/rsa.h>
 #include <aos/kernel.h>
+#include <aos/kv.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "imagef.h"
 
-int get_file_size(FILE *fp, int fd)
+int64_t get_file_size(FILE *fp, int fd)
 {
-    int file_len = 0;
+    int64_t file_len = 0;
     if (fp) {
-        fseek(fp, 0, SEEK_END);
-        file_len = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
+        fseeko(fp, 0, SEEK_END);
+        file_len = ftello(fp);
+        fseeko(fp, 0, SEEK_SET);
     }
     if (fd >= 0) {
         file_len = lseek(fd, 0L, SEEK_END);
@@ -141,6 +142,34 @@ int check_partition_ab(const char *name)
     return 0;
 }
 
+int img_installed_get(const char *img_name, img_installed_t *inst)
+{
+    char key[sizeof(KV_FOTA_INSTALLED) + IMG_NAME_MAX_LEN];
+    int len = sizeof(img_installed_t);
+
+    snprintf(key, sizeof(key), "%s%s", KV_FOTA_INSTALLED, img_name);
+    if (aos_kv_get(key, inst, &len) < 0 || len != sizeof(img_installed_t)) {
+        return -1;
+    }
+    return 0;
+}
+
+int img_installed_set(const char *img_name, int ab, const uint8_t *sha256)
+{
+    char key[sizeof(KV_FOTA_INSTALLED) + IMG_NAME_MAX_LEN];
+    static const uint8_t zero[32];
+    img_installed_t inst;
+
+    snprintf(key, sizeof(key), "%s%s", KV_FOTA_INSTALLED, img_name);
+    if (sha256 == NULL || memcmp(sha256, zero, sizeof(zero)) == 0 || (ab != 1 && ab != 2)) {
+        aos_kv_del(key);
+        return 0;
+    }
+    inst.ab = ab;
+    memcpy(inst.sha256, sha256, sizeof(inst.sha256));
+    return aos_kv_set(key, &inst, sizeof(inst), 1);
+}
+
 int get_rootfs_file_system_type(void)
 {
     static int type = 0;
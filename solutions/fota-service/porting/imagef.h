@@ -3,6 +3,9 @@
  */
 #include <stdio.h>
 #include <stdint.h>
+#include <mbedtls/md5.h>
+#include <mbedtls/sha1.h>
+#include <mbedtls/sha256.h>
 
 #ifndef __IMAGE_F_H__
 #define __IMAGE_F_H__
@@ -53,10 +56,45 @@ typedef struct {
     uint16_t      digest_type;    // the digest type
     uint16_t      signature_type; // the signature type
     unsigned char signature[512]; // the signature for header + image, fill 0 when calculate checksum or calculate signature
-    uint32_t      rsv[29];        // reverse
+    uint8_t       compress[PACK_IMG_MAX_COUNT + 1]; // the encoding of each image, see unpack_type_e, 0: raw
+    uint32_t      unpack_size[PACK_IMG_MAX_COUNT];  // the size of each compressed image decompressed
+    uint32_t      rsv[10];        // reverse
     pack_header_imginfo_v2_t image_info[PACK_IMG_MAX_COUNT]; // 24*15=360B
 } pack_header_v2_t; // 1024Bytes
 
+/*
+ * head_version 3: pack_header_digest_t follows pack_header_v2_t, head_size counts it.
+ * It's covered by head_checksum, the signature covers the images instead.
+ */
+typedef struct {
+#define PACK_DIGEST_MAGIC 0x54474449 // "IDGT"
+    uint32_t      magic;
+    uint32_t      rsv;
+    uint8_t       sha256[PACK_IMG_MAX_COUNT][32]; // the SHA256 of each raw image, all 0: unknown
+} pack_header_digest_t;
+
+/*
+ * head_version 4: pack_header_size64_t follows pack_header_digest_t, head_size counts both.
+ * The images may be larger than 4GB, the offset and size in image_info and unpack_size are ignored.
+ * The signature covers the whole header (head_size, signature zeroed) instead of pack_header_v2_t only.
+ */
+typedef struct {
+#define PACK_SIZE64_MAGIC 0x34365A53 // "SZ64"
+    uint32_t      magic;
+    uint32_t      rsv;
+    struct {
+        uint64_t  offset;
+        uint64_t  size;
+        uint64_t  unpack_size;    // the size of the compressed image decompressed
+    } image[PACK_IMG_MAX_COUNT];
+} pack_header_size64_t;
+
+/* the bytes of the header hashed before the images for the signature */
+static inline uint32_t pack_header_signed_size(const pack_header_v2_t *header)
+{
+    return header->head_version >= 4 ? header->head_size : sizeof(pack_header_v2_t);
+}
+
 typedef struct {
     uint32_t image_count;
     size_t head_size;
@@ -70,14 +108,58 @@ typedef struct {
         char img_name[IMG_NAME_MAX_LEN];
         char img_path[IMG_PATH_MAX_LEN];
         char dev_name[DEV_NAME_MAX_LEN];
-        size_t img_offset;
-        size_t img_size;
-        size_t partition_size;
-        size_t write_size;
-        size_t read_size;
+        uint64_t img_offset;
+        uint64_t img_size;
+        uint64_t partition_size;
+        uint64_t write_size;
+        uint64_t read_size;
+        uint32_t compress;          // unpack_type_e, img_size is the size in the pack
+        uint64_t unpack_size;       // the size written to the partition if it's compressed
+        uint8_t sha256[32];         // from pack_header_digest_t, all 0: unknown
+        uint32_t skipped;           // 1: the active partition has the image, it's not written or switched
     } img_info[IMG_MAX_COUNT];
 } download_img_info_t;
 
+typedef struct {
+#define IMG_DIGEST_MAGIC 0x54534744 // "DGST"
+    uint32_t magic;
+    uint16_t digest_type;           // the digest type of the pack header
+    uint16_t finished;              // 1: hash is the digest of the whole image
+    uint64_t offset;                // the download offset the context is updated to
+    union {
+        mbedtls_md5_context md5;
+        mbedtls_sha1_context sha1;
+        mbedtls_sha256_context sha256;
+    } ctx;
+    uint8_t hash[32];
+} img_digest_t;
+
+/*
+ * The block hash manifest published next to the pack, "<pack url>.blkhash":
+ * blkhash_header_t, then a blkhash_t for each whole block of the image.
+ * weak: the rsync rolling checksum of the block, a = sum(x[i]), b = sum((block_size - i) * x[i]),
+ *       weak = (a & 0xffff) | (b << 16), strong: the md5 of the block.
+ */
+typedef struct {
+#define BLKHASH_MAGIC 0x48534B42    // "BKSH"
+    uint32_t magic;
+    uint32_t block_size;            // a power of 2
+    uint32_t image_size;            // the size of the image in the pack
+    uint32_t block_count;           // image_size / block_size, the tail is always downloaded
+    char img_name[IMG_NAME_MAX_LEN];
+} blkhash_header_t;
+
+typedef struct {
+    uint32_t weak;
+    uint8_t strong[16];
+} blkhash_t;
+
+/* the image installed by the last update, saved to KV_FOTA_INSTALLED + image name */
+typedef struct {
+    uint32_t ab;                    // the partition switched to, 1: A, 2: B
+    uint8_t sha256[32];
+} img_installed_t;
+
 #define IMG_NAME_UBOOT "uboot"
 #define IMG_NAME_KERNEL "kernel"
 #define IMG_NAME_ROOTFS "rootfs"
@@ -88,13 +170,25 @@ typedef struct {
 #define IMG_NAME_DIFF "diff"
 #define IMGINFOFILE "/fotaimgsinfo.bin"     // save download_img_info_t
 #define IMGHEADERPATH "/fotaimgsheader.bin" // save pack_header_v2_t, because of signature verify need header raw data.
+#define IMGDIGESTFILE "/fotaimgsdigest.bin" // save img_digest_t, the digest computed while downloading
+#define IMGPATCHFILE "/fotaimgspatch.bin"   // save bspatch_state_t, the diff image applied while downloading
+#define IMGZSYNCFILE "/fotaimgszsync.bin"   // save the spans copied from the active partition instead of downloading
+#define IMGUNPACKFILE "/fotaimgsunpack.bin" // save unpack_state_t and the frame in memory, the compressed image being written
+#define IMGSKIPFILE "/fotaimgsskip.bin"     // save the mask of the images the active partition has, not downloaded
+#define BLKHASH_SUFFIX ".blkhash"
+#define KV_FOTA_INSTALLED "fota_inst_"
 
-int get_file_size(FILE *fp, int fd);
+/* check the pack header before downloading: the checksum, the image table, the partition sizes and the disk space */
+int flash_pack_preflight(const char *session, const uint8_t *buffer, int length);
+int64_t get_file_size(FILE *fp, int fd);
 uint32_t get_checksum(uint8_t *data, uint32_t length);
 char *strdup_img_path(const char *img_name);
 int check_kernel_partition(void);
 int check_rootfs_partition(void);
 int check_partition_ab(const char *name);
+int img_installed_get(const char *img_name, img_installed_t *inst);
+/* sha256: NULL or all 0, the content of the partition is unknown */
+int img_installed_set(const char *img_name, int ab, const uint8_t *sha256);
 int get_rootfs_file_system_type(void);
 #define FILE_SYSTEM_IS_UBI() (get_rootfs_file_system_type() == 1)
 #define FILE_SYSTEM_IS_EXT4() (get_rootfs_file_system_type() == 2)
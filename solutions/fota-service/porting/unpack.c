@@ -0,0 +1,613 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+#include <string.h>
+#include <errno.h>
+#include <aos/kernel.h>
+#include <ulog/ulog.h>
+#ifdef CONFIG_FOTA_ZSTD
+#include <zstd.h>
+#endif
+#include "unpack.h"
+
+#define TAG "unpack"
+
+typedef enum {
+    LZ4_STAGE_MAGIC = 0,
+    LZ4_STAGE_HEADER,                   // FLG, BD
+    LZ4_STAGE_HEADER_REST,              // content size, dictionary id, HC
+    LZ4_STAGE_BLOCK_SIZE,
+    LZ4_STAGE_BLOCK,
+    LZ4_STAGE_CHECKSUM,
+    LZ4_STAGE_SKIP_SIZE,
+    LZ4_STAGE_SKIP,
+} lz4_stage_e;
+
+#define LZ4_FLG_VERSION_MASK    0xC0
+#define LZ4_FLG_VERSION         0x40
+#define LZ4_FLG_BLOCK_INDEP     0x20
+#define LZ4_FLG_BLOCK_CHECKSUM  0x10
+#define LZ4_FLG_CONTENT_SIZE    0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_DICT_ID         0x01
+#define LZ4_BLOCK_UNCOMPRESSED  0x80000000U
+
+typedef enum {
+    SPARSE_STAGE_HEADER = 0,
+    SPARSE_STAGE_HEADER_REST,           // skipped
+    SPARSE_STAGE_CHUNK,
+    SPARSE_STAGE_RAW,                   // the data is not kept
+    SPARSE_STAGE_FILL,
+    SPARSE_STAGE_CRC,
+    SPARSE_STAGE_END,
+} sparse_stage_e;
+
+#define SPARSE_HEADER_SIZE      28
+#define SPARSE_CHUNK_SIZE       12
+#define SPARSE_CHUNK_MAX        64
+#define SPARSE_CHUNK_RAW        0xCAC1
+#define SPARSE_CHUNK_FILL       0xCAC2
+#define SPARSE_CHUNK_DONT_CARE  0xCAC3
+#define SPARSE_CHUNK_CRC32      0xCAC4
+
+static uint32_t le32(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static uint16_t le16(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static int unpack_reserve(uint8_t **buf, int *size, int want)
+{
+    if (*size >= want) {
+        return 0;
+    }
+    if (*buf) {
+        aos_free(*buf);
+    }
+    *size = 0;
+    *buf = aos_malloc(want);
+    if (*buf == NULL) {
+        return -ENOMEM;
+    }
+    *size = want;
+    return 0;
+}
+
+/* the output replayed from the frame start is written already */
+static int unpack_emit(unpack_t *u, const uint8_t *buffer, int length)
+{
+    unpack_state_t *st = &u->state;
+
+    if (u->discard > 0) {
+        int skip = u->discard < length ? u->discard : length;
+
+        u->discard -= skip;
+        st->out_pos += skip;
+        buffer += skip;
+        length -= skip;
+    }
+    // write_out writes at out_pos
+    if (length > 0 && u->write_out(u->arg, buffer, length) < 0) {
+        return -1;
+    }
+    st->out_pos += length;
+    return 0;
+}
+
+/* a LZ4 block, return the size decompressed or -1 */
+static int lz4_block(const uint8_t *src, int srclen, uint8_t *dst, int dstlen)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + srclen;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dstlen;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t length = token >> 4;
+        size_t offset;
+        unsigned s;
+
+        if (length == 15) {
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                s = *ip++;
+                length += s;
+            } while (s == 255);
+        }
+        if (length > iend - ip || length > oend - op) {
+            return -1;
+        }
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+        // the last sequence has the literals only
+        if (ip == iend) {
+            break;
+        }
+        if (iend - ip < 2) {
+            return -1;
+        }
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - dst) {
+            return -1;
+        }
+        length = token & 15;
+        if (length == 15) {
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                s = *ip++;
+                length += s;
+            } while (s == 255);
+        }
+        length += 4;
+        if (length > oend - op) {
+            return -1;
+        }
+        // the match may overlap the output
+        const uint8_t *match = op - offset;
+        while (length--) {
+            *op++ = *match++;
+        }
+    }
+    return op - dst;
+}
+
+/* a part of the frame is in in[0, need) */
+static int lz4_stage(unpack_t *u)
+{
+    unpack_state_t *st = &u->state;
+    uint8_t *in = u->in;
+    uint32_t value;
+    int n;
+
+    switch (st->stage) {
+        case LZ4_STAGE_MAGIC:
+            value = le32(in);
+            if (value == UNPACK_LZ4_MAGIC) {
+                st->stage = LZ4_STAGE_HEADER;
+                st->need = 2;
+            } else if ((value & 0xFFFFFFF0) == UNPACK_SKIPPABLE_MAGIC) {
+                st->stage = LZ4_STAGE_SKIP_SIZE;
+                st->need = 4;
+            } else {
+                LOGE(TAG, "not a LZ4 frame: 0x%08x", value);
+                return -1;
+            }
+            st->done = 0;
+            break;
+        case LZ4_STAGE_HEADER:
+            st->flags = in[0];
+            if ((st->flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION) {
+                LOGE(TAG, "the LZ4 frame version is error, FLG:0x%02x", st->flags);
+                return -1;
+            }
+            // a linked block needs the output before it, which is not kept
+            if (!(st->flags & LZ4_FLG_BLOCK_INDEP) || (st->flags & LZ4_FLG_DICT_ID)) {
+                LOGE(TAG, "LZ4 linked blocks or dictionary are not supported, FLG:0x%02x", st->flags);
+                return -1;
+            }
+            value = (in[1] >> 4) & 7;
+            if (value < 4) {
+                LOGE(TAG, "the LZ4 block size is error, BD:0x%02x", in[1]);
+                return -1;
+            }
+            st->block_max = 1 << (8 + 2 * value);
+            if (st->block_max > CONFIG_FOTA_UNPACK_FRAME_SIZE) {
+                LOGE(TAG, "the LZ4 block size %d is larger than %d", st->block_max, CONFIG_FOTA_UNPACK_FRAME_SIZE);
+                return -1;
+            }
+            if (unpack_reserve(&u->out, &u->out_size, st->block_max) < 0) {
+                return -ENOMEM;
+            }
+            st->stage = LZ4_STAGE_HEADER_REST;
+            st->need = 1 + (st->flags & LZ4_FLG_CONTENT_SIZE ? 8 : 0);
+            break;
+        case LZ4_STAGE_HEADER_REST:
+            st->stage = LZ4_STAGE_BLOCK_SIZE;
+            st->need = 4;
+            break;
+        case LZ4_STAGE_BLOCK_SIZE:
+            value = le32(in);
+            if (value == 0) {
+                if (st->flags & LZ4_FLG_CONTENT_CHECKSUM) {
+                    st->stage = LZ4_STAGE_CHECKSUM;
+                    st->need = 4;
+                } else {
+                    st->stage = LZ4_STAGE_MAGIC;
+                    st->need = 4;
+                    st->done = 1;
+                }
+                break;
+            }
+            if ((value & ~LZ4_BLOCK_UNCOMPRESSED) > st->block_max) {
+                LOGE(TAG, "the LZ4 block is %d bytes, larger than %d", value & ~LZ4_BLOCK_UNCOMPRESSED, st->block_max);
+                return -1;
+            }
+            // the size word stays in front of the block
+            st->stage = LZ4_STAGE_BLOCK;
+            st->need = 4 + (value & ~LZ4_BLOCK_UNCOMPRESSED) + (st->flags & LZ4_FLG_BLOCK_CHECKSUM ? 4 : 0);
+            return 1;
+        case LZ4_STAGE_BLOCK:
+            value = le32(in);
+            if (value & LZ4_BLOCK_UNCOMPRESSED) {
+                if (unpack_emit(u, in + 4, value & ~LZ4_BLOCK_UNCOMPRESSED) < 0) {
+                    return -1;
+                }
+            } else {
+                n = lz4_block(in + 4, value, u->out, st->block_max);
+                if (n < 0) {
+                    LOGE(TAG, "the LZ4 block at %lld is broken", st->consumed - st->need);
+                    return -1;
+                }
+                if (unpack_emit(u, u->out, n) < 0) {
+                    return -1;
+                }
+            }
+            st->stage = LZ4_STAGE_BLOCK_SIZE;
+            st->need = 4;
+            break;
+        case LZ4_STAGE_CHECKSUM:
+            st->stage = LZ4_STAGE_MAGIC;
+            st->need = 4;
+            st->done = 1;
+            break;
+        case LZ4_STAGE_SKIP_SIZE:
+            st->skip_left = le32(in);
+            st->stage = st->skip_left ? LZ4_STAGE_SKIP : LZ4_STAGE_MAGIC;
+            st->need = st->skip_left ? 0 : 4;
+            st->done = st->skip_left == 0;
+            break;
+    }
+    return 0;
+}
+
+static int lz4_write(unpack_t *u, const uint8_t *buffer, int length)
+{
+    unpack_state_t *st = &u->state;
+    int done = 0;
+    int n;
+
+    while (done < length) {
+        if (st->stage == LZ4_STAGE_SKIP) {
+            n = length - done < st->skip_left ? length - done : st->skip_left;
+            st->skip_left -= n;
+            st->consumed += n;
+            done += n;
+            if (st->skip_left == 0) {
+                st->stage = LZ4_STAGE_MAGIC;
+                st->need = 4;
+                st->done = 1;
+            }
+            continue;
+        }
+        n = st->need - st->fill;
+        if (n > length - done) {
+            n = length - done;
+        }
+        memcpy(u->in + st->fill, buffer + done, n);
+        st->fill += n;
+        st->consumed += n;
+        done += n;
+        if (st->fill < st->need) {
+            break;
+        }
+        int ret = lz4_stage(u);
+        if (ret < 0) {
+            return -1;
+        }
+        // the size word is the start of the block
+        if (ret == 0) {
+            st->fill = 0;
+            st->frame_out = st->out_pos;
+        }
+    }
+    return length;
+}
+
+/* a part of the sparse image is in in[0, need) */
+static int sparse_stage(unpack_t *u)
+{
+    unpack_state_t *st = &u->state;
+    uint8_t *in = u->in;
+    uint32_t type, blocks, total;
+    uint64_t size;
+
+    switch (st->stage) {
+        case SPARSE_STAGE_HEADER:
+            if (le32(in) != UNPACK_SPARSE_MAGIC || le16(in + 4) != 1) {
+                LOGE(TAG, "not a sparse image: 0x%08x v%d", le32(in), le16(in + 4));
+                return -1;
+            }
+            st->chunk_header = le16(in + 10);
+            st->block_size = le32(in + 12);
+            st->chunks_left = le32(in + 20);
+            if (le16(in + 8) < SPARSE_HEADER_SIZE || st->chunk_header < SPARSE_CHUNK_SIZE ||
+                st->chunk_header > SPARSE_CHUNK_MAX || st->block_size == 0 || st->block_size % 4) {
+                LOGE(TAG, "the sparse header is error.");
+                return -1;
+            }
+            st->data_left = le16(in + 8) - SPARSE_HEADER_SIZE;
+            st->stage = st->data_left ? SPARSE_STAGE_HEADER_REST : SPARSE_STAGE_CHUNK;
+            break;
+        case SPARSE_STAGE_CHUNK:
+            type = le16(in);
+            blocks = le32(in + 4);
+            total = le32(in + 8);
+            size = (uint64_t)blocks * st->block_size;
+            st->chunks_left--;
+            st->stage = SPARSE_STAGE_CHUNK;
+            if (type == SPARSE_CHUNK_RAW && total == st->chunk_header + size) {
+                st->data_left = size;
+                st->stage = size ? SPARSE_STAGE_RAW : SPARSE_STAGE_CHUNK;
+            } else if (type == SPARSE_CHUNK_FILL && total == st->chunk_header + 4) {
+                // the size of the fill waits with the pattern
+                st->data_left = size;
+                st->stage = SPARSE_STAGE_FILL;
+                st->need = 4;
+                return 0;
+            } else if (type == SPARSE_CHUNK_DONT_CARE && total == st->chunk_header) {
+                if (size > 0 && u->fill_out(u->arg, 0, size, 0) < 0) {
+                    return -1;
+                }
+                st->out_pos += size;
+            } else if (type == SPARSE_CHUNK_CRC32 && total == st->chunk_header + 4) {
+                st->stage = SPARSE_STAGE_CRC;
+                st->need = 4;
+                return 0;
+            } else {
+                LOGE(TAG, "the sparse chunk 0x%04x is error, %d blocks in %d bytes", type, blocks, total);
+                return -1;
+            }
+            break;
+        case SPARSE_STAGE_FILL:
+            if (u->fill_out(u->arg, le32(in), st->data_left, 1) < 0) {
+                return -1;
+            }
+            st->out_pos += st->data_left;
+            st->data_left = 0;
+            st->stage = SPARSE_STAGE_CHUNK;
+            break;
+        case SPARSE_STAGE_CRC:
+            // the pack digest covers the data
+            st->stage = SPARSE_STAGE_CHUNK;
+            break;
+    }
+    if (st->stage == SPARSE_STAGE_CHUNK && st->chunks_left == 0) {
+        st->stage = SPARSE_STAGE_END;
+        st->done = 1;
+    }
+    st->need = st->chunk_header;
+    return 0;
+}
+
+static int sparse_write(unpack_t *u, const uint8_t *buffer, int length)
+{
+    unpack_state_t *st = &u->state;
+    int done = 0;
+    int n;
+
+    while (done < length) {
+        if (st->stage == SPARSE_STAGE_END) {
+            LOGE(TAG, "%d bytes after the end of the sparse image.", length - done);
+            return -1;
+        }
+        if (st->stage == SPARSE_STAGE_RAW || st->stage == SPARSE_STAGE_HEADER_REST) {
+            n = length - done < st->data_left ? length - done : st->data_left;
+            if (st->stage == SPARSE_STAGE_RAW && unpack_emit(u, buffer + done, n) < 0) {
+                return -1;
+            }
+            st->data_left -= n;
+            st->consumed += n;
+            done += n;
+            if (st->data_left == 0) {
+                st->stage = SPARSE_STAGE_CHUNK;
+                st->need = st->chunk_header;
+                if (st->chunks_left == 0) {
+                    st->stage = SPARSE_STAGE_END;
+                    st->done = 1;
+                }
+            }
+            continue;
+        }
+        n = st->need - st->fill;
+        if (n > length - done) {
+            n = length - done;
+        }
+        memcpy(u->in + st->fill, buffer + done, n);
+        st->fill += n;
+        st->consumed += n;
+        done += n;
+        if (st->fill < st->need) {
+            break;
+        }
+        st->fill = 0;
+        if (sparse_stage(u) < 0) {
+            return -1;
+        }
+        st->frame_out = st->out_pos;
+    }
+    return length;
+}
+
+#ifdef CONFIG_FOTA_ZSTD
+static int zstd_write(unpack_t *u, const uint8_t *buffer, int length)
+{
+    unpack_state_t *st = &u->state;
+    int done = 0;
+
+    while (done < length) {
+        // the frame is kept until it ends, to replay it after a resume
+        int n = CONFIG_FOTA_UNPACK_FRAME_SIZE - st->fill;
+        if (n == 0) {
+            LOGE(TAG, "the zstd frame is larger than %d", CONFIG_FOTA_UNPACK_FRAME_SIZE);
+            return -1;
+        }
+        if (n > length - done) {
+            n = length - done;
+        }
+        memcpy(u->in + st->fill, buffer + done, n);
+
+        ZSTD_inBuffer input = {u->in + st->fill, n, 0};
+        st->fill += n;
+        st->consumed += n;
+        for (;;) {
+            ZSTD_outBuffer output = {u->out, u->out_size, 0};
+            size_t ret = ZSTD_decompressStream(u->dctx, &output, &input);
+
+            if (ZSTD_isError(ret)) {
+                LOGE(TAG, "zstd: %s, the frame ends before %lld", ZSTD_getErrorName(ret), st->consumed);
+                return -1;
+            }
+            if (output.pos > 0 && unpack_emit(u, u->out, output.pos) < 0) {
+                return -1;
+            }
+            if (ret == 0) {
+                // a frame ends, the rest of the input starts the next one
+                int rest = input.size - input.pos;
+                memmove(u->in, (uint8_t *)input.src + input.pos, rest);
+                st->fill = rest;
+                st->frame_out = st->out_pos;
+                st->done = 1;
+                input.src = u->in;
+                input.size = rest;
+                input.pos = 0;
+                if (rest == 0) {
+                    break;
+                }
+                continue;
+            }
+            st->done = 0;
+            if (input.pos == input.size && output.pos < output.size) {
+                break;
+            }
+        }
+        done += n;
+    }
+    return length;
+}
+#endif
+
+int unpack_init(unpack_t *u, int type, void *arg, int (*write_out)(void *arg, const uint8_t *buffer, int length),
+                int (*fill_out)(void *arg, uint32_t pattern, uint64_t length, int care))
+{
+    memset(u, 0, sizeof(unpack_t));
+    u->arg = arg;
+    u->write_out = write_out;
+    u->fill_out = fill_out;
+    u->state.magic = UNPACK_STATE_MAGIC;
+    u->state.type = type;
+    u->state.done = 1;
+    if (type == UNPACK_LZ4) {
+        u->state.stage = LZ4_STAGE_MAGIC;
+        u->state.need = 4;
+        // a block with its size and checksum
+        return unpack_reserve(&u->in, &u->in_size, CONFIG_FOTA_UNPACK_FRAME_SIZE + 8);
+    }
+    if (type == UNPACK_SPARSE && fill_out) {
+        u->state.stage = SPARSE_STAGE_HEADER;
+        u->state.need = SPARSE_HEADER_SIZE;
+        u->state.done = 0;
+        return unpack_reserve(&u->in, &u->in_size, SPARSE_CHUNK_MAX);
+    }
+#ifdef CONFIG_FOTA_ZSTD
+    if (type == UNPACK_ZSTD) {
+        int window_log = 10;
+
+        while ((1 << window_log) < CONFIG_FOTA_UNPACK_FRAME_SIZE)
+            window_log++;
+        u->dctx = ZSTD_createDCtx();
+        if (u->dctx == NULL) {
+            return -ENOMEM;
+        }
+        // a frame larger than the window is rejected instead of allocating it
+        ZSTD_DCtx_setParameter(u->dctx, ZSTD_d_windowLogMax, window_log);
+        if (unpack_reserve(&u->in, &u->in_size, CONFIG_FOTA_UNPACK_FRAME_SIZE) < 0 ||
+            unpack_reserve(&u->out, &u->out_size, ZSTD_DStreamOutSize()) < 0) {
+            unpack_free(u);
+            return -ENOMEM;
+        }
+        return 0;
+    }
+#endif
+    LOGE(TAG, "the compression %d is not supported.", type);
+    return -1;
+}
+
+int unpack_resume(unpack_t *u, const unpack_state_t *state, const uint8_t *in)
+{
+    if (state->magic != UNPACK_STATE_MAGIC || state->type != u->state.type || state->fill > u->in_size) {
+        return -1;
+    }
+    if (state->type == UNPACK_SPARSE) {
+        u->state = *state;
+        memcpy(u->in, in, state->fill);
+        return 0;
+    }
+    if (state->type == UNPACK_LZ4) {
+        // the part of the frame is not used yet
+        u->state = *state;
+        if (state->stage > LZ4_STAGE_HEADER &&
+            unpack_reserve(&u->out, &u->out_size, state->block_max) < 0) {
+            return -ENOMEM;
+        }
+        memcpy(u->in, in, state->fill);
+        return 0;
+    }
+    // zstd: decompress the frame again from its start, the output up to out_pos is written already
+    u->state = *state;
+    u->state.consumed -= state->fill;
+    u->state.out_pos = state->frame_out;
+    u->state.fill = 0;
+    u->discard = state->out_pos - state->frame_out;
+    if (unpack_write(u, in, state->fill) < 0 || u->state.out_pos < state->out_pos) {
+        return -1;
+    }
+    return 0;
+}
+
+void unpack_free(unpack_t *u)
+{
+    if (u->in) {
+        aos_free(u->in);
+        u->in = NULL;
+    }
+    if (u->out) {
+        aos_free(u->out);
+        u->out = NULL;
+    }
+#ifdef CONFIG_FOTA_ZSTD
+    if (u->dctx) {
+        ZSTD_freeDCtx(u->dctx);
+        u->dctx = NULL;
+    }
+#endif
+}
+
+int unpack_write(unpack_t *u, const uint8_t *buffer, int length)
+{
+    if (length <= 0) {
+        return length;
+    }
+    if (u->state.type == UNPACK_LZ4) {
+        return lz4_write(u, buffer, length);
+    }
+    if (u->state.type == UNPACK_SPARSE) {
+        return sparse_write(u, buffer, length);
+    }
+#ifdef CONFIG_FOTA_ZSTD
+    if (u->state.type == UNPACK_ZSTD) {
+        return zstd_write(u, buffer, length);
+    }
+#endif
+    return -1;
+}
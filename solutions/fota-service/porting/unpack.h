@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef __UNPACK_H__
+#define __UNPACK_H__
+
+/*
+ * The streaming decompressor of a compressed pack image.
+ * LZ4: the frame format with independent blocks, the checksums are not checked, the pack digest covers the data.
+ * zstd: a sequence of frames, e.g. the seekable format, needs CONFIG_FOTA_ZSTD and libzstd.
+ * sparse: the Android sparse image, the FILL and DONT_CARE chunks go to fill_out instead of the data.
+ * A frame (a LZ4 block) up to CONFIG_FOTA_UNPACK_FRAME_SIZE is kept in memory until it's decompressed,
+ * so the state can be saved anywhere and the decompression resumes from the last frame boundary.
+ */
+#ifndef CONFIG_FOTA_UNPACK_FRAME_SIZE
+#define CONFIG_FOTA_UNPACK_FRAME_SIZE (1024 * 1024)
+#endif
+
+#define UNPACK_LZ4_MAGIC        0x184D2204
+#define UNPACK_SKIPPABLE_MAGIC  0x184D2A50  // & 0xFFFFFFF0, LZ4 and zstd
+#define UNPACK_SPARSE_MAGIC     0xED26FF3A
+
+typedef enum {
+    UNPACK_NONE = 0,
+    UNPACK_LZ4  = 1,
+    UNPACK_ZSTD = 2,
+    UNPACK_SPARSE = 3,
+    UNPACK_TYPE_END
+} unpack_type_e;
+
+typedef struct {
+#define UNPACK_STATE_MAGIC 0x4B504E55 // "UNPK"
+    uint32_t magic;
+    uint32_t type;                      // unpack_type_e
+    uint64_t consumed;                  // bytes of the compressed stream received
+    uint64_t out_pos;                   // bytes decompressed and written
+    uint64_t frame_out;                 // out_pos at the start of the frame in memory
+    uint32_t fill;                      // bytes of the frame in memory, saved after the state
+    uint32_t stage;                     // LZ4, sparse: the part of the stream in memory
+    uint32_t need;                      // LZ4, sparse: the size of the part
+    uint32_t flags;                     // LZ4: FLG of the frame
+    uint32_t block_max;                 // LZ4: the block size of the frame
+    uint32_t skip_left;                 // bytes of a skippable frame left
+    uint32_t done;                      // the stream ends here if there is no more data
+    uint32_t block_size;                // sparse: the block size of the image
+    uint32_t chunk_header;              // sparse: the size of a chunk header
+    uint32_t chunks_left;               // sparse: the chunks not received
+    uint64_t data_left;                 // sparse: bytes of the RAW chunk or of the header left
+} unpack_state_t;
+
+typedef struct {
+    unpack_state_t state;               // with in[0, fill), all of the progress, save them to resume
+    uint8_t *in;
+    int in_size;
+    uint8_t *out;
+    int out_size;
+    void *dctx;                         // zstd
+    uint64_t discard;                   // the output written before, replayed from the frame start
+    void *arg;
+    int (*write_out)(void *arg, const uint8_t *buffer, int length);
+    // care: 0, the data doesn't matter
+    int (*fill_out)(void *arg, uint32_t pattern, uint64_t length, int care);
+} unpack_t;
+
+int unpack_init(unpack_t *u, int type, void *arg, int (*write_out)(void *arg, const uint8_t *buffer, int length),
+                int (*fill_out)(void *arg, uint32_t pattern, uint64_t length, int care));
+/* continue from a saved state, in: the frame in memory, state->fill bytes */
+int unpack_resume(unpack_t *u, const unpack_state_t *state, const uint8_t *in);
+void unpack_free(unpack_t *u);
+/* return length, or -1 if the stream is broken or write_out fails */
+int unpack_write(unpack_t *u, const uint8_t *buffer, int length);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include "mem_netio.h"
+
+mem_netio_t g_mem;
+
+char *aos_get_device_id(void)
+{
+    return "test";
+}
+
+uint8_t mem_pattern(uint64_t pos)
+{
+    return (uint8_t)((pos * 2654435761ULL) >> 13 ^ (pos >> 32));
+}
+
+static int mem_open(netio_t *io, const char *path)
+{
+    io->size = g_mem.size;
+    io->offset = 0;
+    return 0;
+}
+
+static int mem_close(netio_t *io)
+{
+    return 0;
+}
+
+static int mem_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+{
+    int64_t n = io->size - io->offset;
+
+    if (g_mem.delay_us > 0) {
+        usleep(g_mem.delay_us);
+    }
+    if (n > length) {
+        n = length;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    if (g_mem.src) {
+        memcpy(buffer, g_mem.src + io->offset, n);
+    } else {
+        for (int i = 0; i < n; i++) {
+            buffer[i] = mem_pattern(io->offset + i);
+        }
+    }
+    io->offset += n;
+    return n;
+}
+
+static int mem_write(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+{
+    if (g_mem.delay_us > 0) {
+        usleep(g_mem.delay_us);
+    }
+    if (g_mem.write_hook && g_mem.write_hook(io->offset, buffer, length) < 0) {
+        return -1;
+    }
+    if (g_mem.dst) {
+        if (io->offset + length > g_mem.size) {
+            return -1;
+        }
+        memcpy(g_mem.dst + io->offset, buffer, length);
+    }
+    io->offset += length;
+    return length;
+}
+
+static int mem_seek(netio_t *io, int64_t offset, int whence)
+{
+    io->offset = offset;
+    return 0;
+}
+
+static int mem_sync(netio_t *io)
+{
+    return g_mem.sync_hook ? g_mem.sync_hook() : 0;
+}
+
+static const netio_cls_t mem_cls = {
+    .name = "mem",
+    .open = mem_open,
+    .close = mem_close,
+    .read = mem_read,
+    .write = mem_write,
+    .seek = mem_seek,
+    .sync = mem_sync,
+};
+
+int mem_netio_register(void)
+{
+    return netio_register(&mem_cls);
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+#ifndef TEST_MEM_NETIO_H
+#define TEST_MEM_NETIO_H
+
+#include <stdint.h>
+#include <yoc/netio.h>
+
+/*
+ * The "mem" netio of the host tests: "mem://src" reads the source, any other path is the storage.
+ */
+typedef struct {
+    int64_t size;               /*!< bytes of the source */
+    uint8_t *src;               /*!< the source data, NULL: mem_pattern() */
+    uint8_t *dst;               /*!< the storage data, NULL: not kept */
+    int delay_us;               /*!< each read and write sleeps this long first */
+    int (*write_hook)(int64_t offset, const uint8_t *buffer, int length);  /*!< before a write, < 0: it fails */
+    int (*sync_hook)(void);     /*!< the sync, < 0: it fails */
+} mem_netio_t;
+
+extern mem_netio_t g_mem;
+
+/* the source byte at pos when there is no source data, it differs across the 4 GiB wrap */
+uint8_t mem_pattern(uint64_t pos);
+
+int mem_netio_register(void);
+
+#endif
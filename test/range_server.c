@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "mem_netio.h"
+#include "range_server.h"
+
+#define SEND_SIZE (16 * 1024)
+
+range_server_t g_server;
+
+static int send_all(int fd, const char *data, int length)
+{
+    while (length > 0) {
+        int n = send(fd, data, length, MSG_NOSIGNAL);
+
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/* "GET <path> " */
+static int is_object(const char *request)
+{
+    int len = strlen(g_server.path);
+
+    return strncmp(request, "GET ", 4) == 0 && strncmp(request + 4, g_server.path, len) == 0 &&
+           request[4 + len] == ' ';
+}
+
+/* take one fault of the budget */
+static int fault_take(void)
+{
+    for (;;) {
+        int faults = g_server.faults;
+
+        if (faults == 0) {
+            return 0;
+        }
+        if (faults < 0 || __sync_bool_compare_and_swap(&g_server.faults, faults, faults - 1)) {
+            return 1;
+        }
+    }
+}
+
+/* 206 to "Range: bytes=<first>-[<last>]" */
+static int respond(int fd, const char *request)
+{
+    static __thread uint8_t data[SEND_SIZE];
+    const char *range = strstr(request, "Range: bytes=");
+    long long first, last = g_server.size - 1;
+    char head[256];
+    int n;
+
+    if (!is_object(request)) {
+        n = snprintf(head, sizeof(head), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        return send_all(fd, head, n);
+    }
+    if (range == NULL || sscanf(range, "Range: bytes=%lld-%lld", &first, &last) < 1 || first >= g_server.size) {
+        n = snprintf(head, sizeof(head), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n");
+        return send_all(fd, head, n);
+    }
+    if (sscanf(range, "Range: bytes=%*lld-%lld", &last) < 1) {
+        __sync_fetch_and_add(&g_server.open_ranges, 1);
+    }
+    if (last >= g_server.size) {
+        last = g_server.size - 1;
+    }
+    n = snprintf(head, sizeof(head),
+                 "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\n\r\n",
+                 first, last, (long long)g_server.size, last - first + 1);
+    if (send_all(fd, head, n) < 0) {
+        return -1;
+    }
+    long long cut = g_server.cut > 0 && fault_take() ? first + g_server.cut : -1;
+    for (long long pos = first; pos <= last;) {
+        int length = last + 1 - pos < SEND_SIZE ? last + 1 - pos : SEND_SIZE;
+
+        if (pos == cut) {
+            if (g_server.stall_ms == 0) {
+                return -1;
+            }
+            struct timespec ts = {g_server.stall_ms / 1000, (g_server.stall_ms % 1000) * 1000000L};
+            nanosleep(&ts, NULL);
+        }
+        if (cut > pos && cut - pos < length) {
+            length = cut - pos;
+        }
+
+        if (g_server.data) {
+            g_server.data(data, pos, length);
+        } else {
+            for (int i = 0; i < length; i++) {
+                data[i] = mem_pattern(pos + i);
+            }
+        }
+        n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        if (g_server.sent_hook) {
+            g_server.sent_hook(pos, n);
+        }
+        pos += n;
+    }
+    return 0;
+}
+
+/* a kept alive connection, one request at a time */
+static void *connection(void *arg)
+{
+    int fd = (int)(long)arg;
+    char request[4096];
+    int conns = __sync_add_and_fetch(&g_server.conns, 1);
+
+    for (;;) {
+        int length = 0;
+
+        request[0] = 0;
+        while (strstr(request, "\r\n\r\n") == NULL) {
+            int n = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+
+            if (n <= 0) {
+                goto out;
+            }
+            length += n;
+            request[length] = 0;
+        }
+        if (g_server.max_conns > 0 && conns > g_server.max_conns) {
+            const char *refuse = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+            send_all(fd, refuse, strlen(refuse));
+            break;
+        }
+        if (respond(fd, request) < 0) {
+            break;
+        }
+    }
+out:
+    __sync_sub_and_fetch(&g_server.conns, 1);
+    close(fd);
+    return NULL;
+}
+
+static void *server(void *arg)
+{
+    int listener = (int)(long)arg;
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        int sndbuf = 128 * 1024;
+        pthread_t thread;
+
+        if (fd < 0) {
+            break;
+        }
+        // a small send buffer, the bytes sent are close to the bytes the client took
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        pthread_create(&thread, NULL, connection, (void *)(long)fd);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int range_server_start(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    pthread_t thread;
+
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &len) < 0) {
+        return -1;
+    }
+    pthread_create(&thread, NULL, server, (void *)(long)listener);
+    pthread_detach(thread);
+    return ntohs(addr.sin_port);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+#ifndef TEST_RANGE_SERVER_H
+#define TEST_RANGE_SERVER_H
+
+#include <stdint.h>
+
+/*
+ * The stand-in server of the host tests on the loopback: the Range requests of path are answered with
+ * 206 Partial Content on kept alive connections, other paths with 404. The faults cut the bodies short, stall
+ * them or refuse the connections past a limit.
+ */
+typedef struct {
+    const char *path;           /*!< the object, e.g. "/image" */
+    int64_t size;               /*!< bytes of the object */
+    void (*data)(uint8_t *buffer, int64_t pos, int length);    /*!< the object data at pos, NULL: mem_pattern() */
+    void (*sent_hook)(int64_t pos, int length);                 /*!< the body bytes at pos are sent */
+    int64_t cut;                /*!< a faulty response ends after this many body bytes, 0: none */
+    int stall_ms;               /*!< at the cut, 0: close the connection, > 0: stall this long and go on */
+    volatile int faults;        /*!< the responses left to fault, -1: all */
+    int max_conns;              /*!< connections at once, 503 on the others, 0: no limit */
+    volatile int conns;         /*!< connections open */
+    volatile int open_ranges;   /*!< requests of "bytes=<first>-", to the end */
+} range_server_t;
+
+extern range_server_t g_server;
+
+/* return the port, -1: failed */
+int range_server_start(void);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * bspatch round trip: a patch generated here is applied in random chunks, with the state saved and restored
+ * at random points as flash.c does across a power cut, and the output must be the new data byte for byte.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bspatch.h"
+
+#define OLD_SIZE    (300 * 1024)
+#define NEW_MIN     (250 * 1024)
+#define BLOCK_SIZE  4096
+
+typedef struct {
+    uint8_t *old;
+    int64_t oldsize;
+    uint8_t *out;
+    int64_t outsize;
+} test_file_t;
+
+static uint8_t *append(uint8_t *buf, int64_t *len, const void *data, int64_t n)
+{
+    buf = realloc(buf, *len + n);
+    memcpy(buf + *len, data, n);
+    *len += n;
+    return buf;
+}
+
+static void offtout(int64_t x, uint8_t *buf)
+{
+    uint64_t y = x < 0 ? -x : x;
+
+    for (int i = 0; i < 8; i++) {
+        buf[i] = y >> (i * 8);
+    }
+    if (x < 0) {
+        buf[7] |= 0x80;
+    }
+}
+
+static uint8_t old_at(const uint8_t *old, int64_t pos)
+{
+    return pos >= 0 && pos < OLD_SIZE ? old[pos] : 0;
+}
+
+/* records with sparse changes over the old data, extra bytes and seeks out of the old data both ways */
+static uint8_t *make_patch(const uint8_t *old, uint8_t **new_data, int64_t *newsize, int64_t *patchsize)
+{
+    int64_t target = NEW_MIN + rand() % (100 * 1024);
+    int64_t oldpos = 0, len = 0, plen = BSPATCH_HEADER_SIZE;
+    uint8_t *data = NULL, *patch = malloc(BSPATCH_HEADER_SIZE);
+    uint8_t ctrl[BSPATCH_CTRL_SIZE];
+
+    while (len < target) {
+        int64_t x = rand() % 40000, y = rand() % 2000;
+        int64_t z = rand() % 120000 - 60000;
+
+        x = x < target - len ? x : target - len;
+        y = y < target - len - x ? y : target - len - x;
+        offtout(x, ctrl);
+        offtout(y, ctrl + 8);
+        offtout(z, ctrl + 16);
+        patch = append(patch, &plen, ctrl, sizeof(ctrl));
+        for (int64_t i = 0; i < x; i++) {
+            uint8_t b = rand() % 200 ? old_at(old, oldpos + i) : rand();
+            uint8_t d = b - old_at(old, oldpos + i);
+
+            data = append(data, &len, &b, 1);
+            patch = append(patch, &plen, &d, 1);
+        }
+        for (int64_t i = 0; i < y; i++) {
+            uint8_t b = rand();
+
+            data = append(data, &len, &b, 1);
+            patch = append(patch, &plen, &b, 1);
+        }
+        oldpos += x + z;
+    }
+    memcpy(patch, BSPATCH_MAGIC, strlen(BSPATCH_MAGIC));
+    offtout(len, patch + 16);
+    *new_data = data;
+    *newsize = len;
+    *patchsize = plen;
+    return patch;
+}
+
+static int read_old(void *arg, int64_t pos, uint8_t *buffer, int length)
+{
+    test_file_t *f = (test_file_t *)arg;
+
+    if (pos < 0 || pos + length > f->oldsize) {
+        return -1;
+    }
+    memcpy(buffer, f->old + pos, length);
+    return length;
+}
+
+static int write_new(void *arg, int64_t pos, const uint8_t *buffer, int length)
+{
+    test_file_t *f = (test_file_t *)arg;
+
+    if (pos < 0 || pos + length > f->outsize) {
+        return -1;
+    }
+    memcpy(f->out + pos, buffer, length);
+    return length;
+}
+
+static int round_trip(int seed)
+{
+    test_file_t f;
+    bspatch_t patch;
+    bspatch_state_t saved;
+    uint8_t *new_data, *diff;
+    int64_t newsize, patchsize, pos = 0;
+    int cuts = 0, ret = -1;
+
+    srand(seed);
+    f.old = malloc(OLD_SIZE);
+    f.oldsize = OLD_SIZE;
+    for (int i = 0; i < OLD_SIZE; i++) {
+        f.old[i] = rand();
+    }
+    diff = make_patch(f.old, &new_data, &newsize, &patchsize);
+    f.outsize = newsize;
+    f.out = calloc(1, newsize);
+
+    bspatch_init(&patch, BLOCK_SIZE, &f, read_old, write_new);
+    patch.oldsize = f.oldsize;
+    saved = patch.state;
+    while (pos < patchsize) {
+        int n = 1 + rand() % 20000;
+
+        n = n < patchsize - pos ? n : patchsize - pos;
+        if (bspatch_write(&patch, diff + pos, n) != n) {
+            printf("seed %d: write %d bytes at %lld failed\n", seed, n, (long long)pos);
+            goto out;
+        }
+        pos += n;
+        if (rand() % 3 == 0) {
+            saved = patch.state;
+        }
+        if (rand() % 5 == 0 && pos < patchsize) {
+            // power cut: the stream resumes at the saved state, the bytes after it are applied again
+            bspatch_free(&patch);
+            bspatch_init(&patch, BLOCK_SIZE, &f, read_old, write_new);
+            patch.oldsize = f.oldsize;
+            patch.state = saved;
+            pos = saved.consumed;
+            cuts++;
+        }
+    }
+    if (patch.state.stage != BSPATCH_STAGE_DONE || memcmp(f.out, new_data, newsize) != 0) {
+        printf("seed %d: the output does not match, stage %u\n", seed, patch.state.stage);
+        goto out;
+    }
+    // nothing may follow the end of the patch
+    if (bspatch_write(&patch, diff, 1) >= 0) {
+        printf("seed %d: the bytes after the patch are accepted\n", seed);
+        goto out;
+    }
+    printf("seed %d: %lld bytes patched to %lld, %d cuts\n", seed, (long long)patchsize, (long long)newsize, cuts);
+    ret = 0;
+out:
+    bspatch_free(&patch);
+    free(f.old);
+    free(f.out);
+    free(new_data);
+    free(diff);
+    return ret;
+}
+
+static int not_a_patch(void)
+{
+    test_file_t f = {0};
+    bspatch_t patch;
+    uint8_t buf[BSPATCH_HEADER_SIZE] = "BSDIFF40";
+    int ok;
+
+    bspatch_init(&patch, BLOCK_SIZE, &f, read_old, write_new);
+    // flash.c stores the stream for ota-burndiff from the header left in buf
+    ok = bspatch_write(&patch, buf, sizeof(buf)) < 0 && patch.state.fill == sizeof(buf) &&
+         memcmp(patch.state.buf, buf, sizeof(buf)) == 0;
+    bspatch_free(&patch);
+    if (!ok) {
+        printf("a legacy patch is not rejected with its header kept\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    for (int seed = 1; seed <= 20; seed++) {
+        if (round_trip(seed) < 0) {
+            return 1;
+        }
+    }
+    return not_a_patch() < 0 ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * Crash consistency of the download checkpoints: the storage keeps the written data in a cache until it's synced.
+ * The power is cut at random storage calls, the cache is lost, and the download resumes from the offset in kv.
+ * At every storage call the offset in kv must not run ahead of the synced data, and the image must be complete
+ * at the end, in serial and pipelined modes. A write that fails once with the power on is retried from the
+ * checkpoint in the same download.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <aos/kernel.h>
+#include <aos/kv.h>
+#include <yoc/fota.h>
+#include "mem_netio.h"
+
+#define TOTAL       (3 * 1024 * 1024 + 123)
+#define RUN_MS      60000
+
+static uint8_t *g_src;
+static uint8_t *g_cache;                        /* what the storage reads back, lost at a power cut */
+static uint8_t *g_disk;                         /* the synced data */
+static int g_calls;                             /* storage calls before the power is cut, < 0: never */
+static int g_dead;                              /* the power is cut, the storage fails */
+static int g_transient;                         /* the storage call fails once, the power stays on */
+static int64_t g_crash_offset;                  /* the offset in kv right when the power was cut */
+static int g_ahead;                             /* times the offset in kv ran ahead of the synced data */
+static volatile int g_done;
+
+/* at every storage call: the data before the saved offset is on the disk */
+static int storage_call(void)
+{
+    int64_t offset = 0;
+
+    if (g_dead) {
+        return -1;
+    }
+    if (fota_offset_get(NULL, &offset) < 0) {
+        offset = 0;
+    }
+    if (offset > TOTAL || memcmp(g_disk, g_src, offset) != 0) {
+        printf("the checkpoint %lld is ahead of the synced data\n", (long long)offset);
+        g_ahead++;
+    }
+    if (g_calls >= 0 && g_calls-- == 0) {
+        if (g_transient) {
+            return -1;
+        }
+        g_dead = 1;
+        g_crash_offset = offset;
+        return -1;
+    }
+    return 0;
+}
+
+static int storage_write(int64_t offset, const uint8_t *buffer, int length)
+{
+    return storage_call();
+}
+
+static int storage_sync(void)
+{
+    if (storage_call() < 0) {
+        return -1;
+    }
+    memcpy(g_disk, g_cache, TOTAL);
+    return 0;
+}
+
+static int test_version_check(fota_info_t *info)
+{
+    info->fota_url = "mem://src";
+    return 0;
+}
+
+static const fota_cls_t test_cls = {
+    .name = "test",
+    .version_check = test_version_check,
+};
+
+int fota_data_verify(const char *session)
+{
+    return memcmp(g_cache, g_src, TOTAL) == 0 ? 0 : -1;
+}
+
+static int test_event(void *fota, fota_event_e event)
+{
+    if (event == FOTA_EVENT_FINISH) {
+        g_done = 1;
+    }
+    return 0;
+}
+
+/* download until it finishes or the power is cut, return 1 if it finished */
+static int run(int buffer_count, int calls, int transient)
+{
+    fota_config_t config = {
+        .read_timeoutms = 3000,
+        .write_timeoutms = 3000,
+        .retry_count = transient ? 2 : 0,
+        .sleep_time = transient ? 10 : 1000000,
+        .buffer_count = buffer_count,
+        .checkpoint_bytes = 256 * 1024,
+        .chunk_min = 4096,
+        .chunk_max = 65536,
+    };
+    long long start = aos_now_ms();
+    fota_t *fota;
+
+    g_done = 0;
+    g_dead = 0;
+    g_calls = calls;
+    g_transient = transient;
+    fota = fota_open("test", "mem://dst", test_event);
+    fota_config(fota, &config);
+    fota_start(fota);
+    fota_do_check(fota);
+    fota_download(fota);
+    while (!g_done && !g_dead && aos_now_ms() - start < RUN_MS) {
+        aos_msleep(1);
+    }
+    fota_stop(fota);
+    fota_close(fota);
+    if (g_dead) {
+        // the power is back: the cache is lost, kv has what it had at the cut
+        memcpy(g_cache, g_disk, TOTAL);
+        fota_offset_set(NULL, g_crash_offset);
+    }
+    return g_done;
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/fota_checkpoint_XXXXXX";
+    int ret = 0;
+
+    if (mkdtemp(dir) == NULL || aos_kv_init(dir) < 0) {
+        printf("kv init failed\n");
+        return 1;
+    }
+    g_src = malloc(TOTAL);
+    g_cache = malloc(TOTAL);
+    g_disk = malloc(TOTAL);
+    srand(1);
+    for (int i = 0; i < TOTAL; i++) {
+        g_src[i] = rand();
+    }
+    g_mem.size = TOTAL;
+    g_mem.src = g_src;
+    g_mem.dst = g_cache;
+    g_mem.write_hook = storage_write;
+    g_mem.sync_hook = storage_sync;
+    mem_netio_register();
+    fota_register(&test_cls);
+
+    for (int buffer_count = 1; buffer_count <= 4; buffer_count += 3) {
+        int cuts = 0;
+
+        memset(g_cache, 0xee, TOTAL);
+        memset(g_disk, 0xee, TOTAL);
+        fota_offset_set(NULL, 0);
+        while (!run(buffer_count, cuts < 8 ? rand() % 40 : -1, 0)) {
+            if (!g_dead) {
+                printf("buffers:%d the download neither finished nor was cut\n", buffer_count);
+                ret = 1;
+                break;
+            }
+            cuts++;
+        }
+        if (fota_data_verify(NULL) < 0) {
+            printf("buffers:%d the image does not match\n", buffer_count);
+            ret = 1;
+        }
+        printf("buffers:%d cuts:%d ahead:%d\n", buffer_count, cuts, g_ahead);
+
+        memset(g_cache, 0xee, TOTAL);
+        memset(g_disk, 0xee, TOTAL);
+        fota_offset_set(NULL, 0);
+        if (!run(buffer_count, 10 + rand() % 20, 1) || fota_data_verify(NULL) < 0) {
+            printf("buffers:%d the write failed once and the retry did not complete the image\n", buffer_count);
+            ret = 1;
+        }
+    }
+    if (g_ahead) {
+        ret = 1;
+    }
+    free(g_src);
+    free(g_cache);
+    free(g_disk);
+    return ret;
+}
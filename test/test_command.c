@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * Concurrent control commands: threads issue random check, download, restart and status calls while the fota
+ * task downloads, across start/stop cycles, in serial and pipelined modes. Every stop and close must return,
+ * and once the threads are done the download must still finish with the image intact.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <aos/kernel.h>
+#include <aos/kv.h>
+#include <yoc/fota.h>
+#include "mem_netio.h"
+
+#define TOTAL       (2 * 1024 * 1024 + 7)
+#define THREADS     4
+#define ROUNDS      5
+#define HAMMER_MS   300
+#define FINISH_MS   30000
+
+static uint8_t *g_src;
+static uint8_t *g_dst;
+static fota_t *g_fota;
+static volatile int g_run;
+static volatile int g_verify_failed;
+
+static int test_version_check(fota_info_t *info)
+{
+    info->fota_url = "mem://src";
+    return 0;
+}
+
+static int test_restart(fota_info_t *info)
+{
+    return 0;
+}
+
+static const fota_cls_t test_cls = {
+    .name = "test",
+    .version_check = test_version_check,
+    .restart = test_restart,
+};
+
+int fota_data_verify(const char *session)
+{
+    return memcmp(g_dst, g_src, TOTAL) == 0 ? 0 : -1;
+}
+
+static int test_event(void *arg, fota_event_e event)
+{
+    fota_t *fota = (fota_t *)arg;
+
+    if (fota->error_code == FOTA_ERROR_VERIFY) {
+        g_verify_failed++;
+    }
+    return 0;
+}
+
+static void *hammer(void *arg)
+{
+    unsigned int seed = (unsigned long)arg;
+
+    while (g_run) {
+        switch (rand_r(&seed) % 4) {
+            case 0:
+                fota_do_check(g_fota);
+                break;
+            case 1:
+                fota_download(g_fota);
+                break;
+            case 2:
+                fota_restart(g_fota, 0);
+                break;
+            default:
+                fota_get_status(g_fota);
+                break;
+        }
+        usleep(rand_r(&seed) % 2000);
+    }
+    return NULL;
+}
+
+/* the commands are quiet again: check and download until the task reports the finish */
+static int wait_finish(void)
+{
+    long long start = aos_now_ms();
+
+    while (aos_now_ms() - start < FINISH_MS) {
+        fota_status_e status = fota_get_status(g_fota);
+
+        if (status == FOTA_FINISH) {
+            return 0;
+        }
+        if (status == FOTA_INIT) {
+            fota_do_check(g_fota);
+        }
+        if (status != FOTA_DOWNLOAD) {
+            fota_download(g_fota);
+        }
+        aos_msleep(100);
+    }
+    return -1;
+}
+
+static int round_trip(int buffer_count, int round)
+{
+    fota_config_t config = {
+        .read_timeoutms = 3000,
+        .write_timeoutms = 3000,
+        .retry_count = 2,
+        .sleep_time = 10,
+        .buffer_count = buffer_count,
+    };
+    pthread_t threads[THREADS];
+    int ret = 0;
+
+    memset(g_dst, 0, TOTAL);
+    fota_offset_set(NULL, 0);
+    g_fota = fota_open("test", "mem://dst", test_event);
+    if (g_fota == NULL) {
+        printf("buffers:%d round:%d open failed\n", buffer_count, round);
+        return -1;
+    }
+    fota_config(g_fota, &config);
+    fota_start(g_fota);
+
+    g_run = 1;
+    for (long i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, hammer, (void *)(i + round * 7 + 1));
+    }
+    aos_msleep(HAMMER_MS);
+    g_run = 0;
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (wait_finish() < 0) {
+        printf("buffers:%d round:%d the download did not finish, status:%d\n", buffer_count, round,
+               fota_get_status(g_fota));
+        ret = -1;
+    } else if (fota_data_verify(NULL) < 0) {
+        printf("buffers:%d round:%d the image does not match\n", buffer_count, round);
+        ret = -1;
+    }
+    // a hang here is caught by the test timeout
+    fota_stop(g_fota);
+    fota_close(g_fota);
+    printf("buffers:%d round:%d %s\n", buffer_count, round, ret == 0 ? "ok" : "failed");
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/fota_command_XXXXXX";
+    int ret = 0;
+
+    if (mkdtemp(dir) == NULL || aos_kv_init(dir) < 0) {
+        printf("kv init failed\n");
+        return 1;
+    }
+    g_src = malloc(TOTAL);
+    g_dst = malloc(TOTAL);
+    srand(1);
+    for (int i = 0; i < TOTAL; i++) {
+        g_src[i] = rand();
+    }
+    g_mem.size = TOTAL;
+    g_mem.src = g_src;
+    g_mem.dst = g_dst;
+    g_mem.delay_us = 300;
+    mem_netio_register();
+    fota_register(&test_cls);
+
+    for (int buffer_count = 1; buffer_count <= 4; buffer_count += 3) {
+        for (int round = 0; round < ROUNDS; round++) {
+            if (round_trip(buffer_count, round) < 0) {
+                ret = 1;
+            }
+        }
+    }
+    if (g_verify_failed) {
+        printf("verify failed %d times\n", g_verify_failed);
+        ret = 1;
+    }
+    free(g_src);
+    free(g_dst);
+    return ret;
+}
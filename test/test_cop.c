@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * The conditional version check of fota_cop.c against a stand-in server on the loopback: a "no update" answer
+ * with an ETag is sent back as If-None-Match, a 304 or a 412 is "still no update", an answer without an ETag
+ * forgets it, and an offered update is read in full from a chunked body and forgets it too. The response bytes
+ * and the CPU time of a no-op poll are measured with and without the ETag: the 304 must be the smaller one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <aos/kernel.h>
+#include <aos/kv.h>
+#include <yoc/fota.h>
+
+#define CHANGELOG_SIZE  10000
+#define ETAG_KEY        "cop_etag"
+#define MEASURE_POLLS   20
+
+typedef enum {
+    SERVER_ETAG,                                /* no update with an ETag, 304 to its If-None-Match */
+    SERVER_412,                                 /* 412 to everything */
+    SERVER_PLAIN,                               /* no update without an ETag */
+    SERVER_UPDATE,                              /* an update in a chunked body */
+} server_mode_e;
+
+static volatile server_mode_e g_mode;
+static int g_port;
+static char g_request[4096];                     /* the last request */
+static int g_bodies;                             /* responses with a body */
+static volatile long g_sent;                     /* response bytes sent by the server */
+
+extern const fota_cls_t fota_cop2_cls;
+
+/* the parts of image.c and sysinfo fota_cop.c calls */
+char *aos_get_device_id(void)
+{
+    return "test";
+}
+
+const char *aos_get_product_model(void)
+{
+    return "test";
+}
+
+char *aos_get_app_version(void)
+{
+    return "1.0.0";
+}
+
+char *aos_get_changelog(void)
+{
+    return "";
+}
+
+int aos_set_changelog(const char *changelog)
+{
+    return 0;
+}
+
+int aos_set_app_version(const char *version)
+{
+    return 0;
+}
+
+int check_rootfs_partition(void)
+{
+    return 1;
+}
+
+int check_kernel_partition(void)
+{
+    return 1;
+}
+
+int check_partition_ab(const char *name)
+{
+    return -1;
+}
+
+int img_installed_set(const char *img_name, int ab, const uint8_t *sha256)
+{
+    return 0;
+}
+
+int set_ubivol_cmd(const char *vol_name, char *o_cmd, int len)
+{
+    return -1;
+}
+
+int set_rollback_env_param(int limit_c)
+{
+    return 0;
+}
+
+int64_t get_file_size(FILE *fp, int fd)
+{
+    return 0;
+}
+
+int fota_data_verify(const char *session)
+{
+    return 0;
+}
+
+int flash_pack_preflight(const char *session, const uint8_t *buffer, int length)
+{
+    return 0;
+}
+
+/* the pack the preflight fetches the head of */
+static int pack_open(netio_t *io, const char *path)
+{
+    io->size = io->limit;
+    io->offset = 0;
+    return 0;
+}
+
+static int pack_close(netio_t *io)
+{
+    return 0;
+}
+
+static int pack_read(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+{
+    int64_t n = io->size - io->offset;
+
+    if (n > length) {
+        n = length;
+    }
+    memset(buffer, 0, n);
+    io->offset += n;
+    return n;
+}
+
+static const netio_cls_t pack_cls = {
+    .name = "http",
+    .open = pack_open,
+    .close = pack_close,
+    .read = pack_read,
+};
+
+static int send_all(int fd, const char *data, int length)
+{
+    while (length > 0) {
+        int n = send(fd, data, length, MSG_NOSIGNAL);
+
+        if (n <= 0) {
+            return -1;
+        }
+        g_sent += n;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int respond(int fd, const char *request)
+{
+    static const char *none = "{\"code\":-1,\"msg\":\"no update\",\"result\":{}}";
+    char head[512];
+    int n;
+
+    if (g_mode == SERVER_ETAG && strcasestr(request, "If-None-Match: \"v1\"")) {
+        n = snprintf(head, sizeof(head), "HTTP/1.1 304 Not Modified\r\nETag: \"v1\"\r\n\r\n");
+        return send_all(fd, head, n);
+    }
+    if (g_mode == SERVER_412) {
+        n = snprintf(head, sizeof(head), "HTTP/1.1 412 Precondition Failed\r\nContent-Length: 0\r\n\r\n");
+        return send_all(fd, head, n);
+    }
+    g_bodies++;
+    if (g_mode == SERVER_UPDATE) {
+        char *body = malloc(CHANGELOG_SIZE + 256);
+        int length = snprintf(body, CHANGELOG_SIZE + 256,
+                              "{\"code\":0,\"result\":{\"version\":\"1.0.1\",\"url\":\"http://127.0.0.1:%d/pack\","
+                              "\"changelog\":\"%0*d\",\"timestamp\":1}}", g_port, CHANGELOG_SIZE, 7);
+        int ret;
+
+        n = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                     "Transfer-Encoding: chunked\r\n\r\n");
+        ret = send_all(fd, head, n);
+        for (int offset = 0; ret == 0 && offset < length; offset += 3000) {
+            int size = length - offset < 3000 ? length - offset : 3000;
+
+            n = snprintf(head, sizeof(head), "%x\r\n", size);
+            ret = send_all(fd, head, n) || send_all(fd, body + offset, size) || send_all(fd, "\r\n", 2);
+        }
+        free(body);
+        return ret || send_all(fd, "0\r\n\r\n", 5);
+    }
+    n = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n%sContent-Length: %d\r\n\r\n",
+                 g_mode == SERVER_ETAG ? "ETag: \"v1\"\r\n" : "", (int)strlen(none));
+    return send_all(fd, head, n) || send_all(fd, none, strlen(none));
+}
+
+/* a kept alive connection, one request at a time */
+static void *connection(void *arg)
+{
+    int fd = (int)(long)arg;
+    char request[sizeof(g_request)];
+
+    for (;;) {
+        int length = 0, content_length;
+        char *end = NULL, *p;
+
+        while (end == NULL) {
+            int n = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+
+            if (n <= 0) {
+                goto out;
+            }
+            length += n;
+            request[length] = 0;
+            end = strstr(request, "\r\n\r\n");
+        }
+        p = strcasestr(request, "Content-Length:");
+        content_length = p ? atoi(p + 15) : 0;
+        while (length < end - request + 4 + content_length) {
+            int n = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+
+            if (n <= 0) {
+                goto out;
+            }
+            length += n;
+            request[length] = 0;
+        }
+        memcpy(g_request, request, length + 1);
+        if (respond(fd, request) < 0) {
+            break;
+        }
+    }
+out:
+    close(fd);
+    return NULL;
+}
+
+static void *server(void *arg)
+{
+    int listener = (int)(long)arg;
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        pthread_t thread;
+
+        if (fd < 0) {
+            break;
+        }
+        pthread_create(&thread, NULL, connection, (void *)(long)fd);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static int server_start(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    pthread_t thread;
+    char url[64];
+
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &len) < 0) {
+        return -1;
+    }
+    g_port = ntohs(addr.sin_port);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/api", g_port);
+    aos_kv_setstring("otaurl", url);
+    pthread_create(&thread, NULL, server, (void *)(long)listener);
+    pthread_detach(thread);
+    return 0;
+}
+
+/* poll once, the answer must be want, and the request must carry If-None-Match when conditional */
+static int poll_once(const char *name, fota_info_t *info, int want, int conditional)
+{
+    int ret = fota_cop2_cls.version_check(info);
+    int sent = strcasestr(g_request, "If-None-Match: \"v1\"") != NULL;
+    char etag[80];
+    int saved = aos_kv_getstring(ETAG_KEY, etag, sizeof(etag)) > 0;
+
+    printf("%s: ret:%d If-None-Match:%d saved etag:%d bodies:%d\n", name, ret, sent, saved, g_bodies);
+    if (ret != want || sent != conditional) {
+        printf("%s: want ret:%d If-None-Match:%d\n", name, want, conditional);
+        return -1;
+    }
+    return 0;
+}
+
+static int saved_etag(const char *want)
+{
+    char etag[80];
+
+    if (want == NULL) {
+        return aos_kv_getstring(ETAG_KEY, etag, sizeof(etag)) > 0 ? -1 : 0;
+    }
+    return aos_kv_getstring(ETAG_KEY, etag, sizeof(etag)) > 0 && strcmp(etag, want) == 0 ? 0 : -1;
+}
+
+/* the mean response bytes and CPU time of a no-op poll in mode, with the ETag saved when conditional */
+static int measure(const char *name, server_mode_e mode, int conditional, long *bytes)
+{
+    fota_info_t info = {0};
+    clock_t cpu;
+    long sent;
+
+    aos_kv_del(ETAG_KEY);
+    g_mode = mode;
+    if (conditional && fota_cop2_cls.version_check(&info) != -ENODATA) {
+        return -1;
+    }
+    sent = g_sent;
+    cpu = clock();
+    for (int i = 0; i < MEASURE_POLLS; i++) {
+        if (fota_cop2_cls.version_check(&info) != -ENODATA) {
+            printf("%s: poll %d failed\n", name, i);
+            return -1;
+        }
+    }
+    cpu = clock() - cpu;
+    *bytes = (g_sent - sent) / MEASURE_POLLS;
+    printf("%s: %ld response bytes, %.1f us CPU per poll\n", name, *bytes,
+           (double)cpu * 1000000 / CLOCKS_PER_SEC / MEASURE_POLLS);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/fota_cop_XXXXXX";
+    fota_info_t info = {0};
+    char url[64];
+    long full, not_modified;
+    int bodies;
+
+    if (mkdtemp(dir) == NULL || aos_kv_init(dir) < 0 || server_start() < 0) {
+        printf("init failed\n");
+        return 1;
+    }
+    netio_register(&pack_cls);
+
+    g_mode = SERVER_ETAG;
+    if (poll_once("etag", &info, -ENODATA, 0) < 0 || saved_etag("\"v1\"") < 0) {
+        return 1;
+    }
+    bodies = g_bodies;
+    if (poll_once("not modified", &info, -ENODATA, 1) < 0 || g_bodies != bodies || saved_etag("\"v1\"") < 0) {
+        return 1;
+    }
+    g_mode = SERVER_412;
+    if (poll_once("precondition failed", &info, -ENODATA, 1) < 0 || saved_etag("\"v1\"") < 0) {
+        return 1;
+    }
+    g_mode = SERVER_PLAIN;
+    if (poll_once("plain", &info, -ENODATA, 1) < 0 || saved_etag(NULL) < 0 ||
+        poll_once("plain again", &info, -ENODATA, 0) < 0) {
+        return 1;
+    }
+
+    g_mode = SERVER_ETAG;
+    if (poll_once("etag again", &info, -ENODATA, 0) < 0 || saved_etag("\"v1\"") < 0) {
+        return 1;
+    }
+    g_mode = SERVER_UPDATE;
+    if (poll_once("update", &info, 0, 1) < 0 || saved_etag(NULL) < 0) {
+        return 1;
+    }
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/pack", g_port);
+    if (info.fota_url == NULL || strcmp(info.fota_url, url) != 0 ||
+        info.changelog == NULL || strlen(info.changelog) != CHANGELOG_SIZE) {
+        printf("the update is not read in full\n");
+        return 1;
+    }
+    free(info.fota_url);
+    free(info.changelog);
+    free(info.new_version);
+
+    if (measure("no-op poll, full answer", SERVER_PLAIN, 0, &full) < 0 ||
+        measure("no-op poll, 304", SERVER_ETAG, 1, &not_modified) < 0) {
+        return 1;
+    }
+    if (not_modified >= full) {
+        printf("the 304 is not smaller than the full answer\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * 64-bit offsets through the flash netio: a head_version 4 pack with a rootfs over 4 GiB is written to a sparse
+ * 6 GiB partition file, resumed just below the 2 GiB and 4 GiB marks of both the pack offset and the rootfs
+ * offset, and every byte must land at its own offset. A v4 pack without the 64-bit table is rejected, and a chunk
+ * split across two images whose second half fails to write is written right by the retry.
+ */
+#include <stdarg.h>
+#include <unistd.h>
+
+static ssize_t test_write(int fd, const void *buffer, size_t length);
+
+// the partition size comes from the sparse file, and a write to it can fail
+#define ioctl test_ioctl
+#define write(fd, buffer, length) test_write(fd, buffer, length)
+#include "flash.c"
+#undef write
+#undef ioctl
+
+#define KERNEL_SIZE     300000
+#define ROOTFS_SIZE     ((5ULL << 30) + 12345)
+#define PARTITION_SIZE  (6ULL << 30)
+#define RESUME_SIZE     140000
+
+// relative and short, the partition table has room for DEV_NAME_MAX_LEN + 4 bytes
+static char g_dir[] = "f64_XXXXXX";
+static struct partition_info_t g_table[5];
+static uint8_t *g_head;
+static size_t g_head_size;
+static int g_write_fail;                        /* the next write to the rootfs partition fails */
+
+static ssize_t test_write(int fd, const void *buffer, size_t length)
+{
+    struct stat st;
+
+    if (g_write_fail && fstat(fd, &st) == 0 && st.st_size == PARTITION_SIZE) {
+        g_write_fail = 0;
+        errno = EIO;
+        return -1;
+    }
+    return write(fd, buffer, length);
+}
+
+int test_ioctl(int fd, unsigned long request, ...)
+{
+    struct stat st;
+    va_list ap;
+    void *arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+    if (request == BLKGETSIZE64 && fstat(fd, &st) == 0) {
+        *(uint64_t *)arg = st.st_size;
+        return 0;
+    }
+    return -1;
+}
+
+/* the parts of image.c, libubi and fota.c flash.c calls */
+int get_rootfs_file_system_type(void)
+{
+    return 2;
+}
+
+int check_rootfs_partition(void)
+{
+    return 1;
+}
+
+int check_kernel_partition(void)
+{
+    return 1;
+}
+
+// no <name>_partition in the env
+int check_partition_ab(const char *name)
+{
+    return -1;
+}
+
+char *strdup_img_path(const char *img_name)
+{
+    return NULL;
+}
+
+uint32_t get_checksum(uint8_t *data, uint32_t length)
+{
+    uint32_t sum = 0;
+
+    while (length--) {
+        sum += *data++;
+    }
+    return sum;
+}
+
+int img_installed_get(const char *img_name, img_installed_t *inst)
+{
+    return -1;
+}
+
+int img_installed_set(const char *img_name, int ab, const uint8_t *sha256)
+{
+    return 0;
+}
+
+int get_ubi_info(const char *name, long long *bytes)
+{
+    return -1;
+}
+
+libubi_t libubi_open(void)
+{
+    return NULL;
+}
+
+void libubi_close(libubi_t desc)
+{
+}
+
+int ubi_get_vol_info(libubi_t desc, const char *node, struct ubi_vol_info *info)
+{
+    return -1;
+}
+
+int ubi_leb_change_start(libubi_t desc, int fd, int lnum, int bytes)
+{
+    return -1;
+}
+
+int ubi_leb_unmap(int fd, int lnum)
+{
+    return -1;
+}
+
+const char *fota_session_name(const char *session, const char *name, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s%s", g_dir, name);
+    return buf;
+}
+
+int fota_offset_set(const char *session, int64_t offset)
+{
+    return 0;
+}
+
+int netio_register(const netio_cls_t *cls)
+{
+    return 0;
+}
+
+netio_t *netio_open(const char *path)
+{
+    return NULL;
+}
+
+int netio_read(netio_t *io, uint8_t *buffer, size_t length, int timeoutms)
+{
+    return -1;
+}
+
+int netio_close(netio_t *io)
+{
+    return 0;
+}
+
+static uint8_t pattern(uint64_t pos)
+{
+    return (uint8_t)((pos * 2654435761ULL) >> 13 ^ (pos >> 32));
+}
+
+/* the pack: the header, then the pattern */
+static void pack_data(uint8_t *buffer, uint64_t pos, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        buffer[i] = pos + i < g_head_size ? g_head[pos + i] : pattern(pos + i);
+    }
+}
+
+static void make_file(const char *name, uint64_t size)
+{
+    char path[FOTA_SESSION_KEY_LEN];
+    int fd = open(fota_session_name(NULL, name, path, sizeof(path)), O_CREAT | O_RDWR | O_TRUNC, 0666);
+
+    if (fd >= 0) {
+        if (ftruncate(fd, size) < 0) {
+            printf("truncate %s failed\n", path);
+        }
+        close(fd);
+    }
+}
+
+static void make_table(void)
+{
+    static const char *devs[] = {"/kernelA", "/kernelB", "/rootfsA", "/rootfsB"};
+
+    for (int i = 0; i < 4; i++) {
+        strcpy(g_table[i].img_name, i < 2 ? IMG_NAME_KERNEL : IMG_NAME_ROOTFS);
+        fota_session_name(NULL, devs[i], g_table[i].dev_name, sizeof(g_table[i].dev_name));
+        g_table[i].size = 1;
+        g_table[i].ab = i % 2 + 1;
+    }
+}
+
+/* the pack header, with the 64-bit image table when size64 */
+static void make_head(int size64)
+{
+    pack_header_v2_t *head;
+    pack_header_digest_t *digest;
+    uint8_t *unsigned_head;
+
+    g_head_size = sizeof(pack_header_v2_t) + sizeof(pack_header_digest_t) + (size64 ? sizeof(pack_header_size64_t) : 0);
+    g_head = calloc(1, g_head_size);
+    head = (pack_header_v2_t *)g_head;
+    head->magic = PACK_HEAD_MAGIC;
+    head->head_version = 4;
+    head->head_size = g_head_size;
+    head->image_count = 2;
+    head->digest_type = DIGEST_HASH_SHA256;
+    strcpy(head->image_info[0].img_name, IMG_NAME_KERNEL);
+    head->image_info[0].offset = g_head_size;
+    head->image_info[0].size = KERNEL_SIZE;
+    // the 32-bit table can't hold the rootfs, the 64-bit one does
+    strcpy(head->image_info[1].img_name, IMG_NAME_ROOTFS);
+    head->image_info[1].offset = g_head_size + KERNEL_SIZE;
+    head->image_info[1].size = (uint32_t)ROOTFS_SIZE;
+    digest = (pack_header_digest_t *)(head + 1);
+    digest->magic = PACK_DIGEST_MAGIC;
+    if (size64) {
+        pack_header_size64_t *table = (pack_header_size64_t *)(digest + 1);
+
+        table->magic = PACK_SIZE64_MAGIC;
+        table->image[0].offset = g_head_size;
+        table->image[0].size = KERNEL_SIZE;
+        table->image[1].offset = g_head_size + KERNEL_SIZE;
+        table->image[1].size = ROOTFS_SIZE;
+    }
+    unsigned_head = malloc(g_head_size);
+    memcpy(unsigned_head, g_head, g_head_size);
+    memset(((pack_header_v2_t *)unsigned_head)->signature, 0, sizeof(head->signature));
+    head->head_checksum = get_checksum(unsigned_head, g_head_size);
+    free(unsigned_head);
+}
+
+/* a new io after a power cut: write [pos, pos + length) of the pack, then sync, fail: a rootfs write fails once */
+static int write_at(uint64_t pos, size_t length, int fail)
+{
+    netio_t *io = aos_zalloc(sizeof(netio_t));
+    flash_priv_t *ctx = aos_zalloc(sizeof(flash_priv_t));
+    uint8_t *buffer = malloc(length);
+    int retried = 0;
+    int ret = 0;
+
+    io->private = ctx;
+    io->block_size = CONFIG_FOTA_BUFFER_SIZE;
+    ctx->zsync.old_fd = -1;
+    ctx->partition_info = aos_malloc(sizeof(g_table));
+    memcpy(ctx->partition_info, g_table, sizeof(g_table));
+
+    if (pos && (flash_seek(io, pos, SEEK_SET) < 0 || io->offset != pos)) {
+        printf("resume at %llu moved to %lld\n", (unsigned long long)pos, (long long)io->offset);
+        ret = -1;
+    }
+    pack_data(buffer, pos, length);
+    g_write_fail = fail;
+    for (size_t done = 0; ret == 0 && done < length;) {
+        int n = length - done > 65536 ? 65536 : length - done;
+
+        if (flash_write(io, buffer + done, n, 0) == n) {
+            done += n;
+            continue;
+        }
+        if (fail && !retried) {
+            // the fota task before the retry: the checkpoint, then the storage back at the offset
+            retried = 1;
+            if (flash_sync(io) == 0 && flash_seek(io, pos + done, SEEK_SET) == 0) {
+                continue;
+            }
+        }
+        printf("write %d bytes at %llu failed\n", n, (unsigned long long)(pos + done));
+        ret = -1;
+    }
+    if (fail && !retried) {
+        printf("the rootfs write did not fail\n");
+        ret = -1;
+    }
+    if (ret == 0 && (io->offset != pos + length || flash_sync(io) < 0)) {
+        printf("offset %lld after the writes at %llu\n", (long long)io->offset, (unsigned long long)pos);
+        ret = -1;
+    }
+    flash_close(io);
+    aos_free(io);
+    free(buffer);
+    return ret;
+}
+
+/* the data of the pack at pos is at dev_pos of the partition */
+static int written(const char *name, uint64_t dev_pos, uint64_t pos, size_t length)
+{
+    char path[FOTA_SESSION_KEY_LEN];
+    uint8_t *data = malloc(length), *want = malloc(length);
+    int fd = open(fota_session_name(NULL, name, path, sizeof(path)), O_RDONLY);
+    int ok = fd >= 0 && pread(fd, data, length, dev_pos) == length;
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    pack_data(want, pos, length);
+    ok = ok && memcmp(data, want, length) == 0;
+    free(data);
+    free(want);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t rootfs = 0, total, mark2 = 1ULL << 31, mark4 = 1ULL << 32;
+    download_img_info_t info;
+    char path[FOTA_SESSION_KEY_LEN];
+    FILE *fp;
+    int ok;
+
+    if (mkdtemp(g_dir) == NULL) {
+        return 1;
+    }
+    make_table();
+
+    make_head(0);
+    ok = pack_header_check(g_head, g_head_size) < 0;
+    printf("v4 without the 64-bit table: %s\n", ok ? "rejected" : "accepted");
+    free(g_head);
+    if (!ok) {
+        return 1;
+    }
+
+    make_head(1);
+    if (pack_header_check(g_head, g_head_size) < 0) {
+        printf("v4 with the 64-bit table rejected\n");
+        return 1;
+    }
+    make_file("/kernelA", 1 << 20);
+    make_file("/kernelB", 1 << 20);
+    make_file("/rootfsA", 1 << 20);
+    make_file("/rootfsB", PARTITION_SIZE);
+    rootfs = g_head_size + KERNEL_SIZE;
+    total = rootfs + ROOTFS_SIZE;
+
+    // the chunk across the kernel end fails to write its rootfs part
+    ok = write_at(0, rootfs + 100000, 1) == 0 && written("/kernelB", 0, g_head_size, KERNEL_SIZE) &&
+         written("/rootfsB", 0, rootfs, 100000);
+    printf("the split write retried: %s\n", ok ? "ok" : "failed");
+    // the pack offset across 2 GiB and 4 GiB, then the rootfs offset across 2 GiB and 4 GiB, then the end
+    uint64_t resume[] = {
+        mark2 - RESUME_SIZE / 2, mark4 - RESUME_SIZE / 2,
+        rootfs + mark2 - RESUME_SIZE / 2, rootfs + mark4 - RESUME_SIZE / 2,
+        total - RESUME_SIZE,
+    };
+    for (int i = 0; ok && i < sizeof(resume) / sizeof(resume[0]); i++) {
+        ok = write_at(resume[i], RESUME_SIZE, 0) == 0 &&
+             written("/rootfsB", resume[i] - rootfs, resume[i], RESUME_SIZE);
+        printf("resume at %llu (rootfs +%llu): %s\n", (unsigned long long)resume[i],
+               (unsigned long long)(resume[i] - rootfs), ok ? "ok" : "failed");
+    }
+    ok = ok && written("/kernelB", 0, g_head_size, KERNEL_SIZE) && written("/rootfsB", 0, rootfs, 100000);
+
+    fp = fopen(fota_session_name(NULL, IMGINFOFILE, path, sizeof(path)), "rb");
+    ok = ok && fp && fread(&info, 1, sizeof(info), fp) == sizeof(info) &&
+         info.img_info[1].img_size == ROOTFS_SIZE && info.img_info[1].img_offset == rootfs;
+    if (fp) {
+        fclose(fp);
+    }
+    printf("v4 with the 64-bit table: %s\n", ok ? "ok" : "failed");
+    snprintf(path, sizeof(path), "rm -rf %s", g_dir);
+    if (system(path) != 0) {
+        printf("%s failed\n", path);
+    }
+    free(g_head);
+    return ok ? 0 : 1;
+}
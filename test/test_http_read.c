@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * The body read throughput of http_client_read() against a stand-in server on the loopback: Content-Length and
+ * chunked bodies are read with 4 KiB to 256 KiB reads on one pooled keep-alive connection, the MiB/s and the CPU
+ * time per MiB are printed. Every body must arrive in full with the data of its offset, be reported complete
+ * and leave the connection to the pool.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "http_client.h"
+
+#define BODY_SIZE   (64LL << 20)
+#define BLOCK_SIZE  65536
+#define READ_MAX    (256 * 1024)
+
+static int g_port;
+static volatile int g_accepts;                  /* connections the server accepted */
+static char g_block[BLOCK_SIZE];                /* the body repeats it */
+
+static int send_all(int fd, const char *data, int length)
+{
+    while (length > 0) {
+        int n = send(fd, data, length, MSG_NOSIGNAL);
+
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/* "/chunked": a chunked body of BLOCK_SIZE chunks, others: a Content-Length body */
+static int respond(int fd, const char *request)
+{
+    char head[256];
+    int n;
+
+    if (strstr(request, "/chunked")) {
+        n = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+        if (send_all(fd, head, n) < 0) {
+            return -1;
+        }
+        for (long long sent = 0; sent < BODY_SIZE; sent += BLOCK_SIZE) {
+            n = snprintf(head, sizeof(head), "%x\r\n", BLOCK_SIZE);
+            if (send_all(fd, head, n) || send_all(fd, g_block, BLOCK_SIZE) || send_all(fd, "\r\n", 2)) {
+                return -1;
+            }
+        }
+        return send_all(fd, "0\r\n\r\n", 5);
+    }
+    n = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\n\r\n", BODY_SIZE);
+    if (send_all(fd, head, n) < 0) {
+        return -1;
+    }
+    for (long long sent = 0; sent < BODY_SIZE; sent += BLOCK_SIZE) {
+        if (send_all(fd, g_block, BLOCK_SIZE) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* a kept alive connection, one request at a time */
+static void *connection(void *arg)
+{
+    int fd = (int)(long)arg;
+    char request[4096];
+
+    for (;;) {
+        int length = 0;
+
+        request[0] = 0;
+        while (strstr(request, "\r\n\r\n") == NULL) {
+            int n = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+
+            if (n <= 0) {
+                goto out;
+            }
+            length += n;
+            request[length] = 0;
+        }
+        if (respond(fd, request) < 0) {
+            break;
+        }
+    }
+out:
+    close(fd);
+    return NULL;
+}
+
+static void *server(void *arg)
+{
+    int listener = (int)(long)arg;
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        pthread_t thread;
+
+        if (fd < 0) {
+            break;
+        }
+        g_accepts++;
+        pthread_create(&thread, NULL, connection, (void *)(long)fd);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static int server_start(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    pthread_t thread;
+
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &len) < 0) {
+        return -1;
+    }
+    g_port = ntohs(addr.sin_port);
+    pthread_create(&thread, NULL, server, (void *)(long)listener);
+    pthread_detach(thread);
+    return 0;
+}
+
+/* the body data at offset */
+static int body_match(const char *buffer, long long offset, int length)
+{
+    while (length > 0) {
+        int pos = offset % BLOCK_SIZE;
+        int n = BLOCK_SIZE - pos < length ? BLOCK_SIZE - pos : length;
+
+        if (memcmp(buffer, g_block + pos, n) != 0) {
+            return 0;
+        }
+        buffer += n;
+        offset += n;
+        length -= n;
+    }
+    return 1;
+}
+
+/* read the body of path with read_size reads */
+static int read_body(const char *path, int read_size)
+{
+    static char buffer[READ_MAX];
+    http_client_config_t config = {
+        .timeout_ms = 5000,
+        .buffer_size = 4096,
+        .use_pool = true,
+    };
+    http_client_handle_t client;
+    struct timespec begin, end;
+    long long total = 0;
+    int bad = 0, complete, chunked;
+    clock_t cpu;
+    double seconds, mib;
+    char url[64];
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", g_port, path);
+    config.url = url;
+    client = http_client_init(&config);
+    if (client == NULL) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    cpu = clock();
+    if (http_client_open(client, 0) != HTTP_CLI_OK || http_client_fetch_headers(client) < 0) {
+        printf("%s: open failed\n", path);
+        http_client_cleanup(client);
+        return -1;
+    }
+    chunked = http_client_is_chunked_response(client);
+    for (;;) {
+        int n = http_client_read(client, buffer, read_size);
+
+        if (n <= 0) {
+            break;
+        }
+        if (!bad && !body_match(buffer, total, n)) {
+            bad = 1;
+        }
+        total += n;
+    }
+    cpu = clock() - cpu;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    complete = http_client_is_complete_data_received(client);
+    http_client_close(client);
+    http_client_cleanup(client);
+
+    seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    mib = total / 1048576.0;
+    printf("%-8s read:%-7d %.0f MiB/s %.3f ms CPU/MiB\n", path + 1, read_size, mib / seconds,
+           (double)cpu * 1000 / CLOCKS_PER_SEC / mib);
+    if (total != BODY_SIZE || bad || !complete || chunked != (strstr(path, "/chunked") != NULL)) {
+        printf("%s: %lld of %lld bytes, bad:%d complete:%d chunked:%d\n", path, total, BODY_SIZE, bad, complete,
+               chunked);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const int read_sizes[] = {4096, 16384, 65536, READ_MAX};
+    int ret = 0;
+
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        g_block[i] = (char)(i * 131 + 7);
+    }
+    if (server_start() < 0) {
+        printf("server start failed\n");
+        return 1;
+    }
+    for (int i = 0; i < sizeof(read_sizes) / sizeof(read_sizes[0]); i++) {
+        if (read_body("/length", read_sizes[i]) < 0 || read_body("/chunked", read_sizes[i]) < 0) {
+            ret = 1;
+        }
+    }
+    // every body ends in the pool, one connection serves them all
+    if (g_accepts != 1) {
+        printf("%d connections, the pool is not reused\n", g_accepts);
+        ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * The parallel Range download of the httpc netio over four connections from a faulty stand-in server on the
+ * loopback. A body cut short or stalled past the read timeout must be resumed from where it stopped, without
+ * asking for the segment again or giving up the parallel connections, and a server refusing the extra
+ * connections must leave the download to the single stream. Every download must finish with the data of
+ * each offset written once.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <aos/kernel.h>
+#include <aos/kv.h>
+#include <yoc/fota.h>
+#include "mem_netio.h"
+#include "range_server.h"
+
+#define OBJECT_SIZE (4LL << 20)
+#define RUN_MS      60000
+/* the segments fetched ahead of the refused one are read again by the stream */
+#define SEGMENT_SIZE 65536
+/* a send after the stall may still go out before the server sees the client closed */
+#define STALL_SLACK (16 * 1024)
+
+static char g_url[64];
+static volatile long long g_sent;               /* body bytes the server sent */
+static int64_t g_written;
+static int64_t g_bad;                           /* writes not of the data of their offset */
+static volatile int g_done;
+
+static void count_sent(int64_t pos, int length)
+{
+    __sync_fetch_and_add(&g_sent, length);
+}
+
+static int check_write(int64_t offset, const uint8_t *buffer, int length)
+{
+    if (offset != g_written) {
+        g_bad++;
+    }
+    for (int i = 0; i < length; i++) {
+        if (buffer[i] != mem_pattern(offset + i)) {
+            g_bad++;
+            break;
+        }
+    }
+    g_written += length;
+    return 0;
+}
+
+static int test_version_check(fota_info_t *info)
+{
+    info->fota_url = g_url;
+    return 0;
+}
+
+static const fota_cls_t test_cls = {
+    .name = "test",
+    .version_check = test_version_check,
+};
+
+int fota_data_verify(const char *session)
+{
+    return 0;
+}
+
+static int test_event(void *arg, fota_event_e event)
+{
+    if (event == FOTA_EVENT_FINISH) {
+        g_done = 1;
+    }
+    return 0;
+}
+
+/* sent_max: body bytes the server may send, stream: the download falls back to the single stream */
+static int download(const char *name, int64_t sent_max, int stream)
+{
+    fota_config_t config = {
+        .read_timeoutms = 500,
+        .write_timeoutms = 3000,
+        .retry_count = 0,
+        .sleep_time = 10,
+        .buffer_count = 4,
+        .chunk_min = 4096,
+        .chunk_max = SEGMENT_SIZE,
+    };
+    long long begin = aos_now_ms();
+    fota_t *fota;
+    int ok;
+
+    g_sent = 0;
+    g_written = 0;
+    g_bad = 0;
+    g_done = 0;
+    g_server.open_ranges = 0;
+    aos_kv_setint(KV_FOTA_HTTPC_CONNS, 4);
+    fota_offset_set(NULL, 0);
+    fota = fota_open("test", "mem://dst", test_event);
+    fota_config(fota, &config);
+    fota_start(fota);
+    fota_do_check(fota);
+    fota_download(fota);
+    while (!g_done && aos_now_ms() - begin < RUN_MS) {
+        aos_msleep(1);
+    }
+    fota_stop(fota);
+    fota_close(fota);
+
+    ok = g_done && !g_bad && g_written == OBJECT_SIZE && g_sent <= sent_max &&
+         (g_server.open_ranges > 0) == stream;
+    printf("%-8s written:%lld/%lld sent:%lld stream requests:%d bad:%lld %lld ms %s\n", name, (long long)g_written,
+           OBJECT_SIZE, g_sent, g_server.open_ranges, (long long)g_bad, aos_now_ms() - begin, ok ? "ok" : "failed");
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/fota_fault_XXXXXX";
+    int port, ret = 0;
+
+    if (mkdtemp(dir) == NULL || aos_kv_init(dir) < 0) {
+        printf("kv init failed\n");
+        return 1;
+    }
+    g_mem.size = OBJECT_SIZE;
+    g_mem.write_hook = check_write;
+    g_server.path = "/image";
+    g_server.size = OBJECT_SIZE;
+    g_server.sent_hook = count_sent;
+    port = range_server_start();
+    if (port < 0) {
+        printf("server start failed\n");
+        return 1;
+    }
+    snprintf(g_url, sizeof(g_url), "http://127.0.0.1:%d/image", port);
+    netio_register_httpc(NULL);
+    mem_netio_register();
+    fota_register(&test_cls);
+
+    // one connection at a time, before the pool keeps any open
+    g_server.max_conns = 1;
+    if (download("refused", OBJECT_SIZE + 4 * SEGMENT_SIZE, 1) < 0) {
+        ret = 1;
+    }
+
+    // every body is closed after 40000 bytes
+    g_server.max_conns = 0;
+    g_server.cut = 40000;
+    g_server.stall_ms = 0;
+    g_server.faults = -1;
+    if (download("cut", OBJECT_SIZE, 0) < 0) {
+        ret = 1;
+    }
+
+    // some bodies stall three times the read timeout
+    g_server.stall_ms = 1500;
+    g_server.faults = 6;
+    if (download("stall", OBJECT_SIZE + 6 * STALL_SLACK, 0) < 0) {
+        ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * 64-bit offsets through the fota core: the saved offset round trips past 4 GiB, a 4-byte offset saved by an
+ * older build is still read back, and a download resumed just below the 2 GiB and 4 GiB marks writes every byte
+ * at its own offset and checkpoints past the mark without wrapping, in serial and pipelined modes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <aos/kernel.h>
+#include <aos/kv.h>
+#include <yoc/fota.h>
+#include "mem_netio.h"
+
+#define TAIL        (3 * 1024 * 1024 + 77)
+#define RUN_MS      60000
+
+static int64_t g_first;                         /* the offset of the first write */
+static int64_t g_bad;                           /* writes whose data is not the data of their offset */
+static int64_t g_checkpoint_min;
+static int64_t g_checkpoint_max;
+static int64_t g_end;
+static volatile int g_done;
+
+/* the data of the source is mem_pattern(), every write must carry the data of its offset */
+static int check_write(int64_t offset, const uint8_t *buffer, int length)
+{
+    int64_t checkpoint;
+
+    if (g_first < 0) {
+        g_first = offset;
+    }
+    for (int i = 0; i < length; i++) {
+        if (buffer[i] != mem_pattern(offset + i)) {
+            g_bad++;
+            break;
+        }
+    }
+    if (fota_offset_get(NULL, &checkpoint) == 0) {
+        if (g_checkpoint_min < 0 || checkpoint < g_checkpoint_min) {
+            g_checkpoint_min = checkpoint;
+        }
+        if (checkpoint > g_checkpoint_max) {
+            g_checkpoint_max = checkpoint;
+        }
+    }
+    return 0;
+}
+
+static int test_version_check(fota_info_t *info)
+{
+    info->fota_url = "mem://src";
+    return 0;
+}
+
+static const fota_cls_t test_cls = {
+    .name = "test",
+    .version_check = test_version_check,
+};
+
+int fota_data_verify(const char *session)
+{
+    return 0;
+}
+
+static int test_event(void *arg, fota_event_e event)
+{
+    fota_t *fota = (fota_t *)arg;
+
+    if (event == FOTA_EVENT_FINISH) {
+        g_end = fota->offset;
+        g_done = 1;
+    }
+    return 0;
+}
+
+static int offset_round_trip(void)
+{
+    int64_t big = (5LL << 30) + 123, offset = 0;
+    char key[FOTA_SESSION_KEY_LEN];
+
+    if (fota_offset_set(NULL, big) < 0 || fota_offset_get(NULL, &offset) < 0 || offset != big) {
+        printf("the offset %lld is read back as %lld\n", (long long)big, (long long)offset);
+        return -1;
+    }
+    aos_kv_setint(fota_session_name(NULL, KV_FOTA_OFFSET, key, sizeof(key)), 123456);
+    if (fota_offset_get(NULL, &offset) < 0 || offset != 123456) {
+        printf("the 4-byte offset is read back as %lld\n", (long long)offset);
+        return -1;
+    }
+    return 0;
+}
+
+/* resume the download at start, a bit below mark */
+static int resume(int buffer_count, int64_t mark)
+{
+    fota_config_t config = {
+        .read_timeoutms = 3000,
+        .write_timeoutms = 3000,
+        .retry_count = 2,
+        .sleep_time = 10,
+        .buffer_count = buffer_count,
+        .chunk_min = 4096,
+        .chunk_max = 65536,
+    };
+    int64_t start = mark - TAIL / 2;
+    long long begin = aos_now_ms();
+    fota_t *fota;
+    int ok;
+
+    g_mem.size = start + TAIL;
+    g_first = -1;
+    g_bad = 0;
+    g_checkpoint_min = -1;
+    g_checkpoint_max = 0;
+    g_end = 0;
+    g_done = 0;
+    fota_offset_set(NULL, start);
+    fota = fota_open("test", "mem://dst", test_event);
+    fota_config(fota, &config);
+    fota_start(fota);
+    fota_do_check(fota);
+    fota_download(fota);
+    while (!g_done && aos_now_ms() - begin < RUN_MS) {
+        aos_msleep(1);
+    }
+    fota_stop(fota);
+    fota_close(fota);
+
+    ok = g_done && g_first == start && g_end == g_mem.size && !g_bad &&
+         g_checkpoint_min >= start && g_checkpoint_max > mark;
+    printf("buffers:%d start:%lld first:%lld end:%lld/%lld bad:%lld checkpoints:%lld..%lld %s\n", buffer_count,
+           (long long)start, (long long)g_first, (long long)g_end, (long long)g_mem.size, (long long)g_bad,
+           (long long)g_checkpoint_min, (long long)g_checkpoint_max, ok ? "ok" : "failed");
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/fota_offset64_XXXXXX";
+    int ret = 0;
+
+    if (mkdtemp(dir) == NULL || aos_kv_init(dir) < 0) {
+        printf("kv init failed\n");
+        return 1;
+    }
+    g_mem.write_hook = check_write;
+    mem_netio_register();
+    fota_register(&test_cls);
+
+    if (offset_round_trip() < 0) {
+        ret = 1;
+    }
+    for (int buffer_count = 1; buffer_count <= 4; buffer_count += 3) {
+        if (resume(buffer_count, 1LL << 31) < 0 || resume(buffer_count, 1LL << 32) < 0) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
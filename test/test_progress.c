@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * The per-chunk cost of the progress event: an 80-chunk download with a 1 ms read and a 1 ms write runs with
+ * a free event callback, then with a 10 ms one reported every chunk and every 200 ms. The reporter task keeps
+ * the callback off the download path, so the slow callback must not add its 80 x 10 ms to the download, and
+ * the 200 ms reports must be few.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <aos/kernel.h>
+#include <aos/kv.h>
+#include <yoc/fota.h>
+#include "mem_netio.h"
+
+#define CHUNKS      80
+#define CHUNK_SIZE  65536
+#define CALLBACK_MS 10
+#define RUN_MS      30000
+
+static int g_callback_ms;
+static volatile int g_events;
+static volatile int g_done;
+
+static int test_version_check(fota_info_t *info)
+{
+    info->fota_url = "mem://src";
+    return 0;
+}
+
+static const fota_cls_t test_cls = {
+    .name = "test",
+    .version_check = test_version_check,
+};
+
+int fota_data_verify(const char *session)
+{
+    return 0;
+}
+
+static int test_event(void *arg, fota_event_e event)
+{
+    if (event == FOTA_EVENT_PROGRESS) {
+        // the cJSON and D-Bus work of fotax
+        g_events++;
+        if (g_callback_ms > 0) {
+            aos_msleep(g_callback_ms);
+        }
+    } else if (event == FOTA_EVENT_FINISH) {
+        g_done = 1;
+    }
+    return 0;
+}
+
+/* the download time in milliseconds, -1: it did not finish */
+static long long download(const char *name, int callback_ms, int progress_ms)
+{
+    fota_config_t config = {
+        .read_timeoutms = 3000,
+        .write_timeoutms = 3000,
+        .sleep_time = 10,
+        .buffer_count = 1,
+        .progress_ms = progress_ms,
+        .chunk_min = CHUNK_SIZE,
+        .chunk_max = CHUNK_SIZE,
+    };
+    long long begin, elapsed;
+    fota_t *fota;
+
+    g_callback_ms = callback_ms;
+    g_events = 0;
+    g_done = 0;
+    fota_offset_set(NULL, 0);
+    fota = fota_open("test", "mem://dst", test_event);
+    fota_config(fota, &config);
+    fota_start(fota);
+    fota_do_check(fota);
+    begin = aos_now_ms();
+    fota_download(fota);
+    while (!g_done && aos_now_ms() - begin < RUN_MS) {
+        aos_msleep(1);
+    }
+    elapsed = aos_now_ms() - begin;
+    fota_stop(fota);
+    fota_close(fota);
+
+    printf("%s: %lld ms, %d events\n", name, elapsed, g_events);
+    return g_done ? elapsed : -1;
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/fota_progress_XXXXXX";
+    long long free_cb, per_chunk, coalesced;
+
+    if (mkdtemp(dir) == NULL || aos_kv_init(dir) < 0) {
+        printf("kv init failed\n");
+        return 1;
+    }
+    g_mem.size = (int64_t)CHUNKS * CHUNK_SIZE;
+    g_mem.delay_us = 1000;
+    mem_netio_register();
+    fota_register(&test_cls);
+
+    free_cb = download("free callback, every chunk", 0, 0);
+    per_chunk = download("10 ms callback, every chunk", CALLBACK_MS, 0);
+    coalesced = download("10 ms callback, every 200 ms", CALLBACK_MS, 200);
+    if (free_cb < 0 || per_chunk < 0 || coalesced < 0) {
+        printf("a download did not finish\n");
+        return 1;
+    }
+    // on the download path the callback would cost CHUNKS * CALLBACK_MS
+    printf("callback cost on the download path: %lld ms, %d ms when synchronous\n", per_chunk - free_cb,
+           CHUNKS * CALLBACK_MS);
+    if (per_chunk - free_cb >= CHUNKS * CALLBACK_MS / 2) {
+        printf("the progress callback is on the download path\n");
+        return 1;
+    }
+    if (g_events > coalesced / 200 + 2) {
+        printf("the 200 ms progress events are not coalesced\n");
+        return 1;
+    }
+    return 0;
+}
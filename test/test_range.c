@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * The Range requests of a download whose storage has spans of the data already, like the zsync and the
+ * unchanged images of flash.c: the httpc netio reads from a stand-in server on the loopback, which counts the
+ * bytes it sends and the bytes of them inside the spans. The storage skips the spans by its offset and sets
+ * skip_at to the next one, known from the start (a resume) or after the first write (a fresh download). In
+ * serial and pipelined modes, over one and four connections, every request must end before the next span:
+ * the server sends no byte of a span, and no more than the data needed but for the read ahead of the first
+ * open request of a fresh download. test_range_http runs the same downloads through the pipelined http netio.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <aos/kernel.h>
+#include <aos/kv.h>
+#include <yoc/fota.h>
+#include "mem_netio.h"
+#include "range_server.h"
+
+#define OBJECT_SIZE (48LL << 20)
+#define LATE_SLACK  (8LL << 20)
+#ifdef TEST_RANGE_HTTP
+/* the http netio asks for the whole file at open, before the storage knows the spans */
+#define OPEN_SLACK  (1LL << 20)
+#else
+#define OPEN_SLACK  0
+#endif
+#define RUN_MS      60000
+
+typedef struct {
+    int64_t start;
+    int64_t end;
+} span_t;
+
+/* the storage has them, the second is not block aligned */
+static const span_t g_spans[] = {
+    {16LL << 20, 28LL << 20},
+    {(32LL << 20) + 4096 + 13, 44LL << 20},
+};
+
+static char g_url[64];
+static volatile long long g_sent;               /* body bytes the server sent */
+static volatile long long g_span_sent;          /* of them inside the spans */
+static int g_late;                              /* the storage knows the spans after the first write */
+static int g_plan;                              /* the storage knows the spans */
+static int64_t g_written;
+static int64_t g_bad;                           /* writes inside a span or not of the data of their offset */
+static volatile int g_done;
+
+/* the bytes of [start, end) inside the spans */
+static int64_t span_overlap(int64_t start, int64_t end)
+{
+    int64_t n = 0;
+
+    for (int i = 0; i < sizeof(g_spans) / sizeof(g_spans[0]); i++) {
+        int64_t s = start > g_spans[i].start ? start : g_spans[i].start;
+        int64_t e = end < g_spans[i].end ? end : g_spans[i].end;
+
+        if (e > s) {
+            n += e - s;
+        }
+    }
+    return n;
+}
+
+/* the server sent the body bytes at pos */
+static void count_sent(int64_t pos, int length)
+{
+    __sync_fetch_and_add(&g_sent, length);
+    __sync_fetch_and_add(&g_span_sent, span_overlap(pos, pos + length));
+}
+
+/* like flash_zsync_skip: the offset jumps past a span it reaches, skip_at is the next one */
+static void span_plan(netio_t *io)
+{
+    io->skip_at = 0;
+    if (!g_plan) {
+        return;
+    }
+    for (int i = 0; i < sizeof(g_spans) / sizeof(g_spans[0]); i++) {
+        if (io->offset >= g_spans[i].start && io->offset < g_spans[i].end) {
+            io->offset = g_spans[i].end;
+        }
+        if (io->offset < g_spans[i].start) {
+            io->skip_at = g_spans[i].start;
+            break;
+        }
+    }
+}
+
+static int span_open(netio_t *io, const char *path)
+{
+    io->size = OBJECT_SIZE;
+    io->offset = 0;
+    g_plan = !g_late;
+    return 0;
+}
+
+static int span_close(netio_t *io)
+{
+    return 0;
+}
+
+static int span_write(netio_t *io, uint8_t *buffer, int length, int timeoutms)
+{
+    if (span_overlap(io->offset, io->offset + length) > 0) {
+        g_bad++;
+    }
+    for (int i = 0; i < length; i++) {
+        if (buffer[i] != mem_pattern(io->offset + i)) {
+            g_bad++;
+            break;
+        }
+    }
+    io->offset += length;
+    g_written += length;
+    // the plan is made from the head of the data
+    g_plan = 1;
+    span_plan(io);
+    return length;
+}
+
+static int span_seek(netio_t *io, int64_t offset, int whence)
+{
+    io->offset = offset;
+    span_plan(io);
+    return 0;
+}
+
+static const netio_cls_t span_cls = {
+    .name = "span",
+    .open = span_open,
+    .close = span_close,
+    .write = span_write,
+    .seek = span_seek,
+};
+
+static int test_version_check(fota_info_t *info)
+{
+    info->fota_url = g_url;
+    return 0;
+}
+
+static const fota_cls_t test_cls = {
+    .name = "test",
+    .version_check = test_version_check,
+};
+
+int fota_data_verify(const char *session)
+{
+    return 0;
+}
+
+static int test_event(void *arg, fota_event_e event)
+{
+    if (event == FOTA_EVENT_FINISH) {
+        g_done = 1;
+    }
+    return 0;
+}
+
+static int download(int late, int buffer_count, int conns)
+{
+    fota_config_t config = {
+        .read_timeoutms = 5000,
+        .write_timeoutms = 3000,
+        .retry_count = 2,
+        .sleep_time = 10,
+        .buffer_count = buffer_count,
+        .chunk_min = 4096,
+        .chunk_max = 65536,
+    };
+    int64_t needed = OBJECT_SIZE - span_overlap(0, OBJECT_SIZE);
+    long long begin = aos_now_ms();
+    fota_t *fota;
+    int ok;
+
+    g_late = late;
+    g_sent = 0;
+    g_span_sent = 0;
+    g_written = 0;
+    g_bad = 0;
+    g_done = 0;
+    aos_kv_setint(KV_FOTA_HTTPC_CONNS, conns);
+    fota_offset_set(NULL, 0);
+    fota = fota_open("test", "span://dst", test_event);
+    fota_config(fota, &config);
+    fota_start(fota);
+    fota_do_check(fota);
+    fota_download(fota);
+    while (!g_done && aos_now_ms() - begin < RUN_MS) {
+        aos_msleep(1);
+    }
+    fota_stop(fota);
+    fota_close(fota);
+
+    ok = g_done && !g_bad && g_written == needed && g_span_sent == 0 &&
+         g_sent <= needed + (late ? LATE_SLACK : OPEN_SLACK);
+    printf("%s buffers:%d conns:%d written:%lld/%lld sent:%lld span sent:%lld bad:%lld %lld ms %s\n",
+           late ? "fresh " : "resume", buffer_count, conns, (long long)g_written, (long long)needed, g_sent,
+           g_span_sent, (long long)g_bad, aos_now_ms() - begin, ok ? "ok" : "failed");
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/fota_range_XXXXXX";
+    int port, ret = 0;
+
+    if (mkdtemp(dir) == NULL || aos_kv_init(dir) < 0) {
+        printf("kv init failed\n");
+        return 1;
+    }
+    g_server.path = "/image";
+    g_server.size = OBJECT_SIZE;
+    g_server.sent_hook = count_sent;
+    port = range_server_start();
+    if (port < 0) {
+        printf("server start failed\n");
+        return 1;
+    }
+    snprintf(g_url, sizeof(g_url), "http://127.0.0.1:%d/image", port);
+#ifdef TEST_RANGE_HTTP
+    netio_register_http();
+#else
+    netio_register_httpc(NULL);
+#endif
+    netio_register(&span_cls);
+    fota_register(&test_cls);
+
+    for (int late = 0; late <= 1; late++) {
+        for (int buffer_count = 1; buffer_count <= 4; buffer_count += 3) {
+            for (int conns = 1; conns <= 4; conns += 3) {
+                if (download(late, buffer_count, conns) < 0) {
+                    ret = 1;
+                }
+            }
+        }
+    }
+    return ret;
+}
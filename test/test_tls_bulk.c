@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * The record throughput of the suites of config_yoc_tls_bulk.h: an mbedtls server and client of the profile on a
+ * socketpair, the server offers one suite and sends 16 MiB in full 16KB records, the client counts the records
+ * and the CPU time per MiB. The static RSA AES-128-CBC-SHA suite of config_yoc_tls.h is the baseline. The profile
+ * prefers ChaCha20-Poly1305 to AES-GCM because it costs less CPU without AES instructions: the test fails unless
+ * it does here, and unless a client of the profile picks ChaCha20-Poly1305 from a server offering both.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/certs.h"
+
+#define BODY_SIZE   (16 << 20)
+#define RECORD_SIZE (16 * 1024)
+
+typedef struct {
+    int fd;
+    const int *suites;                          /* the suites the server offers */
+    int ecdsa;                                  /* 1: an ECDSA certificate, 0: RSA */
+    int ret;
+} server_t;
+
+typedef struct {
+    const char *name;
+    int suites[3];
+    int ecdsa;
+} bench_t;
+
+static mbedtls_ctr_drbg_context g_drbg;
+
+/* the calloc and free of the platform */
+void *aos_mbedtls_calloc(size_t n, size_t size)
+{
+    return calloc(n, size);
+}
+
+void aos_mbedtls_free(void *ptr)
+{
+    free(ptr);
+}
+
+static int bio_send(void *ctx, const unsigned char *buffer, size_t length)
+{
+    int n = send(*(int *)ctx, buffer, length, MSG_NOSIGNAL);
+
+    return n < 0 ? MBEDTLS_ERR_SSL_INTERNAL_ERROR : n;
+}
+
+static int bio_recv(void *ctx, unsigned char *buffer, size_t length)
+{
+    int n = recv(*(int *)ctx, buffer, length, 0);
+
+    return n < 0 ? MBEDTLS_ERR_SSL_INTERNAL_ERROR : n;
+}
+
+static void *server(void *arg)
+{
+    server_t *srv = (server_t *)arg;
+    static unsigned char data[RECORD_SIZE];
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    mbedtls_x509_crt crt;
+    mbedtls_pk_context key;
+    const char *crt_pem = srv->ecdsa ? mbedtls_test_srv_crt_ec : mbedtls_test_srv_crt_rsa;
+    const char *key_pem = srv->ecdsa ? mbedtls_test_srv_key_ec : mbedtls_test_srv_key_rsa;
+
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_ssl_init(&ssl);
+    mbedtls_x509_crt_init(&crt);
+    mbedtls_pk_init(&key);
+    srv->ret = -1;
+    if (mbedtls_x509_crt_parse(&crt, (const unsigned char *)crt_pem, strlen(crt_pem) + 1) != 0 ||
+        mbedtls_pk_parse_key(&key, (const unsigned char *)key_pem, strlen(key_pem) + 1, NULL, 0) != 0 ||
+        mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        goto out;
+    }
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &g_drbg);
+    mbedtls_ssl_conf_ciphersuites(&conf, srv->suites);
+    if (mbedtls_ssl_conf_own_cert(&conf, &crt, &key) != 0 || mbedtls_ssl_setup(&ssl, &conf) != 0) {
+        goto out;
+    }
+    mbedtls_ssl_set_bio(&ssl, &srv->fd, bio_send, bio_recv, NULL);
+    if (mbedtls_ssl_handshake(&ssl) != 0) {
+        goto out;
+    }
+    for (int sent = 0; sent < BODY_SIZE;) {
+        int n = mbedtls_ssl_write(&ssl, data, sizeof(data));
+
+        if (n <= 0) {
+            goto out;
+        }
+        sent += n;
+    }
+    mbedtls_ssl_close_notify(&ssl);
+    srv->ret = 0;
+out:
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    mbedtls_x509_crt_free(&crt);
+    mbedtls_pk_free(&key);
+    close(srv->fd);
+    return NULL;
+}
+
+/* download BODY_SIZE from a server offering suites, the CPU ms per MiB, -1: failed */
+static double download(const char *name, const int *suites, int ecdsa, int *negotiated)
+{
+    static unsigned char buffer[RECORD_SIZE];
+    server_t srv = {.suites = suites, .ecdsa = ecdsa};
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    struct timespec begin, end;
+    clock_t cpu, handshake;
+    long long total = 0, records = 0;
+    double seconds, mib, cpu_mib = -1;
+    pthread_t thread;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        return -1;
+    }
+    srv.fd = fds[1];
+    pthread_create(&thread, NULL, server, &srv);
+
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_ssl_init(&ssl);
+    // the client of the profile, its suites in the order of MBEDTLS_SSL_CIPHERSUITES
+    if (mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        goto out;
+    }
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &g_drbg);
+    if (mbedtls_ssl_setup(&ssl, &conf) != 0) {
+        goto out;
+    }
+    mbedtls_ssl_set_bio(&ssl, &fds[0], bio_send, bio_recv, NULL);
+
+    handshake = clock();
+    if (mbedtls_ssl_handshake(&ssl) != 0) {
+        printf("%s: handshake failed\n", name);
+        goto out;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    cpu = clock();
+    handshake = cpu - handshake;
+    for (;;) {
+        int n = mbedtls_ssl_read(&ssl, buffer, sizeof(buffer));
+
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+        records++;
+    }
+    cpu = clock() - cpu;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *negotiated = mbedtls_ssl_get_ciphersuite_id(mbedtls_ssl_get_ciphersuite(&ssl));
+
+    seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    mib = total / 1048576.0;
+    // both ends run in this process, the CPU time is of the encryption and the decryption
+    printf("%-18s %-45s %lld records of %lld B, %.0f records/s, %.2f ms CPU/MiB, handshake %.1f ms CPU\n",
+           name, mbedtls_ssl_get_ciphersuite(&ssl), records, records ? total / records : 0, records / seconds,
+           (double)cpu * 1000 / CLOCKS_PER_SEC / mib, (double)handshake * 1000 / CLOCKS_PER_SEC);
+    if (total == BODY_SIZE) {
+        cpu_mib = (double)cpu * 1000 / CLOCKS_PER_SEC / mib;
+    } else {
+        printf("%s: %lld of %d bytes\n", name, total, BODY_SIZE);
+    }
+out:
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    close(fds[0]);
+    pthread_join(thread, NULL);
+    return srv.ret == 0 ? cpu_mib : -1;
+}
+
+int main(int argc, char **argv)
+{
+    static const bench_t benches[] = {
+        {"cbc", {MBEDTLS_TLS_RSA_WITH_AES_128_CBC_SHA}, 0},
+        {"rsa gcm", {MBEDTLS_TLS_RSA_WITH_AES_128_GCM_SHA256}, 0},
+        {"ecdhe rsa gcm", {MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256}, 0},
+        {"ecdhe rsa chacha", {MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256}, 0},
+        {"ecdhe ecdsa gcm", {MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256}, 1},
+        {"ecdhe ecdsa chacha", {MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256}, 1},
+    };
+    static const int both[] = {
+        MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+        MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+        0,
+    };
+    double cpu[sizeof(benches) / sizeof(benches[0])];
+    mbedtls_entropy_context entropy;
+    int negotiated, ret = 0;
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&g_drbg);
+    if (mbedtls_ctr_drbg_seed(&g_drbg, mbedtls_entropy_func, &entropy, (const unsigned char *)"bulk", 4) != 0) {
+        printf("drbg seed failed\n");
+        return 1;
+    }
+    for (int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        cpu[i] = download(benches[i].name, benches[i].suites, benches[i].ecdsa, &negotiated);
+        if (cpu[i] < 0 || negotiated != benches[i].suites[0]) {
+            printf("%s: failed\n", benches[i].name);
+            ret = 1;
+        }
+    }
+    if (ret == 0 && (cpu[3] >= cpu[2] || cpu[5] >= cpu[4])) {
+        printf("ChaCha20-Poly1305 does not cost less CPU than AES-GCM\n");
+        ret = 1;
+    }
+
+    // the server lists GCM first and follows the client, the client of the profile picks ChaCha20-Poly1305
+    if (download("preference", both, 0, &negotiated) < 0 ||
+        negotiated != MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256) {
+        printf("the profile does not negotiate ChaCha20-Poly1305 first\n");
+        ret = 1;
+    }
+    mbedtls_ctr_drbg_free(&g_drbg);
+    mbedtls_entropy_free(&entropy);
+    return ret;
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright (C) 2019-2020 Alibaba Group Holding Limited
+ */
+
+/*
+ * The mbedtls configuration of test_tls_bulk: the bulk download profile, plus the server side of the loopback,
+ * which sends full 16KB records and picks the suite by the client preference like the openssl servers
+ */
+#ifndef TLS_BULK_BENCH_H
+#define TLS_BULK_BENCH_H
+
+#define MBEDTLS_SSL_SRV_C
+#define MBEDTLS_SSL_SRV_RESPECT_CLIENT_PREFERENCE
+
+#include "config_yoc_tls_bulk.h"
+
+#undef MBEDTLS_SSL_OUT_CONTENT_LEN
+#define MBEDTLS_SSL_OUT_CONTENT_LEN             (16 * 1024)
+
+#endif